@@ -5,12 +5,18 @@
 int main(int argc, char *argv[])
 {
     const char *srcName="f_fibonacci-mips.bin";
+    const char *profileName=0;
     
     if(argc>1){
         srcName=argv[1];
     }
+    if(argc>2){
+        profileName=argv[2];    // Annotate the listing with tools/mips_profile
+    }
     
-    mips_mem_h m=mips_mem_create_ram(0x20000, 4);
+    // The sentinel return address is a long way above the program, so
+    // use a RAM which only allocates the pages that get used
+    mips_mem_h m=mips_mem_create_sparse_ram(4);
     mips_cpu_h c=mips_cpu_create(m);
     
     FILE *src=fopen(srcName,"rb");
@@ -42,14 +48,21 @@ int main(int argc, char *argv[])
     mips_cpu_set_register(c, 4, n);             // Set input argument
     mips_cpu_set_register(c, 29, 0x1000);       // Create a stack pointer
     
+    if(profileName){
+        mips_cpu_set_profiling(c, 1);
+    }
+    
     uint32_t steps=0;
-    while(!mips_cpu_step(c)){
-        fprintf(stderr, "Step %d.\n", steps);
-        ++steps;
-        uint32_t pc;
-        mips_cpu_get_pc(c, &pc);
-        if(pc==sentinelPC)
-            break;
+    mips_cpu_run(c, 1000000, sentinelPC, &steps);   // Run until we return to the sentinel
+    fprintf(stderr, "Executed %d steps.\n", steps);
+    
+    if(profileName){
+        FILE *dst=fopen(profileName, "wt");
+        if(!dst || mips_cpu_write_profile(c, dst)){
+            fprintf(stderr, "Cannot write profile to '%s'.\n", profileName);
+            exit(1);
+        }
+        fclose(dst);
     }
     
     uint32_t fib_n;
@@ -45,6 +45,42 @@ typedef struct mips_cpu_impl *mips_cpu_h;
 */
 mips_cpu_h mips_cpu_create(mips_mem_h mem);
 
+/*! The different ways the simulator can dispatch instructions.
+
+	All engines have exactly the same architectural behaviour, they
+	only differ in how quickly they get there.
+*/
+typedef enum _mips_cpu_engine{
+	//! Calls through a handler pointer for each decoded instruction.
+	mips_EngineInterpreter=0,
+	
+	/*! Jumps directly from the end of one handler to the next (threaded
+		code), which gives the host branch predictor one indirect branch
+		per instruction type rather than a single shared one. Falls back
+		to mips_EngineInterpreter if the compiler cannot support it. */
+	mips_EngineThreaded=1,
+	
+	/*! Translates straight-line runs of instructions up to the next
+		branch into blocks, and links blocks to their successors so that
+		only indirect jumps (JR, JALR) need to look the next block up.
+		Needs a memory which supports mips_mem_add_write_observer, and
+		otherwise behaves like mips_EngineInterpreter. */
+	mips_EngineBlock=2,
+	
+	/*! As mips_EngineBlock, but blocks which are entered often are
+		compiled to native code. Only available on x86-64 hosts, and
+		otherwise behaves like mips_EngineBlock. Results and errors are
+		exactly the same as for the other engines. */
+	mips_EngineJit=3
+}mips_cpu_engine;
+
+/*! Creates a CPU in the same way as mips_cpu_create, but using a
+	specific execution engine.
+	
+	Returns an empty handle if the engine is not known.
+*/
+mips_cpu_h mips_cpu_create_with_engine(mips_mem_h mem, mips_cpu_engine engine);
+
 /*! Reset the CPU as if it had just been created, with all registers zerod.
 	However, it should not modify RAM. Imagine this as asserting the reset
 	input of the CPU core.
@@ -110,6 +146,44 @@ mips_error mips_cpu_step(
 	mips_cpu_h state	//! Valid (non-empty) handle to a CPU
 );
 
+/*! Advances the processor by up to maxSteps instructions without
+	returning to the caller in between.
+
+	Execution stops when the step budget is used up, when an
+	instruction fails, or when the pc of the next instruction is
+	stopPc. The stop address is only checked after an instruction
+	has executed, so a run can start at stopPc.
+
+	Each instruction behaves exactly as if it had been executed by
+	mips_cpu_step, so if an error is returned the CPU is left as
+	it was before the failing instruction, and that instruction
+	is not included in stepsExecuted.
+
+	This replaces the usual driver loop of mips_cpu_step followed
+	by mips_cpu_get_pc:
+
+		uint32_t steps=0;
+		mips_error err=mips_cpu_run(cpu, 1000000, sentinelPC, &steps);
+*/
+mips_error mips_cpu_run(
+	mips_cpu_h state,			//!< Valid (non-empty) handle to a CPU
+	uint32_t maxSteps,			//!< Most instructions to execute
+	uint32_t stopPc,			//!< Address at which to stop
+	uint32_t *stepsExecuted		//!< If not NULL, receives the number of instructions completed
+);
+
+/*! The same as mips_cpu_run, except that execution stops at any of
+	a set of addresses. The set may be empty, in which case only the
+	step budget and errors stop execution.
+*/
+mips_error mips_cpu_run_until(
+	mips_cpu_h state,			//!< Valid (non-empty) handle to a CPU
+	uint32_t maxSteps,			//!< Most instructions to execute
+	const uint32_t *stopPcs,	//!< Addresses at which to stop
+	unsigned stopCount,			//!< Number of entries in stopPcs
+	uint32_t *stepsExecuted		//!< If not NULL, receives the number of instructions completed
+);
+
 /*! Controls printing of diagnostic and debug messages.
 
 	You are encouraged to include diagnostic and debugging
@@ -187,6 +261,322 @@ mips_error mips_cpu_step(
 */
 mips_error mips_cpu_set_debug_level(mips_cpu_h state, unsigned level, FILE *dest);
 
+/*! How debug output is written once mips_cpu_set_debug_level has
+	turned it on. */
+typedef enum _mips_cpu_trace_format{
+	//! Human readable text, formatted as each instruction executes.
+	mips_TraceText=0,
+
+	/*! Fixed size binary records, as described in mips_trace.h. Records
+		are queued and written to the debug destination by a background
+		thread, so the destination must not be used by anything else
+		until tracing is turned off again or the CPU is freed. */
+	mips_TraceBinary=1,
+
+	/*! The same records as mips_TraceBinary, compressed by the writer
+		thread into the seekable format described in mips_trace.h. */
+	mips_TraceCompressed=2
+}mips_cpu_trace_format;
+
+/*! Chooses the format of debug output. The default is mips_TraceText.
+
+	Can be called before or after mips_cpu_set_debug_level. Changing
+	the format, level or destination while a binary trace is being
+	written flushes everything queued so far before returning.
+*/
+mips_error mips_cpu_set_trace_format(mips_cpu_h state, mips_cpu_trace_format format);
+
+/*! Common pairs of instructions which mips_EngineBlock and mips_EngineJit
+	execute as a single superinstruction, with one dispatch instead of
+	two. Fusion never changes results; it is only used while debug output
+	is off, and never when a run would stop between the two instructions.
+*/
+typedef enum _mips_cpu_fusion{
+	//! SLTIU into a register, then BEQ or BNE comparing it with $0.
+	mips_FusionSltiuBranch=0,
+
+	//! ADDIU adjusting a register, then SW relative to it, as in function prologues.
+	mips_FusionAddiuStore=1,
+
+	//! Number of kinds of fusion
+	mips_FusionCount=2
+}mips_cpu_fusion;
+
+/*! Returns how many times a fused pair has been executed since the CPU
+	was created or mips_cpu_reset_fusion_hits was last called. Each hit
+	covers two instructions.
+*/
+mips_error mips_cpu_get_fusion_hits(
+	mips_cpu_h state,			//!< Valid (non-empty) handle to a CPU
+	mips_cpu_fusion fusion,		//!< Which pair to report
+	uint64_t *hits				//!< Where to write the count
+);
+
+//! Sets all the fusion hit counters back to zero.
+mips_error mips_cpu_reset_fusion_hits(mips_cpu_h state);
+
+/*! Turns counting of executions per pc on or off. Counts are kept
+	until the profile is reset or the CPU is freed, so profiling can be
+	turned off and on again around the interesting parts of a run.
+
+	Counting costs a little time per instruction, and stops mips_EngineJit
+	from using native code. Nothing is counted while debug output is
+	turned on by mips_cpu_set_debug_level.
+*/
+mips_error mips_cpu_set_profiling(mips_cpu_h state, unsigned enabled);
+
+/*! Returns the profile for one instruction address.
+	
+	executed counts every attempt to execute the instruction, including
+	attempts which failed. memFaults counts memory exceptions
+	(mips_ExceptionInvalidAddress, mips_ExceptionInvalidAlignment and
+	mips_ExceptionAccessViolation) raised there, including failures to
+	fetch the instruction itself, which are not counted in executed.
+*/
+mips_error mips_cpu_get_profile(
+	mips_cpu_h state,		//!< Valid (non-empty) handle to a CPU
+	uint32_t pc,			//!< Address of the instruction
+	uint64_t *executed,		//!< Receives the number of executions
+	uint64_t *memFaults		//!< Receives the number of memory exceptions
+);
+
+//! Sets every count in the profile back to zero.
+mips_error mips_cpu_reset_profile(mips_cpu_h state);
+
+/*! Writes the profile as text, for tools/mips_profile to annotate a
+	disassembly listing with.
+	
+	The first line is a comment starting with '#', then every address
+	with a non-zero count follows in ascending order as one line of
+	"pc executed memFaults", the pc in hex and the counts in decimal.
+*/
+mips_error mips_cpu_write_profile(mips_cpu_h state, FILE *dst);
+
+//! Number of mnemonics counted in mips_cpu_stats::mnemonics
+#define MIPS_CPU_STATS_MNEMONICS 53
+
+//! Number of exceptions counted in mips_cpu_stats::exceptions
+#define MIPS_CPU_STATS_EXCEPTIONS 6
+
+//! Broad groups of instructions, used to index mips_cpu_stats::classes
+typedef enum _mips_cpu_instr_class{
+	mips_ClassArithmetic=0,	//!< Add, subtract, compare and LUI
+	mips_ClassLogic=1,		//!< AND, OR, XOR and their immediate forms
+	mips_ClassShift=2,		//!< Shifts by constant and variable amounts
+	mips_ClassMultDiv=3,	//!< Multiply, divide and moves to and from HI and LO
+	mips_ClassLoad=4,
+	mips_ClassStore=5,
+	mips_ClassBranch=6,		//!< Conditional branches
+	mips_ClassJump=7,		//!< J, JAL, JR and JALR
+	mips_ClassCount=8
+}mips_cpu_instr_class;
+
+/*! Dynamic instruction counts. Only instructions which completed are
+	counted, except in exceptions.
+*/
+typedef struct _mips_cpu_stats{
+	//! Instructions which completed
+	uint64_t instructions;
+
+	//! Counts per mnemonic, named by mips_cpu_stats_mnemonic
+	uint64_t mnemonics[MIPS_CPU_STATS_MNEMONICS];
+
+	//! Counts per mips_cpu_instr_class
+	uint64_t classes[mips_ClassCount];
+
+	//! Conditional branches, split by whether they went to their target
+	uint64_t branchesTaken;
+	uint64_t branchesNotTaken;
+
+	//! Loads and stores by access size: [0] bytes, [1] half-words, [2] words
+	uint64_t loads[3];
+	uint64_t stores[3];
+
+	//! Exceptions raised, indexed by the mips_error less mips_ExceptionBreak
+	uint64_t exceptions[MIPS_CPU_STATS_EXCEPTIONS];
+}mips_cpu_stats;
+
+/*! Returns the counts collected since the CPU was created, or since
+	mips_cpu_reset_stats was last called. Counting is always on, and
+	costs about the same as one memory increment per instruction.
+*/
+mips_error mips_cpu_get_stats(
+	mips_cpu_h state,			//!< Valid (non-empty) handle to a CPU
+	mips_cpu_stats *stats		//!< Where to write the counts
+);
+
+//! Sets all the statistics back to zero.
+mips_error mips_cpu_reset_stats(mips_cpu_h state);
+
+/*! Returns the name of the instruction counted in mips_cpu_stats::mnemonics[index],
+	using the same names as the test framework, or NULL if index is out of range.
+*/
+const char *mips_cpu_stats_mnemonic(unsigned index);
+
+//! Prints the statistics as tables in the style of mips_test_end_suite.
+mips_error mips_cpu_print_stats(mips_cpu_h state, FILE *dst);
+
+/*! Latencies used by the timing model, in cycles. */
+typedef struct _mips_cpu_timing_config{
+	//! Lost when an instruction uses the result of the load just before it (default 1)
+	unsigned loadUseStall;
+
+	/*! Lost after each taken branch or jump (default 1). The simulator
+		does not execute branch delay slots, so this stands for the slot
+		going unused; set it to zero if the compiler always fills them. */
+	unsigned branchPenalty;
+
+	//! From MULT or MULTU issuing to HI and LO being ready (default 5)
+	unsigned multLatency;
+
+	//! From DIV or DIVU issuing to HI and LO being ready (default 35)
+	unsigned divLatency;
+}mips_cpu_timing_config;
+
+/*! Cycle counts from the timing model. Stall counts are included in
+	cycles, and are given separately to show where time went. */
+typedef struct _mips_cpu_timing{
+	uint64_t cycles;			//!< Cycles until the last instruction left the pipeline
+	uint64_t instructions;		//!< Instructions which completed while timing
+	uint64_t loadUseStalls;		//!< Cycles lost waiting for loads
+	uint64_t hiloStalls;		//!< Cycles lost waiting for the multiply/divide unit
+	uint64_t branchStalls;		//!< Cycles lost after taken branches and jumps, or mispredictions
+}mips_cpu_timing;
+
+/*! Turns the timing model on or off.
+
+	The timing model follows the classic five stage MIPS pipeline, with
+	full forwarding. Each completed instruction costs one cycle, plus
+	any stalls for load-use hazards, for MULT, DIV and friends and moves
+	to or from HI and LO while the multiply/divide unit is busy, and for
+	taken branches (or mispredicted ones, see mips_cpu_set_predictor).
+	Filling the pipeline adds four cycles before the
+	first instruction completes. CPI is cycles divided by instructions.
+
+	Timing only changes how long the simulated program would take, not
+	what it does. It slows the simulator down in the same way as
+	profiling, and can be used along with it, but nothing is timed while
+	debug output is on.
+
+	\param config Latencies to use, or NULL to keep the current ones.
+*/
+mips_error mips_cpu_set_timing(mips_cpu_h state, unsigned enabled, const mips_cpu_timing_config *config);
+
+//! Returns the cycles counted since timing was first turned on, or last reset.
+mips_error mips_cpu_get_timing(mips_cpu_h state, mips_cpu_timing *timing);
+
+//! Sets the cycle counts back to zero, and empties the pipeline.
+mips_error mips_cpu_reset_timing(mips_cpu_h state);
+
+//! Ways of guessing the direction of conditional branches
+typedef enum _mips_cpu_predictor_kind{
+	mips_PredictorStatic=0,		//!< Backward branches taken, forward branches not taken
+	mips_PredictorBimodal=1,	//!< Two bit counters indexed by the branch address
+	mips_PredictorGshare=2		//!< Two bit counters indexed by the address xor recent outcomes
+}mips_cpu_predictor_kind;
+
+/*! Shape of the branch predictor. */
+typedef struct _mips_cpu_predictor_config{
+	mips_cpu_predictor_kind kind;	//!< Direction predictor (default mips_PredictorBimodal)
+
+	//! Log2 of the number of counters, from 1 to 20 (default 10)
+	unsigned tableBits;
+
+	//! Outcomes of recent branches mixed into the gshare index, at most tableBits (default 8)
+	unsigned historyBits;
+
+	//! Entries in the direct mapped branch target buffer, a power of two or zero for none (default 64)
+	unsigned btbEntries;
+
+	//! Depth of the return address stack, at most 64 or zero for none (default 8)
+	unsigned rasDepth;
+}mips_cpu_predictor_config;
+
+/*! Counts from the branch predictor. Returns are also counted as
+	indirect jumps. */
+typedef struct _mips_cpu_predictor_stats{
+	uint64_t branches;			//!< Conditional branches which completed
+	uint64_t branchMisses;		//!< Conditional branches which went the other way
+	uint64_t indirect;			//!< JR and JALR which completed
+	uint64_t indirectMisses;	//!< JR and JALR which went somewhere else
+	uint64_t returns;			//!< JR $31 which completed
+	uint64_t returnMisses;		//!< JR $31 which went somewhere else
+}mips_cpu_predictor_stats;
+
+/*! Turns the branch predictor on or off.
+
+	Each conditional branch has its direction predicted, and each JR and
+	JALR its target. J and JAL, and the targets of taken branches, are
+	known once the instruction is decoded so are never mispredicted.
+	JR $31 is predicted from the return address stack, which JAL, JALR,
+	BGEZAL and BLTZAL push on to; other indirect jumps (or returns when
+	the stack is empty) use the branch target buffer, and fall through if
+	it has nothing for them.
+
+	While both are on, the timing model charges its branch penalty for
+	each misprediction, rather than for each taken branch. Prediction
+	slows the simulator down in the same way as timing, and can be used
+	along with profiling, but nothing is predicted while debug output is
+	on.
+
+	\param config Shape to use, or NULL to keep the current one. A new
+	shape starts with nothing learned.
+*/
+mips_error mips_cpu_set_predictor(mips_cpu_h state, unsigned enabled, const mips_cpu_predictor_config *config);
+
+//! Returns the counts since the predictor was first turned on, or last reset.
+mips_error mips_cpu_get_predictor_stats(mips_cpu_h state, mips_cpu_predictor_stats *stats);
+
+/*! Returns how often the branch or jump at pc completed, and how many
+	of those times it was mispredicted.
+*/
+mips_error mips_cpu_get_branch_profile(
+	mips_cpu_h state,			//!< Valid (non-empty) handle to a CPU
+	uint32_t pc,				//!< Address of the branch
+	uint64_t *executed,			//!< Receives the number of completions
+	uint64_t *mispredicted		//!< Receives the number of mispredictions
+);
+
+//! Sets all the counts back to zero, and forgets everything learned.
+mips_error mips_cpu_reset_predictor(mips_cpu_h state);
+
+/*! Writes the per-branch counts as text, in the same layout as
+	mips_cpu_write_profile: a '#' comment line, then one line of
+	"pc executed mispredicted" for each branch or jump which completed,
+	in ascending order of address.
+*/
+mips_error mips_cpu_write_branch_profile(mips_cpu_h state, FILE *dst);
+
+/*! An opaque handle to a saved CPU and its memory. */
+typedef struct mips_snapshot_impl *mips_snapshot_h;
+
+/*! Saves the registers, pc, npc, hi and lo of the CPU, together with
+	the contents of the memory it is bound to, using mips_mem_snapshot_take.
+
+	Taking a snapshot does not copy memory, so it costs the same
+	however large the memory is. Fails with mips_ErrorNotImplemented if
+	the memory cannot take snapshots.
+*/
+mips_error mips_snapshot_take(
+	mips_cpu_h state,			//!< Valid (non-empty) handle to a CPU
+	mips_snapshot_h *snapshot	//!< Receives the new snapshot
+);
+
+/*! Puts the CPU and its memory back to how they were when the
+	snapshot was taken. Only the memory pages written since are copied.
+
+	Statistics, profiles and the timing and branch models are not part
+	of the snapshot, and carry on counting. Snapshots taken after this
+	one can no longer be restored (see mips_mem_snapshot_restore).
+*/
+mips_error mips_snapshot_restore(mips_snapshot_h snapshot);
+
+/*! Releases a snapshot, which must be done before its memory is freed.
+	The CPU can be freed first. Passing an empty handle is legal, and does
+	nothing.
+*/
+void mips_snapshot_free(mips_snapshot_h snapshot);
+
 /*! Free all resources associated with state.
 
 	\param state Either a handle to a valid simulation state, or an empty (NULL) handle.
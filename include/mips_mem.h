@@ -142,6 +142,20 @@ mips_error mips_mem_write(
     const uint8_t *dataIn	//!< Receives the target bytes
 );
 
+/*! Perform a read transaction which fetches instructions.
+
+    This behaves exactly like \ref mips_mem_read, but lets devices which
+    care (such as the cache model with its split instruction and data
+    caches) tell instruction fetches apart from loads. CPUs should use
+    it whenever they read instructions.
+*/
+mips_error mips_mem_fetch(
+    mips_mem_h mem,     //!< Handle to target memory
+    uint32_t address,   //!< Byte address to start transaction at
+    uint32_t length,    //!< Number of bytes to transfer
+    uint8_t *dataOut    //!< Receives the target bytes
+);
+
 
 /*! Release all resources associated with memory. The caller doesn't
     really know what is being released (it could be memory, it could
@@ -165,6 +179,173 @@ mips_error mips_mem_write(
 */
 void mips_mem_free(mips_mem_h mem);
 
+/*! Callback invoked after a write transaction has modified memory.
+
+    \param context The pointer that was given when the observer was added.
+    \param address Byte address the write started at.
+    \param length Number of bytes which were written.
+*/
+typedef void (*mips_mem_write_observer)(
+    void *context,
+    uint32_t address,
+    uint32_t length
+);
+
+/*! Register a function to be told about every successful write.
+    
+    This exists so that anything which caches the contents of memory
+    (for example a CPU which remembers decoded instructions) can find
+    out when the data it cached has changed underneath it. The observer
+    is called after the data has been updated, and is called for writes
+    from any source, including writes made by a test bench or loader.
+    
+    The same function and context pair should only be added once, and
+    must be removed with mips_mem_remove_write_observer before the context
+    is released.
+    
+    Memory devices which cannot support this will return mips_ErrorNotImplemented,
+    in which case the client should assume nothing about what is cached.
+*/
+mips_error mips_mem_add_write_observer(
+    mips_mem_h mem,                 //!< Handle to target memory
+    mips_mem_write_observer fn,     //!< Function to call on each write
+    void *context                   //!< Passed through to fn
+);
+
+/*! Remove an observer previously added with mips_mem_add_write_observer.
+    
+    Returns mips_ErrorInvalidArgument if the function and context pair
+    was never registered.
+*/
+mips_error mips_mem_remove_write_observer(
+    mips_mem_h mem,                 //!< Handle to target memory
+    mips_mem_write_observer fn,     //!< Function that was added
+    void *context                   //!< Context that was added
+);
+
+/*! An opaque handle to the saved contents of a memory. */
+typedef struct mips_mem_snapshot *mips_mem_snapshot_h;
+
+/*! Remember the current contents of memory, so that they can be put
+    back later by mips_mem_snapshot_restore.
+
+    The RAM device does this with page granular copy-on-write: taking a
+    snapshot copies nothing, and a page is only copied the first time it
+    is written afterwards. Restoring then only has to copy back the pages
+    written since. Any number of snapshots can be held at once.
+
+    Memory devices which cannot support this will return mips_ErrorNotImplemented.
+*/
+mips_error mips_mem_snapshot_take(
+    mips_mem_h mem,                 //!< Handle to target memory
+    mips_mem_snapshot_h *snapshot   //!< Receives the new snapshot
+);
+
+/*! Put the contents of memory back to how they were when the snapshot
+    was taken. Write observers are told about every page which changes.
+
+    The snapshot can be restored again later. Snapshots of the same
+    memory taken after it can no longer be restored, and restoring
+    them returns mips_ErrorInvalidArgument, but they must still be freed.
+*/
+mips_error mips_mem_snapshot_restore(
+    mips_mem_h mem,                 //!< Memory the snapshot was taken of
+    mips_mem_snapshot_h snapshot    //!< Snapshot to go back to
+);
+
+/*! Release a snapshot. This must be done before the memory is freed.
+    Passing an empty snapshot handle is legal, and does nothing.
+*/
+void mips_mem_snapshot_free(
+    mips_mem_h mem,                 //!< Memory the snapshot was taken of
+    mips_mem_snapshot_h snapshot    //!< Snapshot to release
+);
+
+/*! What mips_mem_reset_dirty puts in the pages it resets. */
+typedef enum _mips_mem_dirty_reset{
+    mips_DirtyZero=0,       //!< Fill them with zeros, as in a newly created RAM
+    mips_DirtyRestore=1     //!< Copy them back from the image saved by mips_mem_mark_clean
+}mips_mem_dirty_reset;
+
+/*! Forget which pages are dirty, and remember the current contents as
+    the clean image for mips_DirtyRestore.
+
+    Memory devices which support this keep a set of the pages written
+    since they were created, or since the last call to mips_mem_mark_clean
+    or mips_mem_reset_dirty. The first call copies the whole memory, and
+    later calls only copy the dirty pages, so the usual pattern is to
+    load a program once, mark the memory clean, and then reset it
+    between runs:
+
+        load_image(mem);
+        mips_mem_mark_clean(mem);
+        for(...){
+            run_once(cpu);
+            mips_mem_reset_dirty(mem, mips_DirtyRestore);
+        }
+
+    Memory devices which cannot support this will return mips_ErrorNotImplemented.
+*/
+mips_error mips_mem_mark_clean(mips_mem_h mem);
+
+/*! Put back every dirty page, then forget that they were dirty. Only
+    dirty pages are touched, and write observers are told about each one.
+    mips_DirtyRestore also puts back any pages an earlier mips_DirtyZero
+    reset filled, as they no longer match the clean image.
+
+    Returns mips_ErrorInvalidArgument if asked to restore before
+    mips_mem_mark_clean has ever been called.
+*/
+mips_error mips_mem_reset_dirty(
+    mips_mem_h mem,             //!< Handle to target memory
+    mips_mem_dirty_reset how    //!< What to fill the dirty pages with
+);
+
+/*! Find out which pages have been written since the memory was last
+    clean.
+
+    Up to capacity page addresses are written to addresses in ascending
+    order, and count receives the total number of dirty pages, which may
+    be more than capacity. Passing a capacity of zero just counts them.
+*/
+mips_error mips_mem_get_dirty(
+    mips_mem_h mem,         //!< Handle to target memory
+    uint32_t *pageSize,     //!< Receives the size in bytes of each page
+    uint32_t *addresses,    //!< Receives the byte address of each dirty page
+    unsigned capacity,      //!< Number of entries in addresses
+    unsigned *count         //!< Receives the number of dirty pages
+);
+
+/*! Get a pointer to the bytes which hold part of memory, so that they
+    can be read without a transaction for each access.
+
+    This is meant for things like a CPU which decodes instructions, or a
+    tool which dumps memory, which read a lot and would otherwise pay
+    for a function call and a copy each time. The bytes are in memory
+    order, so for MIPS each word is big-endian.
+
+    The pointer is read-only. Writes must still go through
+    mips_mem_write, so that snapshots, dirty pages and write observers
+    see them. The pointer stays valid until the memory is freed, and
+    what it points at changes whenever memory is written or restored,
+    so anything held from it should be dropped on a write notification.
+
+    No alignment or block size rules apply, but the whole range must be
+    inside the memory, or mips_ExceptionInvalidAddress is returned.
+    Devices which keep memory in pieces, such as the sparse RAM, return
+    mips_ErrorNotImplemented for ranges which span more than one piece,
+    or whose piece does not exist yet.
+    Memory devices which cannot give out pointers, such as the cache
+    model, which has to see every access, return mips_ErrorNotImplemented,
+    and the client should fall back to mips_mem_read.
+*/
+mips_error mips_mem_get_host_range(
+    mips_mem_h mem,         //!< Handle to target memory
+    uint32_t address,       //!< Byte address the range starts at
+    uint32_t length,        //!< Number of bytes in the range
+    const uint8_t **ptr     //!< Receives a pointer to the byte at address
+);
+
 /*! @} */
 
 
@@ -173,7 +354,7 @@ void mips_mem_free(mips_mem_h mem);
     @{
 */
 
-/*! Initialise a new RAM of the given size.
+/*! Initialise a new RAM of the given size, filled with zeros.
 
     The RAM will expect transactions to be at the granularity
     of the blockSize. This means any reads or writes must be aligned
@@ -212,6 +393,241 @@ mips_mem_h mips_mem_create_ram(
     uint32_t blockSize	//!< Granularity of transactions supported by RAM
 );
 
+/*! Initialise a new RAM of the given size, holding a binary image from
+    address 0 and zeros after it.
+
+    Rather than being read in, the image file is mapped straight into
+    the RAM with mmap, privately: a page is only read from the file when
+    it is first used, and only copied when it is first written, so even
+    a large image loads almost instantly, and the program can never
+    change the file. Apart from how it starts, this is the same as a RAM
+    from mips_mem_create_ram, including snapshots and dirty pages (note
+    that mips_DirtyZero still fills pages with zeros, not the image, so
+    use mips_mem_mark_clean and mips_DirtyRestore to go back to it).
+
+    Hosts without mmap read the file in instead. Returns an empty handle
+    if the file cannot be opened, or is bigger than cbMem.
+*/
+mips_mem_h mips_mem_create_ram_image(
+    const char *path,   //!< Binary image to load at address 0
+    uint32_t cbMem,     //!< Total number of bytes of ram
+    uint32_t blockSize  //!< Granularity of transactions supported by RAM
+);
+
+/*! Initialise a new RAM of the given size, kept in a file.
+
+    The file is mapped with mmap and shared, so every write to the RAM
+    (including snapshot restores and dirty page resets) changes the
+    file, and the contents are still there for the next RAM made from
+    it. A file which does not exist is created, and one shorter than
+    cbMem is extended with zeros.
+
+    Returns an empty handle if the file cannot be opened or mapped, or
+    if the host has no mmap.
+*/
+mips_mem_h mips_mem_create_ram_file(
+    const char *path,   //!< File holding the contents of the RAM
+    uint32_t cbMem,     //!< Total number of bytes of ram
+    uint32_t blockSize  //!< Granularity of transactions supported by RAM
+);
+
+/*! Initialise a new RAM covering the whole 32-bit address space, filled
+    with zeros.
+
+    Unlike mips_mem_create_ram, nothing is allocated up front. The
+    space is split into 4KB pages, found through a two-level table, and
+    a page is only allocated the first time it is written. Pages which
+    have never been written read as zeros. This lets a program use addresses
+    far apart, such as a stack near the top of memory and a sentinel
+    return address at 0x10000000, while only paying for the pages it
+    touches.
+
+    Transactions follow the same blockSize rules as mips_mem_create_ram,
+    and may be at any address, as long as they do not wrap past the top
+    of the address space. Host pointers can only be given out for ranges
+    within one page which has been written.
+
+    The sparse RAM does not support snapshots or dirty page tracking,
+    and returns mips_ErrorNotImplemented for them.
+*/
+mips_mem_h mips_mem_create_sparse_ram(
+    uint32_t blockSize  //!< Granularity of transactions supported by RAM
+);
+
+/*! Find out how much host memory the pages of a sparse RAM take up. */
+mips_error mips_mem_get_sparse_resident(
+    mips_mem_h mem,     //!< Handle from mips_mem_create_sparse_ram
+    uint64_t *bytes     //!< Receives the number of bytes of pages allocated
+);
+
+/*! Called by a memory from mips_mem_create_mmio for each read.
+
+    \param context The pointer given to mips_mem_create_mmio.
+    \param offset Byte address within the device, so relative to where
+        it is mapped on a bus.
+*/
+typedef mips_error (*mips_mem_mmio_read_fn)(
+    void *context,
+    uint32_t offset,
+    uint32_t length,
+    uint8_t *dataOut
+);
+
+//! Called by a memory from mips_mem_create_mmio for each write.
+typedef mips_error (*mips_mem_mmio_write_fn)(
+    void *context,
+    uint32_t offset,
+    uint32_t length,
+    const uint8_t *dataIn
+);
+
+/*! Create a memory device which passes every transaction to callbacks,
+    for modelling memory mapped peripherals such as timers or a console.
+
+    The callbacks do their own checking, and whatever they return is
+    returned to the caller. If either is NULL, transactions of that kind
+    fail with mips_ExceptionAccessViolation. Host pointers are never
+    given out, and snapshots succeed but save nothing, as the device
+    state belongs to the callbacks.
+
+    Code should not be run from such a device, since a CPU may keep
+    decoded instructions which the callbacks then change unannounced.
+*/
+mips_mem_h mips_mem_create_mmio(
+    mips_mem_mmio_read_fn read,     //!< Handles reads, or NULL
+    mips_mem_mmio_write_fn write,   //!< Handles writes, or NULL
+    void *context                   //!< Passed to both callbacks
+);
+
+//! What a bus lets through to a mapped device
+typedef enum _mips_bus_access{
+    mips_BusReadWrite=0,    //!< Reads, fetches and writes
+    mips_BusReadOnly=1      //!< Reads and fetches only, so the device acts as ROM
+}mips_bus_access;
+
+/*! Create an empty address space, into which other memory devices are
+    mapped with mips_mem_bus_map.
+
+    Each transaction is passed to the device mapped at its address, after
+    moving the address to where that device's range starts, and is split
+    if it spans more than one mapping. Touching an unmapped address fails
+    with mips_ExceptionInvalidAddress, and writing to a read-only mapping
+    fails with mips_ExceptionAccessViolation; a write which would do
+    either changes nothing. If a device fails its part of a write, the
+    parts already written stay written, and are reported to the bus's
+    write observers.
+
+    Routing uses a table of 4KB pages, so it costs the same however many
+    devices are mapped. mips_mem_get_host_range is passed to the device
+    too, so a CPU reads RAM on the bus directly, without going through
+    the bus at all.
+
+    The bus watches each device for writes, so writes made straight to a
+    device (for example to load a ROM) are still reported to the bus's
+    write observers. If any device cannot report writes, such as the
+    cache model, the bus refuses write observers as well. Snapshots take
+    one snapshot of each device, so only work if all of them support
+    snapshots. Dirty page tracking is not supported.
+
+    Devices are not owned by the bus, and must outlive it.
+*/
+mips_mem_h mips_mem_create_bus(void);
+
+/*! Map part of a device into a bus.
+
+    Bus addresses base to base+length-1 go to device addresses offset to
+    offset+length-1. The same device can be mapped more than once. All
+    three must be multiples of 4KB, and the range must not overlap one
+    already mapped, or mips_ErrorInvalidArgument is returned.
+
+    Everything should be mapped before a CPU is created on the bus, as
+    whether it accepts write observers can change as devices are added.
+*/
+mips_error mips_mem_bus_map(
+    mips_mem_h bus,             //!< Handle from mips_mem_create_bus
+    uint32_t base,              //!< First bus address of the range
+    uint32_t length,            //!< Bytes in the range
+    mips_mem_h device,          //!< Device which handles the range
+    uint32_t offset,            //!< Device address which base goes to
+    mips_bus_access access      //!< Whether writes are allowed
+);
+
+//! Most ways a cache set can have
+#define MIPS_CACHE_MAX_WAYS 16
+
+//! How a cache picks the line to evict from a full set
+typedef enum _mips_cache_replacement{
+    mips_CacheLru=0,    //!< Least recently used
+    mips_CachePlru=1    //!< Tree pseudo-LRU, as commonly built in hardware
+}mips_cache_replacement;
+
+//! What a cache does with writes
+typedef enum _mips_cache_write_policy{
+    //! Writes allocate a line and mark it dirty; it is written back when evicted
+    mips_CacheWriteBack=0,
+    //! Writes go straight to the next level, and do not allocate on a miss
+    mips_CacheWriteThrough=1
+}mips_cache_write_policy;
+
+//! Shape of one cache.
+typedef struct _mips_cache_config{
+    uint32_t size;                      //!< Total bytes of data held
+    uint32_t lineSize;                  //!< Bytes per line, a power of two
+    uint32_t ways;                      //!< Associativity, a power of two up to MIPS_CACHE_MAX_WAYS
+    mips_cache_replacement replacement;
+    mips_cache_write_policy writePolicy;
+}mips_cache_config;
+
+//! The caches simulated by mips_mem_create_cache
+typedef enum _mips_cache_level{
+    mips_CacheL1I=0,    //!< Level one instruction cache, sees mips_mem_fetch
+    mips_CacheL1D=1,    //!< Level one data cache, sees mips_mem_read and mips_mem_write
+    mips_CacheL2=2,     //!< Optional unified level two cache
+    mips_CacheLevels=3
+}mips_cache_level;
+
+//! What happened in one cache
+typedef struct _mips_cache_stats{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;     //!< Valid lines thrown out to make room
+    uint64_t writebacks;    //!< Dirty lines written to the next level
+}mips_cache_stats;
+
+/*! Wraps a memory in a model of a cache hierarchy.
+
+    Every transaction is passed straight on to inner, so the data seen
+    is always exactly the same as without the caches; only tags are
+    simulated, in order to count hits and misses. Transactions which
+    span several lines count an access to each of them.
+
+    The caches need to see every instruction fetch, so they do not
+    support mips_mem_add_write_observer, which makes a CPU fetch each
+    instruction through mips_mem_fetch rather than remembering it.
+
+    The inner memory is not owned by the cache, and must outlive it.
+    Returns an empty handle if a configuration is not valid.
+
+    \param l2 The level two cache, or NULL if there is none.
+*/
+mips_mem_h mips_mem_create_cache(
+    mips_mem_h inner,               //!< Memory behind the caches
+    const mips_cache_config *l1i,   //!< Level one instruction cache
+    const mips_cache_config *l1d,   //!< Level one data cache
+    const mips_cache_config *l2     //!< Unified level two cache, or NULL
+);
+
+//! Returns the counts for one level of a memory from mips_mem_create_cache.
+mips_error mips_mem_get_cache_stats(
+    mips_mem_h mem,             //!< Handle from mips_mem_create_cache
+    mips_cache_level level,     //!< Which cache to report
+    mips_cache_stats *stats     //!< Receives the counts
+);
+
+/*! Sets the counts for every level back to zero, for example after a
+    program has been loaded. The contents of the caches are kept. */
+mips_error mips_mem_reset_cache_stats(mips_mem_h mem);
+
 /*!
     @}
     @}
@@ -140,6 +140,81 @@ void mips_test_end_test(int testId, int passed, const char *msg);
 */
 void mips_test_end_suite();
 
+/*! Opaque handle to a set of test results which is independent of
+    every other set, including the one used by mips_test_begin_suite
+    and friends.
+    
+    The functions above record everything in one process-wide suite,
+    so only one thread can be running tests at a time. To run a suite
+    on many threads, give each thread its own CPU, RAM and context,
+    record tests into the context with mips_test_ctx_begin_test and
+    mips_test_ctx_end_test, then once the threads have finished merge
+    the contexts together and report on the result:
+    
+        // On each thread
+        mips_test_ctx_h ctx=mips_test_ctx_create();
+        int testId=mips_test_ctx_begin_test(ctx, "ADD");
+        ...
+        mips_test_ctx_end_test(ctx, testId, passed, "Testing 5+5 == 10");
+        
+        // Once they have all joined
+        mips_test_ctx_h all=mips_test_ctx_create();
+        for(...){
+            mips_test_ctx_merge(all, shards[i]);
+            mips_test_ctx_free(shards[i]);
+        }
+        mips_test_ctx_report(all, stderr);
+        mips_test_ctx_free(all);
+    
+    A context must only be used by one thread at a time, but different
+    contexts can be used concurrently. Unlike the functions above, misuse
+    is reported through the return value rather than by exiting.
+*/
+typedef struct mips_test_ctx_impl *mips_test_ctx_h;
+
+/*! Creates an empty context, which is the equivalent of mips_test_begin_suite.
+    \retval A new context, or 0 if it could not be allocated.
+*/
+mips_test_ctx_h mips_test_ctx_create();
+
+/*! As mips_test_begin_test, but recording into ctx.
+    
+    \retval The identifier of the test within ctx, or -1 if ctx is not valid
+    or the previous test in ctx has not been completed.
+*/
+int mips_test_ctx_begin_test(mips_test_ctx_h ctx, const char *instruction);
+
+/*! As mips_test_end_test, but recording into ctx.
+    
+    \retval mips_ErrorInvalidHandle if ctx is not valid.
+    \retval mips_ErrorInvalidArgument if testId is not the test in progress in ctx.
+*/
+mips_error mips_test_ctx_end_test(mips_test_ctx_h ctx, int testId, int passed, const char *msg);
+
+/*! Appends every test recorded in src to the end of dst, giving them new
+    identifiers within dst. src is left unchanged, so can be freed or
+    merged elsewhere afterwards.
+    
+    \retval mips_ErrorInvalidArgument if either context has a test in
+    progress, or they are the same context.
+*/
+mips_error mips_test_ctx_merge(mips_test_ctx_h dst, mips_test_ctx_h src);
+
+/*! Prints the same summary table as mips_test_end_suite, covering every
+    test recorded in (or merged into) ctx.
+    
+    \param passed If not NULL, receives the number of tests which passed.
+    
+    \param total If not NULL, receives the number of tests recorded.
+    
+    \retval mips_ErrorInvalidArgument if no tests have been recorded, or the
+    last one has not been completed.
+*/
+mips_error mips_test_ctx_report(mips_test_ctx_h ctx, FILE *dst, unsigned *passed, unsigned *total);
+
+/*! Frees a context. Passing 0 is allowed and does nothing. */
+void mips_test_ctx_free(mips_test_ctx_h ctx);
+
 /*! @} */    
     
 
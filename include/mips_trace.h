@@ -0,0 +1,179 @@
+/*! \file mips_trace.h
+    Binary execution traces, as written by a CPU when the trace format
+    is set to mips_TraceBinary.
+*/
+#ifndef mips_trace_header
+#define mips_trace_header
+
+#include "mips_core.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_trace Binary traces
+    \addtogroup mips_trace
+    @{
+
+    A binary trace is a mips_trace_file_header followed by one
+    mips_trace_record for every instruction the CPU attempted,
+    including the one which failed if a run ended with an error.
+    Both are written in the byte order of the host which produced
+    the trace, which can be detected from the magic number.
+
+    Nothing is formatted while the simulation runs; the records are
+    turned into text later by tools/mips_trace.
+*/
+
+//! Magic number at the start of every binary trace ("MTRC" on a little-endian host)
+#define MIPS_TRACE_MAGIC 0x4352544Du
+
+//! Version of the record layout described by this header
+#define MIPS_TRACE_VERSION 1u
+
+//! Destination value for an instruction which writes no register.
+#define MIPS_TRACE_NO_DEST 0xFFu
+
+/*! Destination values for registers other than the 32 GPRs. For
+    mips_TraceDestHiLo (MULT, DIV and friends) value holds LO and
+    address holds HI. */
+typedef enum _mips_trace_dest{
+    mips_TraceDestHi=32,
+    mips_TraceDestLo=33,
+    mips_TraceDestHiLo=34
+}mips_trace_dest;
+
+//! Bits in mips_trace_record::flags
+typedef enum _mips_trace_flags{
+    mips_TraceMemRead=0x01,    //!< address is a memory location which was read
+    mips_TraceMemWrite=0x02    //!< address is a memory location which was written
+}mips_trace_flags;
+
+//! Written once at the start of a trace.
+typedef struct _mips_trace_file_header{
+    uint32_t magic;         //!< Always MIPS_TRACE_MAGIC
+    uint16_t version;       //!< Always MIPS_TRACE_VERSION
+    uint16_t recordSize;    //!< sizeof(mips_trace_record)
+}mips_trace_file_header;
+
+//! One executed (or failed) instruction.
+typedef struct _mips_trace_record{
+    uint32_t pc;        //!< Address of the instruction
+    uint32_t instr;     //!< Raw instruction word, or zero if it could not be fetched
+    uint32_t value;     //!< Value written to dest, or stored to memory
+    uint32_t address;   //!< Memory address touched, if flags says so
+    uint16_t error;     //!< mips_error returned for this instruction
+    uint8_t dest;       //!< Register written, a mips_trace_dest, or MIPS_TRACE_NO_DEST
+    uint8_t flags;      //!< Combination of mips_trace_flags
+}mips_trace_record;
+
+/*! @} */
+
+
+/*! \defgroup mips_trace_files Compressed traces
+    \addtogroup mips_trace_files
+    @{
+
+    Raw traces are simple but large, so traces can also be stored in
+    a compressed form which is typically 5-10 times smaller than the
+    raw records, and far smaller than the equivalent text.
+
+    A compressed trace starts with a mips_trace_file_header whose magic
+    is MIPS_TRACE_MAGIC_COMPRESSED, followed by a sequence of frames.
+    Each frame is a fixed header, giving the index of its first record,
+    how many records it holds and how many bytes of payload follow, then
+    the payload itself. Decoding state is reset at the start of every
+    frame, so a reader can seek by skipping whole frames without
+    decoding them. Within a frame each record is encoded relative to
+    what came before:
+
+    - PCs are stored as the difference from the previous pc plus 4,
+      and omitted entirely for sequential execution.
+    - The instruction word, destination and memory flags are omitted
+      when they are the same as the last time that pc was seen, or
+      the same as the previous record.
+    - Register values are stored as the difference from the last value
+      written to the same register, and memory addresses and stored
+      values as the difference from the previous ones.
+    - Differences are zig-zag encoded as little-endian base 128
+      varints, so small changes take a single byte.
+
+    Unlike raw traces, compressed traces are always little-endian.
+
+    The reader accepts both raw and compressed traces, so tools do not
+    need to care which they were given.
+*/
+
+//! Magic number at the start of a compressed trace ("MTRZ" as bytes)
+#define MIPS_TRACE_MAGIC_COMPRESSED 0x5A52544Du
+
+//! Version of the compressed encoding described above
+#define MIPS_TRACE_VERSION_COMPRESSED 1u
+
+//! Records in each frame of a compressed trace written by mips_trace_writer
+#define MIPS_TRACE_FRAME_RECORDS 4096u
+
+typedef struct mips_trace_writer_impl *mips_trace_writer_h;
+typedef struct mips_trace_reader_impl *mips_trace_reader_h;
+
+/*! Starts a compressed trace, writing its header to dst.
+
+    Returns an empty handle if the header cannot be written. The
+    file remains owned by the caller, and must stay open until
+    mips_trace_writer_close has been called.
+*/
+mips_trace_writer_h mips_trace_writer_create(FILE *dst);
+
+//! Adds one record to the end of the trace.
+mips_error mips_trace_writer_append(
+    mips_trace_writer_h writer,         //!< Handle from mips_trace_writer_create
+    const mips_trace_record *rec        //!< Record to encode
+);
+
+/*! Writes out any partially filled frame and releases the writer.
+    Does not close the file. */
+mips_error mips_trace_writer_close(mips_trace_writer_h writer);
+
+/*! Opens a raw or compressed trace for reading.
+
+    Returns an empty handle if src does not start with a trace
+    header this library understands. The file remains owned by the
+    caller, and must stay open until mips_trace_reader_close.
+*/
+mips_trace_reader_h mips_trace_reader_open(FILE *src);
+
+/*! Reads up to maxCount records, in the style of fread.
+
+    On success count holds the number of records read, which is only
+    less than maxCount at the end of the trace. Returns
+    mips_ErrorFileReadError if the trace is truncated or corrupt.
+*/
+mips_error mips_trace_reader_read(
+    mips_trace_reader_h reader,     //!< Handle from mips_trace_reader_open
+    mips_trace_record *recs,        //!< Where to put the records
+    unsigned maxCount,              //!< Space available in recs
+    unsigned *count                 //!< Receives the number of records read
+);
+
+/*! Moves to the record with the given index, counting from zero, so
+    that the next read starts there. For compressed traces only the
+    frame containing the record is decoded. Seeking past the end is
+    allowed, and leaves the reader at the end.
+
+    Requires src to be seekable.
+*/
+mips_error mips_trace_reader_seek(mips_trace_reader_h reader, uint64_t index);
+
+//! Index of the record the next read will return.
+uint64_t mips_trace_reader_tell(mips_trace_reader_h reader);
+
+//! Releases the reader. Does not close the file.
+void mips_trace_reader_close(mips_trace_reader_h reader);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -1,35 +1,32 @@
 #include "mips.h"
-#include "mips_cpu_decoder.h"
+#include "mips_cpu_impl.h"
 #include "mips_cpu_alu.h"
-#include <iostream>
 
-using namespace std;
-
-struct mips_cpu_impl
+static void mips_cpu_on_write(void *context, uint32_t address, uint32_t length)
 {
-	uint32_t pc;
-	uint32_t npc;
-	uint32_t regs[32];
-	uint32_t hi;
-	uint32_t lo;
-
-	unsigned logLevel;
-
-	FILE* logDst;
+	mips_cpu_h state = (mips_cpu_h)context;
 
-	mips_mem_h ram;
-};
-
-mips_error fetch(mips_cpu_h state, uint32_t &instr);
-mips_error fetch_next(mips_cpu_h state, uint32_t &instr);
-mips_error execute(mips_cpu_h state, const uint32_t instr);
-mips_error mips_cpu_get_npc(mips_cpu_h state, uint32_t *npc);
-mips_error mips_cpu_set_npc(mips_cpu_h state, uint32_t npc);
+	icache_invalidate(state->decoded, address, length);
+	block_cache_invalidate(state->blocks, address, length);
+}
 
 mips_cpu_h mips_cpu_create(mips_mem_h mem)
 {
+	return mips_cpu_create_with_engine(mem, mips_EngineInterpreter);
+}
+
+mips_cpu_h mips_cpu_create_with_engine(mips_mem_h mem, mips_cpu_engine engine)
+{
+	if(engine != mips_EngineInterpreter && engine != mips_EngineThreaded
+		&& engine != mips_EngineBlock && engine != mips_EngineJit)
+	{
+		return 0;
+	}
+
 	mips_cpu_impl *cpu = new mips_cpu_impl;
 	cpu->ram = mem;
+	data_port_init(cpu->data, mem);
+	cpu->engine = engine;
 	cpu->pc = 0;
 	cpu->npc = cpu->pc + 4;
 	cpu->hi = 0;
@@ -40,6 +37,25 @@ mips_cpu_h mips_cpu_create(mips_mem_h mem)
 		cpu->regs[i] = 0;
 	}
 
+	cpu->logLevel = 0;
+	cpu->logDst = 0;
+
+	cpu->traceFormat = mips_TraceText;
+	trace_ring_init(cpu->trace);
+	cpu->tracePending = false;
+
+	mips_cpu_reset_fusion_hits(cpu);
+	profile_init(cpu->prof);
+	stats_reset(cpu->stats);
+	timing_init(cpu->timing);
+	predictor_init(cpu->predictor);
+
+	// Decoded instructions can only be kept if we hear about writes to them
+	icache_init(cpu->decoded);
+	block_cache_init(cpu->blocks);
+	jit_init(cpu->jit);
+	cpu->decoded.enabled = mips_mem_add_write_observer(mem, mips_cpu_on_write, cpu) == mips_Success;
+
 	return cpu;
 }
 
@@ -216,428 +232,496 @@ mips_error mips_cpu_get_lo(mips_cpu_h state, uint32_t* lo)
 mips_error mips_cpu_step( // this forwards the CPU by one instruction
 	mips_cpu_h state	//! Valid (non-empty) handle to a CPU
 )
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	uint32_t executed = 0;
+	engine_stops stops = { 0, 0 };
+
+	return engine_run(state, 1, stops, executed);
+}
+
+mips_error mips_cpu_run(mips_cpu_h state, uint32_t maxSteps, uint32_t stopPc, uint32_t *stepsExecuted)
+{
+	return mips_cpu_run_until(state, maxSteps, &stopPc, 1, stepsExecuted);
+}
+
+mips_error mips_cpu_run_until(mips_cpu_h state, uint32_t maxSteps, const uint32_t *stopPcs, unsigned stopCount, uint32_t *stepsExecuted)
 {
 	mips_error err = mips_Success;
 
-	uint32_t instr = 0;
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(stopCount && !stopPcs)
+	{
+		return mips_ErrorInvalidArgument;
+	}
 
-	// fetch
-	err = fetch(state, instr);
-	// execute
-	err = execute(state, instr);
+	uint32_t executed = 0;
+	engine_stops stops = { stopPcs, stopCount };
 
-	err = mips_cpu_set_register(state, 0, 0);
+	err = engine_run(state, maxSteps, stops, executed);
 
-	err = mips_cpu_set_pc(state, state->npc);
+	if(stepsExecuted)
+	{
+		*stepsExecuted = executed;
+	}
 
 	return err;
 }
 
-mips_error fetch(mips_cpu_h state, uint32_t &instr)
+// Starts or stops the binary trace writer to match the debug settings
+static mips_error mips_cpu_update_trace(mips_cpu_h state)
 {
-	mips_error err = mips_Success;
+	bool compressed = state->traceFormat == mips_TraceCompressed;
+	bool wanted = state->traceFormat != mips_TraceText && state->logLevel > 0 && state->logDst;
 
-	uint8_t mem_buffer[4];
+	if(state->trace.running
+		&& (!wanted || state->trace.dst != state->logDst || compressed != (state->trace.encoder != 0)))
+	{
+		trace_ring_stop(state->trace);
+	}
 
-	uint32_t pc = 0;
+	if(wanted && !state->trace.running)
+	{
+		return trace_ring_start(state->trace, state->logDst, compressed);
+	}
 
-	err = mips_cpu_get_pc(state, &pc);
+	return mips_Success;
+}
 
-	err = mips_mem_read(state->ram, pc, 4, mem_buffer);
-	
+// Level 1 traces each instruction to dest, level 2 and above also report
+// failures. The level takes effect from the next step or run.
+mips_error mips_cpu_set_debug_level(mips_cpu_h state, unsigned level, FILE *dest)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
 
+	if(level > 0 && !dest)
+	{
+		return mips_ErrorInvalidArgument;
+	}
 
-	instr = to_big(mem_buffer);
+	state->logLevel = level;
+	state->logDst = dest;
 
-	return err;
+	return mips_cpu_update_trace(state);
 }
 
-mips_error fetch_next(mips_cpu_h state, uint32_t &instr)
+mips_error mips_cpu_set_trace_format(mips_cpu_h state, mips_cpu_trace_format format)
 {
-	mips_error err = mips_Success;
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(format != mips_TraceText && format != mips_TraceBinary && format != mips_TraceCompressed)
+	{
+		return mips_ErrorInvalidArgument;
+	}
 
-	uint8_t mem_buffer[4];
+	state->traceFormat = format;
 
-	uint32_t npc = 0;
+	return mips_cpu_update_trace(state);
+}
+
+mips_error mips_cpu_get_fusion_hits(mips_cpu_h state, mips_cpu_fusion fusion, uint64_t *hits)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
 
-	err = mips_cpu_get_npc(state, &npc);
+	if((unsigned)fusion >= mips_FusionCount || !hits)
+	{
+		return mips_ErrorInvalidArgument;
+	}
 
-	err = mips_mem_read(state->ram, npc, 4, mem_buffer);
+	*hits = state->fusionHits[fusion];
 
-	return err;
+	return mips_Success;
 }
 
-mips_error mips_cpu_set_debug_level(mips_cpu_h state, unsigned level, FILE *dest)
+mips_error mips_cpu_reset_fusion_hits(mips_cpu_h state)
 {
-	state->logLevel = level;
-	state->logDst = dest;
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	for(unsigned i = 0; i < mips_FusionCount; i++)
+	{
+		state->fusionHits[i] = 0;
+	}
+
 	return mips_Success;
 }
 
-void mips_cpu_free(mips_cpu_h state)
+mips_error mips_cpu_set_profiling(mips_cpu_h state, unsigned enabled)
 {
-	delete state;
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	state->prof.enabled = enabled != 0;
+
+	return mips_Success;
 }
 
-mips_error execute(mips_cpu_h state, const uint32_t instr)
+mips_error mips_cpu_get_profile(mips_cpu_h state, uint32_t pc, uint64_t *executed, uint64_t *memFaults)
 {
-	mips_error err = mips_Success;
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
 
-	// Initialise variables
-	uint32_t opcode = decode_opcode(instr);
-	uint32_t rs = 0;
-	uint32_t rt = 0;
-	uint32_t rd = 0;
-	uint32_t shift = 0;
-	uint32_t func = 0;
-	uint32_t addr = 0;
-	uint32_t data = 0;
-
-	if(opcode==0)
-	{
-		// r type
-		shift = decode_shift(instr);
-		func = decode_func(instr);
-		err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-		err = mips_cpu_get_register(state, decode_rt(instr), &rt);
-
-		switch(func)
-		{
-			case 0x20:
-				cout << "ADD $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-
-				if(shift != 0x0)
-				{
-					return mips_ExceptionInvalidInstruction;
-				}
-
-				err = ADD(rd, rs, rt);
-			break;
-			case 0x21:
-				cout << "ADDU $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-				
-				if(shift != 0x0)
-				{
-					return mips_ExceptionInvalidInstruction;
-				}
-
-				err = ADDU(rd, rs, rt);
-			break;
-			case 0x24:
-				cout << "AND $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-				
-				if(shift != 0x0)
-				{
-					return mips_ExceptionInvalidInstruction;
-				}
-
-				err = AND(rd, rs, rt);
-			break;
-			case 0x1A:
-				cout << "DIV $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-
-				if(!rt)
-				{
-					return mips_ExceptionInvalidInstruction;
-				}
-
-				err = DIV(state, rs, rt);
-			break;
-			case 0x1B:
-				cout << "DIVU $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-				err = DIVU(state, rs, rt);
-			break;
-			case 0x05:
-				cout << "JALR $" << decode_rd(instr) << ", $" << decode_rs(instr) << endl;
-				err = JALR(state, rd, rs);
-			break;
-			case 0x08:
-				cout << "JR $" << decode_rs(instr) << endl;
-				err = JR(state, rs);
-			break;
-			case 0x10:
-				cout << "MFHI $" << decode_rd(instr) << endl;
-				err = MFHI(state, rd);
-			break;
-			case 0x12:
-				cout << "MFLO $" << decode_rd(instr) << endl;
-				err = MFLO(state, rd);
-			break;
-			case 0x11:
-				cout << "MTHI $" << decode_rs(instr) << endl;
-				err = MTHI(state, rd);
-			break;
-			case 0x13:
-				cout << "MTLO $" << decode_rs(instr) << endl;
-				err = MFLO(state, rs);
-			break;
-			case 0x18:
-				cout << "MULT $" << decode_rs(instr) << ", $" << decode_rt(instr) <<  endl;
-				err = MULT(state, rs, rt);
-			break;
-			case 0x19:
-				cout << "MULTU $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-				err = MULTU(state, rs, rt);
-			break;
-			case 0x25:
-				cout << "OR $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-				err = OR(rd, rs, rt);
-			break;
-			case 0x00:
-				cout << "SLL $" << decode_rd(instr) << ", $" << decode_rt(instr) << ", " << shift << endl;
-				err = SLL(rd, rt, shift);
-			break;
-			case 0x04:
-				cout << "SLLV $" << decode_rd(instr) << ", $" << decode_rt(instr) << ", $" << decode_rs(instr) << endl;
-				err = SLLV(rd, rt, rs);
-			break;
-			case 0x2A:
-				cout << "SLT $" << decode_rd(instr) << ", $" << decode_rt(instr) << ", $" << decode_rs(instr) << endl;
-				err = SLT(rd, rs, rt);
-			break;
-			case 0x2B:
-				cout << "SLTU $" << decode_rd(instr) << ", $" << decode_rt(instr) << ", $" << decode_rs(instr) << endl;
-				err = SLTU(rd, rs, rt);
-			case 0x03:
-				cout << "SRA $" << decode_rd(instr) << ", $" << decode_rt(instr) << ", " << shift << endl;
-				err = SRA(rd, rt, shift);
-			break;
-			case 0x07:
-				cout << "SRAV $" << decode_rd(instr) << ", $" << decode_rt(instr) << ", $" << decode_rs(instr) << endl;
-				err = SRAV(rd, rt, rs);
-			break;
-			case 0x02:
-				cout << "SRL $" << decode_rd(instr) << ", $" << decode_rt(instr) << ", " << shift << endl;
-				err = SRL(rd, rt, shift);
-			break;
-			case 0x06:
-				cout << "SRLV $" << decode_rd(instr) << ", $" << decode_rt(instr) << ", $" << decode_rs(instr) << endl;
-				err = SRLV(rd, rt, rs);
-			break;
-			case 0x22:
-				cout << "SUB $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-				err = SUB(rd, rs, rt);
-			break;
-			case 0x23:
-				cout << "SUBU $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-				err = SUBU(rd, rs, rt);
-			break;
-			case 0x26:
-				cout << "XOR $" << decode_rd(instr) << ", $" << decode_rs(instr) << ", $" << decode_rt(instr) << endl;
-				err = XOR(rd, rs, rt);
-			break;
-		}
+	if(!executed || !memFaults)
+	{
+		return mips_ErrorInvalidArgument;
+	}
+
+	*executed = 0;
+	*memFaults = 0;
+
+	std::unordered_map<uint32_t, profile_page*>::const_iterator it = state->prof.pages.find(pc >> ICACHE_PAGE_BITS);
+
+	if(it != state->prof.pages.end())
+	{
+		uint32_t index = (pc >> 2) & (ICACHE_PAGE_WORDS - 1);
 
-		err = mips_cpu_set_register(state, decode_rd(instr), rd);
+		*executed = it->second->executed[index];
+		*memFaults = it->second->faults[index];
 	}
-	else if(opcode==1)
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_reset_profile(mips_cpu_h state)
+{
+	if(!state)
 	{
-		// j type
-		uint32_t branch_func = decode_branch_func(instr);
-		data = decode_data(instr);
+		return mips_ErrorInvalidHandle;
+	}
 
-		switch(branch_func)
-		{
-			case 0x01:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = BGEZ(state, rs, data);
-				cout << "BGEZ $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x11:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = BGEZAL(state, rs, data);
-				cout << "BGEZAL $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x00:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = BLTZ(state, rs, data);
-				cout << "BLTZ $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x10:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = BLTZAL(state, rs, data);
-				cout << "BLTZAL $" << decode_rs(instr) << ", " << data << endl;
-			break;
-		}
+	profile_free(state->prof);
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_write_profile(mips_cpu_h state, FILE *dst)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
 	}
-	else
+
+	if(!dst)
 	{
-		// i type
-		data = decode_data(instr);		
-		uint32_t instr_next = 0;
-		err = fetch_next(state, instr_next);
-		uint32_t opcode_next = decode_opcode(instr_next);
-		uint32_t nrt = 0;
+		return mips_ErrorInvalidArgument;
+	}
 
-		switch(opcode)
-		{
+	return profile_write(state->prof, dst);
+}
+
+mips_error mips_cpu_get_stats(mips_cpu_h state, mips_cpu_stats *stats)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(!stats)
+	{
+		return mips_ErrorInvalidArgument;
+	}
+
+	stats_fill(state->stats, *stats);
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_reset_stats(mips_cpu_h state)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	stats_reset(state->stats);
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_print_stats(mips_cpu_h state, FILE *dst)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(!dst)
+	{
+		return mips_ErrorInvalidArgument;
+	}
 
-			case 0x08:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = ADDI(rt, rs, data);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "ADDI $" << decode_rt(instr) << ", $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x09:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = ADDIU(rt, rs, data);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "ADDIU $" << decode_rt(instr) << ", $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x0C:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = ANDI(rt, rs, data);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "ANDI $" << decode_rt(instr) << ", $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x04:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = mips_cpu_get_register(state, decode_rt(instr), &rt);
-				err = BEQ(state, rs, rt, data);
-				cout << "BEQ $" << decode_rs(instr) << ", $" << decode_rt(instr) << ", " << data << endl;
-			break;
-			case 0x07:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = mips_cpu_get_register(state, decode_rt(instr), &rt);
-				err = BGTZ(state, rs, data);
-				cout << "BGTZ $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x06:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = BLEZ(state, rs, data);
-				cout << "BLEZ $" << decode_rs(instr) << ", " << data << endl;	
-			break;
-			case 0x05:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = mips_cpu_get_register(state, decode_rt(instr), &rt);
-				err = BNE(state, rs, rt, data);
-				cout << "BNE $" << decode_rs(instr) << ", $" << decode_rt(instr) << ", " << data << endl;		
-			break;
-			case 0x02:
-				err = J(state, decode_addr(instr));
-				cout << "J " << decode_addr(instr) << endl;
-			break;
-			case 0x03:
-				err = JAL(state, decode_addr(instr));
-				cout << "JAL " << decode_addr(instr) << endl;
-			break;
-			case 0x20:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = LB(state->ram, rs + data, rt);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "LB $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x24:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = LBU(state->ram, rs + data, rt);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "LBU $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x21:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-
-				if(!data%2)
-				{
-					return mips_ExceptionInvalidInstruction;
-				}
-
-				err = LH(state->ram, rs + data, rt);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "LH $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x25:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-
-				if(!data%2)
-				{
-					return mips_ExceptionInvalidInstruction;
-				}
-
-				err = LHU(state->ram, rs + data, rt);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "LHU $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x23:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = LW(state->ram, rs + data, rt);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "LW $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x22:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = LWL(state->ram, rs + data, rt);
-				err = mips_cpu_get_register(state, decode_rt(instr_next), &nrt);
-
-				if((opcode_next != 0x22) || (opcode_next != 0x26))
-				{
-					if(rt==nrt)
-					{
-						return mips_ExceptionInvalidInstruction;
-					}
-				}
-
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "LWL $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x26:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = LWR(state->ram, rs + data, rt);
-				err = mips_cpu_set_register(state, decode_rs(instr), rt);
-				cout << "LWR $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x0D:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = ORI(rt, rs, data);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "ORI $" << decode_rt(instr) << ", $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x28:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = mips_cpu_get_register(state, decode_rt(instr), &rt);
-				err = SB(state->ram, rs + data, rt);
-				cout << "SB $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;				
-			break;
-			case 0x29:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = mips_cpu_get_register(state, decode_rt(instr), &rt);
-
-				if(!data%2)
-				{
-					return mips_ExceptionInvalidInstruction;
-				}
-
-				err = SH(state->ram, rs + data, rt);
-				cout << "SH $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x0A:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = SLTI(rt, rs, data);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "SLTI $" << decode_rt(instr) << ", $" << decode_rs(instr) << ", " << data << endl;
-			break;
-			case 0x0B:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = SLTIU(rt, rs, data);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "SLTIU $" << decode_rt(instr) << ", $" << decode_rs(instr) << ", " << data << endl;				
-			break;
-			case 0x2B:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = mips_cpu_get_register(state, decode_rt(instr), &rt);
-				err = SW(state->ram, rs + data, rt);
-				cout << "SW $" << decode_rt(instr) << ", " << data << "($" << decode_rs(instr) << ")" << endl;
-			break;
-			case 0x0E:
-				err = mips_cpu_get_register(state, decode_rs(instr), &rs);
-				err = XORI(rs, rt, data);
-				err = mips_cpu_set_register(state, decode_rt(instr), rt);
-				cout << "XORI $" << decode_rt(instr) << ", $" << decode_rs << ", " << data << endl;
-			break;
-			default:
-				return mips_ExceptionInvalidInstruction;
+	mips_cpu_stats stats;
+
+	stats_fill(state->stats, stats);
+	stats_print(stats, state->timing.totals, state->predictor.totals, dst);
+
+	return ferror(dst) ? mips_ErrorFileWriteError : mips_Success;
+}
+
+mips_error mips_cpu_set_timing(mips_cpu_h state, unsigned enabled, const mips_cpu_timing_config *config)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(config)
+	{
+		state->timing.config = *config;
+	}
+
+	state->timing.enabled = enabled != 0;
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_timing(mips_cpu_h state, mips_cpu_timing *timing)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(!timing)
+	{
+		return mips_ErrorInvalidArgument;
+	}
+
+	*timing = state->timing.totals;
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_reset_timing(mips_cpu_h state)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	timing_reset(state->timing);
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_set_predictor(mips_cpu_h state, unsigned enabled, const mips_cpu_predictor_config *config)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(config && !predictor_configure(state->predictor, *config))
+	{
+		return mips_ErrorInvalidArgument;
+	}
+
+	state->predictor.enabled = enabled != 0;
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_predictor_stats(mips_cpu_h state, mips_cpu_predictor_stats *stats)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(!stats)
+	{
+		return mips_ErrorInvalidArgument;
+	}
+
+	*stats = state->predictor.totals;
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_branch_profile(mips_cpu_h state, uint32_t pc, uint64_t *executed, uint64_t *mispredicted)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(!executed || !mispredicted)
+	{
+		return mips_ErrorInvalidArgument;
+	}
+
+	*executed = 0;
+	*mispredicted = 0;
+
+	std::unordered_map<uint32_t, predictor_site>::const_iterator it = state->predictor.sites.find(pc);
+
+	if(it != state->predictor.sites.end())
+	{
+		*executed = it->second.executed;
+		*mispredicted = it->second.mispredicted;
+	}
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_reset_predictor(mips_cpu_h state)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	predictor_reset(state->predictor);
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_write_branch_profile(mips_cpu_h state, FILE *dst)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(!dst)
+	{
+		return mips_ErrorInvalidArgument;
+	}
+
+	return predictor_write(state->predictor, dst);
+}
+
+// Only the architectural state is saved; everything cached from memory
+// is kept up to date by the write notifications sent on restore
+struct mips_snapshot_impl
+{
+	mips_cpu_h cpu;
+	mips_mem_h ram;		// Kept so the snapshot can be freed after the CPU
+	mips_mem_snapshot_h mem;
+
+	uint32_t pc;
+	uint32_t npc;
+	uint32_t regs[32];
+	uint32_t hi;
+	uint32_t lo;
+};
+
+mips_error mips_snapshot_take(mips_cpu_h state, mips_snapshot_h *snapshot)
+{
+	if(!state)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	if(!snapshot)
+	{
+		return mips_ErrorInvalidArgument;
+	}
+
+	mips_snapshot_impl *snap = new mips_snapshot_impl;
+
+	mips_error err = mips_mem_snapshot_take(state->ram, &snap->mem);
+
+	if(err)
+	{
+		delete snap;
+		return err;
+	}
+
+	snap->cpu = state;
+	snap->ram = state->ram;
+	snap->pc = state->pc;
+	snap->npc = state->npc;
+	snap->hi = state->hi;
+	snap->lo = state->lo;
+
+	for(int i=0; i<=31; i++)
+	{
+		snap->regs[i] = state->regs[i];
+	}
+
+	*snapshot = snap;
+
+	return mips_Success;
+}
+
+mips_error mips_snapshot_restore(mips_snapshot_h snapshot)
+{
+	if(!snapshot)
+	{
+		return mips_ErrorInvalidHandle;
+	}
+
+	mips_cpu_h state = snapshot->cpu;
+
+	mips_error err = mips_mem_snapshot_restore(state->ram, snapshot->mem);
+
+	if(err)
+	{
+		return err;
+	}
+
+	state->pc = snapshot->pc;
+	state->npc = snapshot->npc;
+	state->hi = snapshot->hi;
+	state->lo = snapshot->lo;
+
+	for(int i=0; i<=31; i++)
+	{
+		state->regs[i] = snapshot->regs[i];
+	}
+
+	return mips_Success;
+}
+
+void mips_snapshot_free(mips_snapshot_h snapshot)
+{
+	if(snapshot)
+	{
+		mips_mem_snapshot_free(snapshot->ram, snapshot->mem);
+	}
+
+	delete snapshot;
+}
+
+void mips_cpu_free(mips_cpu_h state)
+{
+	if(state)
+	{
+		if(state->decoded.enabled)
+		{
+			mips_mem_remove_write_observer(state->ram, mips_cpu_on_write, state);
 		}
 
+		block_cache_free(state->blocks);
+		icache_free(state->decoded);
+		jit_free(state->jit);
+		trace_ring_free(state->trace);
+		profile_free(state->prof);
 	}
 
-	return err;
-}
\ No newline at end of file
+	delete state;
+}
@@ -1,5 +1,6 @@
 #include "mips_cpu_alu.h"
 #include "mips_mem.h"
+#include "mips_cpu_memory.h"
 #include "math.h"
 
 //Sign Extension
@@ -10,7 +11,7 @@ uint32_t sign_extend(uint8_t n)
 
 	if(n & 0x80)
 	{
-		n32 = 0xFFFF0000|n32;
+		n32 = 0xFFFFFF00|n32;
 	}
 
 	return n32;
@@ -72,24 +73,12 @@ bool arithmetic_overflow_32_bit(uint32_t rd, uint16_t n)
 //Endian Conversion
 uint32_t to_big(const uint8_t *pData)
 {
-	return
-		(((uint32_t)pData[0])<<24)
-		|
-		(((uint32_t)pData[1])<<16)
-		|
-		(((uint32_t)pData[2])<<8)
-		|
-		(((uint32_t)pData[3])<<0);
+	return load_be32(pData);
 }
 
 void to_little(const uint32_t rt, uint8_t* pData)
 {
-	uint8_t mem_buffer[4];
-
-	mem_buffer[0] = (uint8_t)(rt>>24);
-	mem_buffer[1] = (uint8_t)(rt>>16);
-	mem_buffer[2] = (uint8_t)(rt>>8);
-	mem_buffer[3] = (uint8_t)(rt>>0);
+	store_be32(pData, rt);
 }
 
 mips_error ADD(uint32_t& rd, uint32_t rs, uint32_t rt)
@@ -352,126 +341,91 @@ mips_error DIVU(mips_cpu_h state, uint32_t rs, uint32_t rt)
 	return err;
 }
 
-mips_error LB(mips_mem_h mem, uint32_t addr, uint32_t& rt)
+mips_error LB(data_port &port, uint32_t addr, uint32_t& rt)
 {
-	mips_error err = mips_Success;
-	
-	uint8_t mem_buffer[4];
+	uint8_t value = 0;
 
-	uint32_t eff_addr = addr*4 - addr%4; // Calculates the effective address
-	
-	err = mips_mem_read(mem, eff_addr, 4, mem_buffer);
+	mips_error err = data_load8(port, addr, value);
 
-	rt = sign_extend(mem_buffer[addr%4]);
+	rt = sign_extend(value);
 
 	return err;
 }
 
-mips_error LBU(mips_mem_h mem, uint32_t addr, uint32_t& rt)
+mips_error LBU(data_port &port, uint32_t addr, uint32_t& rt)
 {
-	mips_error err = mips_Success;
-
-	uint8_t mem_buffer[4];
-
-	uint32_t eff_addr = addr*4 - addr %4;
+	uint8_t value = 0;
 
-	err = mips_mem_read(mem, eff_addr, 4, mem_buffer);
+	mips_error err = data_load8(port, addr, value);
 
-	rt = (uint32_t)mem_buffer[addr%4];
+	rt = value;
 
 	return err;
 }
 
-mips_error LH(mips_mem_h mem, uint32_t addr, uint32_t& rt)
+mips_error LH(data_port &port, uint32_t addr, uint32_t& rt)
 {
-	mips_error err = mips_Success;
-
-	uint8_t mem_buffer[4];
-	
-	uint32_t eff_addr = addr*2;
-
-	if(addr%2)
-	{
-		return mips_ExceptionInvalidAddress;
-	}
+	uint16_t value = 0;
 
-	err = mips_mem_read(mem, eff_addr, 4, mem_buffer);
+	mips_error err = data_load16(port, addr, value);
 
-	rt = sign_extend((uint16_t)to_big(mem_buffer));
+	rt = sign_extend(value);
 
 	return err;
 }
 
-mips_error LHU(mips_mem_h mem, uint32_t addr, uint32_t& rt)
+mips_error LHU(data_port &port, uint32_t addr, uint32_t& rt)
 {
-	mips_error err = mips_Success;
-
-	uint8_t mem_buffer[4];
-	
-	uint32_t eff_addr = addr*2;
-
-	if(addr%2)
-	{
-		return mips_ExceptionInvalidAddress;
-	}
+	uint16_t value = 0;
 
-	err = mips_mem_read(mem, eff_addr, 4, mem_buffer);
+	mips_error err = data_load16(port, addr, value);
 
-	rt = to_big(mem_buffer) & 0x0000FFFF;
+	rt = value;
 
 	return err;
 }
 
-mips_error LW(mips_mem_h mem, uint32_t addr, uint32_t& rt)
+mips_error LW(data_port &port, uint32_t addr, uint32_t& rt)
 {
-	mips_error err = mips_Success;
-
-	uint8_t mem_buffer[4];
-
-	if(addr%4)
-	{
-		return mips_ExceptionInvalidAddress;
-	}
-
-	err = mips_mem_read(mem, addr, 4, mem_buffer);
-
-	rt = to_big(mem_buffer);
-
-	return err;
+	return data_load32(port, addr, rt);
 }
 
-mips_error LWL(mips_mem_h mem, uint32_t addr, uint32_t& rt)
+mips_error LWL(data_port &port, uint32_t addr, uint32_t& rt)
 {
-	mips_error err = mips_Success;
-	
-	uint8_t mem_buffer[4];
+	uint32_t word = 0;
+
+	mips_error err = data_load32(port, addr & ~3u, word);
 
-	if(addr%4)
+	if(err)
 	{
-		return mips_ExceptionInvalidAddress;
+		return err;
 	}
 
-	err = mips_mem_read(mem, addr, 4, mem_buffer);
+	// The addressed byte and those after it in the word go to the top of rt
+	uint32_t shift = 8 * (addr % 4);
+	uint32_t keep = shift ? 0xFFFFFFFFu >> (32 - shift) : 0;
 
-	rt = (rt & 0x0000FFFF) | (to_big(mem_buffer) & 0xFFFF0000);
+	rt = (word << shift) | (rt & keep);
 
-	return err;	
+	return err;
 }
 
-mips_error LWR(mips_mem_h mem, uint32_t addr, uint32_t& rt)
+mips_error LWR(data_port &port, uint32_t addr, uint32_t& rt)
 {
-	mips_error err = mips_Success;
+	uint32_t word = 0;
 
-	uint8_t mem_buffer[4];
+	mips_error err = data_load32(port, addr & ~3u, word);
 
-	if(addr%2)
+	if(err)
 	{
-		return mips_ExceptionInvalidAddress;
+		return err;
 	}
 
-	err = mips_mem_read(mem, addr, 4, mem_buffer);
+	// The addressed byte and those before it in the word go to the bottom of rt
+	uint32_t shift = 24 - 8 * (addr % 4);
+	uint32_t keep = shift ? ~(0xFFFFFFFFu >> shift) : 0;
 
-	rt = (rt & 0xFFFF0000) | (to_big(mem_buffer) & 0x0000FFFF);
+	rt = (word >> shift) | (rt & keep);
 
 	return err;
 }
@@ -557,45 +511,14 @@ mips_error ORI(uint32_t& rt, uint32_t rs, const uint16_t n)
 	return OR(rt, rs, sign_extend(n));
 }
 
-mips_error SB(mips_mem_h mem, uint32_t addr, uint32_t rt)
+mips_error SB(data_port &port, uint32_t addr, uint32_t rt)
 {
-	mips_error err = mips_Success;
-	
-	uint8_t mem_buffer[4];
-
-	uint32_t eff_addr = addr - addr%4; // Calculates the effective address
-	
-	err = mips_mem_read(mem, eff_addr, 4, mem_buffer);
-
-	mem_buffer[addr%4] = (uint8_t)rt;
-
-	err = mips_mem_write(mem, addr, 4, mem_buffer);
-
-	return err;
+	return data_store8(port, addr, (uint8_t)rt);
 }
 
-mips_error SH(mips_mem_h mem, uint32_t addr, uint32_t rt)
+mips_error SH(data_port &port, uint32_t addr, uint32_t rt)
 {
-	mips_error err = mips_Success;
-
-	uint8_t mem_buffer[4];
-	
-	uint32_t eff_addr = addr*2;
-
-	if(addr%2)
-	{
-		return mips_ExceptionInvalidAddress;
-	}
-
-	err = mips_mem_read(mem, addr, 4, mem_buffer);
-
-	mem_buffer[0] = (uint8_t)rt;
-	mem_buffer[1] = (uint8_t)(rt>>8);
-
-	err = mips_mem_write(mem, addr, 4, mem_buffer);
-
-	return err;
-
+	return data_store16(port, addr, (uint16_t)rt);
 }
 
 mips_error SLL(uint32_t& rd, uint32_t rt, const uint32_t n)
@@ -712,22 +635,9 @@ mips_error SUBU(uint32_t& rd, uint32_t rs, uint32_t rt)
 	return ADDU(rd, rs, ~rt + 1);
 }
 
-mips_error SW(mips_mem_h mem, uint32_t addr, uint32_t rt)
+mips_error SW(data_port &port, uint32_t addr, uint32_t rt)
 {
-	mips_error err = mips_Success;
-
-	uint8_t mem_buffer[4];
-
-	to_little(rt, mem_buffer);
-
-	if(addr%4)
-	{
-		return mips_ExceptionInvalidInstruction;
-	}
-
-	err = mips_mem_write(mem, addr, 4, mem_buffer);
-
-	return err;
+	return data_store32(port, addr, rt);
 }
 
 mips_error XOR(uint32_t& rd, uint32_t rs, uint32_t rt)
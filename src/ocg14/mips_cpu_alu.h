@@ -0,0 +1,83 @@
+#ifndef mips_cpu_alu_header
+#define mips_cpu_alu_header
+
+#include "mips_cpu.h"
+#include "mips_cpu_memory.h"
+
+// Internal cpu accessors used by the instruction implementations
+mips_error mips_cpu_get_npc(mips_cpu_h state, uint32_t *npc);
+mips_error mips_cpu_set_npc(mips_cpu_h state, uint32_t npc);
+mips_error mips_cpu_set_accum(mips_cpu_h state, uint32_t hi, uint32_t lo);
+mips_error mips_cpu_set_hi(mips_cpu_h state, uint32_t hi);
+mips_error mips_cpu_set_lo(mips_cpu_h state, uint32_t lo);
+mips_error mips_cpu_get_hi(mips_cpu_h state, uint32_t* hi);
+mips_error mips_cpu_get_lo(mips_cpu_h state, uint32_t* lo);
+
+//Sign Extension
+uint32_t sign_extend(uint8_t n);
+uint32_t sign_extend(uint16_t n);
+uint64_t sign_extend(uint32_t n);
+
+//Test for Overflow
+bool arithmetic_overflow_32_bit(uint32_t rs, uint32_t rt);
+bool arithmetic_overflow_32_bit(uint32_t rd, uint16_t n);
+
+//Endian Conversion
+uint32_t to_big(const uint8_t *pData);
+void to_little(const uint32_t rt, uint8_t* pData);
+
+mips_error ADD(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error ADDI(uint32_t& rt, uint32_t rs, const uint16_t n);
+mips_error ADDU(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error ADDIU(uint32_t& rt, uint32_t rs, const uint16_t n);
+mips_error AND(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error ANDI(uint32_t& rt, uint32_t rs, const uint16_t n);
+mips_error BEQ(mips_cpu_h state, uint32_t rs, uint32_t rt, const uint16_t n);
+mips_error BGEZ(mips_cpu_h state, uint32_t rs, const uint16_t n);
+mips_error BGEZAL(mips_cpu_h state, uint32_t rs, const uint16_t n);
+mips_error BGTZ(mips_cpu_h state, uint32_t rs, const uint16_t n);
+mips_error BLEZ(mips_cpu_h state, uint32_t rs, const uint16_t n);
+mips_error BLTZ(mips_cpu_h state, uint32_t rs, const uint16_t n);
+mips_error BLTZAL(mips_cpu_h state, uint32_t rs, const uint16_t n);
+mips_error BNE(mips_cpu_h state, uint32_t rs, uint32_t rt, const uint16_t n);
+mips_error J(mips_cpu_h state, const uint32_t n);
+mips_error JALR(mips_cpu_h state, uint32_t rs, uint32_t nrd);
+mips_error JAL(mips_cpu_h state, const uint32_t n);
+mips_error JR(mips_cpu_h state, uint32_t rs);
+mips_error DIV(mips_cpu_h state, uint32_t rs, uint32_t rt);
+mips_error DIVU(mips_cpu_h state, uint32_t rs, uint32_t rt);
+mips_error LB(data_port &port, uint32_t addr, uint32_t& rt);
+mips_error LBU(data_port &port, uint32_t addr, uint32_t& rt);
+mips_error LH(data_port &port, uint32_t addr, uint32_t& rt);
+mips_error LHU(data_port &port, uint32_t addr, uint32_t& rt);
+mips_error LW(data_port &port, uint32_t addr, uint32_t& rt);
+mips_error LWL(data_port &port, uint32_t addr, uint32_t& rt);
+mips_error LWR(data_port &port, uint32_t addr, uint32_t& rt);
+mips_error LUI(uint32_t& rt, const uint16_t n);
+mips_error MFHI(mips_cpu_h state, uint32_t& rd);
+mips_error MFLO(mips_cpu_h state, uint32_t& rd);
+mips_error MTHI(mips_cpu_h state, uint32_t& rs);
+mips_error MTLO(mips_cpu_h state, uint32_t& rs);
+mips_error MULT(mips_cpu_h state, uint32_t rs, uint32_t rt);
+mips_error MULTU(mips_cpu_h state, uint32_t rs, uint32_t rt);
+mips_error OR(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error ORI(uint32_t& rt, uint32_t rs, const uint16_t n);
+mips_error SB(data_port &port, uint32_t addr, uint32_t rt);
+mips_error SH(data_port &port, uint32_t addr, uint32_t rt);
+mips_error SLL(uint32_t& rd, uint32_t rt, const uint32_t n);
+mips_error SLLV(uint32_t& rd, uint32_t rt, uint32_t rs);
+mips_error SLT(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error SLTI(uint32_t& rt, uint32_t rs, const uint16_t n);
+mips_error SLTIU(uint32_t& rt, uint32_t rs, const uint16_t n);
+mips_error SLTU(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error SRA(uint32_t& rd, uint32_t rt, const uint32_t n);
+mips_error SRAV(uint32_t& rd, uint32_t rt, uint32_t rs);
+mips_error SRL(uint32_t& rd, uint32_t rt, const uint32_t n);
+mips_error SRLV(uint32_t& rd, uint32_t rt, uint32_t rs);
+mips_error SUB(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error SUBU(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error SW(data_port &port, uint32_t addr, uint32_t rt);
+mips_error XOR(uint32_t& rd, uint32_t rs, uint32_t rt);
+mips_error XORI(uint32_t& rt, uint32_t rs, const uint16_t n);
+
+#endif
@@ -0,0 +1,185 @@
+#include "mips_cpu_block.h"
+#include "mips_cpu_impl.h"
+
+void block_cache_init(block_cache &cache)
+{
+	cache.epoch = 0;
+}
+
+void block_cache_collect(block_cache &cache)
+{
+	for(unsigned i = 0; i < cache.retired.size(); i++)
+	{
+		delete cache.retired[i];
+	}
+
+	cache.retired.clear();
+}
+
+void block_cache_free(block_cache &cache)
+{
+	std::unordered_map<uint32_t, translated_block*>::iterator it;
+
+	for(it = cache.blocks.begin(); it != cache.blocks.end(); ++it)
+	{
+		delete it->second;
+	}
+
+	cache.blocks.clear();
+	cache.pages.clear();
+
+	block_cache_collect(cache);
+}
+
+static void block_retire(block_cache &cache, translated_block *block)
+{
+	block->valid = false;
+	cache.blocks.erase(block->start);
+	cache.retired.push_back(block);
+}
+
+void block_cache_invalidate(block_cache &cache, uint32_t address, uint32_t length)
+{
+	if(!length || cache.pages.empty())
+	{
+		return;
+	}
+
+	// Compared in 64 bits, as a range ending at the top of the address
+	// space would otherwise end at zero
+	uint64_t end = (uint64_t)address + length;
+	uint32_t first = address >> ICACHE_PAGE_BITS;
+	uint32_t last = (uint32_t)((end - 1) >> ICACHE_PAGE_BITS);
+
+	for(uint32_t tag = first; tag <= last; tag++)
+	{
+		std::unordered_map<uint32_t, std::vector<translated_block*> >::iterator it = cache.pages.find(tag);
+
+		if(it == cache.pages.end())
+		{
+			continue;
+		}
+
+		std::vector<translated_block*> &list = it->second;
+
+		for(unsigned i = 0; i < list.size(); )
+		{
+			translated_block *block = list[i];
+
+			if(block->start < end && address < (uint64_t)block->start + block->length)
+			{
+				block_retire(cache, block);
+
+				list[i] = list.back();
+				list.pop_back();
+
+				cache.epoch++;
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+}
+
+// Recognises pairs of instructions which run_blocks can execute together.
+// Only the idioms compilers actually produce are matched, so the second
+// instruction must use the register the first one wrote.
+static uint8_t block_fusion(const decoded_instr &a, const decoded_instr &b)
+{
+	if(a.op == op_SLTIU && a.rt != 0 && (b.op == op_BEQ || b.op == op_BNE)
+		&& ((b.rs == a.rt && b.rt == 0) || (b.rs == 0 && b.rt == a.rt)))
+	{
+		return mips_FusionSltiuBranch + 1;
+	}
+
+	if(a.op == op_ADDIU && a.rt == a.rs && b.op == op_SW && b.rs == a.rt)
+	{
+		return mips_FusionAddiuStore + 1;
+	}
+
+	return 0;
+}
+
+static mips_error block_translate(mips_cpu_h state, uint32_t pc, translated_block *&block)
+{
+	mips_error err = mips_Success;
+
+	const decoded_instr *instr = 0;
+
+	// A block that cannot even start is not a block, so report the fetch error
+	err = icache_fetch(state, pc, instr);
+
+	if(err)
+	{
+		return err;
+	}
+
+	block = new translated_block;
+	block->start = pc;
+	block->valid = true;
+	block->indirect = false;
+	block->heat = 0;
+	block->native = 0;
+	block->nativeCount = 0;
+
+	for(unsigned i = 0; i < 2; i++)
+	{
+		block->links[i].pc = 0;
+		block->links[i].epoch = 0;
+		block->links[i].target = 0;
+	}
+
+	uint32_t addr = pc;
+
+	while(true)
+	{
+		block->instrs.push_back(*instr);
+		addr += 4;
+
+		if(instr->flags & decode_Branch)
+		{
+			block->indirect = (instr->flags & decode_Indirect) != 0;
+			break;
+		}
+
+		// Stop at a page boundary so each block belongs to one page, and
+		// leave anything that does not fetch cleanly to be reported when
+		// the cpu actually gets there
+		if(instr->op == op_invalid
+			|| block->instrs.size() >= BLOCK_MAX_INSTRS
+			|| (addr & ((1u << ICACHE_PAGE_BITS) - 1)) == 0
+			|| icache_fetch(state, addr, instr))
+		{
+			break;
+		}
+	}
+
+	block->length = addr - pc;
+
+	// Fusion is decided per block rather than in the icache, as a block
+	// is always thrown away as a whole when any part of it is written
+	for(unsigned i = 0; i + 1 < block->instrs.size(); i++)
+	{
+		block->instrs[i].fusion = block_fusion(block->instrs[i], block->instrs[i + 1]);
+	}
+
+	state->blocks.blocks[pc] = block;
+	state->blocks.pages[pc >> ICACHE_PAGE_BITS].push_back(block);
+
+	return mips_Success;
+}
+
+mips_error block_lookup(mips_cpu_h state, uint32_t pc, translated_block *&block)
+{
+	std::unordered_map<uint32_t, translated_block*>::iterator it = state->blocks.blocks.find(pc);
+
+	if(it != state->blocks.blocks.end())
+	{
+		block = it->second;
+		return mips_Success;
+	}
+
+	return block_translate(state, pc, block);
+}
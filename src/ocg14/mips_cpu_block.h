@@ -0,0 +1,63 @@
+#ifndef mips_cpu_block_header
+#define mips_cpu_block_header
+
+#include "mips_cpu_decoder.h"
+#include "mips_cpu_jit.h"
+#include <unordered_map>
+#include <vector>
+
+// Longest run of instructions translated as one block
+const uint32_t BLOCK_MAX_INSTRS = 64;
+
+struct translated_block;
+
+// A remembered exit from one block straight into another. Links are only
+// followed if nothing has been invalidated since they were made.
+struct block_link
+{
+	uint32_t pc;
+	uint32_t epoch;
+	translated_block *target;
+};
+
+struct translated_block
+{
+	uint32_t start;
+	uint32_t length;	// In bytes, as start + length wraps for the last page
+	bool valid;
+	bool indirect;		// Ends with JR or JALR, so is never chained
+
+	block_link links[2];	// [0] falls through, [1] is the branch target
+
+	std::vector<decoded_instr> instrs;
+
+	uint32_t heat;			// Times entered, used to decide when to compile
+	jit_fn native;			// Compiled code for the first nativeCount instructions
+	uint32_t nativeCount;
+};
+
+struct block_cache
+{
+	// Bumped whenever a block is thrown away, which breaks all links
+	uint32_t epoch;
+
+	std::unordered_map<uint32_t, translated_block*> blocks;
+
+	// Every block that overlaps a page, so writes can find them quickly
+	std::unordered_map<uint32_t, std::vector<translated_block*> > pages;
+
+	// Blocks which have been invalidated, but may still be executing
+	std::vector<translated_block*> retired;
+};
+
+void block_cache_init(block_cache &cache);
+void block_cache_free(block_cache &cache);
+void block_cache_invalidate(block_cache &cache, uint32_t address, uint32_t length);
+
+// Releases retired blocks, only safe when no block is running
+void block_cache_collect(block_cache &cache);
+
+// Finds the block starting at pc, translating it if needed
+mips_error block_lookup(mips_cpu_h state, uint32_t pc, translated_block *&block);
+
+#endif
@@ -1,4 +1,6 @@
 #include "mips_cpu_decoder.h"
+#include "mips_cpu_exec.h"
+#include "mips_cpu_alu.h"
 
 uint32_t decode_opcode(uint32_t instr)
 {
@@ -43,4 +45,130 @@ uint32_t decode_data(uint32_t instr)
 uint32_t decode_addr(uint32_t instr)
 {
 	return (instr>>0) & 0x03FFFFFF;
-}
\ No newline at end of file
+}
+
+const instr_handler instr_handlers[op_count] =
+{
+	execute_invalid,
+#define MIPS_CPU_OP_TABLE(name) execute_##name,
+	MIPS_CPU_OPS(MIPS_CPU_OP_TABLE)
+#undef MIPS_CPU_OP_TABLE
+};
+
+#define OP(name) op_##name
+#define NONE op_invalid
+
+// Indexed by the opcode field. SPECIAL (0) and REGIMM (1) have their own tables.
+static const uint8_t sg_opcodeTable[64] =
+{
+	NONE,     NONE,     OP(J),    OP(JAL),  OP(BEQ),  OP(BNE),  OP(BLEZ), OP(BGTZ),	// 0x00
+	OP(ADDI), OP(ADDIU),OP(SLTI), OP(SLTIU),OP(ANDI), OP(ORI),  OP(XORI), NONE,		// 0x08
+	NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,		// 0x10
+	NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,		// 0x18
+	OP(LB),   OP(LH),   OP(LWL),  OP(LW),   OP(LBU),  OP(LHU),  OP(LWR),  NONE,		// 0x20
+	OP(SB),   OP(SH),   NONE,     OP(SW),   NONE,     NONE,     NONE,     NONE,		// 0x28
+	NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,		// 0x30
+	NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE		// 0x38
+};
+
+// Indexed by the func field of SPECIAL (opcode 0) instructions
+static const uint8_t sg_functTable[64] =
+{
+	OP(SLL),  NONE,     OP(SRL),  OP(SRA),  OP(SLLV), NONE,     OP(SRLV), OP(SRAV),	// 0x00
+	OP(JR),   OP(JALR), NONE,     NONE,     NONE,     NONE,     NONE,     NONE,		// 0x08
+	OP(MFHI), OP(MTHI), OP(MFLO), OP(MTLO), NONE,     NONE,     NONE,     NONE,		// 0x10
+	OP(MULT), OP(MULTU),OP(DIV),  OP(DIVU), NONE,     NONE,     NONE,     NONE,		// 0x18
+	OP(ADD),  OP(ADDU), OP(SUB),  OP(SUBU), OP(AND),  OP(OR),   OP(XOR),  NONE,		// 0x20
+	NONE,     NONE,     OP(SLT),  OP(SLTU), NONE,     NONE,     NONE,     NONE,		// 0x28
+	NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,		// 0x30
+	NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE		// 0x38
+};
+
+// Flags for SPECIAL instructions, indexed like sg_functTable
+static const uint8_t sg_functFlags[64] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0,	// 0x00
+	0, 0, 0, 0, 0, 0, 0, 0,	// 0x08
+	0, 0, 0, 0, 0, 0, 0, 0,	// 0x10
+	0, 0, 0, 0, 0, 0, 0, 0,	// 0x18
+	decode_ShiftMustBeZero, decode_ShiftMustBeZero, 0, 0, decode_ShiftMustBeZero, 0, 0, 0,	// 0x20
+	0, 0, 0, 0, 0, 0, 0, 0,	// 0x28
+	0, 0, 0, 0, 0, 0, 0, 0,	// 0x30
+	0, 0, 0, 0, 0, 0, 0, 0	// 0x38
+};
+
+// Indexed by the rt field of REGIMM (opcode 1) instructions
+static const uint8_t sg_regimmTable[32] =
+{
+	OP(BLTZ), OP(BGEZ), NONE,     NONE,     NONE,     NONE,     NONE,     NONE,		// 0x00
+	NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,		// 0x08
+	OP(BLTZAL),OP(BGEZAL),NONE,   NONE,     NONE,     NONE,     NONE,     NONE,		// 0x10
+	NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE,     NONE		// 0x18
+};
+
+#undef OP
+#undef NONE
+
+static uint8_t decode_op_flags(uint8_t op)
+{
+	switch(op)
+	{
+		case op_BEQ:
+		case op_BGEZ:
+		case op_BGEZAL:
+		case op_BGTZ:
+		case op_BLEZ:
+		case op_BLTZ:
+		case op_BLTZAL:
+		case op_BNE:
+			return decode_Branch | decode_Conditional;
+		case op_J:
+		case op_JAL:
+			return decode_Branch;
+		case op_JR:
+		case op_JALR:
+			return decode_Branch | decode_Indirect;
+		default:
+			return 0;
+	}
+}
+
+void decode_instr(uint32_t instr, decoded_instr &d)
+{
+	uint32_t opcode = decode_opcode(instr);
+
+	d.instr = instr;
+	d.rs = (uint8_t)decode_rs(instr);
+	d.rt = (uint8_t)decode_rt(instr);
+	d.rd = (uint8_t)decode_rd(instr);
+	d.shift = (uint8_t)decode_shift(instr);
+	d.imm = decode_data(instr);
+	d.simm = sign_extend((uint16_t)d.imm);
+	d.flags = 0;
+	d.fusion = 0;
+
+	if(opcode==0)
+	{
+		// r type
+		d.op = sg_functTable[decode_func(instr)];
+		d.flags = sg_functFlags[decode_func(instr)];
+	}
+	else if(opcode==1)
+	{
+		// j type
+		d.op = sg_regimmTable[decode_branch_func(instr)];
+	}
+	else
+	{
+		// i type
+		if(opcode==0x02 || opcode==0x03)
+		{
+			d.imm = decode_addr(instr);
+		}
+
+		d.op = sg_opcodeTable[opcode];
+	}
+
+	d.flags |= decode_op_flags(d.op);
+	d.handler = instr_handlers[d.op];
+}
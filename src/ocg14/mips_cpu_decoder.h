@@ -1,7 +1,7 @@
 #ifndef mips_cpu_decoder_header
 #define mips_cpu_decoder_header
 
-#include "mips_core.h"
+#include "mips_cpu.h"
 
 uint32_t decode_opcode(uint32_t instr);
 uint32_t decode_rs(uint32_t instr);
@@ -13,4 +13,58 @@ uint32_t decode_branch_func(uint32_t instr);
 uint32_t decode_data(uint32_t instr);
 uint32_t decode_addr(uint32_t instr);
 
-#endif
\ No newline at end of file
+// Every instruction the decoder knows about, in the same order as the
+// instruction list used by the test framework
+#define MIPS_CPU_OPS(X) \
+	X(ADD) X(ADDI) X(ADDIU) X(ADDU) X(AND) X(ANDI) \
+	X(BEQ) X(BGEZ) X(BGEZAL) X(BGTZ) X(BLEZ) X(BLTZ) X(BLTZAL) X(BNE) \
+	X(DIV) X(DIVU) X(J) X(JAL) X(JALR) X(JR) \
+	X(LB) X(LBU) X(LH) X(LHU) X(LW) X(LWL) X(LWR) \
+	X(MFHI) X(MFLO) X(MTHI) X(MTLO) X(MULT) X(MULTU) \
+	X(OR) X(ORI) X(SB) X(SH) X(SLL) X(SLLV) X(SLT) X(SLTI) X(SLTIU) X(SLTU) \
+	X(SRA) X(SRAV) X(SRL) X(SRLV) X(SUB) X(SUBU) X(SW) X(XOR) X(XORI)
+
+enum instr_op
+{
+	op_invalid,
+#define MIPS_CPU_OP_ENUM(name) op_##name,
+	MIPS_CPU_OPS(MIPS_CPU_OP_ENUM)
+#undef MIPS_CPU_OP_ENUM
+	op_count
+};
+
+struct decoded_instr;
+
+typedef mips_error (*instr_handler)(mips_cpu_h state, const decoded_instr &d);
+
+// Checks which are done on the encoding before the handler runs
+enum decode_flags
+{
+	decode_ShiftMustBeZero = 0x01,
+	decode_Branch = 0x02,	// May change npc, so ends a basic block
+	decode_Indirect = 0x04,	// Target comes from a register
+	decode_Conditional = 0x08	// A branch which may fall through
+};
+
+// An instruction word with every field already pulled out, so that
+// executing it again does not need to go back through the decode_* helpers
+struct decoded_instr
+{
+	instr_handler handler;
+	uint32_t instr;
+	uint32_t imm;	// Zero-extended immediate, or the jump target for J-type
+	uint32_t simm;	// Sign-extended immediate
+	uint8_t op;		// Index into instr_handlers
+	uint8_t rs;
+	uint8_t rt;
+	uint8_t rd;
+	uint8_t shift;
+	uint8_t flags;
+	uint8_t fusion;	// One more than the mips_cpu_fusion this starts, or zero
+};
+
+extern const instr_handler instr_handlers[op_count];
+
+void decode_instr(uint32_t instr, decoded_instr &d);
+
+#endif
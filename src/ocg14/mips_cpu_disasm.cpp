@@ -0,0 +1,77 @@
+#include "mips_cpu_disasm.h"
+#include <stdio.h>
+
+static const char *const sg_opNames[op_count] =
+{
+	"<INVALID>",
+#define MIPS_CPU_OP_NAME(name) #name,
+	MIPS_CPU_OPS(MIPS_CPU_OP_NAME)
+#undef MIPS_CPU_OP_NAME
+};
+
+const char *disasm_name(uint8_t op)
+{
+	if(op >= op_count)
+	{
+		return sg_opNames[op_invalid];
+	}
+
+	return sg_opNames[op];
+}
+
+void disasm_instr(const decoded_instr &d, char *text, unsigned size)
+{
+	const char *name = disasm_name(d.op);
+
+	unsigned rs = d.rs;
+	unsigned rt = d.rt;
+	unsigned rd = d.rd;
+	unsigned shift = d.shift;
+
+	switch(d.op)
+	{
+		case op_ADD: case op_ADDU: case op_AND: case op_OR: case op_SLT:
+		case op_SLTU: case op_SUB: case op_SUBU: case op_XOR:
+			snprintf(text, size, "%s $%u, $%u, $%u", name, rd, rs, rt);
+			break;
+		case op_DIV: case op_DIVU: case op_MULT: case op_MULTU:
+			snprintf(text, size, "%s $%u, $%u", name, rs, rt);
+			break;
+		case op_JALR:
+			snprintf(text, size, "%s $%u, $%u", name, rd, rs);
+			break;
+		case op_JR: case op_MTHI: case op_MTLO:
+			snprintf(text, size, "%s $%u", name, rs);
+			break;
+		case op_MFHI: case op_MFLO:
+			snprintf(text, size, "%s $%u", name, rd);
+			break;
+		case op_SLL: case op_SRA: case op_SRL:
+			snprintf(text, size, "%s $%u, $%u, %u", name, rd, rt, shift);
+			break;
+		case op_SLLV: case op_SRAV: case op_SRLV:
+			snprintf(text, size, "%s $%u, $%u, $%u", name, rd, rt, rs);
+			break;
+		case op_BGEZ: case op_BGEZAL: case op_BLTZ: case op_BLTZAL:
+		case op_BGTZ: case op_BLEZ:
+			snprintf(text, size, "%s $%u, %u", name, rs, d.imm);
+			break;
+		case op_BEQ: case op_BNE:
+			snprintf(text, size, "%s $%u, $%u, %u", name, rs, rt, d.imm);
+			break;
+		case op_ADDI: case op_ADDIU: case op_ANDI: case op_ORI:
+		case op_SLTI: case op_SLTIU: case op_XORI:
+			snprintf(text, size, "%s $%u, $%u, %u", name, rt, rs, d.imm);
+			break;
+		case op_J: case op_JAL:
+			snprintf(text, size, "%s %u", name, d.imm);
+			break;
+		case op_LB: case op_LBU: case op_LH: case op_LHU: case op_LW:
+		case op_LWL: case op_LWR: case op_SB: case op_SH: case op_SW:
+			snprintf(text, size, "%s $%u, %u($%u)", name, rt, d.imm, rs);
+			break;
+		default:
+			snprintf(text, size, "%s 0x%08x", name, d.instr);
+			break;
+	}
+}
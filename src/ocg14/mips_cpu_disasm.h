@@ -0,0 +1,13 @@
+#ifndef mips_cpu_disasm_header
+#define mips_cpu_disasm_header
+
+#include "mips_cpu_decoder.h"
+
+// Writes the assembly for a decoded instruction into text, such as
+// "ADDU $3, $1, $2", truncating it if it does not fit in size bytes
+void disasm_instr(const decoded_instr &d, char *text, unsigned size);
+
+// Name of an instruction, or "<INVALID>" if it was not recognised
+const char *disasm_name(uint8_t op);
+
+#endif
@@ -0,0 +1,707 @@
+#include "mips_cpu_impl.h"
+#include "mips_cpu_exec.h"
+#include "mips_cpu_disasm.h"
+
+// Each engine is instantiated once per trace level, and the level is
+// chosen when a run starts. Level 0 uses the empty specialisation, so its
+// kernels contain no formatting code at all. Level 1 prints every
+// instruction before it executes, and level 2 and above also report
+// the error when one fails. TRACE_BINARY queues records for the writer
+// thread instead of printing anything, TRACE_PROFILE only counts how
+// often each pc runs, and TRACE_MODELS feeds the pipeline timing and
+// branch predictor models. TRACE_PROFILE_MODELS does both of the last
+// two, for when profiling and a model are on together.
+//
+// None of these is ever asked for by a debug level: levels above 2 are
+// treated as 2, and the internal kinds are numbered above anything a
+// level can become.
+const unsigned TRACE_MAX_LEVEL = 2;
+const unsigned TRACE_BINARY = 0x100;
+const unsigned TRACE_PROFILE = 0x101;
+const unsigned TRACE_MODELS = 0x102;
+const unsigned TRACE_PROFILE_MODELS = 0x103;
+
+template<unsigned Level>
+struct tracer
+{
+	static void instr(mips_cpu_h state, uint32_t pc, const decoded_instr &d)
+	{
+		char text[64];
+
+		disasm_instr(d, text, sizeof(text));
+		fprintf(state->logDst, "%08x: %s\n", pc, text);
+	}
+
+	static void retired(mips_cpu_h)
+	{
+	}
+
+	static mips_error fail(mips_cpu_h state, mips_error err)
+	{
+		if(Level > 1)
+		{
+			fprintf(state->logDst, "%08x: error 0x%x\n", state->pc, err);
+		}
+
+		return err;
+	}
+};
+
+template<>
+struct tracer<0>
+{
+	static void instr(mips_cpu_h, uint32_t, const decoded_instr &)
+	{
+	}
+
+	static void retired(mips_cpu_h)
+	{
+	}
+
+	static mips_error fail(mips_cpu_h, mips_error err)
+	{
+		return err;
+	}
+};
+
+template<>
+struct tracer<TRACE_BINARY>
+{
+	// Anything which depends on registers the instruction may overwrite
+	// is captured before it runs
+	static void instr(mips_cpu_h state, uint32_t pc, const decoded_instr &d)
+	{
+		mips_trace_record &rec = state->traceRecord;
+
+		rec.pc = pc;
+		rec.instr = d.instr;
+		rec.value = 0;
+		rec.address = 0;
+		rec.error = mips_Success;
+		rec.dest = trace_dest(d);
+		rec.flags = trace_mem_flags(d);
+
+		if(rec.flags)
+		{
+			rec.address = state->regs[d.rs] + d.simm;
+			rec.value = state->regs[d.rt];
+		}
+
+		state->tracePending = true;
+	}
+
+	static void retired(mips_cpu_h state)
+	{
+		mips_trace_record &rec = state->traceRecord;
+
+		if(rec.dest < 32)
+		{
+			rec.value = state->regs[rec.dest];
+		}
+		else if(rec.dest == mips_TraceDestHi)
+		{
+			rec.value = state->hi;
+		}
+		else if(rec.dest == mips_TraceDestLo)
+		{
+			rec.value = state->lo;
+		}
+		else if(rec.dest == mips_TraceDestHiLo)
+		{
+			rec.value = state->lo;
+			rec.address = state->hi;
+		}
+
+		trace_ring_push(state->trace, rec);
+		state->tracePending = false;
+	}
+
+	static mips_error fail(mips_cpu_h state, mips_error err)
+	{
+		mips_trace_record &rec = state->traceRecord;
+
+		// Nothing is pending if the instruction could not be fetched
+		if(!state->tracePending)
+		{
+			rec.pc = state->pc;
+			rec.instr = 0;
+			rec.value = 0;
+			rec.address = 0;
+			rec.dest = MIPS_TRACE_NO_DEST;
+			rec.flags = 0;
+		}
+
+		rec.error = err;
+
+		trace_ring_push(state->trace, rec);
+		state->tracePending = false;
+
+		return err;
+	}
+};
+
+template<>
+struct tracer<TRACE_PROFILE>
+{
+	static void instr(mips_cpu_h state, uint32_t pc, const decoded_instr &)
+	{
+		profile_count(state->prof, pc);
+	}
+
+	static void retired(mips_cpu_h)
+	{
+	}
+
+	// Only faults caused by a memory access (or fetch) are counted, the
+	// pc still being that of the instruction which raised them
+	static mips_error fail(mips_cpu_h state, mips_error err)
+	{
+		if(err == mips_ExceptionInvalidAddress
+			|| err == mips_ExceptionInvalidAlignment
+			|| err == mips_ExceptionAccessViolation)
+		{
+			profile_fault(state->prof, state->pc);
+		}
+
+		return err;
+	}
+};
+
+template<>
+struct tracer<TRACE_MODELS>
+{
+	static void instr(mips_cpu_h state, uint32_t pc, const decoded_instr &d)
+	{
+		state->modelled = d;
+		state->modelledPc = pc;
+	}
+
+	// Without a predictor, fetch is assumed to carry straight on, so
+	// only taken branches redirect it
+	static void retired(mips_cpu_h state)
+	{
+		const decoded_instr &d = state->modelled;
+		bool redirected = state->pc != state->modelledPc + 4;
+
+		if(state->predictor.enabled && (d.flags & decode_Branch))
+		{
+			redirected = predictor_retire(state->predictor, d, state->modelledPc, state->pc);
+		}
+
+		if(state->timing.enabled)
+		{
+			timing_retire(state->timing, d, redirected);
+		}
+	}
+
+	static mips_error fail(mips_cpu_h, mips_error err)
+	{
+		return err;
+	}
+};
+
+template<>
+struct tracer<TRACE_PROFILE_MODELS>
+{
+	static void instr(mips_cpu_h state, uint32_t pc, const decoded_instr &d)
+	{
+		tracer<TRACE_PROFILE>::instr(state, pc, d);
+		tracer<TRACE_MODELS>::instr(state, pc, d);
+	}
+
+	static void retired(mips_cpu_h state)
+	{
+		tracer<TRACE_MODELS>::retired(state);
+	}
+
+	static mips_error fail(mips_cpu_h state, mips_error err)
+	{
+		return tracer<TRACE_PROFILE>::fail(state, err);
+	}
+};
+
+// Checks that apply to the encoding rather than to any one instruction
+static inline mips_error check_encoding(const decoded_instr &instr)
+{
+	if((instr.flags & decode_ShiftMustBeZero) && instr.shift != 0x0)
+	{
+		return mips_ExceptionInvalidInstruction;
+	}
+
+	return mips_Success;
+}
+
+// Commits an instruction once its handler has run. On error the pc is
+// left pointing at the instruction which failed. Statistics are counted
+// here so that every engine agrees on them.
+static inline mips_error retire(mips_cpu_h state, const decoded_instr &instr, mips_error err)
+{
+	state->regs[0] = 0;
+
+	if(err)
+	{
+		return err;
+	}
+
+	state->stats.ops[instr.op]++;
+
+	if(instr.flags & decode_Conditional)
+	{
+		state->stats.branchesTaken += state->npc != state->pc + 4;
+	}
+
+	state->pc = state->npc;
+	state->npc = state->pc + 4;
+
+	return mips_Success;
+}
+
+template<unsigned Level>
+static mips_error run_interpreter(mips_cpu_h state, uint32_t maxSteps, const engine_stops &stops, uint32_t &executed)
+{
+	mips_error err = mips_Success;
+
+	const decoded_instr *instr = 0;
+
+	while(executed < maxSteps)
+	{
+		// fetch
+		err = icache_fetch(state, state->pc, instr);
+
+		if(err)
+		{
+			return tracer<Level>::fail(state, err);
+		}
+
+		tracer<Level>::instr(state, state->pc, *instr);
+
+		// execute
+		err = check_encoding(*instr);
+
+		if(!err)
+		{
+			err = instr->handler(state, *instr);
+		}
+
+		err = retire(state, *instr, err);
+
+		if(err)
+		{
+			return tracer<Level>::fail(state, err);
+		}
+
+		tracer<Level>::retired(state);
+
+		executed++;
+
+		if(engine_should_stop(stops, state->pc))
+		{
+			return mips_Success;
+		}
+	}
+
+	return mips_Success;
+}
+
+#if defined(__GNUC__)
+
+// Threaded code using the GCC "labels as values" extension. Each handler
+// ends with its own copy of the fetch and indirect jump, rather than all
+// of them returning to a single dispatch point.
+template<unsigned Level>
+static mips_error run_threaded(mips_cpu_h state, uint32_t maxSteps, const engine_stops &stops, uint32_t &executed)
+{
+	static void *const labels[op_count] =
+	{
+		&&do_invalid,
+#define MIPS_CPU_OP_LABEL(name) &&do_##name,
+		MIPS_CPU_OPS(MIPS_CPU_OP_LABEL)
+#undef MIPS_CPU_OP_LABEL
+	};
+
+	mips_error err = mips_Success;
+
+	const decoded_instr *instr = 0;
+
+	if(executed >= maxSteps)
+	{
+		return mips_Success;
+	}
+
+#define DISPATCH() \
+	err = icache_fetch(state, state->pc, instr); \
+	if(err) return tracer<Level>::fail(state, err); \
+	tracer<Level>::instr(state, state->pc, *instr); \
+	err = check_encoding(*instr); \
+	if(err) return tracer<Level>::fail(state, err); \
+	goto *labels[instr->op]
+
+#define NEXT() \
+	err = retire(state, *instr, err); \
+	if(err) return tracer<Level>::fail(state, err); \
+	tracer<Level>::retired(state); \
+	if(++executed >= maxSteps) return mips_Success; \
+	if(engine_should_stop(stops, state->pc)) return mips_Success; \
+	DISPATCH()
+
+	DISPATCH();
+
+do_invalid:
+	err = execute_invalid(state, *instr);
+	NEXT();
+
+#define MIPS_CPU_OP_BODY(name) \
+do_##name: \
+	err = execute_##name(state, *instr); \
+	NEXT();
+
+	MIPS_CPU_OPS(MIPS_CPU_OP_BODY)
+
+#undef MIPS_CPU_OP_BODY
+#undef NEXT
+#undef DISPATCH
+}
+
+#else
+
+template<unsigned Level>
+static mips_error run_threaded(mips_cpu_h state, uint32_t maxSteps, const engine_stops &stops, uint32_t &executed)
+{
+	return run_interpreter<Level>(state, maxSteps, stops, executed);
+}
+
+#endif
+
+// Compiled code cannot stop part way through, so is not used if any
+// instruction in it would leave the pc at a stop address
+static bool native_passes_stop(const translated_block *block, const engine_stops &stops)
+{
+	for(unsigned i = 0; i < stops.count; i++)
+	{
+		uint32_t offset = stops.pcs[i] - block->start;
+
+		if(offset && offset <= 4 * block->nativeCount && !(offset & 0x3))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Superinstructions for the pairs marked by block_translate. Each runs
+// both instructions back to back with the same commit as run_blocks, and
+// sets done to the number which completed; on error the pc is left on the
+// instruction which failed.
+static mips_error fused_SltiuBranch(mips_cpu_h state, const decoded_instr &a, const decoded_instr &b, uint32_t &done)
+{
+	mips_error err = retire(state, a, execute_SLTIU(state, a));
+
+	if(err)
+	{
+		return err;
+	}
+
+	done = 1;
+
+	err = retire(state, b, b.op == op_BEQ ? execute_BEQ(state, b) : execute_BNE(state, b));
+
+	if(err)
+	{
+		return err;
+	}
+
+	done = 2;
+
+	return mips_Success;
+}
+
+static mips_error fused_AddiuStore(mips_cpu_h state, const decoded_instr &a, const decoded_instr &b, uint32_t &done)
+{
+	mips_error err = retire(state, a, execute_ADDIU(state, a));
+
+	if(err)
+	{
+		return err;
+	}
+
+	done = 1;
+
+	err = retire(state, b, execute_SW(state, b));
+
+	if(err)
+	{
+		return err;
+	}
+
+	done = 2;
+
+	return mips_Success;
+}
+
+typedef mips_error (*fused_handler)(mips_cpu_h state, const decoded_instr &a, const decoded_instr &b, uint32_t &done);
+
+// Indexed by mips_cpu_fusion
+static const fused_handler fused_handlers[mips_FusionCount] =
+{
+	fused_SltiuBranch,
+	fused_AddiuStore
+};
+
+// Runs whole translated blocks, following links between them so that the
+// block cache is only consulted when a link has not been made yet, or the
+// block ended with an indirect jump. With jit set, blocks which keep being
+// entered are compiled to native code, unless tracing is on as compiled
+// code cannot report each instruction.
+template<unsigned Level>
+static mips_error run_blocks(mips_cpu_h state, uint32_t maxSteps, const engine_stops &stops, uint32_t &executed, bool jit)
+{
+	mips_error err = mips_Success;
+
+	block_cache &cache = state->blocks;
+	translated_block *block = 0;
+
+	if(!state->decoded.enabled)
+	{
+		// Blocks cannot be kept safely if writes are not reported
+		return run_interpreter<Level>(state, maxSteps, stops, executed);
+	}
+
+	block_cache_collect(cache);
+
+	while(executed < maxSteps)
+	{
+		if(!block)
+		{
+			err = block_lookup(state, state->pc, block);
+
+			if(err)
+			{
+				return tracer<Level>::fail(state, err);
+			}
+		}
+
+		uint32_t count = block->instrs.size();
+		uint32_t first = 0;
+
+		if(jit && Level == 0)
+		{
+			if(!block->native && block->heat < JIT_THRESHOLD && ++block->heat == JIT_THRESHOLD)
+			{
+				jit_compile(state, block);
+			}
+
+			// Compiled code runs to completion, so only enter it if the
+			// whole of it fits in what is left of this run
+			if(block->native && maxSteps - executed >= block->nativeCount
+				&& !native_passes_stop(block, stops))
+			{
+				first = block->native(state, state->regs);
+				executed += first;
+
+				for(uint32_t i = 0; i < first; i++)
+				{
+					state->stats.ops[block->instrs[i].op]++;
+				}
+
+				state->pc = block->start + 4 * first;
+				state->npc = state->pc + 4;
+
+				if(!block->valid || executed >= maxSteps)
+				{
+					block = 0;
+					continue;
+				}
+			}
+		}
+
+		for(uint32_t i = first; i < count; i++)
+		{
+			const decoded_instr &instr = block->instrs[i];
+
+			// Pairs are only fused when nothing would need to stop between
+			// them, and never while tracing as that reports each one
+			if(Level == 0 && instr.fusion && maxSteps - executed >= 2
+				&& !engine_should_stop(stops, state->pc + 4))
+			{
+				uint32_t done = 0;
+
+				err = fused_handlers[instr.fusion - 1](state, instr, block->instrs[i + 1], done);
+				executed += done;
+
+				if(err)
+				{
+					return err;
+				}
+
+				state->fusionHits[instr.fusion - 1]++;
+				i++;
+			}
+			else
+			{
+				tracer<Level>::instr(state, state->pc, instr);
+
+				err = check_encoding(instr);
+
+				if(!err)
+				{
+					err = instr.handler(state, instr);
+				}
+
+				err = retire(state, instr, err);
+
+				if(err)
+				{
+					return tracer<Level>::fail(state, err);
+				}
+
+				tracer<Level>::retired(state);
+
+				executed++;
+			}
+
+			if(engine_should_stop(stops, state->pc))
+			{
+				return mips_Success;
+			}
+
+			// Leave if the block was rewritten, control went elsewhere,
+			// or we have done enough
+			if(!block->valid
+				|| state->pc != block->start + 4 * (i + 1)
+				|| executed >= maxSteps)
+			{
+				break;
+			}
+		}
+
+		if(!block->valid || executed >= maxSteps)
+		{
+			block = 0;
+			continue;
+		}
+
+		translated_block *next = 0;
+		uint32_t pc = state->pc;
+
+		if(!block->indirect)
+		{
+			for(unsigned k = 0; k < 2; k++)
+			{
+				const block_link &link = block->links[k];
+
+				if(link.target && link.pc == pc && link.epoch == cache.epoch)
+				{
+					next = link.target;
+					break;
+				}
+			}
+		}
+
+		if(!next)
+		{
+			err = block_lookup(state, pc, next);
+
+			if(err)
+			{
+				return tracer<Level>::fail(state, err);
+			}
+
+			// Never link out of a block which has been thrown away
+			if(!block->indirect && block->valid)
+			{
+				block_link &link = block->links[pc == block->start + block->length ? 0 : 1];
+
+				link.pc = pc;
+				link.epoch = cache.epoch;
+				link.target = next;
+			}
+		}
+
+		block = next;
+	}
+
+	return mips_Success;
+}
+
+template<unsigned Level>
+static mips_error run_engine(mips_cpu_h state, uint32_t maxSteps, const engine_stops &stops, uint32_t &executed)
+{
+	switch(state->engine)
+	{
+		case mips_EngineJit:
+			return run_blocks<Level>(state, maxSteps, stops, executed, true);
+		case mips_EngineBlock:
+			return run_blocks<Level>(state, maxSteps, stops, executed, false);
+		case mips_EngineThreaded:
+			return run_threaded<Level>(state, maxSteps, stops, executed);
+		case mips_EngineInterpreter:
+		default:
+			return run_interpreter<Level>(state, maxSteps, stops, executed);
+	}
+}
+
+mips_error engine_run(mips_cpu_h state, uint32_t maxSteps, const engine_stops &stops, uint32_t &executed)
+{
+	mips_error err = mips_Success;
+
+	executed = 0;
+
+	unsigned level = state->logDst ? state->logLevel : 0;
+
+	if(level > TRACE_MAX_LEVEL)
+	{
+		level = TRACE_MAX_LEVEL;
+	}
+
+	if(state->trace.running)
+	{
+		level = TRACE_BINARY;
+	}
+	else if(level == 0)
+	{
+		bool models = state->timing.enabled || state->predictor.enabled;
+
+		if(state->prof.enabled)
+		{
+			level = models ? TRACE_PROFILE_MODELS : TRACE_PROFILE;
+		}
+		else if(models)
+		{
+			level = TRACE_MODELS;
+		}
+	}
+
+	switch(level)
+	{
+		case 0:
+			err = run_engine<0>(state, maxSteps, stops, executed);
+			break;
+		case 1:
+			err = run_engine<1>(state, maxSteps, stops, executed);
+			break;
+		case TRACE_BINARY:
+			err = run_engine<TRACE_BINARY>(state, maxSteps, stops, executed);
+			break;
+		case TRACE_PROFILE:
+			err = run_engine<TRACE_PROFILE>(state, maxSteps, stops, executed);
+			break;
+		case TRACE_MODELS:
+			err = run_engine<TRACE_MODELS>(state, maxSteps, stops, executed);
+			break;
+		case TRACE_PROFILE_MODELS:
+			err = run_engine<TRACE_PROFILE_MODELS>(state, maxSteps, stops, executed);
+			break;
+		default:
+			err = run_engine<TRACE_MAX_LEVEL>(state, maxSteps, stops, executed);
+			break;
+	}
+
+	// A run always stops at the first error, so this sees each one once
+	if(err)
+	{
+		stats_exception(state->stats, err);
+	}
+
+	return err;
+}
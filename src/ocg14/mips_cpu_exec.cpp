@@ -0,0 +1,340 @@
+#include "mips_cpu_exec.h"
+#include "mips_cpu_impl.h"
+#include "mips_cpu_alu.h"
+
+mips_error execute_invalid(mips_cpu_h, const decoded_instr &)
+{
+	return mips_ExceptionInvalidInstruction;
+}
+
+// r type
+
+mips_error execute_ADD(mips_cpu_h state, const decoded_instr &d)
+{
+	return ADD(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_ADDU(mips_cpu_h state, const decoded_instr &d)
+{
+	return ADDU(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_AND(mips_cpu_h state, const decoded_instr &d)
+{
+	return AND(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_DIV(mips_cpu_h state, const decoded_instr &d)
+{
+	if(!state->regs[d.rt])
+	{
+		return mips_ExceptionInvalidInstruction;
+	}
+
+	return DIV(state, state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_DIVU(mips_cpu_h state, const decoded_instr &d)
+{
+	if(!state->regs[d.rt])
+	{
+		return mips_ExceptionInvalidInstruction;
+	}
+
+	return DIVU(state, state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_JALR(mips_cpu_h state, const decoded_instr &d)
+{
+	return JALR(state, state->regs[d.rs], d.rd);
+}
+
+mips_error execute_JR(mips_cpu_h state, const decoded_instr &d)
+{
+	return JR(state, state->regs[d.rs]);
+}
+
+mips_error execute_MFHI(mips_cpu_h state, const decoded_instr &d)
+{
+	return MFHI(state, state->regs[d.rd]);
+}
+
+mips_error execute_MFLO(mips_cpu_h state, const decoded_instr &d)
+{
+	return MFLO(state, state->regs[d.rd]);
+}
+
+mips_error execute_MTHI(mips_cpu_h state, const decoded_instr &d)
+{
+	return MTHI(state, state->regs[d.rs]);
+}
+
+mips_error execute_MTLO(mips_cpu_h state, const decoded_instr &d)
+{
+	return MTLO(state, state->regs[d.rs]);
+}
+
+mips_error execute_MULT(mips_cpu_h state, const decoded_instr &d)
+{
+	return MULT(state, state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_MULTU(mips_cpu_h state, const decoded_instr &d)
+{
+	return MULTU(state, state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_OR(mips_cpu_h state, const decoded_instr &d)
+{
+	return OR(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_SLL(mips_cpu_h state, const decoded_instr &d)
+{
+	return SLL(state->regs[d.rd], state->regs[d.rt], d.shift);
+}
+
+mips_error execute_SLLV(mips_cpu_h state, const decoded_instr &d)
+{
+	return SLLV(state->regs[d.rd], state->regs[d.rt], state->regs[d.rs]);
+}
+
+mips_error execute_SLT(mips_cpu_h state, const decoded_instr &d)
+{
+	return SLT(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_SLTU(mips_cpu_h state, const decoded_instr &d)
+{
+	return SLTU(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_SRA(mips_cpu_h state, const decoded_instr &d)
+{
+	return SRA(state->regs[d.rd], state->regs[d.rt], d.shift);
+}
+
+mips_error execute_SRAV(mips_cpu_h state, const decoded_instr &d)
+{
+	return SRAV(state->regs[d.rd], state->regs[d.rt], state->regs[d.rs]);
+}
+
+mips_error execute_SRL(mips_cpu_h state, const decoded_instr &d)
+{
+	return SRL(state->regs[d.rd], state->regs[d.rt], d.shift);
+}
+
+mips_error execute_SRLV(mips_cpu_h state, const decoded_instr &d)
+{
+	return SRLV(state->regs[d.rd], state->regs[d.rt], state->regs[d.rs]);
+}
+
+mips_error execute_SUB(mips_cpu_h state, const decoded_instr &d)
+{
+	return SUB(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_SUBU(mips_cpu_h state, const decoded_instr &d)
+{
+	return SUBU(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+mips_error execute_XOR(mips_cpu_h state, const decoded_instr &d)
+{
+	return XOR(state->regs[d.rd], state->regs[d.rs], state->regs[d.rt]);
+}
+
+// j type
+
+mips_error execute_BGEZ(mips_cpu_h state, const decoded_instr &d)
+{
+	return BGEZ(state, state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_BGEZAL(mips_cpu_h state, const decoded_instr &d)
+{
+	return BGEZAL(state, state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_BLTZ(mips_cpu_h state, const decoded_instr &d)
+{
+	return BLTZ(state, state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_BLTZAL(mips_cpu_h state, const decoded_instr &d)
+{
+	return BLTZAL(state, state->regs[d.rs], (uint16_t)d.imm);
+}
+
+// i type
+
+mips_error execute_ADDI(mips_cpu_h state, const decoded_instr &d)
+{
+	return ADDI(state->regs[d.rt], state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_ADDIU(mips_cpu_h state, const decoded_instr &d)
+{
+	return ADDIU(state->regs[d.rt], state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_ANDI(mips_cpu_h state, const decoded_instr &d)
+{
+	return ANDI(state->regs[d.rt], state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_BEQ(mips_cpu_h state, const decoded_instr &d)
+{
+	return BEQ(state, state->regs[d.rs], state->regs[d.rt], (uint16_t)d.imm);
+}
+
+mips_error execute_BGTZ(mips_cpu_h state, const decoded_instr &d)
+{
+	return BGTZ(state, state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_BLEZ(mips_cpu_h state, const decoded_instr &d)
+{
+	return BLEZ(state, state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_BNE(mips_cpu_h state, const decoded_instr &d)
+{
+	return BNE(state, state->regs[d.rs], state->regs[d.rt], (uint16_t)d.imm);
+}
+
+mips_error execute_J(mips_cpu_h state, const decoded_instr &d)
+{
+	return J(state, d.imm);
+}
+
+mips_error execute_JAL(mips_cpu_h state, const decoded_instr &d)
+{
+	return JAL(state, d.imm);
+}
+
+mips_error execute_LB(mips_cpu_h state, const decoded_instr &d)
+{
+	uint32_t rt = 0;
+	mips_error err = LB(state->data, state->regs[d.rs] + d.simm, rt);
+
+	if(!err)
+	{
+		state->regs[d.rt] = rt;
+	}
+
+	return err;
+}
+
+mips_error execute_LBU(mips_cpu_h state, const decoded_instr &d)
+{
+	uint32_t rt = 0;
+	mips_error err = LBU(state->data, state->regs[d.rs] + d.simm, rt);
+
+	if(!err)
+	{
+		state->regs[d.rt] = rt;
+	}
+
+	return err;
+}
+
+mips_error execute_LH(mips_cpu_h state, const decoded_instr &d)
+{
+	uint32_t rt = 0;
+	mips_error err = LH(state->data, state->regs[d.rs] + d.simm, rt);
+
+	if(!err)
+	{
+		state->regs[d.rt] = rt;
+	}
+
+	return err;
+}
+
+mips_error execute_LHU(mips_cpu_h state, const decoded_instr &d)
+{
+	uint32_t rt = 0;
+	mips_error err = LHU(state->data, state->regs[d.rs] + d.simm, rt);
+
+	if(!err)
+	{
+		state->regs[d.rt] = rt;
+	}
+
+	return err;
+}
+
+mips_error execute_LW(mips_cpu_h state, const decoded_instr &d)
+{
+	uint32_t rt = 0;
+	mips_error err = LW(state->data, state->regs[d.rs] + d.simm, rt);
+
+	if(!err)
+	{
+		state->regs[d.rt] = rt;
+	}
+
+	return err;
+}
+
+mips_error execute_LWL(mips_cpu_h state, const decoded_instr &d)
+{
+	uint32_t rt = state->regs[d.rt];
+	mips_error err = LWL(state->data, state->regs[d.rs] + d.simm, rt);
+
+	if(!err)
+	{
+		state->regs[d.rt] = rt;
+	}
+
+	return err;
+}
+
+mips_error execute_LWR(mips_cpu_h state, const decoded_instr &d)
+{
+	uint32_t rt = state->regs[d.rt];
+	mips_error err = LWR(state->data, state->regs[d.rs] + d.simm, rt);
+
+	if(!err)
+	{
+		state->regs[d.rt] = rt;
+	}
+
+	return err;
+}
+
+mips_error execute_ORI(mips_cpu_h state, const decoded_instr &d)
+{
+	return ORI(state->regs[d.rt], state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_SB(mips_cpu_h state, const decoded_instr &d)
+{
+	return SB(state->data, state->regs[d.rs] + d.simm, state->regs[d.rt]);
+}
+
+mips_error execute_SH(mips_cpu_h state, const decoded_instr &d)
+{
+	return SH(state->data, state->regs[d.rs] + d.simm, state->regs[d.rt]);
+}
+
+mips_error execute_SLTI(mips_cpu_h state, const decoded_instr &d)
+{
+	return SLTI(state->regs[d.rt], state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_SLTIU(mips_cpu_h state, const decoded_instr &d)
+{
+	return SLTIU(state->regs[d.rt], state->regs[d.rs], (uint16_t)d.imm);
+}
+
+mips_error execute_SW(mips_cpu_h state, const decoded_instr &d)
+{
+	return SW(state->data, state->regs[d.rs] + d.simm, state->regs[d.rt]);
+}
+
+mips_error execute_XORI(mips_cpu_h state, const decoded_instr &d)
+{
+	return XORI(state->regs[d.rt], state->regs[d.rs], (uint16_t)d.imm);
+}
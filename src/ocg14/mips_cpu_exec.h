@@ -0,0 +1,13 @@
+#ifndef mips_cpu_exec_header
+#define mips_cpu_exec_header
+
+#include "mips_cpu_decoder.h"
+
+// One handler per instruction, selected by decode_instr
+mips_error execute_invalid(mips_cpu_h state, const decoded_instr &d);
+
+#define MIPS_CPU_OP_HANDLER(name) mips_error execute_##name(mips_cpu_h state, const decoded_instr &d);
+MIPS_CPU_OPS(MIPS_CPU_OP_HANDLER)
+#undef MIPS_CPU_OP_HANDLER
+
+#endif
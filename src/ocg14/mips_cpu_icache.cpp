@@ -0,0 +1,142 @@
+#include "mips_cpu_icache.h"
+#include "mips_cpu_impl.h"
+#include "mips_cpu_alu.h"
+#include <algorithm>
+#include <string.h>
+
+void icache_init(icache &cache)
+{
+	cache.enabled = false;
+	cache.lastTag = 0;
+	cache.lastPage = 0;
+}
+
+void icache_free(icache &cache)
+{
+	std::unordered_map<uint32_t, icache_page*>::iterator it;
+
+	for(it = cache.pages.begin(); it != cache.pages.end(); ++it)
+	{
+		delete it->second;
+	}
+
+	cache.pages.clear();
+	cache.lastPage = 0;
+}
+
+void icache_invalidate(icache &cache, uint32_t address, uint32_t length)
+{
+	if(!length)
+	{
+		return;
+	}
+
+	uint32_t first = address >> 2;
+	uint32_t last = (address + length - 1) >> 2;
+
+	// Only the words written are dropped, so that data sharing a page
+	// with code (such as a small stack) does not keep flushing the code.
+	// Snapshot restores report whole pages, so each page's share of the
+	// range is cleared in one go.
+	while(first <= last)
+	{
+		uint32_t index = first & (ICACHE_PAGE_WORDS - 1);
+		uint32_t count = std::min(last - first + 1, ICACHE_PAGE_WORDS - index);
+
+		std::unordered_map<uint32_t, icache_page*>::iterator it = cache.pages.find(first >> (ICACHE_PAGE_BITS - 2));
+
+		// Pages are only emptied, not released, as the instruction
+		// currently executing may be the one being overwritten
+		if(it != cache.pages.end())
+		{
+			memset(it->second->valid + index, 0, count);
+		}
+
+		first += count;
+	}
+}
+
+static icache_page *icache_get_page(icache &cache, mips_mem_h mem, uint32_t tag)
+{
+	if(cache.lastPage && cache.lastTag == tag)
+	{
+		return cache.lastPage;
+	}
+
+	icache_page *&page = cache.pages[tag];
+
+	if(!page)
+	{
+		page = new icache_page;
+
+		for(uint32_t i = 0; i < ICACHE_PAGE_WORDS; i++)
+		{
+			page->valid[i] = 0;
+		}
+
+		// Pages which are not wholly in memory just use mips_mem_fetch
+		if(mips_mem_get_host_range(mem, tag << ICACHE_PAGE_BITS, 1u << ICACHE_PAGE_BITS, &page->host))
+		{
+			page->host = 0;
+		}
+	}
+
+	cache.lastTag = tag;
+	cache.lastPage = page;
+
+	return page;
+}
+
+mips_error icache_fill(mips_cpu_h state, uint32_t pc, const decoded_instr *&d)
+{
+	mips_error err = mips_Success;
+
+	uint8_t mem_buffer[4];
+
+	// Without write notifications nothing can be kept, so decode into a
+	// single slot every time. Unaligned fetches also go to the memory,
+	// which decides whether to fail them, and are never kept: they do not
+	// belong to any one slot of a page.
+	if(!state->decoded.enabled || (pc & 3))
+	{
+		err = mips_mem_fetch(state->ram, pc, 4, mem_buffer);
+
+		if(err)
+		{
+			return err;
+		}
+
+		decode_instr(to_big(mem_buffer), state->decoded.uncached);
+		d = &state->decoded.uncached;
+
+		return mips_Success;
+	}
+
+	icache_page *page = icache_get_page(state->decoded, state->ram, pc >> ICACHE_PAGE_BITS);
+	uint32_t index = (pc >> 2) & (ICACHE_PAGE_WORDS - 1);
+
+	if(!page->valid[index])
+	{
+		if(page->host)
+		{
+			decode_instr(to_big(page->host + index * 4), page->instrs[index]);
+		}
+		else
+		{
+			err = mips_mem_fetch(state->ram, pc, 4, mem_buffer);
+
+			if(err)
+			{
+				return err;
+			}
+
+			decode_instr(to_big(mem_buffer), page->instrs[index]);
+		}
+
+		page->valid[index] = 1;
+	}
+
+	d = &page->instrs[index];
+
+	return mips_Success;
+}
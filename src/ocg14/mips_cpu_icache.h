@@ -0,0 +1,43 @@
+#ifndef mips_cpu_icache_header
+#define mips_cpu_icache_header
+
+#include "mips_cpu_decoder.h"
+#include <unordered_map>
+
+// Decoded instructions are kept per page, so that a write to memory only
+// has to find one page to throw away
+const uint32_t ICACHE_PAGE_BITS = 12;
+const uint32_t ICACHE_PAGE_WORDS = 1u << (ICACHE_PAGE_BITS - 2);
+
+struct icache_page
+{
+	decoded_instr instrs[ICACHE_PAGE_WORDS];
+	uint8_t valid[ICACHE_PAGE_WORDS];
+
+	// The page's bytes in the host, if the memory gives them out
+	const uint8_t *host;
+};
+
+struct icache
+{
+	bool enabled;
+
+	// The page that was used last, which is nearly always the next one needed
+	uint32_t lastTag;
+	icache_page *lastPage;
+
+	std::unordered_map<uint32_t, icache_page*> pages;
+
+	// Used instead of the pages when the memory cannot report writes
+	decoded_instr uncached;
+};
+
+void icache_init(icache &cache);
+void icache_free(icache &cache);
+void icache_invalidate(icache &cache, uint32_t address, uint32_t length);
+
+// Slow path of icache_fetch (see mips_cpu_impl.h), which fetches and
+// decodes the instruction at pc if it is not already held
+mips_error icache_fill(mips_cpu_h state, uint32_t pc, const decoded_instr *&d);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef mips_cpu_impl_header
+#define mips_cpu_impl_header
+
+#include "mips.h"
+#include "mips_cpu_icache.h"
+#include "mips_cpu_memory.h"
+#include "mips_cpu_block.h"
+#include "mips_cpu_trace.h"
+#include "mips_cpu_profile.h"
+#include "mips_cpu_stats.h"
+#include "mips_cpu_timing.h"
+#include "mips_cpu_predictor.h"
+
+struct mips_cpu_impl
+{
+	uint32_t pc;
+	uint32_t npc;
+	uint32_t regs[32];
+	uint32_t hi;
+	uint32_t lo;
+
+	unsigned logLevel;
+
+	FILE* logDst;
+
+	// Binary tracing, with the record for the instruction in flight
+	mips_cpu_trace_format traceFormat;
+	trace_ring trace;
+	mips_trace_record traceRecord;
+	bool tracePending;
+
+	mips_mem_h ram;
+	data_port data;
+
+	mips_cpu_engine engine;
+
+	icache decoded;
+	block_cache blocks;
+	jit_arena jit;
+
+	uint64_t fusionHits[mips_FusionCount];
+
+	profile prof;
+	cpu_stats stats;
+	timing_model timing;
+	predictor_model predictor;
+
+	// Instruction in flight for the timing and branch models, copied
+	// before it executes as a store may throw away the cache entry
+	decoded_instr modelled;
+	uint32_t modelledPc;
+};
+
+// Returns the decoded instruction at pc. The common case of hitting the
+// same page as last time is handled here so that it can be inlined into
+// the engines.
+inline mips_error icache_fetch(mips_cpu_h state, uint32_t pc, const decoded_instr *&d)
+{
+	icache &cache = state->decoded;
+
+	if(cache.lastPage && cache.lastTag == (pc >> ICACHE_PAGE_BITS) && !(pc & 0x3))
+	{
+		uint32_t index = (pc >> 2) & (ICACHE_PAGE_WORDS - 1);
+
+		if(cache.lastPage->valid[index])
+		{
+			d = &cache.lastPage->instrs[index];
+			return mips_Success;
+		}
+	}
+
+	return icache_fill(state, pc, d);
+}
+
+// Addresses at which a run should return to the caller
+struct engine_stops
+{
+	const uint32_t *pcs;
+	unsigned count;
+};
+
+inline bool engine_should_stop(const engine_stops &stops, uint32_t pc)
+{
+	for(unsigned i = 0; i < stops.count; i++)
+	{
+		if(stops.pcs[i] == pc)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Runs up to maxSteps instructions using the engine chosen at creation,
+// returning early once the pc reaches one of the stop addresses
+mips_error engine_run(mips_cpu_h state, uint32_t maxSteps, const engine_stops &stops, uint32_t &executed);
+
+#endif
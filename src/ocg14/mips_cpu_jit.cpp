@@ -0,0 +1,432 @@
+#include "mips_cpu_jit.h"
+#include "mips_cpu_impl.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+
+#include <sys/mman.h>
+#include <vector>
+
+// Longest native sequence for one instruction, including its side exit
+const uint32_t JIT_MAX_INSTR_BYTES = 64;
+
+// Registers used by the generated code: rbx holds the cpu handle and
+// r12 points at regs[0]; eax, ecx and rdx/rsi/rdi are scratch.
+struct jit_emitter
+{
+	uint8_t *code;
+	uint32_t size;
+
+	// Places which jump to a side exit, and the instruction index to report
+	std::vector<std::pair<uint32_t, uint32_t> > exits;
+};
+
+static void emit8(jit_emitter &e, uint8_t b)
+{
+	e.code[e.size++] = b;
+}
+
+static void emit32(jit_emitter &e, uint32_t v)
+{
+	for(unsigned i = 0; i < 4; i++)
+	{
+		emit8(e, (v >> (8 * i)) & 0xFF);
+	}
+}
+
+static void emit64(jit_emitter &e, uint64_t v)
+{
+	emit32(e, (uint32_t)v);
+	emit32(e, (uint32_t)(v >> 32));
+}
+
+// mov eax/ecx, [r12 + 4*reg]
+static void emit_load(jit_emitter &e, uint8_t modrmReg, uint32_t reg)
+{
+	emit8(e, 0x41); emit8(e, 0x8B); emit8(e, 0x44 | (modrmReg << 3)); emit8(e, 0x24); emit8(e, reg * 4);
+}
+
+// mov [r12 + 4*reg], eax; $0 is never written
+static void emit_store(jit_emitter &e, uint32_t reg)
+{
+	if(reg != 0)
+	{
+		emit8(e, 0x41); emit8(e, 0x89); emit8(e, 0x44); emit8(e, 0x24); emit8(e, reg * 4);
+	}
+}
+
+// Conditional jump (0F cc) to the side exit for instruction index
+static void emit_exit_jcc(jit_emitter &e, uint8_t cc, uint32_t index)
+{
+	emit8(e, 0x0F); emit8(e, cc);
+	e.exits.push_back(std::make_pair(e.size, index));
+	emit32(e, 0);
+}
+
+const uint8_t JIT_EAX = 0;
+const uint8_t JIT_ECX = 1;
+
+const uint8_t JIT_JO = 0x80;
+const uint8_t JIT_JE = 0x84;
+const uint8_t JIT_JNE = 0x85;
+
+// reg-reg ALU op "op eax, ecx"
+static void emit_rr(jit_emitter &e, uint8_t opcode, const decoded_instr &d)
+{
+	emit_load(e, JIT_EAX, d.rs);
+	emit_load(e, JIT_ECX, d.rt);
+	emit8(e, opcode); emit8(e, 0xC8);
+	emit_store(e, d.rd);
+}
+
+// reg-imm ALU op "op eax, imm32"
+static void emit_ri(jit_emitter &e, uint8_t opcode, const decoded_instr &d, uint32_t imm)
+{
+	emit_load(e, JIT_EAX, d.rs);
+	emit8(e, opcode); emit32(e, imm);
+	emit_store(e, d.rt);
+}
+
+// "shr/sar eax, shift" on rt into rd
+static void emit_shift(jit_emitter &e, uint8_t modrm, const decoded_instr &d)
+{
+	emit_load(e, JIT_EAX, d.rt);
+	emit8(e, 0xC1); emit8(e, modrm); emit8(e, d.shift);
+	emit_store(e, d.rd);
+}
+
+// setb al; movzx eax, al
+static void emit_setb(jit_emitter &e)
+{
+	emit8(e, 0x0F); emit8(e, 0x92); emit8(e, 0xC0);
+	emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);
+}
+
+// Emits native code for instructions which are pure register operations.
+// The results must match the functions in mips_cpu_alu.cpp exactly,
+// including where those differ from the architecture, so that switching
+// engine never changes what a program does.
+static bool emit_native(jit_emitter &e, const decoded_instr &d, uint32_t index)
+{
+	switch(d.op)
+	{
+		case op_ADDU:
+			emit_rr(e, 0x01, d);
+			return true;
+		case op_SUBU:
+			emit_rr(e, 0x29, d);
+			return true;
+		case op_AND:
+			emit_rr(e, 0x21, d);
+			return true;
+		case op_OR:
+			emit_rr(e, 0x09, d);
+			return true;
+		case op_XOR:
+			emit_rr(e, 0x31, d);
+			return true;
+		case op_ADDIU:
+			emit_ri(e, 0x05, d, d.simm);
+			return true;
+		// ANDI, ORI and XORI sign-extend their immediate in the ALU
+		case op_ANDI:
+			emit_ri(e, 0x25, d, d.simm);
+			return true;
+		case op_ORI:
+			emit_ri(e, 0x0D, d, d.simm);
+			return true;
+		case op_XORI:
+			emit_ri(e, 0x35, d, d.simm);
+			return true;
+		case op_SLTU:
+			emit_load(e, JIT_EAX, d.rs);
+			emit_load(e, JIT_ECX, d.rt);
+			emit8(e, 0x39); emit8(e, 0xC8);		// cmp eax, ecx
+			emit_setb(e);
+			emit_store(e, d.rd);
+			return true;
+		case op_SLTIU:
+			emit_load(e, JIT_EAX, d.rs);
+			emit8(e, 0x3D); emit32(e, d.imm);	// cmp eax, imm32
+			emit_setb(e);
+			emit_store(e, d.rt);
+			return true;
+		// The ALU shifts SLL to the right as well
+		case op_SLL:
+		case op_SRL:
+			emit_shift(e, 0xE8, d);
+			return true;
+		case op_SRA:
+			emit_shift(e, 0xF8, d);
+			return true;
+		// Signed overflow leaves through a side exit, so the interpreter
+		// runs the instruction again and raises the exception itself
+		case op_ADD:
+			emit_load(e, JIT_EAX, d.rs);
+			emit_load(e, JIT_ECX, d.rt);
+			emit8(e, 0x01); emit8(e, 0xC8);		// add eax, ecx
+			emit_exit_jcc(e, JIT_JO, index);
+			emit_store(e, d.rd);
+			return true;
+		case op_SUB:
+			emit_load(e, JIT_EAX, d.rs);
+			emit_load(e, JIT_ECX, d.rt);
+			emit8(e, 0xF7); emit8(e, 0xD9);		// neg ecx
+			emit8(e, 0x01); emit8(e, 0xC8);		// add eax, ecx
+			emit_exit_jcc(e, JIT_JO, index);
+			emit_store(e, d.rd);
+			return true;
+		case op_ADDI:
+			emit_load(e, JIT_EAX, d.rs);
+			emit8(e, 0x05); emit32(e, d.simm);
+			emit_exit_jcc(e, JIT_JO, index);
+			emit_store(e, d.rt);
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool is_store(uint8_t op)
+{
+	return op == op_SB || op == op_SH || op == op_SW;
+}
+
+// Anything else calls the handler the interpreter would have used, and
+// leaves at this instruction if it reports an error
+static void emit_call(jit_emitter &e, const decoded_instr &d, uint32_t index, const translated_block *block)
+{
+	emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);		// mov rdi, rbx
+	emit8(e, 0x48); emit8(e, 0xBE); emit64(e, (uint64_t)&d);	// mov rsi, &d
+	emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uint64_t)d.handler);	// mov rax, handler
+	emit8(e, 0xFF); emit8(e, 0xD0);						// call rax
+	emit8(e, 0x85); emit8(e, 0xC0);						// test eax, eax
+	emit_exit_jcc(e, JIT_JNE, index);
+
+	// mov dword [r12], 0; the handler may have written $0
+	emit8(e, 0x41); emit8(e, 0xC7); emit8(e, 0x04); emit8(e, 0x24); emit32(e, 0);
+
+	// A store may have overwritten this block, in which case the rest of
+	// the compiled code is stale
+	if(is_store(d.op))
+	{
+		emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uint64_t)&block->valid);	// mov rax, &valid
+		emit8(e, 0x80); emit8(e, 0x38); emit8(e, 0x00);	// cmp byte [rax], 0
+		emit_exit_jcc(e, JIT_JE, index + 1);
+	}
+}
+
+void jit_init(jit_arena &arena)
+{
+	arena.base = 0;
+	arena.used = 0;
+	arena.writable = false;
+	arena.failed = false;
+}
+
+void jit_free(jit_arena &arena)
+{
+	if(arena.base)
+	{
+		munmap(arena.base, JIT_ARENA_SIZE);
+	}
+
+	jit_init(arena);
+}
+
+// Drops every piece of compiled code, so the arena can be reused
+static void jit_flush(mips_cpu_h state)
+{
+	block_cache &cache = state->blocks;
+
+	std::unordered_map<uint32_t, translated_block*>::iterator it;
+
+	for(it = cache.blocks.begin(); it != cache.blocks.end(); ++it)
+	{
+		it->second->native = 0;
+		it->second->nativeCount = 0;
+	}
+
+	for(unsigned i = 0; i < cache.retired.size(); i++)
+	{
+		cache.retired[i]->native = 0;
+		cache.retired[i]->nativeCount = 0;
+	}
+
+	state->jit.used = 0;
+}
+
+// Code is only written while the arena is writable, and only run once it
+// has been made executable again
+static bool jit_make_writable(jit_arena &arena)
+{
+	if(!arena.writable)
+	{
+		if(mprotect(arena.base, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE))
+		{
+			return false;
+		}
+
+		arena.writable = true;
+	}
+
+	return true;
+}
+
+static void jit_make_executable(mips_cpu_h state)
+{
+	jit_arena &arena = state->jit;
+
+	if(mprotect(arena.base, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC))
+	{
+		// None of the code can be run, so give up on compiling
+		jit_flush(state);
+		arena.failed = true;
+		return;
+	}
+
+	arena.writable = false;
+}
+
+void jit_compile(mips_cpu_h state, translated_block *block)
+{
+	jit_arena &arena = state->jit;
+
+	if(arena.failed)
+	{
+		return;
+	}
+
+	if(!arena.base)
+	{
+		void *base = mmap(0, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+
+		if(base == MAP_FAILED)
+		{
+			arena.failed = true;
+			return;
+		}
+
+		arena.base = (uint8_t*)base;
+		arena.writable = true;
+	}
+
+	// The final branch is left to the block engine, as is anything which
+	// would fail on every run
+	uint32_t count = 0;
+	uint32_t nativeOps = 0;
+
+	while(count < block->instrs.size())
+	{
+		const decoded_instr &d = block->instrs[count];
+
+		if((d.flags & decode_Branch) || d.op == op_invalid)
+		{
+			break;
+		}
+
+		if((d.flags & decode_ShiftMustBeZero) && d.shift != 0x0)
+		{
+			break;
+		}
+
+		count++;
+	}
+
+	if(count < 2)
+	{
+		return;
+	}
+
+	if(!jit_make_writable(arena))
+	{
+		return;
+	}
+
+	// Prologue, epilogue and one exit per instruction, in the worst case
+	uint32_t needed = 32 + count * (JIT_MAX_INSTR_BYTES + 16);
+
+	if(arena.used + needed > JIT_ARENA_SIZE)
+	{
+		jit_flush(state);
+	}
+
+	jit_emitter e;
+	e.code = arena.base + arena.used;
+	e.size = 0;
+
+	emit8(e, 0x53);								// push rbx
+	emit8(e, 0x41); emit8(e, 0x54);				// push r12
+	emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x08);	// sub rsp, 8
+	emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB);	// mov rbx, rdi
+	emit8(e, 0x49); emit8(e, 0x89); emit8(e, 0xF4);	// mov r12, rsi
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		const decoded_instr &d = block->instrs[i];
+
+		if(emit_native(e, d, i))
+		{
+			nativeOps++;
+		}
+		else
+		{
+			emit_call(e, d, i, block);
+		}
+	}
+
+	emit8(e, 0xB8); emit32(e, count);			// mov eax, count
+
+	uint32_t epilogue = e.size;
+	emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x08);	// add rsp, 8
+	emit8(e, 0x41); emit8(e, 0x5C);				// pop r12
+	emit8(e, 0x5B);								// pop rbx
+	emit8(e, 0xC3);								// ret
+
+	for(unsigned i = 0; i < e.exits.size(); i++)
+	{
+		uint32_t fixup = e.exits[i].first;
+		uint32_t rel = e.size - (fixup + 4);
+
+		for(unsigned b = 0; b < 4; b++)
+		{
+			e.code[fixup + b] = (rel >> (8 * b)) & 0xFF;
+		}
+
+		emit8(e, 0xB8); emit32(e, e.exits[i].second);	// mov eax, index
+		emit8(e, 0xE9); emit32(e, epilogue - (e.size + 4));	// jmp epilogue
+	}
+
+	// Only worth it if something was actually turned into native code
+	if(nativeOps)
+	{
+		arena.used += (e.size + 15) & ~15u;
+
+		block->native = (jit_fn)e.code;
+		block->nativeCount = count;
+	}
+
+	jit_make_executable(state);
+}
+
+#else
+
+// No code generator for this host, so blocks are always interpreted
+
+void jit_init(jit_arena &arena)
+{
+	arena.base = 0;
+	arena.used = 0;
+	arena.writable = false;
+	arena.failed = true;
+}
+
+void jit_free(jit_arena &arena)
+{
+	jit_init(arena);
+}
+
+void jit_compile(mips_cpu_h, translated_block *)
+{
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef mips_cpu_jit_header
+#define mips_cpu_jit_header
+
+#include "mips_cpu.h"
+
+struct translated_block;
+
+// Native code for the start of a block. Returns how many instructions
+// completed; if that is fewer than were compiled, the next one must be
+// run by the interpreter (it either faulted, or the block was rewritten).
+typedef uint32_t (*jit_fn)(mips_cpu_h state, uint32_t *regs);
+
+// Number of times a block runs before it is compiled
+const uint32_t JIT_THRESHOLD = 32;
+
+// Size of the executable arena; when it fills up everything is thrown away
+const uint32_t JIT_ARENA_SIZE = 4u << 20;
+
+struct jit_arena
+{
+	uint8_t *base;
+	uint32_t used;
+	bool writable;	// Otherwise executable; the arena is never both at once
+	bool failed;	// The host would not give us executable memory
+};
+
+void jit_init(jit_arena &arena);
+void jit_free(jit_arena &arena);
+
+// Compiles as much of the block as possible, setting its native entry
+// point. Leaves the block alone if nothing worth compiling was found.
+void jit_compile(mips_cpu_h state, translated_block *block);
+
+#endif
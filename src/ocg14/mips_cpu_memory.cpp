@@ -0,0 +1,198 @@
+#include "mips_cpu_memory.h"
+
+void data_port_init(data_port &port, mips_mem_h mem)
+{
+	port.mem = mem;
+	port.tag = DATA_NO_PAGE;
+	port.host = 0;
+}
+
+// Returns the host byte for address, or NULL if its page has none. The
+// memory's bytes never move, so a page only has to be asked for once
+// each time the accesses move to it.
+static const uint8_t *data_host(data_port &port, uint32_t address)
+{
+	uint32_t tag = address >> DATA_PAGE_BITS;
+
+	if(port.tag != tag)
+	{
+		port.tag = tag;
+
+		// Pages which are not wholly in memory use transactions
+		if(mips_mem_get_host_range(port.mem, tag << DATA_PAGE_BITS, 1u << DATA_PAGE_BITS, &port.host))
+		{
+			port.host = 0;
+		}
+	}
+
+	return port.host ? port.host + (address & ((1u << DATA_PAGE_BITS) - 1)) : 0;
+}
+
+// A page without host bytes may get them when it is written, as the
+// sparse RAM only allocates a page on its first write, so after a store
+// the port asks again
+static mips_error data_stored(data_port &port, mips_error err)
+{
+	if(!port.host)
+	{
+		port.tag = DATA_NO_PAGE;
+	}
+
+	return err;
+}
+
+// Byte and halfword accesses to memory without host bytes are passed on
+// as they are, so that a device register sees exactly what the program
+// did. Only a memory which refuses them, such as a RAM whose block size
+// is a word, gets the whole word instead.
+static mips_error data_read_narrow(data_port &port, uint32_t address, uint32_t length, uint8_t *bytes)
+{
+	mips_error err = mips_mem_read(port.mem, address, length, bytes);
+
+	if(err == mips_ExceptionInvalidAlignment)
+	{
+		uint8_t word[4];
+
+		err = mips_mem_read(port.mem, address & ~3u, 4, word);
+		memcpy(bytes, word + (address & 3), length);
+	}
+
+	return err;
+}
+
+static mips_error data_write_narrow(data_port &port, uint32_t address, uint32_t length, const uint8_t *bytes)
+{
+	mips_error err = mips_mem_write(port.mem, address, length, bytes);
+
+	if(err == mips_ExceptionInvalidAlignment)
+	{
+		uint8_t word[4];
+
+		err = mips_mem_read(port.mem, address & ~3u, 4, word);
+
+		if(!err)
+		{
+			memcpy(word + (address & 3), bytes, length);
+			err = mips_mem_write(port.mem, address & ~3u, 4, word);
+		}
+	}
+
+	return err;
+}
+
+// Stores to memory with host bytes merge into the word already there,
+// and write that back
+static mips_error data_write_merged(data_port &port, const uint8_t *p, uint32_t address, uint32_t length, const uint8_t *bytes)
+{
+	uint8_t word[4];
+
+	memcpy(word, p - (address & 3), 4);
+	memcpy(word + (address & 3), bytes, length);
+
+	return mips_mem_write(port.mem, address & ~3u, 4, word);
+}
+
+mips_error data_load8(data_port &port, uint32_t address, uint8_t &value)
+{
+	const uint8_t *p = data_host(port, address);
+
+	if(p)
+	{
+		value = *p;
+		return mips_Success;
+	}
+
+	return data_read_narrow(port, address, 1, &value);
+}
+
+mips_error data_load16(data_port &port, uint32_t address, uint16_t &value)
+{
+	if(address & 1)
+	{
+		return mips_ExceptionInvalidAlignment;
+	}
+
+	const uint8_t *p = data_host(port, address);
+
+	if(p)
+	{
+		value = load_be16(p);
+		return mips_Success;
+	}
+
+	uint8_t bytes[2] = {0, 0};
+	mips_error err = data_read_narrow(port, address, 2, bytes);
+
+	value = load_be16(bytes);
+
+	return err;
+}
+
+mips_error data_load32(data_port &port, uint32_t address, uint32_t &value)
+{
+	if(address & 3)
+	{
+		return mips_ExceptionInvalidAlignment;
+	}
+
+	const uint8_t *p = data_host(port, address);
+
+	if(p)
+	{
+		value = load_be32(p);
+		return mips_Success;
+	}
+
+	uint8_t word[4];
+	mips_error err = mips_mem_read(port.mem, address, 4, word);
+
+	value = load_be32(word);
+
+	return err;
+}
+
+mips_error data_store8(data_port &port, uint32_t address, uint8_t value)
+{
+	const uint8_t *p = data_host(port, address);
+
+	if(p)
+	{
+		return data_write_merged(port, p, address, 1, &value);
+	}
+
+	return data_stored(port, data_write_narrow(port, address, 1, &value));
+}
+
+mips_error data_store16(data_port &port, uint32_t address, uint16_t value)
+{
+	if(address & 1)
+	{
+		return mips_ExceptionInvalidAlignment;
+	}
+
+	const uint8_t *p = data_host(port, address);
+	uint8_t bytes[2];
+
+	store_be16(bytes, value);
+
+	if(p)
+	{
+		return data_write_merged(port, p, address, 2, bytes);
+	}
+
+	return data_stored(port, data_write_narrow(port, address, 2, bytes));
+}
+
+mips_error data_store32(data_port &port, uint32_t address, uint32_t value)
+{
+	if(address & 3)
+	{
+		return mips_ExceptionInvalidAlignment;
+	}
+
+	uint8_t word[4];
+
+	store_be32(word, value);
+
+	return data_stored(port, mips_mem_write(port.mem, address, 4, word));
+}
@@ -0,0 +1,92 @@
+#ifndef mips_cpu_memory_header
+#define mips_cpu_memory_header
+
+#include "mips.h"
+#include <string.h>
+
+// MIPS memory is big-endian. These move values between registers and
+// bytes in memory order, with a single load or store and a byte swap on
+// little-endian hosts.
+inline uint32_t load_be32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return v;
+#elif defined(__GNUC__)
+	return __builtin_bswap32(v);
+#else
+	return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+#endif
+}
+
+inline uint16_t load_be16(const uint8_t *p)
+{
+	uint16_t v;
+	memcpy(&v, p, 2);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return v;
+#elif defined(__GNUC__)
+	return __builtin_bswap16(v);
+#else
+	return (uint16_t)((v >> 8) | (v << 8));
+#endif
+}
+
+inline void store_be32(uint8_t *p, uint32_t v)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#elif defined(__GNUC__)
+	v = __builtin_bswap32(v);
+#else
+	v = (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+#endif
+
+	memcpy(p, &v, 4);
+}
+
+inline void store_be16(uint8_t *p, uint16_t v)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#elif defined(__GNUC__)
+	v = __builtin_bswap16(v);
+#else
+	v = (uint16_t)((v >> 8) | (v << 8));
+#endif
+
+	memcpy(p, &v, 2);
+}
+
+// The CPU's way in to data memory. Loads read straight from the host
+// bytes of the page used last, if the memory gives them out, and only
+// fall back to mips_mem_read when it does not. Stores always go through
+// mips_mem_write, so that snapshots, dirty pages and write observers
+// see them; a byte or halfword store to a page with host bytes merges
+// into the word there and writes that back. Elsewhere (memory mapped
+// devices, say) byte and halfword accesses keep their own size.
+const uint32_t DATA_PAGE_BITS = 12;
+const uint32_t DATA_NO_PAGE = 0xFFFFFFFFu;
+
+struct data_port
+{
+	mips_mem_h mem;
+
+	// The page looked up last (DATA_NO_PAGE if none), and its host bytes or NULL
+	uint32_t tag;
+	const uint8_t *host;
+};
+
+void data_port_init(data_port &port, mips_mem_h mem);
+
+// Each access checks alignment to its own size first, as MIPS does, and
+// then that it lies in memory
+mips_error data_load8(data_port &port, uint32_t address, uint8_t &value);
+mips_error data_load16(data_port &port, uint32_t address, uint16_t &value);
+mips_error data_load32(data_port &port, uint32_t address, uint32_t &value);
+mips_error data_store8(data_port &port, uint32_t address, uint8_t value);
+mips_error data_store16(data_port &port, uint32_t address, uint16_t value);
+mips_error data_store32(data_port &port, uint32_t address, uint32_t value);
+
+#endif
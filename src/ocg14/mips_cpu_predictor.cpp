@@ -0,0 +1,219 @@
+#include "mips.h"
+#include "mips_cpu_predictor.h"
+#include <algorithm>
+#include <string.h>
+
+const unsigned PREDICTOR_MAX_TABLE_BITS = 20;
+const unsigned PREDICTOR_MAX_RAS = sizeof(((predictor_model*)0)->ras) / sizeof(uint32_t);
+
+// Tag of an empty target buffer entry; jumps are word aligned, so it never matches
+const uint32_t PREDICTOR_NO_TAG = 0xFFFFFFFF;
+
+void predictor_init(predictor_model &pred)
+{
+	mips_cpu_predictor_config config;
+
+	config.kind = mips_PredictorBimodal;
+	config.tableBits = 10;
+	config.historyBits = 8;
+	config.btbEntries = 64;
+	config.rasDepth = 8;
+
+	pred.enabled = false;
+	predictor_configure(pred, config);
+}
+
+bool predictor_configure(predictor_model &pred, const mips_cpu_predictor_config &config)
+{
+	if(config.kind != mips_PredictorStatic && config.kind != mips_PredictorBimodal
+		&& config.kind != mips_PredictorGshare)
+	{
+		return false;
+	}
+
+	if(config.tableBits < 1 || config.tableBits > PREDICTOR_MAX_TABLE_BITS
+		|| config.historyBits > config.tableBits
+		|| (config.btbEntries & (config.btbEntries - 1))
+		|| config.rasDepth > PREDICTOR_MAX_RAS)
+	{
+		return false;
+	}
+
+	pred.config = config;
+	predictor_reset(pred);
+
+	return true;
+}
+
+void predictor_reset(predictor_model &pred)
+{
+	memset(&pred.totals, 0, sizeof(pred.totals));
+
+	// Weakly not taken, so that a branch seen once is not yet trusted
+	pred.counters.assign(1u << pred.config.tableBits, 1);
+	pred.history = 0;
+
+	pred.btbTags.assign(pred.config.btbEntries, PREDICTOR_NO_TAG);
+	pred.btbTargets.assign(pred.config.btbEntries, 0);
+
+	pred.rasTop = 0;
+	pred.rasCount = 0;
+
+	pred.sites.clear();
+}
+
+static bool predictor_direction(predictor_model &pred, const decoded_instr &d, uint32_t pc, bool taken)
+{
+	if(pred.config.kind == mips_PredictorStatic)
+	{
+		return (int32_t)d.simm < 0;
+	}
+
+	uint32_t index = pc >> 2;
+
+	if(pred.config.kind == mips_PredictorGshare)
+	{
+		index ^= pred.history & ((1u << pred.config.historyBits) - 1);
+	}
+
+	uint8_t &counter = pred.counters[index & ((1u << pred.config.tableBits) - 1)];
+	bool predicted = counter >= 2;
+
+	if(taken && counter < 3)
+	{
+		counter++;
+	}
+	else if(!taken && counter > 0)
+	{
+		counter--;
+	}
+
+	pred.history = (pred.history << 1) | (taken ? 1 : 0);
+
+	return predicted;
+}
+
+// Returns pc + 4 when the buffer knows nothing about the jump
+static uint32_t predictor_btb(predictor_model &pred, uint32_t pc, uint32_t target)
+{
+	uint32_t predicted = pc + 4;
+
+	if(pred.config.btbEntries)
+	{
+		uint32_t index = (pc >> 2) & (pred.config.btbEntries - 1);
+
+		if(pred.btbTags[index] == pc)
+		{
+			predicted = pred.btbTargets[index];
+		}
+
+		pred.btbTags[index] = pc;
+		pred.btbTargets[index] = target;
+	}
+
+	return predicted;
+}
+
+static void predictor_push(predictor_model &pred, uint32_t address)
+{
+	if(!pred.config.rasDepth)
+	{
+		return;
+	}
+
+	pred.ras[pred.rasTop] = address;
+	pred.rasTop = (pred.rasTop + 1) % pred.config.rasDepth;
+	pred.rasCount = std::min(pred.rasCount + 1, pred.config.rasDepth);
+}
+
+static bool predictor_pop(predictor_model &pred, uint32_t &address)
+{
+	if(!pred.rasCount)
+	{
+		return false;
+	}
+
+	pred.rasTop = (pred.rasTop + pred.config.rasDepth - 1) % pred.config.rasDepth;
+	pred.rasCount--;
+	address = pred.ras[pred.rasTop];
+
+	return true;
+}
+
+bool predictor_retire(predictor_model &pred, const decoded_instr &d, uint32_t pc, uint32_t nextPc)
+{
+	mips_cpu_predictor_stats &totals = pred.totals;
+	bool taken = nextPc != pc + 4;
+	bool missed = false;
+
+	if(d.flags & decode_Conditional)
+	{
+		missed = predictor_direction(pred, d, pc, taken) != taken;
+
+		totals.branches++;
+		totals.branchMisses += missed;
+	}
+	else if(d.flags & decode_Indirect)
+	{
+		uint32_t predicted;
+		bool isReturn = d.op == op_JR && d.rs == 31;
+
+		// The buffer learns every target, even those the stack predicted
+		uint32_t fromBtb = predictor_btb(pred, pc, nextPc);
+
+		if(!isReturn || !predictor_pop(pred, predicted))
+		{
+			predicted = fromBtb;
+		}
+
+		missed = predicted != nextPc;
+
+		totals.indirect++;
+		totals.indirectMisses += missed;
+
+		if(isReturn)
+		{
+			totals.returns++;
+			totals.returnMisses += missed;
+		}
+	}
+
+	// BGEZAL and BLTZAL only link when they are taken
+	if(d.op == op_JAL || d.op == op_JALR
+		|| ((d.op == op_BGEZAL || d.op == op_BLTZAL) && taken))
+	{
+		predictor_push(pred, pc + 4);
+	}
+
+	predictor_site &site = pred.sites[pc];
+
+	site.executed++;
+	site.mispredicted += missed;
+
+	return missed;
+}
+
+mips_error predictor_write(const predictor_model &pred, FILE *dst)
+{
+	std::vector<uint32_t> pcs;
+	std::unordered_map<uint32_t, predictor_site>::const_iterator it;
+
+	for(it = pred.sites.begin(); it != pred.sites.end(); ++it)
+	{
+		pcs.push_back(it->first);
+	}
+
+	std::sort(pcs.begin(), pcs.end());
+
+	fprintf(dst, "# pc executed mispredicted\n");
+
+	for(unsigned i = 0; i < pcs.size(); i++)
+	{
+		const predictor_site &site = pred.sites.find(pcs[i])->second;
+
+		fprintf(dst, "%08x %llu %llu\n", pcs[i],
+			(unsigned long long)site.executed, (unsigned long long)site.mispredicted);
+	}
+
+	return ferror(dst) ? mips_ErrorFileWriteError : mips_Success;
+}
@@ -0,0 +1,51 @@
+#ifndef mips_cpu_predictor_header
+#define mips_cpu_predictor_header
+
+#include "mips_cpu_decoder.h"
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+// Counts for one branch or jump
+struct predictor_site
+{
+	uint64_t executed;
+	uint64_t mispredicted;
+};
+
+struct predictor_model
+{
+	bool enabled;
+	mips_cpu_predictor_config config;
+	mips_cpu_predictor_stats totals;
+
+	std::vector<uint8_t> counters;	// Two bit saturating counters, taken from 2 up
+	uint32_t history;				// Recent conditional outcomes, newest in bit 0
+
+	// Direct mapped, tagged with the full pc of the jump
+	std::vector<uint32_t> btbTags;
+	std::vector<uint32_t> btbTargets;
+
+	// Circular, so the oldest return is lost when it overflows
+	uint32_t ras[64];
+	unsigned rasTop;
+	unsigned rasCount;
+
+	std::unordered_map<uint32_t, predictor_site> sites;
+};
+
+void predictor_init(predictor_model &pred);
+
+// Returns false, leaving the model as it was, if config cannot be built
+bool predictor_configure(predictor_model &pred, const mips_cpu_predictor_config &config);
+
+// Sets the counts to zero and forgets everything learned
+void predictor_reset(predictor_model &pred);
+
+// Checks the prediction for a branch or jump which has completed, leaving
+// the pc at nextPc, then learns from it. Returns true if it was mispredicted.
+bool predictor_retire(predictor_model &pred, const decoded_instr &d, uint32_t pc, uint32_t nextPc);
+
+mips_error predictor_write(const predictor_model &pred, FILE *dst);
+
+#endif
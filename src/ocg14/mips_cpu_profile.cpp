@@ -0,0 +1,71 @@
+#include "mips_cpu_profile.h"
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+void profile_init(profile &prof)
+{
+	prof.enabled = false;
+	prof.lastTag = 0;
+	prof.lastPage = 0;
+}
+
+void profile_free(profile &prof)
+{
+	std::unordered_map<uint32_t, profile_page*>::iterator it;
+
+	for(it = prof.pages.begin(); it != prof.pages.end(); ++it)
+	{
+		delete it->second;
+	}
+
+	prof.pages.clear();
+	prof.lastPage = 0;
+}
+
+profile_page *profile_page_for(profile &prof, uint32_t tag)
+{
+	profile_page *&page = prof.pages[tag];
+
+	if(!page)
+	{
+		page = new profile_page;
+		memset(page, 0, sizeof(profile_page));
+	}
+
+	prof.lastTag = tag;
+	prof.lastPage = page;
+
+	return page;
+}
+
+mips_error profile_write(const profile &prof, FILE *dst)
+{
+	std::vector<uint32_t> tags;
+	std::unordered_map<uint32_t, profile_page*>::const_iterator it;
+
+	for(it = prof.pages.begin(); it != prof.pages.end(); ++it)
+	{
+		tags.push_back(it->first);
+	}
+
+	std::sort(tags.begin(), tags.end());
+
+	fprintf(dst, "# pc executed faults\n");
+
+	for(unsigned i = 0; i < tags.size(); i++)
+	{
+		const profile_page *page = prof.pages.find(tags[i])->second;
+
+		for(uint32_t w = 0; w < ICACHE_PAGE_WORDS; w++)
+		{
+			if(page->executed[w] || page->faults[w])
+			{
+				fprintf(dst, "%08x %llu %llu\n", (tags[i] << ICACHE_PAGE_BITS) | (w << 2),
+					(unsigned long long)page->executed[w], (unsigned long long)page->faults[w]);
+			}
+		}
+	}
+
+	return ferror(dst) ? mips_ErrorFileWriteError : mips_Success;
+}
@@ -0,0 +1,53 @@
+#ifndef mips_cpu_profile_header
+#define mips_cpu_profile_header
+
+#include "mips_cpu_icache.h"
+#include <stdio.h>
+#include <unordered_map>
+
+// Counters for every word of one page, using the same pages as the icache
+struct profile_page
+{
+	uint64_t executed[ICACHE_PAGE_WORDS];
+	uint64_t faults[ICACHE_PAGE_WORDS];	// Memory exceptions raised there
+};
+
+struct profile
+{
+	bool enabled;
+
+	// Runs nearly always stay on one page, so remember the last one
+	uint32_t lastTag;
+	profile_page *lastPage;
+
+	std::unordered_map<uint32_t, profile_page*> pages;
+};
+
+void profile_init(profile &prof);
+void profile_free(profile &prof);
+
+// Finds or creates the counters for a page, and makes it the last page
+profile_page *profile_page_for(profile &prof, uint32_t tag);
+
+// Writes every pc with a non-zero count, in address order
+mips_error profile_write(const profile &prof, FILE *dst);
+
+inline void profile_count(profile &prof, uint32_t pc)
+{
+	uint32_t tag = pc >> ICACHE_PAGE_BITS;
+	profile_page *page = prof.lastPage;
+
+	if(!page || prof.lastTag != tag)
+	{
+		page = profile_page_for(prof, tag);
+	}
+
+	page->executed[(pc >> 2) & (ICACHE_PAGE_WORDS - 1)]++;
+}
+
+inline void profile_fault(profile &prof, uint32_t pc)
+{
+	profile_page_for(prof, pc >> ICACHE_PAGE_BITS)->faults[(pc >> 2) & (ICACHE_PAGE_WORDS - 1)]++;
+}
+
+#endif
@@ -0,0 +1,215 @@
+#include "mips.h"
+#include "mips_cpu_stats.h"
+#include <string.h>
+
+// Same order as the instruction list in the test framework
+static const char *const sg_mnemonics[MIPS_CPU_STATS_MNEMONICS] =
+{
+	"ADD", "ADDI", "ADDIU", "ADDU", "AND", "ANDI",
+	"BEQ", "BGEZ", "BGEZAL", "BGTZ", "BLEZ", "BLTZ", "BLTZAL", "BNE",
+	"DIV", "DIVU", "J", "JAL", "JALR", "JR",
+	"LB", "LBU", "LH", "LHU", "LUI", "LW", "LWL", "LWR",
+	"MFHI", "MFLO", "MTHI", "MTLO", "MULT", "MULTU",
+	"OR", "ORI", "SB", "SH", "SLL", "SLLV", "SLT", "SLTI", "SLTIU", "SLTU",
+	"SRA", "SRAV", "SRL", "SRLV", "SUB", "SUBU", "SW", "XOR", "XORI"
+};
+
+static const char *const sg_opNames[op_count] =
+{
+	"<INVALID>",
+#define MIPS_CPU_OP_NAME(name) #name,
+	MIPS_CPU_OPS(MIPS_CPU_OP_NAME)
+#undef MIPS_CPU_OP_NAME
+};
+
+static const char *const sg_classNames[mips_ClassCount] =
+{
+	"Arithmetic", "Logic", "Shift", "MultDiv", "Load", "Store", "Branch", "Jump"
+};
+
+static const char *const sg_exceptionNames[MIPS_CPU_STATS_EXCEPTIONS] =
+{
+	"Break", "InvAddress", "InvAlign", "AccessViol", "InvInstr", "Overflow"
+};
+
+static mips_cpu_instr_class stats_class(unsigned op)
+{
+	switch(op)
+	{
+		case op_AND: case op_ANDI: case op_OR: case op_ORI: case op_XOR: case op_XORI:
+			return mips_ClassLogic;
+		case op_SLL: case op_SLLV: case op_SRA: case op_SRAV: case op_SRL: case op_SRLV:
+			return mips_ClassShift;
+		case op_DIV: case op_DIVU: case op_MULT: case op_MULTU:
+		case op_MFHI: case op_MFLO: case op_MTHI: case op_MTLO:
+			return mips_ClassMultDiv;
+		case op_LB: case op_LBU: case op_LH: case op_LHU: case op_LW: case op_LWL: case op_LWR:
+			return mips_ClassLoad;
+		case op_SB: case op_SH: case op_SW:
+			return mips_ClassStore;
+		case op_BEQ: case op_BGEZ: case op_BGEZAL: case op_BGTZ:
+		case op_BLEZ: case op_BLTZ: case op_BLTZAL: case op_BNE:
+			return mips_ClassBranch;
+		case op_J: case op_JAL: case op_JALR: case op_JR:
+			return mips_ClassJump;
+		default:
+			return mips_ClassArithmetic;
+	}
+}
+
+// Log2 of the bytes a load or store moves
+static unsigned stats_width(unsigned op)
+{
+	switch(op)
+	{
+		case op_LB: case op_LBU: case op_SB:
+			return 0;
+		case op_LH: case op_LHU: case op_SH:
+			return 1;
+		default:
+			return 2;
+	}
+}
+
+void stats_reset(cpu_stats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void stats_exception(cpu_stats &stats, mips_error err)
+{
+	if(err >= mips_ExceptionBreak && err < mips_ExceptionBreak + MIPS_CPU_STATS_EXCEPTIONS)
+	{
+		stats.exceptions[err - mips_ExceptionBreak]++;
+	}
+}
+
+void stats_fill(const cpu_stats &stats, mips_cpu_stats &out)
+{
+	memset(&out, 0, sizeof(out));
+
+	// op_invalid never completes, so is never counted
+	for(unsigned op = 1; op < op_count; op++)
+	{
+		uint64_t count = stats.ops[op];
+
+		for(unsigned i = 0; i < MIPS_CPU_STATS_MNEMONICS; i++)
+		{
+			if(!strcmp(sg_mnemonics[i], sg_opNames[op]))
+			{
+				out.mnemonics[i] = count;
+				break;
+			}
+		}
+
+		mips_cpu_instr_class cls = stats_class(op);
+
+		out.instructions += count;
+		out.classes[cls] += count;
+
+		if(cls == mips_ClassLoad)
+		{
+			out.loads[stats_width(op)] += count;
+		}
+		else if(cls == mips_ClassStore)
+		{
+			out.stores[stats_width(op)] += count;
+		}
+	}
+
+	out.branchesTaken = stats.branchesTaken;
+	out.branchesNotTaken = out.classes[mips_ClassBranch] - stats.branchesTaken;
+
+	for(unsigned i = 0; i < MIPS_CPU_STATS_EXCEPTIONS; i++)
+	{
+		out.exceptions[i] = stats.exceptions[i];
+	}
+}
+
+static double stats_share(uint64_t count, uint64_t total)
+{
+	return total ? 100.0 * count / (double)total : 0.0;
+}
+
+static void stats_row(FILE *dst, const char *name, uint64_t count, uint64_t total)
+{
+	fprintf(dst, "|%12s | %12llu |  %5.1f%% |\n", name, (unsigned long long)count, stats_share(count, total));
+}
+
+void stats_print(const mips_cpu_stats &stats, const mips_cpu_timing &timing,
+	const mips_cpu_predictor_stats &predictor, FILE *dst)
+{
+	const char *rule = "+-------------+--------------+---------+\n";
+
+	fprintf(dst, "\n");
+	fprintf(dst, "| Instruction |        count |   share |\n");
+	fprintf(dst, "%s", rule);
+
+	for(unsigned i = 0; i < MIPS_CPU_STATS_MNEMONICS; i++)
+	{
+		if(stats.mnemonics[i])
+		{
+			stats_row(dst, sg_mnemonics[i], stats.mnemonics[i], stats.instructions);
+		}
+	}
+
+	fprintf(dst, "%s", rule);
+	fprintf(dst, "\n");
+	fprintf(dst, "|       Class |        count |   share |\n");
+	fprintf(dst, "%s", rule);
+
+	for(unsigned i = 0; i < mips_ClassCount; i++)
+	{
+		stats_row(dst, sg_classNames[i], stats.classes[i], stats.instructions);
+	}
+
+	fprintf(dst, "%s", rule);
+	fprintf(dst, "\n");
+	fprintf(dst, "|   Exception |        count |\n");
+	fprintf(dst, "+-------------+--------------+\n");
+
+	for(unsigned i = 0; i < MIPS_CPU_STATS_EXCEPTIONS; i++)
+	{
+		fprintf(dst, "|%12s | %12llu |\n", sg_exceptionNames[i], (unsigned long long)stats.exceptions[i]);
+	}
+
+	fprintf(dst, "+-------------+--------------+\n");
+	fprintf(dst, "\n");
+
+	uint64_t branches = stats.branchesTaken + stats.branchesNotTaken;
+
+	fprintf(dst, "Instructions executed :     %llu\n", (unsigned long long)stats.instructions);
+	fprintf(dst, "Branches taken :            %llu (%5.1f%%)\n",
+		(unsigned long long)stats.branchesTaken, stats_share(stats.branchesTaken, branches));
+	fprintf(dst, "Branches not taken :        %llu (%5.1f%%)\n",
+		(unsigned long long)stats.branchesNotTaken, stats_share(stats.branchesNotTaken, branches));
+	fprintf(dst, "Loads (byte/half/word) :    %llu / %llu / %llu\n",
+		(unsigned long long)stats.loads[0], (unsigned long long)stats.loads[1], (unsigned long long)stats.loads[2]);
+	fprintf(dst, "Stores (byte/half/word) :   %llu / %llu / %llu\n",
+		(unsigned long long)stats.stores[0], (unsigned long long)stats.stores[1], (unsigned long long)stats.stores[2]);
+
+	if(timing.instructions)
+	{
+		fprintf(dst, "Cycles (timed instrs) :     %llu (%llu)\n",
+			(unsigned long long)timing.cycles, (unsigned long long)timing.instructions);
+		fprintf(dst, "CPI :                       %.3f\n", timing.cycles / (double)timing.instructions);
+		fprintf(dst, "Stalls (load/hilo/branch) : %llu / %llu / %llu\n",
+			(unsigned long long)timing.loadUseStalls, (unsigned long long)timing.hiloStalls,
+			(unsigned long long)timing.branchStalls);
+	}
+
+	if(predictor.branches || predictor.indirect)
+	{
+		fprintf(dst, "Branch mispredictions :     %llu (%5.1f%%)\n",
+			(unsigned long long)predictor.branchMisses, stats_share(predictor.branchMisses, predictor.branches));
+		fprintf(dst, "Indirect mispredictions :   %llu (%5.1f%%)\n",
+			(unsigned long long)predictor.indirectMisses, stats_share(predictor.indirectMisses, predictor.indirect));
+		fprintf(dst, "Return mispredictions :     %llu (%5.1f%%)\n",
+			(unsigned long long)predictor.returnMisses, stats_share(predictor.returnMisses, predictor.returns));
+	}
+}
+
+const char *mips_cpu_stats_mnemonic(unsigned index)
+{
+	return index < MIPS_CPU_STATS_MNEMONICS ? sg_mnemonics[index] : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef mips_cpu_stats_header
+#define mips_cpu_stats_header
+
+#include "mips_cpu_decoder.h"
+#include <stdio.h>
+
+// Only what has to be counted as instructions run is kept here; classes
+// and access sizes are worked out from the per-op counts when asked for
+struct cpu_stats
+{
+	uint64_t ops[op_count];
+	uint64_t branchesTaken;
+	uint64_t exceptions[MIPS_CPU_STATS_EXCEPTIONS];
+};
+
+void stats_reset(cpu_stats &stats);
+
+// Counts the error a run stopped with, if it came from the program
+void stats_exception(cpu_stats &stats, mips_error err);
+
+void stats_fill(const cpu_stats &stats, mips_cpu_stats &out);
+
+// Cycles and CPI, and misprediction rates, are only printed if timing
+// and the branch predictor have counted something
+void stats_print(const mips_cpu_stats &stats, const mips_cpu_timing &timing,
+	const mips_cpu_predictor_stats &predictor, FILE *dst);
+
+#endif
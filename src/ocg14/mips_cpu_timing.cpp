@@ -0,0 +1,128 @@
+#include "mips.h"
+#include "mips_cpu_timing.h"
+#include <string.h>
+
+// Cycles from an instruction entering fetch to leaving writeback
+const uint32_t TIMING_PIPELINE_DEPTH = 5;
+
+void timing_init(timing_model &timing)
+{
+	timing.enabled = false;
+
+	timing.config.loadUseStall = 1;
+	timing.config.branchPenalty = 1;
+	timing.config.multLatency = 5;
+	timing.config.divLatency = 35;
+
+	timing_reset(timing);
+}
+
+void timing_reset(timing_model &timing)
+{
+	memset(&timing.totals, 0, sizeof(timing.totals));
+
+	timing.loadDest = 0;
+	timing.hiloReady = 0;
+}
+
+// General purpose registers an instruction needs in execute. $0 never
+// causes a stall, so is used for "nothing".
+static void timing_sources(const decoded_instr &d, uint8_t &a, uint8_t &b)
+{
+	a = 0;
+	b = 0;
+
+	switch(d.op)
+	{
+		case op_SLL: case op_SRL: case op_SRA:
+			a = d.rt;
+			break;
+		case op_ADDI: case op_ADDIU: case op_ANDI: case op_ORI: case op_XORI:
+		case op_SLTI: case op_SLTIU:
+		case op_LB: case op_LBU: case op_LH: case op_LHU: case op_LW:
+		case op_BGEZ: case op_BGEZAL: case op_BGTZ: case op_BLEZ: case op_BLTZ: case op_BLTZAL:
+		case op_JR: case op_JALR: case op_MTHI: case op_MTLO:
+			a = d.rs;
+			break;
+		case op_J: case op_JAL: case op_MFHI: case op_MFLO: case op_invalid:
+			break;
+		default:
+			// Two register ALU ops, stores, LWL/LWR, BEQ/BNE, MULT/DIV
+			a = d.rs;
+			b = d.rt;
+			break;
+	}
+}
+
+static bool timing_is_load(uint8_t op)
+{
+	switch(op)
+	{
+		case op_LB: case op_LBU: case op_LH: case op_LHU: case op_LW: case op_LWL: case op_LWR:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void timing_retire(timing_model &timing, const decoded_instr &d, bool redirected)
+{
+	mips_cpu_timing &totals = timing.totals;
+	uint64_t stall = 0;
+
+	// Nothing leaves the pipeline until the first instruction reaches the end
+	if(totals.instructions == 0)
+	{
+		totals.cycles += TIMING_PIPELINE_DEPTH - 1;
+	}
+
+	uint8_t a, b;
+	timing_sources(d, a, b);
+
+	if(timing.loadDest && (a == timing.loadDest || b == timing.loadDest))
+	{
+		stall = timing.config.loadUseStall;
+		totals.loadUseStalls += stall;
+	}
+
+	uint64_t issue = totals.cycles + stall;
+	uint64_t hilo = 0;
+
+	switch(d.op)
+	{
+		case op_MULT: case op_MULTU: case op_DIV: case op_DIVU:
+		case op_MFHI: case op_MFLO: case op_MTHI: case op_MTLO:
+			// The unit is not pipelined, and HI/LO are interlocked
+			if(timing.hiloReady > issue)
+			{
+				hilo = timing.hiloReady - issue;
+				totals.hiloStalls += hilo;
+			}
+			break;
+		default:
+			break;
+	}
+
+	issue += hilo;
+
+	if(d.op == op_MULT || d.op == op_MULTU)
+	{
+		timing.hiloReady = issue + timing.config.multLatency;
+	}
+	else if(d.op == op_DIV || d.op == op_DIVU)
+	{
+		timing.hiloReady = issue + timing.config.divLatency;
+	}
+
+	totals.cycles = issue + 1;
+	totals.instructions++;
+
+	// The instruction fetched behind the branch or jump is lost
+	if((d.flags & decode_Branch) && redirected)
+	{
+		totals.cycles += timing.config.branchPenalty;
+		totals.branchStalls += timing.config.branchPenalty;
+	}
+
+	timing.loadDest = timing_is_load(d.op) ? d.rt : 0;
+}
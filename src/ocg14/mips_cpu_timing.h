@@ -0,0 +1,26 @@
+#ifndef mips_cpu_timing_header
+#define mips_cpu_timing_header
+
+#include "mips_cpu_decoder.h"
+
+// Scoreboard for the classic five stage pipeline. Cycles are counted as
+// each instruction leaves decode, so an instruction with no hazards adds
+// exactly one.
+struct timing_model
+{
+	bool enabled;
+	mips_cpu_timing_config config;
+	mips_cpu_timing totals;
+
+	uint8_t loadDest;		// Register loaded by the previous instruction, or zero
+	uint64_t hiloReady;		// Cycle at which the multiply/divide unit is free
+};
+
+void timing_init(timing_model &timing);
+void timing_reset(timing_model &timing);
+
+// Accounts for an instruction which has completed. redirected is true if
+// the instruction after it was not the one fetched behind it.
+void timing_retire(timing_model &timing, const decoded_instr &d, bool redirected);
+
+#endif
@@ -0,0 +1,173 @@
+#include "mips_cpu_trace.h"
+#include <chrono>
+
+void trace_ring_init(trace_ring &ring)
+{
+	ring.slots = 0;
+	ring.dst = 0;
+	ring.encoder = 0;
+	ring.running = false;
+	ring.head.store(0);
+	ring.cachedTail = 0;
+	ring.tail.store(0);
+	ring.stop.store(false);
+}
+
+static void trace_ring_drain(trace_ring *ring)
+{
+	uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+	for(;;)
+	{
+		// Read stop before head, so that once stop is seen every record
+		// pushed before it is visible too
+		bool stopping = ring->stop.load(std::memory_order_acquire);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+
+		if(head == tail)
+		{
+			if(stopping)
+			{
+				break;
+			}
+
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			continue;
+		}
+
+		while(tail != head)
+		{
+			uint32_t index = tail & (TRACE_RING_SIZE - 1);
+			uint64_t count = head - tail;
+
+			// Write up to the end of the buffer, then wrap
+			if(count > TRACE_RING_SIZE - index)
+			{
+				count = TRACE_RING_SIZE - index;
+			}
+
+			if(ring->encoder)
+			{
+				for(uint64_t i = 0; i < count; i++)
+				{
+					mips_trace_writer_append(ring->encoder, &ring->slots[index + i]);
+				}
+			}
+			else
+			{
+				fwrite(&ring->slots[index], sizeof(mips_trace_record), count, ring->dst);
+			}
+
+			tail += count;
+			ring->tail.store(tail, std::memory_order_release);
+		}
+	}
+
+	if(ring->encoder)
+	{
+		mips_trace_writer_close(ring->encoder);
+		ring->encoder = 0;
+	}
+	else
+	{
+		fflush(ring->dst);
+	}
+}
+
+mips_error trace_ring_start(trace_ring &ring, FILE *dst, bool compressed)
+{
+	if(compressed)
+	{
+		ring.encoder = mips_trace_writer_create(dst);
+
+		if(!ring.encoder)
+		{
+			return mips_ErrorFileWriteError;
+		}
+	}
+	else
+	{
+		mips_trace_file_header header;
+		header.magic = MIPS_TRACE_MAGIC;
+		header.version = MIPS_TRACE_VERSION;
+		header.recordSize = sizeof(mips_trace_record);
+
+		if(fwrite(&header, sizeof(header), 1, dst) != 1)
+		{
+			return mips_ErrorFileWriteError;
+		}
+	}
+
+	if(!ring.slots)
+	{
+		ring.slots = new mips_trace_record[TRACE_RING_SIZE];
+	}
+
+	ring.dst = dst;
+	ring.head.store(0);
+	ring.cachedTail = 0;
+	ring.tail.store(0);
+	ring.stop.store(false);
+	ring.writer = std::thread(trace_ring_drain, &ring);
+	ring.running = true;
+
+	return mips_Success;
+}
+
+void trace_ring_stop(trace_ring &ring)
+{
+	if(ring.running)
+	{
+		ring.stop.store(true, std::memory_order_release);
+		ring.writer.join();
+		ring.running = false;
+	}
+}
+
+void trace_ring_free(trace_ring &ring)
+{
+	trace_ring_stop(ring);
+
+	delete[] ring.slots;
+	ring.slots = 0;
+}
+
+uint8_t trace_dest(const decoded_instr &d)
+{
+	switch(d.op)
+	{
+		case op_ADD: case op_ADDU: case op_AND: case op_OR: case op_SLT:
+		case op_SLTU: case op_SUB: case op_SUBU: case op_XOR: case op_JALR:
+		case op_MFHI: case op_MFLO: case op_SLL: case op_SLLV: case op_SRA:
+		case op_SRAV: case op_SRL: case op_SRLV:
+			return d.rd;
+		case op_ADDI: case op_ADDIU: case op_ANDI: case op_ORI: case op_SLTI:
+		case op_SLTIU: case op_XORI: case op_LB: case op_LBU: case op_LH:
+		case op_LHU: case op_LW: case op_LWL: case op_LWR:
+			return d.rt;
+		case op_BGEZAL: case op_BLTZAL: case op_JAL:
+			return 31;
+		case op_MTHI:
+			return mips_TraceDestHi;
+		case op_MTLO:
+			return mips_TraceDestLo;
+		case op_DIV: case op_DIVU: case op_MULT: case op_MULTU:
+			return mips_TraceDestHiLo;
+		default:
+			return MIPS_TRACE_NO_DEST;
+	}
+}
+
+uint8_t trace_mem_flags(const decoded_instr &d)
+{
+	switch(d.op)
+	{
+		case op_LB: case op_LBU: case op_LH: case op_LHU: case op_LW:
+		case op_LWL: case op_LWR:
+			return mips_TraceMemRead;
+		case op_SB: case op_SH: case op_SW:
+			return mips_TraceMemWrite;
+		default:
+			return 0;
+	}
+}
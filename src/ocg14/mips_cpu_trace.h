@@ -0,0 +1,70 @@
+#ifndef mips_cpu_trace_header
+#define mips_cpu_trace_header
+
+#include "mips_cpu_decoder.h"
+#include "mips_trace.h"
+#include <atomic>
+#include <thread>
+
+// Records held between the CPU and the writer thread, a power of two
+const uint32_t TRACE_RING_SIZE = 1u << 16;
+
+// Single-producer single-consumer queue of trace records. The CPU is the
+// only writer of head and the background thread the only writer of tail,
+// so neither side ever needs a lock.
+struct trace_ring
+{
+	mips_trace_record *slots;
+	FILE *dst;
+	mips_trace_writer_h encoder;	// Set when writing a compressed trace
+	bool running;
+
+	// Each side's counters are kept on their own cache line
+	char padHead[64];
+	std::atomic<uint64_t> head;
+	uint64_t cachedTail;	// Producer's last view of tail
+
+	char padTail[64];
+	std::atomic<uint64_t> tail;
+	std::atomic<bool> stop;
+
+	std::thread writer;
+};
+
+void trace_ring_init(trace_ring &ring);
+
+// Writes the trace header to dst and starts the writer thread
+mips_error trace_ring_start(trace_ring &ring, FILE *dst, bool compressed);
+
+// Waits for everything queued to be written, then stops the thread
+void trace_ring_stop(trace_ring &ring);
+
+void trace_ring_free(trace_ring &ring);
+
+// Register an instruction writes, as recorded in mips_trace_record::dest
+uint8_t trace_dest(const decoded_instr &d);
+
+// Whether an instruction reads or writes memory, as mips_trace_flags
+uint8_t trace_mem_flags(const decoded_instr &d);
+
+// Queues one record, waiting for the writer if the ring is full so that
+// nothing is ever dropped
+inline void trace_ring_push(trace_ring &ring, const mips_trace_record &rec)
+{
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+	while(head - ring.cachedTail >= TRACE_RING_SIZE)
+	{
+		ring.cachedTail = ring.tail.load(std::memory_order_acquire);
+
+		if(head - ring.cachedTail >= TRACE_RING_SIZE)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	ring.slots[head & (TRACE_RING_SIZE - 1)] = rec;
+	ring.head.store(head + 1, std::memory_order_release);
+}
+
+#endif
@@ -0,0 +1,437 @@
+#include "mips_test_vectors.h"
+#include <string.h>
+
+static bool vector_check(const test_vector &v)
+{
+	if(!v.instruction[0] || v.instruction[VECTOR_MAX_NAME - 1]
+		|| v.codeWords < 1 || v.codeWords > VECTOR_MAX_CODE
+		|| v.memInCount > VECTOR_MAX_MEM || v.memOutCount > VECTOR_MAX_MEM
+		|| (v.setRegs & 1))
+	{
+		return false;
+	}
+
+	for(unsigned i = 0; i < v.memInCount; i++)
+	{
+		if(v.memIn[i].address % 4 || v.memIn[i].address >= VECTOR_RAM_SIZE)
+		{
+			return false;
+		}
+	}
+
+	for(unsigned i = 0; i < v.memOutCount; i++)
+	{
+		if(v.memOut[i].address % 4 || v.memOut[i].address >= VECTOR_RAM_SIZE)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Applies one "name=value" item to v, either as a setting or a check
+static bool vector_item(test_vector &v, char *item, bool check)
+{
+	char *eq = strchr(item, '=');
+
+	if(!eq)
+	{
+		return false;
+	}
+
+	*eq = 0;
+
+	char *end;
+	uint32_t value = (uint32_t)strtoul(eq + 1, &end, 0);
+
+	if(end == eq + 1 || *end)
+	{
+		return false;
+	}
+
+	if(item[0] == '$')
+	{
+		unsigned long reg = strtoul(item + 1, &end, 10);
+
+		if(end == item + 1 || *end || reg > 31)
+		{
+			return false;
+		}
+
+		if(check)
+		{
+			v.checkRegs |= 1u << reg;
+			v.regsOut[reg] = value;
+		}
+		else
+		{
+			v.setRegs |= 1u << reg;
+			v.regsIn[reg] = value;
+		}
+
+		return true;
+	}
+
+	if(item[0] == '[' && eq[-1] == ']')
+	{
+		uint32_t &count = check ? v.memOutCount : v.memInCount;
+		vector_word *words = check ? v.memOut : v.memIn;
+
+		if(count == VECTOR_MAX_MEM)
+		{
+			return false;
+		}
+
+		words[count].address = (uint32_t)strtoul(item + 1, &end, 0);
+		words[count].value = value;
+		count++;
+
+		return end == eq - 1;
+	}
+
+	if(!check && !strcmp(item, "steps"))
+	{
+		v.steps = value;
+		return true;
+	}
+
+	if(check && !strcmp(item, "pc"))
+	{
+		v.checkPc = 1;
+		v.pcOut = value;
+		return true;
+	}
+
+	if(check && !strcmp(item, "error"))
+	{
+		v.error = value;
+		return true;
+	}
+
+	return false;
+}
+
+// Returns false for blank and comment lines; sets bad if the line could not be parsed
+static bool vector_parse(char *line, test_vector &v, bool &bad)
+{
+	memset(&v, 0, sizeof(v));
+	bad = false;
+
+	char *name = strtok(line, " \t\r\n");
+
+	if(!name || name[0] == '#')
+	{
+		return false;
+	}
+
+	bad = true;
+
+	if(strlen(name) >= VECTOR_MAX_NAME)
+	{
+		return false;
+	}
+
+	strcpy(v.instruction, name);
+
+	char *codes = strtok(0, " \t\r\n");
+
+	if(!codes)
+	{
+		return false;
+	}
+
+	for(char *word = codes; ; word++)
+	{
+		char *end;
+
+		if(v.codeWords == VECTOR_MAX_CODE)
+		{
+			return false;
+		}
+
+		v.code[v.codeWords++] = (uint32_t)strtoul(word, &end, 16);
+
+		if(end == word || (*end && *end != ','))
+		{
+			return false;
+		}
+
+		if(!*end)
+		{
+			break;
+		}
+
+		word = end;
+	}
+
+	v.steps = v.codeWords;
+
+	bool check = false;
+	char *item;
+
+	while((item = strtok(0, " \t\r\n")))
+	{
+		if(!strcmp(item, "=>") && !check)
+		{
+			check = true;
+		}
+		else if(!vector_item(v, item, check))
+		{
+			return false;
+		}
+	}
+
+	bad = !vector_check(v);
+
+	return !bad;
+}
+
+static mips_error vectors_load_text(const char *path, FILE *src, std::vector<test_vector> &vectors)
+{
+	char line[1024];
+	uint32_t lineNo = 0;
+	test_vector v;
+	bool bad;
+
+	while(fgets(line, sizeof(line), src))
+	{
+		lineNo++;
+
+		if(vector_parse(line, v, bad))
+		{
+			v.id = lineNo;
+			vectors.push_back(v);
+		}
+		else if(bad)
+		{
+			fprintf(stderr, "%s:%u: cannot parse test vector.\n", path, lineNo);
+			return mips_ErrorFileReadError;
+		}
+	}
+
+	return ferror(src) ? mips_ErrorFileReadError : mips_Success;
+}
+
+static mips_error vectors_load_binary(const char *path, FILE *src, std::vector<test_vector> &vectors)
+{
+	vector_file_header header;
+
+	if(1 != fread(&header, sizeof(header), 1, src)
+		|| header.version != VECTOR_FILE_VERSION || header.recordSize != sizeof(test_vector))
+	{
+		fprintf(stderr, "%s: unsupported test vector file version.\n", path);
+		return mips_ErrorFileReadError;
+	}
+
+	test_vector v;
+
+	while(1 == fread(&v, sizeof(v), 1, src))
+	{
+		if(!vector_check(v))
+		{
+			fprintf(stderr, "%s: test vector %u is not valid.\n", path, v.id);
+			return mips_ErrorFileReadError;
+		}
+
+		vectors.push_back(v);
+	}
+
+	return ferror(src) ? mips_ErrorFileReadError : mips_Success;
+}
+
+mips_error vectors_load(const char *path, std::vector<test_vector> &vectors)
+{
+	FILE *src = fopen(path, "rb");
+
+	if(!src)
+	{
+		fprintf(stderr, "Cannot open test vectors '%s'.\n", path);
+		return mips_ErrorFileReadError;
+	}
+
+	uint32_t magic = 0;
+	size_t got = fread(&magic, sizeof(magic), 1, src);
+
+	rewind(src);
+
+	mips_error err;
+
+	if(got == 1 && magic == VECTOR_FILE_MAGIC)
+	{
+		err = vectors_load_binary(path, src, vectors);
+	}
+	else
+	{
+		err = vectors_load_text(path, src, vectors);
+	}
+
+	fclose(src);
+
+	return err;
+}
+
+mips_error vectors_save(const char *path, const std::vector<test_vector> &vectors)
+{
+	FILE *dst = fopen(path, "wb");
+
+	if(!dst)
+	{
+		return mips_ErrorFileWriteError;
+	}
+
+	vector_file_header header;
+
+	header.magic = VECTOR_FILE_MAGIC;
+	header.version = VECTOR_FILE_VERSION;
+	header.recordSize = sizeof(test_vector);
+
+	bool ok = 1 == fwrite(&header, sizeof(header), 1, dst);
+
+	if(ok && vectors.size())
+	{
+		ok = vectors.size() == fwrite(&vectors[0], sizeof(test_vector), vectors.size(), dst);
+	}
+
+	ok = (0 == fclose(dst)) && ok;
+
+	return ok ? mips_Success : mips_ErrorFileWriteError;
+}
+
+// Memory holds words most significant byte first
+static mips_error vector_write_word(mips_mem_h mem, uint32_t address, uint32_t value)
+{
+	uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+
+	return mips_mem_write(mem, address, 4, bytes);
+}
+
+static mips_error vector_read_word(mips_mem_h mem, uint32_t address, uint32_t &value)
+{
+	uint8_t bytes[4];
+	mips_error err = mips_mem_read(mem, address, 4, bytes);
+
+	value = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+
+	return err;
+}
+
+// Runs one vector, returning false and describing the first difference in msg if it failed
+static bool vector_execute(mips_cpu_h cpu, mips_mem_h mem, const test_vector &v, char *msg, size_t size)
+{
+	mips_error err = mips_Success;
+
+	for(unsigned i = 0; i < v.codeWords && !err; i++)
+	{
+		err = vector_write_word(mem, i * 4, v.code[i]);
+	}
+
+	for(unsigned i = 0; i < v.memInCount && !err; i++)
+	{
+		err = vector_write_word(mem, v.memIn[i].address, v.memIn[i].value);
+	}
+
+	for(unsigned r = 1; r < 32 && !err; r++)
+	{
+		if(v.setRegs & (1u << r))
+		{
+			err = mips_cpu_set_register(cpu, r, v.regsIn[r]);
+		}
+	}
+
+	if(err)
+	{
+		snprintf(msg, size, "vector %u: setup failed with error 0x%x", v.id, err);
+		return false;
+	}
+
+	for(unsigned i = 0; i < v.steps && !err; i++)
+	{
+		err = mips_cpu_step(cpu);
+	}
+
+	if(err != (mips_error)v.error)
+	{
+		snprintf(msg, size, "vector %u: error 0x%x, expected 0x%x", v.id, err, v.error);
+		return false;
+	}
+
+	for(unsigned r = 0; r < 32; r++)
+	{
+		uint32_t got = 0;
+
+		if((v.checkRegs & (1u << r))
+			&& (mips_cpu_get_register(cpu, r, &got) || got != v.regsOut[r]))
+		{
+			snprintf(msg, size, "vector %u: $%u is 0x%08x, expected 0x%08x", v.id, r, got, v.regsOut[r]);
+			return false;
+		}
+	}
+
+	for(unsigned i = 0; i < v.memOutCount; i++)
+	{
+		uint32_t got = 0;
+
+		if(vector_read_word(mem, v.memOut[i].address, got) || got != v.memOut[i].value)
+		{
+			snprintf(msg, size, "vector %u: [0x%x] is 0x%08x, expected 0x%08x",
+				v.id, v.memOut[i].address, got, v.memOut[i].value);
+			return false;
+		}
+	}
+
+	uint32_t pc = 0;
+
+	if(v.checkPc && (mips_cpu_get_pc(cpu, &pc) || pc != v.pcOut))
+	{
+		snprintf(msg, size, "vector %u: pc is 0x%08x, expected 0x%08x", v.id, pc, v.pcOut);
+		return false;
+	}
+
+	return true;
+}
+
+mips_error vectors_run(const test_vector *vectors, size_t count, mips_cpu_engine engine,
+	mips_test_ctx_h ctx, unsigned &passed)
+{
+	passed = 0;
+
+	mips_mem_h mem = mips_mem_create_ram(VECTOR_RAM_SIZE, 4);
+	mips_cpu_h cpu = mem ? mips_cpu_create_with_engine(mem, engine) : 0;
+	mips_snapshot_h blank = 0;
+
+	mips_error err = cpu ? mips_snapshot_take(cpu, &blank) : mips_ErrorInvalidArgument;
+
+	for(size_t i = 0; i < count && !err; i++)
+	{
+		const test_vector &v = vectors[i];
+		char msg[128] = "";
+
+		err = mips_snapshot_restore(blank);
+
+		if(err)
+		{
+			break;
+		}
+
+		int testId = ctx ? mips_test_ctx_begin_test(ctx, v.instruction) : mips_test_begin_test(v.instruction);
+		bool ok = vector_execute(cpu, mem, v, msg, sizeof(msg));
+
+		if(ctx)
+		{
+			err = mips_test_ctx_end_test(ctx, testId, ok, msg);
+		}
+		else
+		{
+			mips_test_end_test(testId, ok, msg);
+		}
+
+		passed += ok;
+	}
+
+	mips_snapshot_free(blank);
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+
+	return err;
+}
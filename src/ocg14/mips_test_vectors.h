@@ -0,0 +1,79 @@
+#ifndef mips_test_vectors_header
+#define mips_test_vectors_header
+
+#include "mips.h"
+#include "mips_test.h"
+#include <vector>
+
+const unsigned VECTOR_MAX_CODE = 4;
+const unsigned VECTOR_MAX_MEM = 4;
+const unsigned VECTOR_MAX_NAME = 12;
+
+// Every vector runs in a RAM of this size, with its code at address 0
+const uint32_t VECTOR_RAM_SIZE = 0x10000;
+
+// Binary vector files start with a vector_file_header ("MTVC" on a
+// little-endian host), followed by raw test_vector records. Like binary
+// traces they are in the byte order of the host which wrote them.
+const uint32_t VECTOR_FILE_MAGIC = 0x4356544Du;
+const uint16_t VECTOR_FILE_VERSION = 1;
+
+struct vector_file_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t recordSize;
+};
+
+struct vector_word
+{
+	uint32_t address;
+	uint32_t value;
+};
+
+// One test, written in a text file as
+//
+//     ADD 00853020 $4=0x7fffffff $5=1 => error=0x2005 $6=0
+//     SW ac850010 $4=0x100 $5=7 => [0x110]=7
+//
+// The code words are stored from address 0 and the CPU stepped once per
+// word (or steps= times), stopping at the first error. Settings before
+// the arrow are applied first, and everything after it is checked. All
+// other registers and memory start as zero.
+struct test_vector
+{
+	char instruction[VECTOR_MAX_NAME];	// Passed to mips_test_begin_test
+	uint32_t id;	// Line or record number, for messages
+
+	uint32_t code[VECTOR_MAX_CODE];
+	uint32_t codeWords;
+	uint32_t steps;
+
+	uint32_t setRegs;	// Bit n is set if regsIn[n] is used
+	uint32_t regsIn[32];
+	vector_word memIn[VECTOR_MAX_MEM];
+	uint32_t memInCount;
+
+	uint32_t checkRegs;	// Bit n is set if regsOut[n] is checked
+	uint32_t regsOut[32];
+	vector_word memOut[VECTOR_MAX_MEM];
+	uint32_t memOutCount;
+	uint32_t checkPc;	// Non-zero if pcOut is checked
+	uint32_t pcOut;
+	uint32_t error;	// mips_error expected from the last step
+};
+
+// Reads a text file, or a binary file written by vectors_save. Problems
+// are described on stderr.
+mips_error vectors_load(const char *path, std::vector<test_vector> &vectors);
+
+mips_error vectors_save(const char *path, const std::vector<test_vector> &vectors);
+
+// Runs each vector on the same CPU and RAM, restored from a snapshot in
+// between, and records one test per vector in ctx, or in the global suite
+// if ctx is 0. Different threads can run vectors at once as long as they
+// use different contexts.
+mips_error vectors_run(const test_vector *vectors, size_t count, mips_cpu_engine engine,
+	mips_test_ctx_h ctx, unsigned &passed);
+
+#endif
@@ -7,14 +7,38 @@
 
 #include "mips.h"
 #include "mips_test_encoder.h"
+#include "mips_test_vectors.h"
 #include <string> 
 #include <iostream>
+#include <thread>
 
 using namespace std;
 
 void to_little(const uint32_t rt, uint8_t* pData);
 
-int main()
+// Tests of things other than single instructions, defined after main
+static void test_icache_unaligned();
+static void test_engine_parity();
+static void test_run();
+static void test_binary_trace();
+static void test_trace_codec();
+static void test_fusion();
+static void test_profile();
+static void test_stats();
+static void test_timing();
+static void test_cache_stats();
+static void test_predictor();
+static void test_snapshots();
+static void test_dirty_pages();
+static void test_test_contexts();
+static void test_data_port();
+static void test_sparse_ram();
+static void test_block_wraparound();
+static void test_ram_files();
+static void test_mmio_access();
+static void test_bus();
+
+int main(int argc, char *argv[])
 {
 
 	mips_mem_h mem=mips_mem_create_ram(4096, 4);
@@ -151,20 +175,16 @@ int main()
 	err = mips_cpu_set_register(cpu, 4, 2147483647);
 	err = mips_cpu_set_register(cpu, 5, 2147483647);
  
-	// 3 - step CPU
+	// 3 - step CPU, which should trap rather than write r6
 	err = mips_cpu_step(cpu);
 
-	if(err != mips_Success)
-	{
-		fprintf(stderr, "mips_cpu_set_debug_level : failed.\n" );
-		exit(EXIT_FAILURE);
-	} 
+	passed = err == mips_ExceptionArithmeticOverflow;
  
 	// 4 -Check the result
 
 	err = mips_cpu_get_register(cpu, 6, &got); 
 
-	passed = got == 0;
+	passed = passed && got == 0;
 
 	mips_test_end_test(testId, passed, "2147483647 + 2147483647 != Overflow");
 
@@ -395,9 +415,1717 @@ int main()
 	passed = got == 40&50;
 
 	mips_test_end_test(testId, passed, "40 & 50 != 32"); 
+
+	// Table driven tests, one per line of the file named on the command
+	// line, or of the test_vectors.txt next to this program
+	string vectorsPath = argv[0];
+	size_t slash = vectorsPath.find_last_of("/\\");
+
+	vectorsPath = (slash == string::npos) ? "" : vectorsPath.substr(0, slash + 1);
+	vectorsPath += "test_vectors.txt";
+
+	if(argc > 1)
+	{
+		vectorsPath = argv[1];
+	}
+
+	vector<test_vector> vectors;
+	unsigned vectorsPassed;
+
+	if(vectors_load(vectorsPath.c_str(), vectors) == mips_Success && vectors.size())
+	{
+		// Every engine runs the whole set, as they must all behave the same
+		for(int engine = mips_EngineInterpreter; engine <= mips_EngineJit; engine++)
+		{
+			vectors_run(&vectors[0], vectors.size(), (mips_cpu_engine)engine, 0, vectorsPassed);
+		}
+	}
+
+	test_icache_unaligned();
+	test_engine_parity();
+	test_run();
+	test_binary_trace();
+	test_trace_codec();
+	test_fusion();
+	test_profile();
+	test_stats();
+	test_timing();
+	test_cache_stats();
+	test_predictor();
+	test_snapshots();
+	test_dirty_pages();
+	test_test_contexts();
+	test_data_port();
+	test_sparse_ram();
+	test_block_wraparound();
+	test_ram_files();
+	test_mmio_access();
+	test_bus();
  
 	mips_test_end_suite();
 
 	return 0;
 }
 
+// Big-endian word access for the tests below, written out here so that
+// they do not depend on the CPU's own endian helpers
+static void write_word(mips_mem_h mem, uint32_t address, uint32_t value)
+{
+	uint8_t buffer[4];
+
+	buffer[0] = (uint8_t)(value >> 24);
+	buffer[1] = (uint8_t)(value >> 16);
+	buffer[2] = (uint8_t)(value >> 8);
+	buffer[3] = (uint8_t)value;
+	mips_mem_write(mem, address, 4, buffer);
+}
+
+static uint32_t read_word(mips_mem_h mem, uint32_t address)
+{
+	uint8_t buffer[4] = {0, 0, 0, 0};
+
+	mips_mem_read(mem, address, 4, buffer);
+
+	return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16)
+		| ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+static void test_icache_unaligned()
+{
+	mips_mem_h mem = mips_mem_create_ram(4096, 4);
+	mips_mem_h bytes = mips_mem_create_ram(4096, 1);
+	mips_cpu_h cold = mips_cpu_create(mem);
+	mips_cpu_h cpu = mips_cpu_create(mem);
+	mips_error coldErr;
+	uint32_t got = 0;
+	int testId;
+	int passed;
+
+	// An unaligned pc fails the same way whether or not the word it
+	// falls inside has already been decoded
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	write_word(mem, 0, opcode(0x08) | rs(0) | rt(1) | data(1));	// addi r1, r0, 1
+
+	mips_cpu_set_pc(cold, 2);
+	coldErr = mips_cpu_step(cold);
+
+	passed = mips_cpu_step(cpu) == mips_Success;
+	mips_cpu_set_pc(cpu, 2);
+	passed = passed && coldErr == mips_ExceptionInvalidAlignment;
+	passed = passed && mips_cpu_step(cpu) == coldErr;
+
+	mips_test_end_test(testId, passed, "unaligned pc ran the decoded instruction of its word");
+
+	mips_cpu_free(cpu);
+	mips_cpu_free(cold);
+
+	// Memory which allows the unaligned fetch must not have its result
+	// kept for the aligned pc of the same word
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	cpu = mips_cpu_create(bytes);
+
+	write_word(bytes, 0, opcode(0x08) | rs(0) | rt(1) | data(1));	// addi r1, r0, 1
+	write_word(bytes, 4, opcode(0x08) | rs(0) | rt(2) | data(2));	// addi r2, r0, 2
+
+	mips_cpu_set_pc(cpu, 2);
+	passed = mips_cpu_step(cpu) == mips_Success;
+	mips_cpu_set_pc(cpu, 0);
+	passed = passed && mips_cpu_step(cpu) == mips_Success;
+	mips_cpu_get_register(cpu, 1, &got);
+	passed = passed && got == 1;
+
+	mips_test_end_test(testId, passed, "aligned pc ran the instruction fetched at an unaligned one");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(bytes);
+	mips_mem_free(mem);
+}
+
+// Where one engine stopped and what it left behind
+struct engine_result
+{
+	uint32_t regs[32];
+	uint32_t pc;
+	uint32_t steps;
+	mips_error err;
+	mips_error overflowErr;
+	mips_error alignmentErr;
+	uint32_t memory[0x300 / 4];
+};
+
+static void engine_parity_run(mips_cpu_engine engine, engine_result &result)
+{
+	mips_mem_h mem = mips_mem_create_ram(4096, 4);
+	mips_cpu_h cpu = mips_cpu_create_with_engine(mem, engine);
+
+	// A new RAM holds whatever malloc gave it, and every word compared
+	// below has to start out the same
+	for(uint32_t address = 0; address < 0x300; address += 4)
+	{
+		write_word(mem, address, 0);
+	}
+
+	write_word(mem, 0x00, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+	write_word(mem, 0x04, opcode(0) | rs(2) | rt(1) | rd(2) | func(0x21));	// addu r2, r2, r1
+	write_word(mem, 0x08, opcode(0x23) | rs(0) | rt(3) | data(0x200));	// lw r3, 0x200(r0)
+	write_word(mem, 0x0C, opcode(0) | rs(2) | rt(3) | rd(4) | func(0x23));	// subu r4, r2, r3
+	write_word(mem, 0x10, opcode(0x0B) | rs(1) | rt(5) | data(40));	// sltiu r5, r1, 40
+	write_word(mem, 0x14, opcode(0x02) | addr(0));	// j 0
+	write_word(mem, 0x18, opcode(0) | rs(6) | rt(5) | rd(6) | func(0x21));	// addu r6, r6, r5
+	write_word(mem, 0x100, opcode(0) | rs(7) | rt(7) | rd(8) | func(0x20));	// add r8, r7, r7
+	write_word(mem, 0x200, 7);
+
+	// Long enough for every block to be compiled by the JIT engine
+	result.steps = 0;
+	result.err = mips_Success;
+
+	while(result.steps < 700 && !result.err)
+	{
+		result.err = mips_cpu_step(cpu);
+		result.steps += !result.err;
+	}
+
+	mips_cpu_get_pc(cpu, &result.pc);
+
+	// A trap, and then a pc no instruction can be fetched from
+	mips_cpu_set_register(cpu, 7, 0x7FFFFFFF);
+	mips_cpu_set_pc(cpu, 0x100);
+	result.overflowErr = mips_cpu_step(cpu);
+	mips_cpu_set_pc(cpu, 2);
+	result.alignmentErr = mips_cpu_step(cpu);
+
+	for(unsigned i = 0; i < 32; i++)
+	{
+		mips_cpu_get_register(cpu, i, &result.regs[i]);
+	}
+
+	for(unsigned i = 0; i < 0x300 / 4; i++)
+	{
+		result.memory[i] = read_word(mem, i * 4);
+	}
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+static void test_engine_parity()
+{
+	engine_result expected;
+	engine_result got;
+
+	engine_parity_run(mips_EngineInterpreter, expected);
+
+	// Every engine ends up exactly where the interpreter does
+	for(int engine = mips_EngineThreaded; engine <= mips_EngineJit; engine++)
+	{
+		int testId = mips_test_begin_test("<INTERNAL>");
+		int passed;
+
+		engine_parity_run((mips_cpu_engine)engine, got);
+
+		passed = got.pc == expected.pc && got.steps == expected.steps && got.err == expected.err;
+		passed = passed && got.overflowErr == expected.overflowErr && got.alignmentErr == expected.alignmentErr;
+
+		for(unsigned i = 0; i < 32; i++)
+		{
+			passed = passed && got.regs[i] == expected.regs[i];
+		}
+
+		for(unsigned i = 0; i < 0x300 / 4; i++)
+		{
+			passed = passed && got.memory[i] == expected.memory[i];
+		}
+
+		mips_test_end_test(testId, passed, "engine did not match the interpreter");
+	}
+}
+
+static void test_run()
+{
+	const uint32_t stops[2] = {0x14, 0x0C};
+	uint32_t expected[3] = {0, 0, 0};
+	uint32_t steps;
+	uint32_t pc;
+	uint32_t got;
+	uint32_t other;
+	int testId;
+	int passed;
+
+	for(int engine = mips_EngineInterpreter; engine <= mips_EngineJit; engine++)
+	{
+		mips_mem_h mem = mips_mem_create_ram(4096, 4);
+		mips_cpu_h cpu = mips_cpu_create_with_engine(mem, (mips_cpu_engine)engine);
+
+		for(unsigned i = 0; i < 4; i++)
+		{
+			write_word(mem, i * 4, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+		}
+		write_word(mem, 0x10, opcode(0) | rs(2) | rt(2) | rd(3) | func(0x20));	// add r3, r2, r2
+		write_word(mem, 0x14, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+
+		// The stop address is only checked after an instruction, and the
+		// budget is always honoured, including budgets of none and one
+		testId = mips_test_begin_test("<INTERNAL>");
+
+		steps = 99;
+		passed = mips_cpu_run(cpu, 0, 0, &steps) == mips_Success && steps == 0;
+		mips_cpu_get_pc(cpu, &pc);
+		passed = passed && pc == 0;
+
+		passed = passed && mips_cpu_run(cpu, 1, 0x100, &steps) == mips_Success && steps == 1;
+		mips_cpu_get_pc(cpu, &pc);
+		passed = passed && pc == 4;
+
+		mips_cpu_set_pc(cpu, 0);
+		passed = passed && mips_cpu_run(cpu, 3, 0, &steps) == mips_Success && steps == 3;
+		mips_cpu_get_pc(cpu, &pc);
+		passed = passed && pc == 0x0C;
+
+		mips_test_end_test(testId, passed, "mips_cpu_run did not keep to its budget");
+
+		// Any of several stop addresses ends a run, and a failing
+		// instruction is neither executed nor counted
+		testId = mips_test_begin_test("<INTERNAL>");
+
+		mips_cpu_set_pc(cpu, 0);
+		passed = mips_cpu_run_until(cpu, 100, stops, 2, &steps) == mips_Success && steps == 3;
+		mips_cpu_get_pc(cpu, &pc);
+		passed = passed && pc == 0x0C;
+
+		mips_cpu_set_register(cpu, 1, 0);
+		mips_cpu_set_register(cpu, 2, 0x7FFFFFFF);
+		mips_cpu_set_pc(cpu, 0);
+		passed = passed && mips_cpu_run_until(cpu, 100, 0, 0, &steps) == mips_ExceptionArithmeticOverflow;
+		passed = passed && steps == 4;
+		mips_cpu_get_pc(cpu, &pc);
+		passed = passed && pc == 0x10;
+		mips_cpu_get_register(cpu, 1, &got);
+		passed = passed && got == 4;
+
+		mips_test_end_test(testId, passed, "mips_cpu_run_until stopped in the wrong place");
+
+		mips_cpu_free(cpu);
+
+		// Long runs, which the JIT engine compiles, end up in the same
+		// place on every engine
+		testId = mips_test_begin_test("<INTERNAL>");
+
+		cpu = mips_cpu_create_with_engine(mem, (mips_cpu_engine)engine);
+
+		write_word(mem, 0x10, opcode(0) | rs(2) | rt(1) | rd(2) | func(0x21));	// addu r2, r2, r1
+		write_word(mem, 0x14, opcode(0x02) | addr(0));	// j 0
+		write_word(mem, 0x18, opcode(0x08) | rs(0) | rt(0) | data(0));	// addi r0, r0, 0
+
+		passed = mips_cpu_run(cpu, 5000, 0x100, &steps) == mips_Success && steps == 5000;
+		mips_cpu_get_register(cpu, 1, &got);
+		mips_cpu_get_register(cpu, 2, &other);
+		mips_cpu_get_pc(cpu, &pc);
+
+		if(engine == mips_EngineInterpreter)
+		{
+			expected[0] = got;
+			expected[1] = other;
+			expected[2] = pc;
+		}
+
+		passed = passed && got == expected[0] && other == expected[1] && pc == expected[2];
+
+		mips_test_end_test(testId, passed, "long mips_cpu_run did not match the interpreter");
+
+		mips_cpu_free(cpu);
+		mips_mem_free(mem);
+	}
+}
+
+static void test_binary_trace()
+{
+	// More instructions than the ring holds, so the CPU has to wait for
+	// the writer thread, followed by one which fails
+	const uint32_t count = 100000;
+
+	mips_mem_h mem = mips_mem_create_ram(0x80000, 4);
+	mips_cpu_h cpu = mips_cpu_create(mem);
+	FILE *dst = tmpfile();
+	mips_trace_file_header header;
+	mips_trace_record rec;
+	uint32_t steps = 0;
+	uint32_t records = 0;
+	int testId;
+	int passed;
+
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		write_word(mem, i * 4, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+	}
+	write_word(mem, count * 4, opcode(0) | rs(3) | rt(3) | rd(2) | func(0x20));	// add r2, r3, r3
+	mips_cpu_set_register(cpu, 3, 0x7FFFFFFF);
+
+	passed = dst != 0;
+	passed = passed && mips_cpu_set_trace_format(cpu, mips_TraceBinary) == mips_Success;
+	passed = passed && mips_cpu_set_debug_level(cpu, 1, dst) == mips_Success;
+	passed = passed && mips_cpu_run(cpu, 2 * count, 0xFFFFFFFC, &steps) == mips_ExceptionArithmeticOverflow;
+	passed = passed && steps == count;
+
+	// Turning tracing off waits for everything queued to be written
+	passed = passed && mips_cpu_set_debug_level(cpu, 0, 0) == mips_Success;
+
+	if(dst)
+	{
+		rewind(dst);
+
+		passed = passed && fread(&header, sizeof(header), 1, dst) == 1;
+		passed = passed && header.magic == MIPS_TRACE_MAGIC && header.version == MIPS_TRACE_VERSION;
+		passed = passed && header.recordSize == sizeof(mips_trace_record);
+
+		// One record per instruction, in order, including the failure
+		while(passed && fread(&rec, sizeof(rec), 1, dst) == 1)
+		{
+			if(records < count)
+			{
+				passed = rec.pc == records * 4 && rec.error == mips_Success;
+				passed = passed && rec.dest == 1 && rec.value == records + 1;
+			}
+			else
+			{
+				passed = rec.pc == count * 4 && rec.error == mips_ExceptionArithmeticOverflow;
+			}
+
+			records++;
+		}
+
+		passed = passed && records == count + 1;
+
+		fclose(dst);
+	}
+
+	mips_test_end_test(testId, passed, "binary trace lost or changed records");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+// Record i of a made up trace, which loops, branches backwards, touches
+// memory, writes HI and LO, and fails now and then
+static mips_trace_record trace_test_record(uint32_t i)
+{
+	mips_trace_record rec;
+
+	rec.pc = 0x400000 + (i % 37) * 4;
+	rec.instr = 0x20000000 | (i % 37);
+	rec.value = i * 2654435761u;
+	rec.address = 0;
+	rec.error = mips_Success;
+	rec.dest = (uint8_t)(i % 32);
+	rec.flags = 0;
+
+	switch(i % 11)
+	{
+		case 3:
+			rec.flags = mips_TraceMemRead;
+			rec.address = 0x10000000 + (i % 5) * 4;
+			break;
+		case 4:
+			rec.flags = mips_TraceMemWrite;
+			rec.address = 0x10000000 - (i % 7) * 4;
+			rec.dest = MIPS_TRACE_NO_DEST;
+			break;
+		case 5:
+			rec.dest = mips_TraceDestHi;
+			break;
+		case 6:
+			rec.dest = mips_TraceDestLo;
+			rec.value = 0xFFFFFFFFu - i;
+			break;
+		case 7:
+			rec.dest = mips_TraceDestHiLo;
+			rec.address = i * 40503u;
+			break;
+		case 8:
+			if(i % 3 == 0)
+			{
+				// Could not even be fetched
+				rec.pc = 0xFFFFFFF0u;
+				rec.instr = 0;
+				rec.value = 0;
+				rec.dest = MIPS_TRACE_NO_DEST;
+				rec.error = mips_ExceptionInvalidAddress;
+			}
+			else
+			{
+				rec.error = mips_ExceptionArithmeticOverflow;
+			}
+			break;
+	}
+
+	return rec;
+}
+
+static bool trace_records_equal(const mips_trace_record &a, const mips_trace_record &b)
+{
+	return a.pc == b.pc && a.instr == b.instr && a.value == b.value && a.address == b.address
+		&& a.error == b.error && a.dest == b.dest && a.flags == b.flags;
+}
+
+static void test_trace_codec()
+{
+	// Enough records for a few frames, the last one partly full
+	const uint32_t count = MIPS_TRACE_FRAME_RECORDS * 2 + 100;
+
+	FILE *file = tmpfile();
+	mips_trace_writer_h writer = file ? mips_trace_writer_create(file) : 0;
+	mips_trace_reader_h reader = 0;
+	mips_trace_record recs[256];
+	unsigned got = 0;
+	uint32_t read = 0;
+	int testId;
+	int passed;
+
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	passed = writer != 0;
+
+	for(uint32_t i = 0; passed && i < count; i++)
+	{
+		mips_trace_record rec = trace_test_record(i);
+
+		passed = mips_trace_writer_append(writer, &rec) == mips_Success;
+	}
+
+	if(writer)
+	{
+		passed = mips_trace_writer_close(writer) == mips_Success && passed;
+	}
+
+	// It should have been worth compressing
+	passed = passed && ftell(file) < (long)(count * sizeof(mips_trace_record));
+
+	if(passed)
+	{
+		rewind(file);
+		reader = mips_trace_reader_open(file);
+	}
+
+	passed = passed && reader != 0;
+
+	// Everything comes back, in order and unchanged
+	while(passed && read < count + 1)
+	{
+		passed = mips_trace_reader_read(reader, recs, 256, &got) == mips_Success;
+
+		for(unsigned k = 0; passed && k < got; k++)
+		{
+			passed = trace_records_equal(recs[k], trace_test_record(read + k));
+		}
+
+		read += got;
+
+		if(got < 256)
+		{
+			break;
+		}
+	}
+
+	passed = passed && read == count;
+
+	// Seeking in to the middle of a frame decodes from its start
+	uint32_t index = MIPS_TRACE_FRAME_RECORDS + 1234;
+
+	passed = passed && mips_trace_reader_seek(reader, index) == mips_Success;
+	passed = passed && mips_trace_reader_tell(reader) == index;
+	passed = passed && mips_trace_reader_read(reader, recs, 1, &got) == mips_Success;
+	passed = passed && got == 1 && trace_records_equal(recs[0], trace_test_record(index));
+
+	if(reader)
+	{
+		mips_trace_reader_close(reader);
+	}
+
+	if(file)
+	{
+		fclose(file);
+	}
+
+	mips_test_end_test(testId, passed, "compressed trace did not read back as written");
+}
+
+// Registers, pc and counts left by one run of the fusion test program
+struct fusion_result
+{
+	uint32_t regs[32];
+	uint32_t pc;
+	uint32_t steps;
+	mips_error err;
+	uint64_t hits[mips_FusionCount];
+};
+
+static void fusion_run(mips_cpu_engine engine, uint32_t pc, uint32_t maxSteps, uint32_t stopPc, fusion_result &result)
+{
+	mips_mem_h mem = mips_mem_create_ram(4096, 4);
+	mips_cpu_h cpu = mips_cpu_create_with_engine(mem, engine);
+
+	write_word(mem, 0x00, opcode(0x09) | rs(29) | rt(29) | data(8));	// addiu r29, r29, 8
+	write_word(mem, 0x04, opcode(0x2B) | rs(29) | rt(1) | data(0));	// sw r1, 0(r29)
+	write_word(mem, 0x08, opcode(0x0B) | rs(1) | rt(2) | data(5));	// sltiu r2, r1, 5
+	write_word(mem, 0x0C, opcode(0x04) | rs(2) | rt(0) | data(8));	// beq r2, r0, 8
+	write_word(mem, 0x10, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+	write_word(mem, 0x14, opcode(0x0B) | rs(1) | rt(3) | data(5));	// sltiu r3, r1, 5
+	write_word(mem, 0x18, opcode(0x04) | rs(0) | rt(3) | data(8));	// beq r0, r3, 8
+	write_word(mem, 0x1C, opcode(0x08) | rs(4) | rt(4) | data(1));	// addi r4, r4, 1
+
+	// A taken branch, and a store which fails after its ADDIU
+	write_word(mem, 0x100, opcode(0x0B) | rs(0) | rt(2) | data(1));	// sltiu r2, r0, 1
+	write_word(mem, 0x104, opcode(0x05) | rs(2) | rt(0) | data(4));	// bne r2, r0, 4
+	write_word(mem, 0x200, opcode(0x09) | rs(29) | rt(29) | data(2));	// addiu r29, r29, 2
+	write_word(mem, 0x204, opcode(0x2B) | rs(29) | rt(1) | data(0));	// sw r1, 0(r29)
+
+	mips_cpu_set_register(cpu, 29, 0x400);
+	mips_cpu_set_pc(cpu, pc);
+
+	result.steps = 0;
+	result.err = mips_cpu_run(cpu, maxSteps, stopPc, &result.steps);
+
+	mips_cpu_get_pc(cpu, &result.pc);
+
+	for(unsigned i = 0; i < 32; i++)
+	{
+		mips_cpu_get_register(cpu, i, &result.regs[i]);
+	}
+
+	for(unsigned i = 0; i < mips_FusionCount; i++)
+	{
+		mips_cpu_get_fusion_hits(cpu, (mips_cpu_fusion)i, &result.hits[i]);
+	}
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+static void test_fusion()
+{
+	// Where to start and stop, and how many of each pair should be fused
+	struct fusion_case
+	{
+		uint32_t pc;
+		uint32_t maxSteps;
+		uint32_t stopPc;
+		uint32_t steps;
+		uint64_t sltiuBranch;
+		uint64_t addiuStore;
+		const char *msg;
+	};
+
+	static const fusion_case cases[] =
+	{
+		{ 0x000, 100, 0x020, 8, 2, 1, "fused pairs did not match unfused execution" },
+		{ 0x000, 6, 0x1000, 6, 1, 1, "pair was fused across the end of the budget" },
+		{ 0x000, 100, 0x00C, 3, 0, 1, "pair was fused across a stop address" },
+		{ 0x100, 2, 0x1000, 2, 1, 0, "fused taken branch did not match unfused execution" },
+		{ 0x200, 100, 0x1000, 1, 0, 0, "fused store which failed did not match unfused execution" }
+	};
+
+	fusion_result expected;
+	fusion_result got;
+
+	for(unsigned c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+	{
+		int testId = mips_test_begin_test("<INTERNAL>");
+		int passed;
+
+		// The interpreter never fuses, so it shows what should happen
+		fusion_run(mips_EngineInterpreter, cases[c].pc, cases[c].maxSteps, cases[c].stopPc, expected);
+		fusion_run(mips_EngineBlock, cases[c].pc, cases[c].maxSteps, cases[c].stopPc, got);
+
+		passed = expected.steps == cases[c].steps;
+		passed = passed && got.pc == expected.pc && got.steps == expected.steps && got.err == expected.err;
+
+		for(unsigned i = 0; i < 32; i++)
+		{
+			passed = passed && got.regs[i] == expected.regs[i];
+		}
+
+		passed = passed && got.hits[mips_FusionSltiuBranch] == cases[c].sltiuBranch;
+		passed = passed && got.hits[mips_FusionAddiuStore] == cases[c].addiuStore;
+
+		mips_test_end_test(testId, passed, cases[c].msg);
+	}
+}
+
+static void test_profile()
+{
+	const uint32_t stop = 0x08;
+	uint64_t executed[4];
+	uint64_t faults[4];
+
+	for(int engine = mips_EngineInterpreter; engine <= mips_EngineJit; engine++)
+	{
+		int testId = mips_test_begin_test("<INTERNAL>");
+		mips_mem_h mem = mips_mem_create_ram(4096, 4);
+		mips_cpu_h cpu = mips_cpu_create_with_engine(mem, (mips_cpu_engine)engine);
+		int passed;
+
+		write_word(mem, 0x00, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+		write_word(mem, 0x04, opcode(0) | rs(2) | rt(1) | rd(2) | func(0x21));	// addu r2, r2, r1
+		write_word(mem, 0x08, opcode(0x02) | addr(0));	// j 0
+		write_word(mem, 0x20, opcode(0x23) | rs(3) | rt(4) | data(0));	// lw r4, 0(r3)
+		mips_cpu_set_register(cpu, 3, 0x10000);
+
+		passed = mips_cpu_set_profiling(cpu, 1) == mips_Success;
+
+		// Each run goes once round the loop, stopping at the jump, which
+		// is often enough for the JIT engine to want to compile it
+		for(unsigned i = 0; i < 40; i++)
+		{
+			passed = passed && mips_cpu_run_until(cpu, 100, &stop, 1, 0) == mips_Success;
+		}
+
+		// A load which faults, and a pc which cannot be fetched from
+		mips_cpu_set_pc(cpu, 0x20);
+		passed = passed && mips_cpu_step(cpu) == mips_ExceptionInvalidAddress;
+		mips_cpu_set_pc(cpu, 0x2000);
+		passed = passed && mips_cpu_step(cpu) == mips_ExceptionInvalidAddress;
+
+		// Nothing is counted while profiling is off
+		passed = passed && mips_cpu_set_profiling(cpu, 0) == mips_Success;
+		mips_cpu_set_pc(cpu, 0);
+		passed = passed && mips_cpu_step(cpu) == mips_Success;
+
+		mips_cpu_get_profile(cpu, 0x00, &executed[0], &faults[0]);
+		mips_cpu_get_profile(cpu, 0x08, &executed[1], &faults[1]);
+		mips_cpu_get_profile(cpu, 0x20, &executed[2], &faults[2]);
+		mips_cpu_get_profile(cpu, 0x2000, &executed[3], &faults[3]);
+
+		passed = passed && executed[0] == 40 && faults[0] == 0;
+		passed = passed && executed[1] == 39 && faults[1] == 0;
+		passed = passed && executed[2] == 1 && faults[2] == 1;
+		passed = passed && executed[3] == 0 && faults[3] == 1;
+
+		// And a reset clears every count
+		passed = passed && mips_cpu_reset_profile(cpu) == mips_Success;
+		mips_cpu_get_profile(cpu, 0x00, &executed[0], &faults[0]);
+		passed = passed && executed[0] == 0;
+
+		mips_test_end_test(testId, passed, "profile counts for a loop are wrong");
+
+		mips_cpu_free(cpu);
+		mips_mem_free(mem);
+	}
+}
+
+// Count of one mnemonic in a set of statistics, found by its name
+static uint64_t stats_mnemonic_count(const mips_cpu_stats &stats, const char *name)
+{
+	for(unsigned i = 0; i < MIPS_CPU_STATS_MNEMONICS; i++)
+	{
+		if(string(mips_cpu_stats_mnemonic(i)) == name)
+		{
+			return stats.mnemonics[i];
+		}
+	}
+
+	return ~0ull;
+}
+
+static void test_stats()
+{
+	mips_cpu_stats stats;
+
+	for(int engine = mips_EngineInterpreter; engine <= mips_EngineJit; engine++)
+	{
+		int testId = mips_test_begin_test("<INTERNAL>");
+		mips_mem_h mem = mips_mem_create_ram(4096, 4);
+		mips_cpu_h cpu = mips_cpu_create_with_engine(mem, (mips_cpu_engine)engine);
+		int passed;
+
+		write_word(mem, 0x00, opcode(0x08) | rs(0) | rt(1) | data(5));	// addi r1, r0, 5
+		write_word(mem, 0x04, opcode(0) | rs(1) | rt(1) | rd(2) | func(0x21));	// addu r2, r1, r1
+		write_word(mem, 0x08, opcode(0) | rs(1) | rt(2) | rd(3) | func(0x24));	// and r3, r1, r2
+		write_word(mem, 0x0C, opcode(0x23) | rs(0) | rt(4) | data(0x100));	// lw r4, 0x100(r0)
+		write_word(mem, 0x10, opcode(0x21) | rs(0) | rt(5) | data(0x102));	// lh r5, 0x102(r0)
+		write_word(mem, 0x14, opcode(0x28) | rs(0) | rt(1) | data(0x104));	// sb r1, 0x104(r0)
+		write_word(mem, 0x18, opcode(0x2B) | rs(0) | rt(1) | data(0x108));	// sw r1, 0x108(r0)
+		write_word(mem, 0x1C, opcode(0x04) | rs(1) | rt(0) | data(4));	// beq r1, r0, 4
+		write_word(mem, 0x20, opcode(0) | rs(7) | rt(7) | rd(6) | func(0x20));	// add r6, r7, r7
+		write_word(mem, 0x40, opcode(0x04) | rs(0) | rt(0) | data(4));	// beq r0, r0, 4
+		write_word(mem, 0x44, opcode(0x02) | addr(0));	// j 0
+		mips_cpu_set_register(cpu, 7, 0x7FFFFFFF);
+
+		// Everything up to the ADD, which overflows, then a taken branch
+		// and a jump on their own
+		passed = mips_cpu_run(cpu, 100, 0x1000, 0) == mips_ExceptionArithmeticOverflow;
+		mips_cpu_set_pc(cpu, 0x40);
+		passed = passed && mips_cpu_step(cpu) == mips_Success;
+		mips_cpu_set_pc(cpu, 0x44);
+		passed = passed && mips_cpu_step(cpu) == mips_Success;
+
+		passed = passed && mips_cpu_get_stats(cpu, &stats) == mips_Success;
+		passed = passed && stats.instructions == 10;
+
+		passed = passed && stats_mnemonic_count(stats, "ADD") == 0 && stats_mnemonic_count(stats, "ADDI") == 1;
+		passed = passed && stats_mnemonic_count(stats, "BEQ") == 2 && stats_mnemonic_count(stats, "SW") == 1;
+
+		passed = passed && stats.classes[mips_ClassArithmetic] == 2 && stats.classes[mips_ClassLogic] == 1;
+		passed = passed && stats.classes[mips_ClassLoad] == 2 && stats.classes[mips_ClassStore] == 2;
+		passed = passed && stats.classes[mips_ClassBranch] == 2 && stats.classes[mips_ClassJump] == 1;
+		passed = passed && stats.classes[mips_ClassShift] == 0 && stats.classes[mips_ClassMultDiv] == 0;
+
+		passed = passed && stats.branchesTaken == 1 && stats.branchesNotTaken == 1;
+		passed = passed && stats.loads[0] == 0 && stats.loads[1] == 1 && stats.loads[2] == 1;
+		passed = passed && stats.stores[0] == 1 && stats.stores[1] == 0 && stats.stores[2] == 1;
+
+		for(unsigned i = 0; i < MIPS_CPU_STATS_EXCEPTIONS; i++)
+		{
+			passed = passed && stats.exceptions[i] == (i == mips_ExceptionArithmeticOverflow - mips_ExceptionBreak);
+		}
+
+		// And a reset clears them all
+		passed = passed && mips_cpu_reset_stats(cpu) == mips_Success;
+		passed = passed && mips_cpu_get_stats(cpu, &stats) == mips_Success;
+		passed = passed && stats.instructions == 0 && stats.exceptions[mips_ExceptionArithmeticOverflow - mips_ExceptionBreak] == 0;
+
+		mips_test_end_test(testId, passed, "instruction mix or exception counts are wrong");
+
+		mips_cpu_free(cpu);
+		mips_mem_free(mem);
+	}
+}
+
+static void test_timing()
+{
+	const mips_cpu_timing_config config = { 3, 2, 5, 35 };
+	mips_cpu_timing timing;
+
+	for(int engine = mips_EngineInterpreter; engine <= mips_EngineJit; engine++)
+	{
+		int testId = mips_test_begin_test("<INTERNAL>");
+		mips_mem_h mem = mips_mem_create_ram(4096, 4);
+		mips_cpu_h cpu = mips_cpu_create_with_engine(mem, (mips_cpu_engine)engine);
+		int passed;
+
+		write_word(mem, 0x00, opcode(0x23) | rs(0) | rt(1) | data(0x100));	// lw r1, 0x100(r0)
+		write_word(mem, 0x04, opcode(0) | rs(1) | rt(1) | rd(2) | func(0x21));	// addu r2, r1, r1
+		write_word(mem, 0x08, opcode(0x23) | rs(0) | rt(3) | data(0x100));	// lw r3, 0x100(r0)
+		write_word(mem, 0x0C, opcode(0) | rs(1) | rt(1) | rd(4) | func(0x21));	// addu r4, r1, r1
+		write_word(mem, 0x10, opcode(0x04) | rs(4) | rt(0) | data(4));	// beq r4, r0, 4
+		write_word(mem, 0x14, opcode(0x02) | addr(0));	// j 0
+		write_word(mem, 0x100, 7);
+
+		passed = mips_cpu_set_timing(cpu, 1, &config) == mips_Success;
+		passed = passed && mips_cpu_run(cpu, 6, 0x1000, 0) == mips_Success;
+		passed = passed && mips_cpu_get_timing(cpu, &timing) == mips_Success;
+
+		// Four cycles to fill the pipeline and one per instruction, plus
+		// a stall for the ADDU using a load just before it (but not for
+		// the one which does not), and a penalty for the taken jump but
+		// not the branch which falls through
+		passed = passed && timing.instructions == 6;
+		passed = passed && timing.loadUseStalls == 3 && timing.branchStalls == 2 && timing.hiloStalls == 0;
+		passed = passed && timing.cycles == 4 + 6 + 3 + 2;
+
+		// A reset empties the pipeline, so it has to be filled again
+		passed = passed && mips_cpu_reset_timing(cpu) == mips_Success;
+		passed = passed && mips_cpu_step(cpu) == mips_Success;
+		passed = passed && mips_cpu_get_timing(cpu, &timing) == mips_Success;
+		passed = passed && timing.instructions == 1 && timing.cycles == 5;
+
+		mips_test_end_test(testId, passed, "timing model cycle count is wrong");
+
+		mips_cpu_free(cpu);
+		mips_mem_free(mem);
+	}
+}
+
+static bool cache_stats_are(mips_mem_h cache, mips_cache_level level,
+	uint64_t hits, uint64_t misses, uint64_t evictions, uint64_t writebacks)
+{
+	mips_cache_stats stats;
+
+	if(mips_mem_get_cache_stats(cache, level, &stats) != mips_Success)
+	{
+		return false;
+	}
+
+	return stats.hits == hits && stats.misses == misses
+		&& stats.evictions == evictions && stats.writebacks == writebacks;
+}
+
+static void test_cache_stats()
+{
+	// Direct mapped level one caches, so that lines 0x100 apart collide,
+	// in front of a level two cache big enough to keep everything
+	mips_cache_config l1 = { 256, 16, 1, mips_CacheLru, mips_CacheWriteBack };
+	mips_cache_config l2 = { 1024, 16, 4, mips_CacheLru, mips_CacheWriteBack };
+
+	mips_mem_h ram = mips_mem_create_ram(0x1000, 4);
+	mips_mem_h cache = mips_mem_create_cache(ram, &l1, &l1, &l2);
+	uint8_t buffer[8];
+	int testId;
+	int passed;
+
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	mips_mem_read(cache, 0x0, 4, buffer);		// L1D miss, L2 miss
+	mips_mem_read(cache, 0x4, 4, buffer);		// L1D hit
+	mips_mem_read(cache, 0x100, 4, buffer);		// L1D miss evicting 0x0, L2 miss
+	mips_mem_write(cache, 0x100, 4, buffer);	// L1D hit, line now dirty
+	mips_mem_read(cache, 0x0, 4, buffer);		// L1D miss writing back 0x100, L2 hit twice
+	mips_mem_read(cache, 0x1C, 8, buffer);		// Two lines: L1D and L2 miss each
+
+	passed = cache_stats_are(cache, mips_CacheL1D, 2, 5, 2, 1);
+	passed = passed && cache_stats_are(cache, mips_CacheL2, 2, 4, 0, 0);
+	passed = passed && cache_stats_are(cache, mips_CacheL1I, 0, 0, 0, 0);
+
+	// Fetches only reach the instruction cache
+	mips_mem_fetch(cache, 0x0, 4, buffer);		// L1I miss, L2 hit
+
+	passed = passed && cache_stats_are(cache, mips_CacheL1I, 0, 1, 0, 0);
+	passed = passed && cache_stats_are(cache, mips_CacheL2, 3, 4, 0, 0);
+
+	// Resetting the counts keeps what is cached
+	passed = passed && mips_mem_reset_cache_stats(cache) == mips_Success;
+	mips_mem_fetch(cache, 0x0, 4, buffer);
+
+	passed = passed && cache_stats_are(cache, mips_CacheL1I, 1, 0, 0, 0);
+	passed = passed && cache_stats_are(cache, mips_CacheL1D, 0, 0, 0, 0);
+	passed = passed && cache_stats_are(cache, mips_CacheL2, 0, 0, 0, 0);
+
+	mips_test_end_test(testId, passed, "cache hit and miss counts are wrong");
+
+	mips_mem_free(cache);
+	mips_mem_free(ram);
+}
+
+static void test_predictor()
+{
+	mips_cpu_predictor_config config = { mips_PredictorBimodal, 10, 8, 64, 8 };
+	mips_cpu_predictor_stats stats;
+	uint64_t executed = 0;
+	uint64_t mispredicted = 0;
+
+	for(int engine = mips_EngineInterpreter; engine <= mips_EngineJit; engine++)
+	{
+		int testId = mips_test_begin_test("<INTERNAL>");
+		mips_mem_h mem = mips_mem_create_ram(4096, 4);
+		mips_cpu_h cpu = mips_cpu_create_with_engine(mem, (mips_cpu_engine)engine);
+		int passed;
+
+		// This simulator works out branch targets differently from MIPS
+		// (see the BEQ tests), so the jump back is at both places this
+		// always-taken forward branch could go to
+		write_word(mem, 0x00, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+		write_word(mem, 0x04, opcode(0x04) | rs(0) | rt(0) | data(1));	// beq r0, r0, 1
+		write_word(mem, 0x0C, opcode(0x02) | addr(0));	// j 0
+		write_word(mem, 0x24, opcode(0x02) | addr(0));	// j 0
+
+		// A two bit counter starting at weakly not taken only misses once
+		config.kind = mips_PredictorBimodal;
+		passed = mips_cpu_set_predictor(cpu, 1, &config) == mips_Success;
+		passed = passed && mips_cpu_run(cpu, 150, 0x1000, 0) == mips_Success;
+
+		passed = passed && mips_cpu_get_branch_profile(cpu, 0x04, &executed, &mispredicted) == mips_Success;
+		passed = passed && executed == 50 && mispredicted == 1;
+		passed = passed && mips_cpu_get_predictor_stats(cpu, &stats) == mips_Success;
+		passed = passed && stats.branches == 50 && stats.branchMisses == 1;
+		passed = passed && stats.indirect == 0 && stats.returns == 0;
+
+		// Jumps always go where they say
+		passed = passed && mips_cpu_get_branch_profile(cpu, 0x0C, &executed, &mispredicted) == mips_Success;
+		passed = passed && mispredicted == 0;
+
+		// Forward branches are never taken as far as the static predictor
+		// is concerned, so it misses every time
+		config.kind = mips_PredictorStatic;
+		mips_cpu_set_pc(cpu, 0);
+		passed = passed && mips_cpu_set_predictor(cpu, 1, &config) == mips_Success;
+		passed = passed && mips_cpu_reset_predictor(cpu) == mips_Success;
+		passed = passed && mips_cpu_run(cpu, 150, 0x1000, 0) == mips_Success;
+
+		passed = passed && mips_cpu_get_branch_profile(cpu, 0x04, &executed, &mispredicted) == mips_Success;
+		passed = passed && executed == 50 && mispredicted == 50;
+
+		mips_test_end_test(testId, passed, "misprediction counts for a loop branch are wrong");
+
+		mips_cpu_free(cpu);
+		mips_mem_free(mem);
+	}
+}
+
+static void test_snapshots()
+{
+	// Four pages, so that writes can land in pages of their own
+	mips_mem_h mem = mips_mem_create_ram(0x4000, 4);
+	mips_cpu_h cpu = mips_cpu_create(mem);
+	mips_snapshot_h snap = 0;
+	mips_mem_snapshot_h older = 0;
+	mips_mem_snapshot_h newer = 0;
+	uint32_t got = 0;
+	uint32_t pc = 0;
+	int testId;
+	int passed;
+
+	// Take, modify, restore: registers, pc and memory all go back
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	write_word(mem, 0, opcode(0x09) | rs(0) | rt(6) | data(1));	// addiu r6, r0, 1
+	write_word(mem, 0x1000, 0x11111111);
+	mips_cpu_set_register(cpu, 5, 55);
+
+	passed = mips_snapshot_take(cpu, &snap) == mips_Success;
+
+	mips_cpu_set_register(cpu, 5, 77);
+	write_word(mem, 0x1000, 0x22222222);
+	passed = passed && mips_cpu_step(cpu) == mips_Success;
+
+	passed = passed && mips_snapshot_restore(snap) == mips_Success;
+
+	mips_cpu_get_register(cpu, 5, &got);
+	passed = passed && got == 55;
+	mips_cpu_get_register(cpu, 6, &got);
+	passed = passed && got == 0;
+	mips_cpu_get_pc(cpu, &pc);
+	passed = passed && pc == 0;
+	passed = passed && read_word(mem, 0x1000) == 0x11111111;
+
+	// A snapshot can be restored more than once
+	write_word(mem, 0x1000, 0x33333333);
+	passed = passed && mips_snapshot_restore(snap) == mips_Success;
+	passed = passed && read_word(mem, 0x1000) == 0x11111111;
+
+	mips_test_end_test(testId, passed, "snapshot restore did not put back registers and memory");
+
+	// The icache must not keep instructions which a restore replaced
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	write_word(mem, 0, opcode(0x09) | rs(0) | rt(6) | data(2));	// addiu r6, r0, 2
+	passed = mips_cpu_step(cpu) == mips_Success;
+	mips_cpu_get_register(cpu, 6, &got);
+	passed = passed && got == 2;
+
+	passed = passed && mips_snapshot_restore(snap) == mips_Success;
+	passed = passed && mips_cpu_step(cpu) == mips_Success;
+	mips_cpu_get_register(cpu, 6, &got);
+	passed = passed && got == 1;
+
+	mips_test_end_test(testId, passed, "stale instruction ran after snapshot restore");
+
+	// Snapshots can be freed after the CPU they were taken of
+	mips_cpu_free(cpu);
+	mips_snapshot_free(snap);
+
+	// Nested snapshots restore to their own points, and restoring an
+	// older one makes the newer one invalid
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	write_word(mem, 0x2000, 1);
+	passed = mips_mem_snapshot_take(mem, &older) == mips_Success;
+	write_word(mem, 0x2000, 2);
+	passed = passed && mips_mem_snapshot_take(mem, &newer) == mips_Success;
+	write_word(mem, 0x2000, 3);
+	write_word(mem, 0x3000, 4);
+
+	passed = passed && mips_mem_snapshot_restore(mem, newer) == mips_Success;
+	passed = passed && read_word(mem, 0x2000) == 2 && read_word(mem, 0x3000) == 0;
+
+	passed = passed && mips_mem_snapshot_restore(mem, older) == mips_Success;
+	passed = passed && read_word(mem, 0x2000) == 1;
+
+	passed = passed && mips_mem_snapshot_restore(mem, newer) == mips_ErrorInvalidArgument;
+
+	mips_mem_snapshot_free(mem, newer);
+	mips_mem_snapshot_free(mem, older);
+
+	mips_test_end_test(testId, passed, "nested snapshots restored the wrong contents");
+
+	// Freeing the newer snapshot hands its saved pages to the older one,
+	// which must then still restore everything written since it
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	write_word(mem, 0x2000, 1);
+	write_word(mem, 0x3000, 1);
+	passed = mips_mem_snapshot_take(mem, &older) == mips_Success;
+	write_word(mem, 0x2000, 2);
+	passed = passed && mips_mem_snapshot_take(mem, &newer) == mips_Success;
+	write_word(mem, 0x2000, 3);
+	write_word(mem, 0x3000, 3);
+
+	mips_mem_snapshot_free(mem, newer);
+
+	passed = passed && mips_mem_snapshot_restore(mem, older) == mips_Success;
+	passed = passed && read_word(mem, 0x2000) == 1 && read_word(mem, 0x3000) == 1;
+
+	mips_mem_snapshot_free(mem, older);
+
+	mips_test_end_test(testId, passed, "undo log merged on free lost a page");
+
+	mips_mem_free(mem);
+}
+
+static void test_dirty_pages()
+{
+	mips_mem_h mem = mips_mem_create_ram(0x4000, 4);
+	uint32_t pageSize = 0;
+	uint32_t addresses[4];
+	unsigned count = 0;
+	int testId;
+	int passed;
+
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	// Nothing to restore to until the memory has been marked clean
+	passed = mips_mem_reset_dirty(mem, mips_DirtyRestore) == mips_ErrorInvalidArgument;
+
+	// The image: one word in each page
+	for(uint32_t page = 0; page < 4; page++)
+	{
+		write_word(mem, page * 0x1000, 0x100 + page);
+	}
+
+	passed = passed && mips_mem_get_dirty(mem, &pageSize, addresses, 4, &count) == mips_Success;
+	passed = passed && pageSize == 0x1000 && count == 4;
+
+	passed = passed && mips_mem_mark_clean(mem) == mips_Success;
+	passed = passed && mips_mem_get_dirty(mem, &pageSize, addresses, 4, &count) == mips_Success;
+	passed = passed && count == 0;
+
+	// Pages come back in order, and capacity only limits what is listed
+	write_word(mem, 0x3004, 7);
+	write_word(mem, 0x1000, 7);
+
+	passed = passed && mips_mem_get_dirty(mem, &pageSize, addresses, 1, &count) == mips_Success;
+	passed = passed && count == 2 && addresses[0] == 0x1000;
+	passed = passed && mips_mem_get_dirty(mem, &pageSize, addresses, 4, &count) == mips_Success;
+	passed = passed && count == 2 && addresses[0] == 0x1000 && addresses[1] == 0x3000;
+
+	// Restoring puts back the clean image and forgets the pages
+	passed = passed && mips_mem_reset_dirty(mem, mips_DirtyRestore) == mips_Success;
+	passed = passed && read_word(mem, 0x1000) == 0x101;
+	passed = passed && read_word(mem, 0x3000) == 0x103 && read_word(mem, 0x3004) == 0;
+	passed = passed && mips_mem_get_dirty(mem, &pageSize, addresses, 4, &count) == mips_Success;
+	passed = passed && count == 0;
+
+	// Zeroing only touches dirty pages, and a later restore also puts
+	// back the pages it zeroed
+	write_word(mem, 0x2000, 9);
+
+	passed = passed && mips_mem_reset_dirty(mem, mips_DirtyZero) == mips_Success;
+	passed = passed && read_word(mem, 0x2000) == 0 && read_word(mem, 0x0) == 0x100;
+
+	passed = passed && mips_mem_reset_dirty(mem, mips_DirtyRestore) == mips_Success;
+	passed = passed && read_word(mem, 0x2000) == 0x102;
+
+	mips_test_end_test(testId, passed, "dirty pages were not tracked or reset correctly");
+
+	mips_mem_free(mem);
+}
+
+// One shard of test_test_contexts: counts r1 up on its own CPU and RAM,
+// recording a test into ctx after every ten steps and failing test breakAt
+static void test_context_shard(mips_test_ctx_h ctx, unsigned tests, uint32_t breakAt)
+{
+	mips_mem_h mem = mips_mem_create_ram(4096, 4);
+	mips_cpu_h cpu = mips_cpu_create(mem);
+
+	write_word(mem, 0x00, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+	write_word(mem, 0x04, opcode(0x02) | addr(0));	// j 0
+
+	for(unsigned i = 0; i < tests; i++)
+	{
+		int testId = mips_test_ctx_begin_test(ctx, "ADDI");
+		uint32_t r1 = 0;
+		int passed = mips_cpu_run(cpu, 10, 0x1000, 0) == mips_Success;
+		passed = passed && mips_cpu_get_register(cpu, 1, &r1) == mips_Success;
+		passed = passed && r1 == 5 * (i + 1) && i != breakAt;
+		mips_test_ctx_end_test(ctx, testId, passed, "shard counted wrongly");
+	}
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+static void test_test_contexts()
+{
+	int testId = mips_test_begin_test("<INTERNAL>");
+	mips_test_ctx_h shards[2] = { mips_test_ctx_create(), mips_test_ctx_create() };
+	mips_test_ctx_h all = mips_test_ctx_create();
+	FILE *report = tmpfile();
+	unsigned passed = 0;
+	unsigned total = 0;
+	int ok = shards[0] && shards[1] && all && report;
+
+	if(ok)
+	{
+		// The second shard fails one of its tests on purpose, so the
+		// merged totals show that failures from a thread are kept
+		std::thread first(test_context_shard, shards[0], 30, 30);
+		std::thread second(test_context_shard, shards[1], 20, 7);
+		first.join();
+		second.join();
+
+		ok = mips_test_ctx_report(shards[0], report, &passed, &total) == mips_Success;
+		ok = ok && passed == 30 && total == 30;
+		ok = ok && mips_test_ctx_report(shards[1], report, &passed, &total) == mips_Success;
+		ok = ok && passed == 19 && total == 20;
+
+		ok = ok && mips_test_ctx_merge(all, shards[0]) == mips_Success;
+		ok = ok && mips_test_ctx_merge(all, shards[1]) == mips_Success;
+		ok = ok && mips_test_ctx_report(all, report, &passed, &total) == mips_Success;
+		ok = ok && passed == 49 && total == 50;
+
+		// Merging a context into itself is refused
+		ok = ok && mips_test_ctx_merge(all, all) == mips_ErrorInvalidArgument;
+	}
+
+	mips_test_end_test(testId, ok, "merged test contexts from two threads are wrong");
+
+	if(report)
+		fclose(report);
+	mips_test_ctx_free(all);
+	mips_test_ctx_free(shards[0]);
+	mips_test_ctx_free(shards[1]);
+}
+
+static void test_data_port()
+{
+	mips_cache_config l1 = { 256, 16, 1, mips_CacheLru, mips_CacheWriteBack };
+
+	mips_mem_h ram = mips_mem_create_ram(0x1000, 4);
+	mips_mem_h behind = mips_mem_create_ram(0x1000, 4);
+
+	// The cache gives out no host bytes, so its accesses take the other
+	// path: narrow ones are refused by the RAM behind it, and become words
+	mips_mem_h mems[2] = { ram, mips_mem_create_cache(behind, &l1, &l1, 0) };
+	mips_mem_h backing[2] = { ram, behind };
+
+	for(unsigned m = 0; m < 2; m++)
+	{
+		int testId = mips_test_begin_test("<INTERNAL>");
+		mips_cpu_h cpu = mips_cpu_create(mems[m]);
+		uint32_t got = 0;
+		int passed;
+
+		write_word(backing[m], 0x00, opcode(0x28) | rs(4) | rt(5) | data(1));	// sb r5, 1(r4)
+		write_word(backing[m], 0x04, opcode(0x29) | rs(4) | rt(5) | data(2));	// sh r5, 2(r4)
+		write_word(backing[m], 0x08, opcode(0x20) | rs(4) | rt(6) | data(1));	// lb r6, 1(r4)
+		write_word(backing[m], 0x0C, opcode(0x21) | rs(4) | rt(7) | data(2));	// lh r7, 2(r4)
+		write_word(backing[m], 0x10, opcode(0x23) | rs(4) | rt(8) | data(0));	// lw r8, 0(r4)
+		write_word(backing[m], 0x100, 0x11223344);
+
+		mips_cpu_set_register(cpu, 4, 0x100);
+		mips_cpu_set_register(cpu, 5, 0x1234ABCD);
+
+		// Stores only change their own bytes of the word
+		passed = mips_cpu_step(cpu) == mips_Success;
+		passed = passed && read_word(backing[m], 0x100) == 0x11CD3344;
+		passed = passed && mips_cpu_step(cpu) == mips_Success;
+		passed = passed && read_word(backing[m], 0x100) == 0x11CDABCD;
+
+		// And loads find them there, sign extended
+		passed = passed && mips_cpu_step(cpu) == mips_Success;
+		mips_cpu_get_register(cpu, 6, &got);
+		passed = passed && got == 0xFFFFFFCD;
+		passed = passed && mips_cpu_step(cpu) == mips_Success;
+		mips_cpu_get_register(cpu, 7, &got);
+		passed = passed && got == 0xFFFFABCD;
+		passed = passed && mips_cpu_step(cpu) == mips_Success;
+		mips_cpu_get_register(cpu, 8, &got);
+		passed = passed && got == 0x11CDABCD;
+
+		mips_test_end_test(testId, passed, "byte and halfword stores did not merge into the word");
+
+		mips_cpu_free(cpu);
+	}
+
+	mips_mem_free(mems[1]);
+	mips_mem_free(behind);
+	mips_mem_free(ram);
+}
+
+static void test_sparse_ram()
+{
+	mips_mem_h mem = mips_mem_create_sparse_ram(4);
+	mips_cpu_h cpu;
+	const uint8_t *host = 0;
+	uint32_t got = 1;
+	uint64_t resident = 1;
+	uint8_t buffer[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	uint8_t back[8];
+	int testId;
+	int passed;
+
+	// Pages nobody has written read as zeros, without being allocated
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	passed = mem != 0;
+	passed = passed && read_word(mem, 0x80000000) == 0 && read_word(mem, 0xFFFFFFFC) == 0;
+	passed = passed && mips_mem_get_sparse_resident(mem, &resident) == mips_Success;
+	passed = passed && resident == 0;
+
+	mips_test_end_test(testId, passed, "untouched sparse RAM did not read as zeros");
+
+	// Writes allocate the pages they land in, once each
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	write_word(mem, 0x10000000, 0x12345678);
+	write_word(mem, 0x10000004, 0x9abcdef0);
+	write_word(mem, 0xFFFFFFFC, 0x0badf00d);
+
+	passed = read_word(mem, 0x10000000) == 0x12345678 && read_word(mem, 0x10000004) == 0x9abcdef0;
+	passed = passed && read_word(mem, 0xFFFFFFFC) == 0x0badf00d;
+	passed = passed && mips_mem_get_sparse_resident(mem, &resident) == mips_Success;
+	passed = passed && resident == 2 * 4096;
+
+	mips_test_end_test(testId, passed, "sparse RAM writes did not allocate their pages");
+
+	// A write over a page boundary is split between both pages
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	passed = mips_mem_write(mem, 0x20000FFC, 8, buffer) == mips_Success;
+	passed = passed && mips_mem_read(mem, 0x20000FFC, 8, back) == mips_Success;
+	passed = passed && back[3] == 4 && back[4] == 5;
+	passed = passed && read_word(mem, 0x20000FFC) == 0x01020304 && read_word(mem, 0x20001000) == 0x05060708;
+	passed = passed && mips_mem_get_sparse_resident(mem, &resident) == mips_Success;
+	passed = passed && resident == 4 * 4096;
+
+	mips_test_end_test(testId, passed, "sparse RAM write across pages was wrong");
+
+	// Nothing can wrap past the top of the address space
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	passed = mips_mem_write(mem, 0xFFFFFFFC, 8, buffer) == mips_ExceptionInvalidAddress;
+	passed = passed && mips_mem_read(mem, 0xFFFFFFFC, 8, back) == mips_ExceptionInvalidAddress;
+	passed = passed && read_word(mem, 0x0) == 0 && read_word(mem, 0xFFFFFFFC) == 0x0badf00d;
+	passed = passed && mips_mem_get_sparse_resident(mem, &resident) == mips_Success;
+	passed = passed && resident == 4 * 4096;
+
+	mips_test_end_test(testId, passed, "sparse RAM allowed a transaction to wrap");
+
+	// Looking at pages, whether by asking for their host bytes or by
+	// loading from them, does not allocate them
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	cpu = mips_cpu_create(mem);
+
+	write_word(mem, 0x20000000, opcode(0x23) | rs(3) | rt(2) | data(0));	// lw r2, 0(r3)
+	write_word(mem, 0x20000004, opcode(0x20) | rs(3) | rt(4) | data(1));	// lb r4, 1(r3)
+	mips_cpu_set_pc(cpu, 0x20000000);
+	mips_cpu_set_register(cpu, 3, 0x40000000);
+
+	passed = mips_mem_get_host_range(mem, 0x50000000, 4, &host) == mips_ErrorNotImplemented;
+	passed = passed && mips_cpu_step(cpu) == mips_Success && mips_cpu_step(cpu) == mips_Success;
+	mips_cpu_get_register(cpu, 2, &got);
+	passed = passed && got == 0;
+	passed = passed && mips_mem_get_sparse_resident(mem, &resident) == mips_Success;
+	passed = passed && resident == 4 * 4096;
+
+	mips_test_end_test(testId, passed, "sparse RAM allocated pages which were only read");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+static void test_block_wraparound()
+{
+	mips_mem_h mem = mips_mem_create_sparse_ram(4);
+	mips_cpu_h cpu;
+	uint32_t got = 0;
+	int testId;
+	int passed;
+
+	// Code in the last page of the address space must still be thrown
+	// away when it is written, whichever engine has translated it
+	for(int engine = mips_EngineInterpreter; engine <= mips_EngineJit; engine++)
+	{
+		testId = mips_test_begin_test("<INTERNAL>");
+
+		cpu = mips_cpu_create_with_engine(mem, (mips_cpu_engine)engine);
+
+		write_word(mem, 0xFFFFFFF0, opcode(0x08) | rs(0) | rt(1) | data(100));	// addi r1, r0, 100
+		write_word(mem, 0xFFFFFFF4, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+		write_word(mem, 0xFFFFFFF8, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+		write_word(mem, 0xFFFFFFFC, opcode(0x08) | rs(1) | rt(1) | data(50));	// addi r1, r1, 50
+
+		mips_cpu_set_pc(cpu, 0xFFFFFFF0);
+		passed = mips_cpu_run(cpu, 4, 0, 0) == mips_Success;
+		mips_cpu_get_register(cpu, 1, &got);
+		passed = passed && got == 152;
+
+		write_word(mem, 0xFFFFFFFC, opcode(0x08) | rs(1) | rt(1) | data(1));	// addi r1, r1, 1
+
+		mips_cpu_set_pc(cpu, 0xFFFFFFF0);
+		passed = passed && mips_cpu_run(cpu, 4, 0, 0) == mips_Success;
+		mips_cpu_get_register(cpu, 1, &got);
+		passed = passed && got == 103;
+
+		mips_test_end_test(testId, passed, "code at the top of memory was not invalidated by a write");
+
+		mips_cpu_free(cpu);
+	}
+
+	mips_mem_free(mem);
+}
+
+// What a memory mapped device has been asked to do
+static void test_ram_files()
+{
+	const char *imagePath = "test_mips_image.bin";
+	const char *filePath = "test_mips_ram.bin";
+	const uint8_t image[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	uint8_t back[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	mips_mem_h mem;
+	FILE *f;
+	int testId;
+	int passed;
+
+	f = fopen(imagePath, "wb");
+	fwrite(image, 1, sizeof(image), f);
+	fclose(f);
+	remove(filePath);
+
+	// An image fills the start of the RAM, which reads as zeros after it,
+	// and writes to the RAM never reach the file
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	mem = mips_mem_create_ram_image(imagePath, 0x2000, 4);
+
+	passed = mem != 0;
+	passed = passed && read_word(mem, 0) == 0x01020304 && read_word(mem, 4) == 0x05060708;
+	passed = passed && read_word(mem, 8) == 0 && read_word(mem, 0x1FFC) == 0;
+
+	write_word(mem, 0, 0xDEADBEEF);
+	passed = passed && read_word(mem, 0) == 0xDEADBEEF;
+	mips_mem_free(mem);
+
+	f = fopen(imagePath, "rb");
+	passed = passed && fread(back, 1, sizeof(back), f) == sizeof(back) && back[0] == 1 && back[3] == 4;
+	fclose(f);
+
+	mips_test_end_test(testId, passed, "RAM image did not load as expected");
+
+	// An image which does not fit is refused
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	mem = mips_mem_create_ram_image(imagePath, 4, 4);
+	passed = mem == 0;
+	mips_mem_free(mem);
+
+	mips_test_end_test(testId, passed, "RAM image bigger than the RAM was accepted");
+
+	// A file RAM keeps what was written after it is freed, and starts
+	// from it next time
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	mem = mips_mem_create_ram_file(filePath, 0x2000, 4);
+
+	passed = mem != 0;
+	passed = passed && read_word(mem, 0x1004) == 0;
+	write_word(mem, 0x1004, 0xCAFEF00D);
+	mips_mem_free(mem);
+
+	f = fopen(filePath, "rb");
+	passed = passed && f != 0;
+
+	if(f)
+	{
+		passed = passed && fseek(f, 0x1004, SEEK_SET) == 0 && fread(back, 1, 4, f) == 4;
+		passed = passed && back[0] == 0xCA && back[1] == 0xFE && back[2] == 0xF0 && back[3] == 0x0D;
+		passed = passed && fseek(f, 0, SEEK_END) == 0 && ftell(f) == 0x2000;
+		fclose(f);
+	}
+
+	mem = mips_mem_create_ram_file(filePath, 0x2000, 4);
+	passed = passed && mem != 0 && read_word(mem, 0x1004) == 0xCAFEF00D;
+	mips_mem_free(mem);
+
+	mips_test_end_test(testId, passed, "RAM file did not keep its contents");
+
+	remove(imagePath);
+	remove(filePath);
+}
+
+struct mmio_log
+{
+	unsigned reads;
+	unsigned writes;
+	uint32_t offset;	// Of the last access
+	uint32_t length;
+	uint8_t data[4];
+};
+
+static mips_error mmio_log_read(void *context, uint32_t offset, uint32_t length, uint8_t *dataOut)
+{
+	mmio_log *log = (mmio_log*)context;
+
+	log->reads++;
+	log->offset = offset;
+	log->length = length;
+
+	for(uint32_t i = 0; i < length; i++)
+	{
+		dataOut[i] = 0x5A;
+	}
+
+	return mips_Success;
+}
+
+static mips_error mmio_log_write(void *context, uint32_t offset, uint32_t length, const uint8_t *dataIn)
+{
+	mmio_log *log = (mmio_log*)context;
+
+	log->writes++;
+	log->offset = offset;
+	log->length = length;
+
+	for(uint32_t i = 0; i < length && i < 4; i++)
+	{
+		log->data[i] = dataIn[i];
+	}
+
+	return mips_Success;
+}
+
+// A device which only takes whole words, as many real registers do
+static mips_error mmio_word_read(void *context, uint32_t offset, uint32_t length, uint8_t *dataOut)
+{
+	if(length != 4)
+	{
+		return mips_ExceptionInvalidAlignment;
+	}
+
+	return mmio_log_read(context, offset, length, dataOut);
+}
+
+static mips_error mmio_word_write(void *context, uint32_t offset, uint32_t length, const uint8_t *dataIn)
+{
+	if(length != 4)
+	{
+		return mips_ExceptionInvalidAlignment;
+	}
+
+	return mmio_log_write(context, offset, length, dataIn);
+}
+
+static void test_mmio_access()
+{
+	mmio_log log = { 0, 0, 0, 0, { 0, 0, 0, 0 } };
+	mmio_log wordLog = { 0, 0, 0, 0, { 0, 0, 0, 0 } };
+
+	mips_mem_h ram = mips_mem_create_ram(0x1000, 4);
+	mips_mem_h device = mips_mem_create_mmio(mmio_log_read, mmio_log_write, &log);
+	mips_mem_h wordDevice = mips_mem_create_mmio(mmio_word_read, mmio_word_write, &wordLog);
+	mips_mem_h bus = mips_mem_create_bus();
+	mips_cpu_h cpu = 0;
+	uint32_t got = 0;
+	int testId;
+	int passed;
+
+	mips_mem_bus_map(bus, 0, 0x1000, ram, 0, mips_BusReadWrite);
+	mips_mem_bus_map(bus, 0x10000000, 0x1000, device, 0, mips_BusReadWrite);
+	mips_mem_bus_map(bus, 0x10001000, 0x1000, wordDevice, 0, mips_BusReadWrite);
+
+	write_word(bus, 0x00, opcode(0x28) | rs(4) | rt(5) | data(1));	// sb r5, 1(r4)
+	write_word(bus, 0x04, opcode(0x29) | rs(4) | rt(5) | data(2));	// sh r5, 2(r4)
+	write_word(bus, 0x08, opcode(0x20) | rs(4) | rt(6) | data(3));	// lb r6, 3(r4)
+	write_word(bus, 0x0C, opcode(0x28) | rs(7) | rt(5) | data(1));	// sb r5, 1(r7)
+	write_word(bus, 0x10, opcode(0x21) | rs(7) | rt(6) | data(2));	// lh r6, 2(r7)
+
+	cpu = mips_cpu_create(bus);
+	mips_cpu_set_register(cpu, 4, 0x10000000);
+	mips_cpu_set_register(cpu, 5, 0x1234ABCD);
+	mips_cpu_set_register(cpu, 7, 0x10001000);
+
+	// Byte and halfword stores reach a device as they are, without
+	// reading the rest of the word first
+	testId = mips_test_begin_test("sb");
+
+	passed = mips_cpu_step(cpu) == mips_Success;
+	passed = passed && log.reads == 0 && log.writes == 1;
+	passed = passed && log.offset == 1 && log.length == 1 && log.data[0] == 0xCD;
+
+	mips_test_end_test(testId, passed, "sb to a device was not a single byte write");
+
+	testId = mips_test_begin_test("sh");
+
+	passed = mips_cpu_step(cpu) == mips_Success;
+	passed = passed && log.reads == 0 && log.writes == 2;
+	passed = passed && log.offset == 2 && log.length == 2 && log.data[0] == 0xAB && log.data[1] == 0xCD;
+
+	mips_test_end_test(testId, passed, "sh to a device was not a single halfword write");
+
+	testId = mips_test_begin_test("lb");
+
+	passed = mips_cpu_step(cpu) == mips_Success;
+	passed = passed && log.reads == 1 && log.offset == 3 && log.length == 1;
+	mips_cpu_get_register(cpu, 6, &got);
+	passed = passed && got == 0x5A;
+
+	mips_test_end_test(testId, passed, "lb from a device was not a single byte read");
+
+	// A device which refuses them gets the whole word instead, with a
+	// store merged into what was read
+	testId = mips_test_begin_test("sb");
+
+	passed = mips_cpu_step(cpu) == mips_Success;
+	passed = passed && wordLog.reads == 1 && wordLog.writes == 1;
+	passed = passed && wordLog.offset == 0 && wordLog.length == 4;
+	passed = passed && wordLog.data[0] == 0x5A && wordLog.data[1] == 0xCD && wordLog.data[2] == 0x5A;
+
+	mips_test_end_test(testId, passed, "sb to a word-only device was not a word write");
+
+	testId = mips_test_begin_test("lh");
+
+	passed = mips_cpu_step(cpu) == mips_Success;
+	passed = passed && wordLog.reads == 2 && wordLog.offset == 0 && wordLog.length == 4;
+	mips_cpu_get_register(cpu, 6, &got);
+	passed = passed && got == 0x5A5A;
+
+	mips_test_end_test(testId, passed, "lh from a word-only device was not a word read");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(bus);
+	mips_mem_free(wordDevice);
+	mips_mem_free(device);
+	mips_mem_free(ram);
+}
+
+// The writes a memory has reported to an observer
+struct write_log
+{
+	unsigned count;
+	uint32_t address[8];
+	uint32_t length[8];
+};
+
+static void write_log_add(void *context, uint32_t address, uint32_t length)
+{
+	write_log *log = (write_log*)context;
+
+	if(log->count < 8)
+	{
+		log->address[log->count] = address;
+		log->length[log->count] = length;
+	}
+
+	log->count++;
+}
+
+static bool write_log_has(const write_log &log, uint32_t address, uint32_t length)
+{
+	for(unsigned i = 0; i < log.count && i < 8; i++)
+	{
+		if(log.address[i] == address && log.length[i] == length)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static mips_error mmio_refuse_write(void *, uint32_t, uint32_t, const uint8_t *)
+{
+	return mips_ExceptionAccessViolation;
+}
+
+static void test_bus()
+{
+	// 0x0000  two pages of RAM A
+	// 0x2000  a page of RAM B
+	// 0x3000  a device which refuses every write
+	// 0x8000  a ROM
+	// 0x10000 the second page of RAM A again
+	mips_mem_h ramA = mips_mem_create_ram(0x2000, 4);
+	mips_mem_h ramB = mips_mem_create_ram(0x1000, 4);
+	mips_mem_h rom = mips_mem_create_ram(0x1000, 4);
+	mips_mem_h device = mips_mem_create_mmio(0, mmio_refuse_write, 0);
+	mips_mem_h bus = mips_mem_create_bus();
+	write_log log = { 0, { 0 }, { 0 } };
+	uint8_t buffer[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	uint8_t back[8];
+	int testId;
+	int passed;
+
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	passed = mips_mem_bus_map(bus, 0x0000, 0x2000, ramA, 0, mips_BusReadWrite) == mips_Success;
+	passed = passed && mips_mem_bus_map(bus, 0x2000, 0x1000, ramB, 0, mips_BusReadWrite) == mips_Success;
+	passed = passed && mips_mem_bus_map(bus, 0x3000, 0x1000, device, 0, mips_BusReadWrite) == mips_Success;
+	passed = passed && mips_mem_bus_map(bus, 0x8000, 0x1000, rom, 0, mips_BusReadOnly) == mips_Success;
+	passed = passed && mips_mem_bus_map(bus, 0x10000, 0x1000, ramA, 0x1000, mips_BusReadWrite) == mips_Success;
+
+	// Overlapping or unaligned ranges are refused
+	passed = passed && mips_mem_bus_map(bus, 0x1000, 0x1000, ramB, 0, mips_BusReadWrite) == mips_ErrorInvalidArgument;
+	passed = passed && mips_mem_bus_map(bus, 0x20000, 0x800, ramB, 0, mips_BusReadWrite) == mips_ErrorInvalidArgument;
+
+	passed = passed && mips_mem_add_write_observer(bus, write_log_add, &log) == mips_Success;
+
+	mips_test_end_test(testId, passed, "bus could not be set up");
+
+	// Nothing is mapped there, and a write running off the end of a
+	// mapping changes nothing
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	passed = mips_mem_read(bus, 0x5000, 4, back) == mips_ExceptionInvalidAddress;
+	passed = passed && mips_mem_write(bus, 0x5000, 4, buffer) == mips_ExceptionInvalidAddress;
+	passed = passed && mips_mem_write(bus, 0x10FFC, 8, buffer) == mips_ExceptionInvalidAddress;
+	passed = passed && read_word(ramA, 0x1FFC) == 0;
+	passed = passed && log.count == 0;
+
+	mips_test_end_test(testId, passed, "bus routed an access to an unmapped address");
+
+	// A ROM can be loaded directly and read through the bus, but not
+	// written through it
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	write_word(rom, 0x10, 0xCAFEF00D);
+	passed = write_log_has(log, 0x8010, 4);
+	passed = passed && read_word(bus, 0x8010) == 0xCAFEF00D;
+	passed = passed && mips_mem_write(bus, 0x8010, 4, buffer) == mips_ExceptionAccessViolation;
+	passed = passed && mips_mem_write(bus, 0x7FFC, 8, buffer) == mips_ExceptionInvalidAddress;
+	passed = passed && read_word(rom, 0x10) == 0xCAFEF00D;
+
+	mips_test_end_test(testId, passed, "bus let a read-only mapping be written");
+
+	// Transactions are split where one mapping ends and the next begins
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	log.count = 0;
+	passed = mips_mem_write(bus, 0x1FFC, 8, buffer) == mips_Success;
+	passed = passed && read_word(ramA, 0x1FFC) == 0x01020304 && read_word(ramB, 0) == 0x05060708;
+	passed = passed && mips_mem_read(bus, 0x1FFC, 8, back) == mips_Success;
+	passed = passed && back[0] == 1 && back[7] == 8;
+	passed = passed && write_log_has(log, 0x1FFC, 8);
+
+	mips_test_end_test(testId, passed, "bus transfer across mappings was wrong");
+
+	// Observers hear about every bus address which changed, however the
+	// change was made
+	testId = mips_test_begin_test("<INTERNAL>");
+
+	log.count = 0;
+	write_word(bus, 0x1000, 1);
+	passed = log.count == 2 && write_log_has(log, 0x1000, 4) && write_log_has(log, 0x10000, 4);
+
+	log.count = 0;
+	write_word(ramA, 0x1004, 2);
+	passed = passed && log.count == 2 && write_log_has(log, 0x1004, 4) && write_log_has(log, 0x10004, 4);
+	passed = passed && read_word(bus, 0x10004) == 2;
+
+	// The part of a write which a device refuses is not reported, but
+	// the part before it is
+	log.count = 0;
+	passed = passed && mips_mem_write(bus, 0x2FFC, 8, buffer) == mips_ExceptionAccessViolation;
+	passed = passed && read_word(ramB, 0xFFC) == 0x01020304;
+	passed = passed && log.count == 1 && write_log_has(log, 0x2FFC, 4);
+
+	mips_test_end_test(testId, passed, "bus did not report a write to its observers");
+
+	mips_mem_remove_write_observer(bus, write_log_add, &log);
+	mips_mem_free(bus);
+	mips_mem_free(device);
+	mips_mem_free(rom);
+	mips_mem_free(ramB);
+	mips_mem_free(ramA);
+}
@@ -0,0 +1,239 @@
+/* The parts of mips_mem.h which are the same for every memory device.
+   Calls are checked and then handed to the device through its ops
+   table, see mips_mem_provider.h.
+*/
+#include "mips_mem_provider.h"
+
+#include <stdlib.h>
+
+void mips_mem_provider_init(struct mips_mem_provider *mem, const struct mips_mem_ops *ops)
+{
+	mem->ops=ops;
+	mem->observers=0;
+}
+
+mips_error mips_mem_provider_add_observer(struct mips_mem_provider *mem, mips_mem_write_observer fn, void *context)
+{
+	struct mips_mem_observer *obs=(struct mips_mem_observer*)malloc(sizeof(struct mips_mem_observer));
+	if(obs==0)
+		return mips_InternalError;
+
+	obs->fn=fn;
+	obs->context=context;
+	obs->next=mem->observers;
+	mem->observers=obs;
+
+	return mips_Success;
+}
+
+mips_error mips_mem_provider_remove_observer(struct mips_mem_provider *mem, mips_mem_write_observer fn, void *context)
+{
+	struct mips_mem_observer **link=&mem->observers;
+	while(*link){
+		if((*link)->fn==fn && (*link)->context==context){
+			struct mips_mem_observer *obs=*link;
+			*link=obs->next;
+			free(obs);
+			return mips_Success;
+		}
+		link=&(*link)->next;
+	}
+	return mips_ErrorInvalidArgument;
+}
+
+void mips_mem_provider_notify(struct mips_mem_provider *mem, uint32_t address, uint32_t length)
+{
+	struct mips_mem_observer *obs=mem->observers;
+	while(obs){
+		obs->fn(obs->context, address, length);
+		obs=obs->next;
+	}
+}
+
+extern "C" mips_error mips_mem_read(
+	mips_mem_h mem,		//!< Handle to target memory
+	uint32_t address,	//!< Byte address to start transaction at
+	uint32_t length,	//!< Number of bytes to transfer
+	uint8_t *dataOut	//!< Receives the target bytes
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+
+	return mem->ops->read(mem, address, length, dataOut);
+}
+
+extern "C" mips_error mips_mem_fetch(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	uint8_t *dataOut
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+
+	if(mem->ops->fetch)
+		return mem->ops->fetch(mem, address, length, dataOut);
+
+	return mem->ops->read(mem, address, length, dataOut);
+}
+
+extern "C" mips_error mips_mem_write(
+	mips_mem_h mem,			//! Handle to target memory
+	uint32_t address,		//! Byte address to start transaction at
+	uint32_t length,		//! Number of bytes to transfer
+	const uint8_t *dataIn	//! Receives the target bytes
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+
+	mips_error err=mem->ops->write(mem, address, length, dataIn);
+	if(err)
+		return err;
+
+	mips_mem_provider_notify(mem, address, length);
+	return mips_Success;
+}
+
+extern "C" mips_error mips_mem_add_write_observer(
+	mips_mem_h mem,
+	mips_mem_write_observer fn,
+	void *context
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(fn==0)
+		return mips_ErrorInvalidArgument;
+
+	if(mem->ops->add_write_observer)
+		return mem->ops->add_write_observer(mem, fn, context);
+
+	return mips_mem_provider_add_observer(mem, fn, context);
+}
+
+extern "C" mips_error mips_mem_remove_write_observer(
+	mips_mem_h mem,
+	mips_mem_write_observer fn,
+	void *context
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+
+	if(mem->ops->remove_write_observer)
+		return mem->ops->remove_write_observer(mem, fn, context);
+
+	return mips_mem_provider_remove_observer(mem, fn, context);
+}
+
+extern "C" mips_error mips_mem_snapshot_take(
+	mips_mem_h mem,
+	mips_mem_snapshot_h *snapshot
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(snapshot==0)
+		return mips_ErrorInvalidArgument;
+	if(mem->ops->snapshot_take==0)
+		return mips_ErrorNotImplemented;
+
+	return mem->ops->snapshot_take(mem, snapshot);
+}
+
+extern "C" mips_error mips_mem_snapshot_restore(
+	mips_mem_h mem,
+	mips_mem_snapshot_h snapshot
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(snapshot==0 || mem->ops->snapshot_restore==0)
+		return mips_ErrorInvalidArgument;
+
+	return mem->ops->snapshot_restore(mem, snapshot);
+}
+
+extern "C" void mips_mem_snapshot_free(
+	mips_mem_h mem,
+	mips_mem_snapshot_h snapshot
+)
+{
+	if(mem && snapshot && mem->ops->snapshot_free)
+		mem->ops->snapshot_free(mem, snapshot);
+}
+
+extern "C" mips_error mips_mem_mark_clean(mips_mem_h mem)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(mem->ops->mark_clean==0)
+		return mips_ErrorNotImplemented;
+
+	return mem->ops->mark_clean(mem);
+}
+
+extern "C" mips_error mips_mem_reset_dirty(
+	mips_mem_h mem,
+	mips_mem_dirty_reset how
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(how!=mips_DirtyZero && how!=mips_DirtyRestore)
+		return mips_ErrorInvalidArgument;
+	if(mem->ops->reset_dirty==0)
+		return mips_ErrorNotImplemented;
+
+	return mem->ops->reset_dirty(mem, how);
+}
+
+extern "C" mips_error mips_mem_get_dirty(
+	mips_mem_h mem,
+	uint32_t *pageSize,
+	uint32_t *addresses,
+	unsigned capacity,
+	unsigned *count
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(pageSize==0 || count==0 || (capacity && addresses==0))
+		return mips_ErrorInvalidArgument;
+	if(mem->ops->get_dirty==0)
+		return mips_ErrorNotImplemented;
+
+	return mem->ops->get_dirty(mem, pageSize, addresses, capacity, count);
+}
+
+extern "C" void mips_mem_free(mips_mem_h mem)
+{
+	if(mem){
+		while(mem->observers){
+			struct mips_mem_observer *obs=mem->observers;
+			mem->observers=obs->next;
+			free(obs);
+		}
+		mem->ops->free(mem);
+	}
+}
+
+extern "C" mips_error mips_mem_get_host_range(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	const uint8_t **ptr
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(ptr==0)
+		return mips_ErrorInvalidArgument;
+	if(mem->ops->get_host_range==0)
+		return mips_ErrorNotImplemented;
+
+	return mem->ops->get_host_range(mem, address, length, ptr);
+}
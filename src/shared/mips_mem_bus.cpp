@@ -0,0 +1,373 @@
+/* A memory device which routes address ranges to other memories, as
+   described in mips_mem.h, so that RAM, ROM and peripherals can share
+   one address space.
+
+   Ranges are mapped in whole 4KB pages, and each page's mapping is
+   found through a two-level table (ten bits, then ten bits), so routing
+   a transaction costs the same however many devices there are. Host
+   pointers are passed straight through from the device behind a page,
+   which lets a CPU read RAM on the bus without going through it at all.
+
+   Each mapping watches its device for writes, so that anything which
+   changes a device directly (a loader, or a snapshot restore) is
+   reported to the bus's observers at the bus address.
+*/
+#include "mips_mem_provider.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BUS_PAGE_BITS 12
+#define BUS_PAGE_SIZE (1u<<BUS_PAGE_BITS)
+#define BUS_LEAF_BITS 10
+#define BUS_LEAF_SIZE (1u<<BUS_LEAF_BITS)
+#define BUS_TOP_SIZE (1u<<(32-BUS_PAGE_BITS-BUS_LEAF_BITS))
+
+struct mips_mem_bus;
+
+struct bus_mapping
+{
+	uint32_t base;
+	uint32_t length;
+	mips_mem_h child;
+	uint32_t offset;		// Child address of base
+	mips_bus_access access;
+	int observed;			// Non-zero if the child accepted our observer
+	struct mips_mem_bus *bus;
+	struct bus_mapping *next;
+};
+
+struct bus_leaf
+{
+	struct bus_mapping *pages[BUS_LEAF_SIZE];
+};
+
+struct bus_snapshot
+{
+	struct mips_mem_snapshot base;	// Must be first
+	unsigned count;
+	mips_mem_h *children;
+	mips_mem_snapshot_h *snapshots;
+};
+
+struct mips_mem_bus
+{
+	struct mips_mem_provider base;	// Must be first
+	struct bus_mapping *mappings;
+	int blind;				// Some child cannot report writes
+	struct bus_mapping *writing;	// Mapping a write through the bus is going to
+	struct bus_leaf *top[BUS_TOP_SIZE];
+};
+
+static struct bus_mapping *bus_find(const struct mips_mem_bus *bus, uint32_t address)
+{
+	const struct bus_leaf *leaf=bus->top[address>>(BUS_PAGE_BITS+BUS_LEAF_BITS)];
+	if(leaf==0)
+		return 0;
+	return leaf->pages[(address>>BUS_PAGE_BITS) & (BUS_LEAF_SIZE-1)];
+}
+
+/* Writes through the bus are reported by the generic layer at the
+   address they were made to, so only other changes to a child (made
+   directly, or seen through another mapping of it) are passed on here */
+static void bus_on_child_write(void *context, uint32_t address, uint32_t length)
+{
+	struct bus_mapping *m=(struct bus_mapping*)context;
+
+	if(m->bus->writing==m)
+		return;
+
+	uint64_t lo=(address > m->offset) ? address : m->offset;
+	uint64_t hi=(uint64_t)address+length;
+	if(hi > (uint64_t)m->offset+m->length)
+		hi=(uint64_t)m->offset+m->length;
+
+	if(lo<hi)
+		mips_mem_provider_notify(&m->bus->base, m->base+(uint32_t)(lo-m->offset), (uint32_t)(hi-lo));
+}
+
+enum bus_kind{ bus_Read, bus_Fetch, bus_Write };
+
+/* Checks that a write can be routed in full, so that one which would
+   fail on its way through does not change anything first */
+static mips_error bus_check_write(const struct mips_mem_bus *bus, uint32_t address, uint32_t length)
+{
+	uint64_t end=(uint64_t)address+length;
+
+	for(uint64_t at=address; at<end; ){
+		const struct bus_mapping *m=bus_find(bus, (uint32_t)at);
+		if(m==0)
+			return mips_ExceptionInvalidAddress;
+		if(m->access==mips_BusReadOnly)
+			return mips_ExceptionAccessViolation;
+		at=(uint64_t)m->base+m->length;
+	}
+	return mips_Success;
+}
+
+/* Splits a transaction at mapping boundaries and hands each piece on */
+static mips_error bus_transfer(struct mips_mem_bus *bus, enum bus_kind kind, uint32_t address, uint32_t length, uint8_t *data)
+{
+	if((uint64_t)address+length > ((uint64_t)1<<32))
+		return mips_ExceptionInvalidAddress;
+
+	if(kind==bus_Write){
+		mips_error err=bus_check_write(bus, address, length);
+		if(err)
+			return err;
+	}
+
+	uint32_t start=address;
+
+	while(length){
+		struct bus_mapping *m=bus_find(bus, address);
+		if(m==0)
+			return mips_ExceptionInvalidAddress;
+
+		uint64_t left=(uint64_t)m->base+m->length-address;
+		uint32_t chunk=(length < left) ? length : (uint32_t)left;
+		uint32_t childAddress=m->offset+(address-m->base);
+
+		mips_error err;
+		if(kind==bus_Write){
+			bus->writing=m;
+			err=mips_mem_write(m->child, childAddress, chunk, data);
+			bus->writing=0;
+		}else if(kind==bus_Fetch){
+			err=mips_mem_fetch(m->child, childAddress, chunk, data);
+		}else{
+			err=mips_mem_read(m->child, childAddress, chunk, data);
+		}
+		if(err){
+			// A device can still refuse its piece. The generic layer
+			// only reports whole writes, so report the pieces before it
+			if(kind==bus_Write && address!=start)
+				mips_mem_provider_notify(&bus->base, start, address-start);
+			return err;
+		}
+
+		address+=chunk;
+		length-=chunk;
+		data+=chunk;
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_bus_read(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	return bus_transfer((struct mips_mem_bus*)mem, bus_Read, address, length, dataOut);
+}
+
+static mips_error mips_mem_bus_fetch(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	return bus_transfer((struct mips_mem_bus*)mem, bus_Fetch, address, length, dataOut);
+}
+
+static mips_error mips_mem_bus_write(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn)
+{
+	return bus_transfer((struct mips_mem_bus*)mem, bus_Write, address, length, (uint8_t*)dataIn);
+}
+
+/* If a child cannot report writes then neither can the bus, so that a
+   CPU fetches through it (and through the child) every time */
+static mips_error mips_mem_bus_add_write_observer(mips_mem_h mem, mips_mem_write_observer fn, void *context)
+{
+	if(((struct mips_mem_bus*)mem)->blind)
+		return mips_ErrorNotImplemented;
+	return mips_mem_provider_add_observer(mem, fn, context);
+}
+
+static mips_error mips_mem_bus_remove_write_observer(mips_mem_h mem, mips_mem_write_observer fn, void *context)
+{
+	return mips_mem_provider_remove_observer(mem, fn, context);
+}
+
+static mips_error mips_mem_bus_get_host_range(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t **ptr)
+{
+	struct bus_mapping *m=bus_find((struct mips_mem_bus*)mem, address);
+
+	if(m==0)
+		return mips_ExceptionInvalidAddress;
+	if((uint64_t)address+length > (uint64_t)m->base+m->length)
+		return mips_ErrorNotImplemented;
+
+	return mips_mem_get_host_range(m->child, m->offset+(address-m->base), length, ptr);
+}
+
+static void bus_snapshot_release(struct bus_snapshot *snap)
+{
+	for(unsigned i=0; i<snap->count; i++){
+		mips_mem_snapshot_free(snap->children[i], snap->snapshots[i]);
+	}
+	free(snap->children);
+	free(snap->snapshots);
+	free(snap);
+}
+
+/* A snapshot of the bus is one snapshot of each different child */
+static mips_error mips_mem_bus_snapshot_take(mips_mem_h mem, mips_mem_snapshot_h *snapshot)
+{
+	struct mips_mem_bus *bus=(struct mips_mem_bus*)mem;
+
+	unsigned mappings=0;
+	for(struct bus_mapping *m=bus->mappings; m; m=m->next){
+		mappings++;
+	}
+
+	struct bus_snapshot *snap=(struct bus_snapshot*)malloc(sizeof(struct bus_snapshot));
+	mips_mem_h *children=(mips_mem_h*)malloc((mappings ? mappings : 1)*sizeof(mips_mem_h));
+	mips_mem_snapshot_h *snapshots=(mips_mem_snapshot_h*)malloc((mappings ? mappings : 1)*sizeof(mips_mem_snapshot_h));
+	if(snap==0 || children==0 || snapshots==0){
+		free(snapshots);
+		free(children);
+		free(snap);
+		return mips_InternalError;
+	}
+
+	snap->base.owner=mem;
+	snap->count=0;
+	snap->children=children;
+	snap->snapshots=snapshots;
+
+	for(struct bus_mapping *m=bus->mappings; m; m=m->next){
+		unsigned i=0;
+		while(i<snap->count && snap->children[i]!=m->child){
+			i++;
+		}
+		if(i<snap->count)
+			continue;
+
+		mips_error err=mips_mem_snapshot_take(m->child, &snap->snapshots[i]);
+		if(err){
+			bus_snapshot_release(snap);
+			return err;
+		}
+		snap->children[i]=m->child;
+		snap->count++;
+	}
+
+	*snapshot=&snap->base;
+	return mips_Success;
+}
+
+static mips_error mips_mem_bus_snapshot_restore(mips_mem_h mem, mips_mem_snapshot_h snapshot)
+{
+	struct bus_snapshot *snap=(struct bus_snapshot*)snapshot;
+
+	if(snap->base.owner!=mem)
+		return mips_ErrorInvalidArgument;
+
+	// The children tell our observers about what changes
+	for(unsigned i=0; i<snap->count; i++){
+		mips_error err=mips_mem_snapshot_restore(snap->children[i], snap->snapshots[i]);
+		if(err)
+			return err;
+	}
+	return mips_Success;
+}
+
+static void mips_mem_bus_snapshot_free(mips_mem_h, mips_mem_snapshot_h snapshot)
+{
+	bus_snapshot_release((struct bus_snapshot*)snapshot);
+}
+
+static void mips_mem_bus_free(mips_mem_h mem)
+{
+	struct mips_mem_bus *bus=(struct mips_mem_bus*)mem;
+
+	while(bus->mappings){
+		struct bus_mapping *m=bus->mappings;
+		bus->mappings=m->next;
+		if(m->observed)
+			mips_mem_remove_write_observer(m->child, bus_on_child_write, m);
+		free(m);
+	}
+	for(uint32_t i=0; i<BUS_TOP_SIZE; i++){
+		free(bus->top[i]);
+	}
+	free(bus);
+}
+
+static const struct mips_mem_ops sg_busOps={
+	mips_mem_bus_read,
+	mips_mem_bus_write,
+	mips_mem_bus_fetch,
+	mips_mem_bus_add_write_observer,
+	mips_mem_bus_remove_write_observer,
+	mips_mem_bus_free,
+	mips_mem_bus_snapshot_take,
+	mips_mem_bus_snapshot_restore,
+	mips_mem_bus_snapshot_free,
+	0,	// no dirty page tracking
+	0,
+	0,
+	mips_mem_bus_get_host_range
+};
+
+extern "C" mips_mem_h mips_mem_create_bus(void)
+{
+	struct mips_mem_bus *bus=(struct mips_mem_bus*)calloc(1, sizeof(struct mips_mem_bus));
+	if(bus==0)
+		return 0;
+
+	mips_mem_provider_init(&bus->base, &sg_busOps);
+	return &bus->base;
+}
+
+extern "C" mips_error mips_mem_bus_map(
+	mips_mem_h mem,
+	uint32_t base,
+	uint32_t length,
+	mips_mem_h child,
+	uint32_t offset,
+	mips_bus_access access
+){
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(mem->ops!=&sg_busOps || child==0 || child==mem || length==0
+		|| (base|length|offset)&(BUS_PAGE_SIZE-1)
+		|| (uint64_t)base+length > ((uint64_t)1<<32)
+		|| (uint64_t)offset+length > ((uint64_t)1<<32)
+		|| (access!=mips_BusReadWrite && access!=mips_BusReadOnly))
+		return mips_ErrorInvalidArgument;
+
+	struct mips_mem_bus *bus=(struct mips_mem_bus*)mem;
+	uint32_t first=base>>BUS_PAGE_BITS;
+	uint32_t count=length>>BUS_PAGE_BITS;
+
+	for(uint32_t page=first; page<first+count; page++){
+		if(bus_find(bus, page<<BUS_PAGE_BITS))
+			return mips_ErrorInvalidArgument;
+	}
+
+	// Leaves first, so that nothing is half mapped if memory runs out
+	for(uint32_t index=first>>BUS_LEAF_BITS; index<=(first+count-1)>>BUS_LEAF_BITS; index++){
+		if(bus->top[index]==0){
+			bus->top[index]=(struct bus_leaf*)calloc(1, sizeof(struct bus_leaf));
+			if(bus->top[index]==0)
+				return mips_InternalError;
+		}
+	}
+
+	struct bus_mapping *m=(struct bus_mapping*)malloc(sizeof(struct bus_mapping));
+	if(m==0)
+		return mips_InternalError;
+
+	m->base=base;
+	m->length=length;
+	m->child=child;
+	m->offset=offset;
+	m->access=access;
+	m->bus=bus;
+	m->observed=mips_mem_add_write_observer(child, bus_on_child_write, m)==mips_Success;
+	m->next=bus->mappings;
+	bus->mappings=m;
+
+	if(!m->observed)
+		bus->blind=1;
+
+	for(uint32_t page=first; page<first+count; page++){
+		bus->top[page>>BUS_LEAF_BITS]->pages[page&(BUS_LEAF_SIZE-1)]=m;
+	}
+	return mips_Success;
+}
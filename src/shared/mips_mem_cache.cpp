@@ -0,0 +1,431 @@
+/* A memory device which models a cache hierarchy in front of another
+   memory, as described in mips_mem.h. Only tags are kept; data always
+   comes from the inner memory, so the caches can never change what a
+   program sees.
+
+   Tags for each set are stored contiguously, padded to a multiple of four
+   ways, so that a lookup compares four ways at a time with SSE2 where the
+   host has it.
+*/
+#include "mips_mem_provider.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Tag of an empty way. Line numbers are addresses shifted right by at
+   least two bits, so can never match it */
+#define CACHE_INVALID 0xFFFFFFFFu
+
+struct cache_level
+{
+	int present;
+	mips_cache_config config;
+	uint32_t lineBits;
+	uint32_t sets;
+	uint32_t stride;	/* ways rounded up to a multiple of four */
+
+	uint32_t *tags;		/* sets*stride line numbers */
+	uint8_t *dirty;		/* sets*stride */
+	uint64_t *used;		/* sets*stride last use times, for LRU */
+	uint16_t *tree;		/* one tree of ways-1 bits per set, for PLRU */
+	uint64_t clock;
+
+	/* The line used last, and its slot. Touching it again cannot change
+	   the replacement order, so repeats skip the lookup */
+	uint32_t mruLine;
+	uint32_t mruSlot;
+
+	mips_cache_stats stats;
+
+	struct cache_level *next;	/* NULL for the inner memory */
+};
+
+struct mips_mem_cache
+{
+	struct mips_mem_provider base;	// Must be first
+	mips_mem_h inner;
+	struct cache_level levels[mips_CacheLevels];
+};
+
+static int cache_is_pow2(uint32_t x)
+{
+	return x && !(x & (x-1));
+}
+
+static uint32_t cache_log2(uint32_t x)
+{
+	uint32_t n=0;
+	while(x>1){
+		x>>=1;
+		n++;
+	}
+	return n;
+}
+
+/* Returns the way holding line, or -1 */
+static int cache_find(const uint32_t *tags, uint32_t stride, uint32_t line)
+{
+#if defined(__SSE2__)
+	__m128i key=_mm_set1_epi32((int)line);
+	for(uint32_t w=0; w<stride; w+=4){
+		__m128i t=_mm_loadu_si128((const __m128i*)(tags+w));
+		int mask=_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(t, key)));
+		if(mask){
+			return w + ((mask&1) ? 0 : (mask&2) ? 1 : (mask&4) ? 2 : 3);
+		}
+	}
+#else
+	for(uint32_t w=0; w<stride; w++){
+		if(tags[w]==line){
+			return w;
+		}
+	}
+#endif
+	return -1;
+}
+
+static void cache_touch(struct cache_level *c, uint32_t set, uint32_t way)
+{
+	if(c->config.replacement==mips_CacheLru){
+		c->used[set*c->stride+way]=++c->clock;
+		return;
+	}
+
+	/* Walk down from the root, pointing each node away from this way */
+	uint32_t ways=c->config.ways;
+	uint16_t bits=c->tree[set];
+	uint32_t node=1;
+	for(uint32_t half=ways>>1; half; half>>=1){
+		uint32_t right=(way & half) ? 1 : 0;
+		if(right){
+			bits&=~(1u<<node);
+		}else{
+			bits|=(1u<<node);
+		}
+		node=node*2+right;
+	}
+	c->tree[set]=bits;
+}
+
+static uint32_t cache_victim(const struct cache_level *c, uint32_t set)
+{
+	const uint32_t *tags=c->tags+set*c->stride;
+	uint32_t ways=c->config.ways;
+
+	for(uint32_t w=0; w<ways; w++){
+		if(tags[w]==CACHE_INVALID){
+			return w;
+		}
+	}
+
+	if(c->config.replacement==mips_CacheLru){
+		const uint64_t *used=c->used+set*c->stride;
+		uint32_t oldest=0;
+		for(uint32_t w=1; w<ways; w++){
+			if(used[w]<used[oldest]){
+				oldest=w;
+			}
+		}
+		return oldest;
+	}
+
+	uint16_t bits=c->tree[set];
+	uint32_t node=1;
+	uint32_t way=0;
+	for(uint32_t half=ways>>1; half; half>>=1){
+		uint32_t right=(bits>>node)&1;
+		way|=right ? half : 0;
+		node=node*2+right;
+	}
+	return way;
+}
+
+static void cache_access(struct cache_level *c, uint32_t address, int write)
+{
+	if(!c){
+		return;
+	}
+
+	uint32_t line=address>>c->lineBits;
+	int writeBack=c->config.writePolicy==mips_CacheWriteBack;
+
+	if(line==c->mruLine){
+		c->stats.hits++;
+		if(write){
+			if(writeBack){
+				c->dirty[c->mruSlot]=1;
+			}else{
+				cache_access(c->next, address, 1);
+			}
+		}
+		return;
+	}
+
+	uint32_t set=line&(c->sets-1);
+	uint32_t *tags=c->tags+set*c->stride;
+
+	int way=cache_find(tags, c->stride, line);
+	if(way>=0){
+		c->stats.hits++;
+		cache_touch(c, set, way);
+		c->mruLine=line;
+		c->mruSlot=set*c->stride+way;
+		if(write){
+			if(writeBack){
+				c->dirty[set*c->stride+way]=1;
+			}else{
+				cache_access(c->next, address, 1);
+			}
+		}
+		return;
+	}
+
+	c->stats.misses++;
+
+	if(write && !writeBack){
+		// No write allocate
+		cache_access(c->next, address, 1);
+		return;
+	}
+
+	way=cache_victim(c, set);
+	if(tags[way]!=CACHE_INVALID){
+		c->stats.evictions++;
+		if(c->dirty[set*c->stride+way]){
+			c->stats.writebacks++;
+			cache_access(c->next, tags[way]<<c->lineBits, 1);
+		}
+	}
+
+	cache_access(c->next, address, 0);	// Line fill
+
+	tags[way]=line;
+	c->dirty[set*c->stride+way]=write ? 1 : 0;
+	cache_touch(c, set, way);
+	c->mruLine=line;
+	c->mruSlot=set*c->stride+way;
+}
+
+/* Counts an access to every line the transaction covers */
+static void cache_transaction(struct cache_level *c, uint32_t address, uint32_t length, int write)
+{
+	if(!length){
+		return;
+	}
+
+	uint32_t first=address>>c->lineBits;
+	uint32_t last=(address+length-1)>>c->lineBits;
+	for(uint32_t line=first; line<=last; line++){
+		cache_access(c, line<<c->lineBits, write);
+	}
+}
+
+static mips_error mips_mem_cache_read(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	struct mips_mem_cache *cache=(struct mips_mem_cache*)mem;
+
+	mips_error err=mips_mem_read(cache->inner, address, length, dataOut);
+	if(!err){
+		cache_transaction(&cache->levels[mips_CacheL1D], address, length, 0);
+	}
+	return err;
+}
+
+static mips_error mips_mem_cache_fetch(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	struct mips_mem_cache *cache=(struct mips_mem_cache*)mem;
+
+	mips_error err=mips_mem_fetch(cache->inner, address, length, dataOut);
+	if(!err){
+		cache_transaction(&cache->levels[mips_CacheL1I], address, length, 0);
+	}
+	return err;
+}
+
+static mips_error mips_mem_cache_write(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn)
+{
+	struct mips_mem_cache *cache=(struct mips_mem_cache*)mem;
+
+	mips_error err=mips_mem_write(cache->inner, address, length, dataIn);
+	if(!err){
+		cache_transaction(&cache->levels[mips_CacheL1D], address, length, 1);
+	}
+	return err;
+}
+
+static mips_error mips_mem_cache_add_write_observer(mips_mem_h, mips_mem_write_observer, void *)
+{
+	return mips_ErrorNotImplemented;
+}
+
+static mips_error mips_mem_cache_remove_write_observer(mips_mem_h, mips_mem_write_observer, void *)
+{
+	return mips_ErrorInvalidArgument;
+}
+
+/* Snapshots and dirty pages are of the data, which lives in the inner
+   memory; the tags and counts carry on as they are */
+static mips_error mips_mem_cache_snapshot_take(mips_mem_h mem, mips_mem_snapshot_h *snapshot)
+{
+	return mips_mem_snapshot_take(((struct mips_mem_cache*)mem)->inner, snapshot);
+}
+
+static mips_error mips_mem_cache_snapshot_restore(mips_mem_h mem, mips_mem_snapshot_h snapshot)
+{
+	return mips_mem_snapshot_restore(((struct mips_mem_cache*)mem)->inner, snapshot);
+}
+
+static void mips_mem_cache_snapshot_free(mips_mem_h mem, mips_mem_snapshot_h snapshot)
+{
+	mips_mem_snapshot_free(((struct mips_mem_cache*)mem)->inner, snapshot);
+}
+
+static mips_error mips_mem_cache_mark_clean(mips_mem_h mem)
+{
+	return mips_mem_mark_clean(((struct mips_mem_cache*)mem)->inner);
+}
+
+static mips_error mips_mem_cache_reset_dirty(mips_mem_h mem, mips_mem_dirty_reset how)
+{
+	return mips_mem_reset_dirty(((struct mips_mem_cache*)mem)->inner, how);
+}
+
+static mips_error mips_mem_cache_get_dirty(mips_mem_h mem, uint32_t *pageSize, uint32_t *addresses, unsigned capacity, unsigned *count)
+{
+	return mips_mem_get_dirty(((struct mips_mem_cache*)mem)->inner, pageSize, addresses, capacity, count);
+}
+
+static void cache_level_free(struct cache_level *c)
+{
+	free(c->tags);
+	free(c->dirty);
+	free(c->used);
+	free(c->tree);
+}
+
+static void mips_mem_cache_free(mips_mem_h mem)
+{
+	struct mips_mem_cache *cache=(struct mips_mem_cache*)mem;
+
+	for(unsigned i=0; i<mips_CacheLevels; i++){
+		cache_level_free(&cache->levels[i]);
+	}
+	free(cache);
+}
+
+static const struct mips_mem_ops sg_cacheOps={
+	mips_mem_cache_read,
+	mips_mem_cache_write,
+	mips_mem_cache_fetch,
+	mips_mem_cache_add_write_observer,
+	mips_mem_cache_remove_write_observer,
+	mips_mem_cache_free,
+	mips_mem_cache_snapshot_take,
+	mips_mem_cache_snapshot_restore,
+	mips_mem_cache_snapshot_free,
+	mips_mem_cache_mark_clean,
+	mips_mem_cache_reset_dirty,
+	mips_mem_cache_get_dirty,
+	0	// every access has to be seen, so no host pointers
+};
+
+/* Returns zero if the configuration cannot be built */
+static int cache_level_init(struct cache_level *c, const mips_cache_config *config, struct cache_level *next)
+{
+	memset(c, 0, sizeof(*c));
+
+	if(!cache_is_pow2(config->lineSize) || config->lineSize<4
+		|| !cache_is_pow2(config->ways) || config->ways>MIPS_CACHE_MAX_WAYS
+		|| !config->size || config->size % (config->lineSize*config->ways)
+		|| !cache_is_pow2(config->size / (config->lineSize*config->ways))
+		|| (config->replacement!=mips_CacheLru && config->replacement!=mips_CachePlru)
+		|| (config->writePolicy!=mips_CacheWriteBack && config->writePolicy!=mips_CacheWriteThrough)){
+		return 0;
+	}
+
+	c->present=1;
+	c->config=*config;
+	c->lineBits=cache_log2(config->lineSize);
+	c->sets=config->size / (config->lineSize*config->ways);
+	c->stride=(config->ways+3)&~3u;
+	c->mruLine=CACHE_INVALID;
+	c->next=next;
+
+	uint32_t slots=c->sets*c->stride;
+	c->tags=(uint32_t*)malloc(slots*sizeof(uint32_t));
+	c->dirty=(uint8_t*)calloc(slots, 1);
+	c->used=(uint64_t*)calloc(slots, sizeof(uint64_t));
+	c->tree=(uint16_t*)calloc(c->sets, sizeof(uint16_t));
+	if(!c->tags || !c->dirty || !c->used || !c->tree){
+		return 0;
+	}
+
+	for(uint32_t i=0; i<slots; i++){
+		c->tags[i]=CACHE_INVALID;
+	}
+	return 1;
+}
+
+extern "C" mips_mem_h mips_mem_create_cache(
+	mips_mem_h inner,
+	const mips_cache_config *l1i,
+	const mips_cache_config *l1d,
+	const mips_cache_config *l2
+){
+	if(!inner || !l1i || !l1d)
+		return 0;
+
+	struct mips_mem_cache *cache=(struct mips_mem_cache*)calloc(1, sizeof(struct mips_mem_cache));
+	if(cache==0)
+		return 0;
+
+	mips_mem_provider_init(&cache->base, &sg_cacheOps);
+	cache->inner=inner;
+
+	struct cache_level *next=0;
+	int ok=1;
+	if(l2){
+		ok=cache_level_init(&cache->levels[mips_CacheL2], l2, 0);
+		next=&cache->levels[mips_CacheL2];
+	}
+	ok=ok && cache_level_init(&cache->levels[mips_CacheL1I], l1i, next);
+	ok=ok && cache_level_init(&cache->levels[mips_CacheL1D], l1d, next);
+
+	if(!ok){
+		mips_mem_cache_free(&cache->base);
+		return 0;
+	}
+	return &cache->base;
+}
+
+extern "C" mips_error mips_mem_get_cache_stats(
+	mips_mem_h mem,
+	mips_cache_level level,
+	mips_cache_stats *stats
+){
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(mem->ops!=&sg_cacheOps || (unsigned)level>=mips_CacheLevels || !stats)
+		return mips_ErrorInvalidArgument;
+
+	*stats=((struct mips_mem_cache*)mem)->levels[level].stats;
+	return mips_Success;
+}
+
+extern "C" mips_error mips_mem_reset_cache_stats(mips_mem_h mem)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(mem->ops!=&sg_cacheOps)
+		return mips_ErrorInvalidArgument;
+
+	struct mips_mem_cache *cache=(struct mips_mem_cache*)mem;
+	for(unsigned i=0; i<mips_CacheLevels; i++){
+		memset(&cache->levels[i].stats, 0, sizeof(mips_cache_stats));
+	}
+	return mips_Success;
+}
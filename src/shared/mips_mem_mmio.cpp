@@ -0,0 +1,94 @@
+/* A memory device which hands every transaction to callbacks, as
+   described in mips_mem.h, for modelling memory mapped peripherals.
+   It is normally mapped into an address space with mips_mem_bus_map.
+*/
+#include "mips_mem_provider.h"
+
+#include <stdlib.h>
+
+struct mips_mem_mmio
+{
+	struct mips_mem_provider base;	// Must be first
+	mips_mem_mmio_read_fn read;
+	mips_mem_mmio_write_fn write;
+	void *context;
+};
+
+static mips_error mips_mem_mmio_read(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	struct mips_mem_mmio *mmio=(struct mips_mem_mmio*)mem;
+
+	if(mmio->read==0)
+		return mips_ExceptionAccessViolation;
+	return mmio->read(mmio->context, address, length, dataOut);
+}
+
+static mips_error mips_mem_mmio_write(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn)
+{
+	struct mips_mem_mmio *mmio=(struct mips_mem_mmio*)mem;
+
+	if(mmio->write==0)
+		return mips_ExceptionAccessViolation;
+	return mmio->write(mmio->context, address, length, dataIn);
+}
+
+/* Registers hold no memory to save, so snapshots of them are empty. This
+   lets a bus holding peripherals still snapshot its RAM */
+static mips_error mips_mem_mmio_snapshot_take(mips_mem_h mem, mips_mem_snapshot_h *snapshot)
+{
+	struct mips_mem_snapshot *snap=(struct mips_mem_snapshot*)malloc(sizeof(struct mips_mem_snapshot));
+	if(snap==0)
+		return mips_InternalError;
+
+	snap->owner=mem;
+	*snapshot=snap;
+	return mips_Success;
+}
+
+static mips_error mips_mem_mmio_snapshot_restore(mips_mem_h mem, mips_mem_snapshot_h snapshot)
+{
+	return snapshot->owner==mem ? mips_Success : mips_ErrorInvalidArgument;
+}
+
+static void mips_mem_mmio_snapshot_free(mips_mem_h, mips_mem_snapshot_h snapshot)
+{
+	free(snapshot);
+}
+
+static void mips_mem_mmio_free(mips_mem_h mem)
+{
+	free(mem);
+}
+
+static const struct mips_mem_ops sg_mmioOps={
+	mips_mem_mmio_read,
+	mips_mem_mmio_write,
+	0,	// fetches are just reads
+	0,	// observers are kept by the generic layer
+	0,
+	mips_mem_mmio_free,
+	mips_mem_mmio_snapshot_take,
+	mips_mem_mmio_snapshot_restore,
+	mips_mem_mmio_snapshot_free,
+	0,	// no dirty page tracking
+	0,
+	0,
+	0	// every access has to reach the callbacks
+};
+
+extern "C" mips_mem_h mips_mem_create_mmio(
+	mips_mem_mmio_read_fn read,
+	mips_mem_mmio_write_fn write,
+	void *context
+){
+	struct mips_mem_mmio *mmio=(struct mips_mem_mmio*)malloc(sizeof(struct mips_mem_mmio));
+	if(mmio==0)
+		return 0;
+
+	mips_mem_provider_init(&mmio->base, &sg_mmioOps);
+	mmio->read=read;
+	mmio->write=write;
+	mmio->context=context;
+
+	return &mmio->base;
+}
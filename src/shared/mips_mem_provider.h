@@ -0,0 +1,78 @@
+/* Internal interface between the generic functions in mips_mem.cpp and
+   the devices which implement them. Each device embeds a mips_mem_provider
+   as its first member, and fills in ops with its own functions.
+
+   The generic layer checks handles, and tells write observers about
+   successful writes, so devices only move data.
+*/
+#ifndef mips_mem_provider_header
+#define mips_mem_provider_header
+
+#include "mips_mem.h"
+
+struct mips_mem_observer
+{
+	mips_mem_write_observer fn;
+	void *context;
+	struct mips_mem_observer *next;
+};
+
+struct mips_mem_ops
+{
+	mips_error (*read)(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut);
+	mips_error (*write)(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn);
+
+	/* Instruction fetches, or NULL if the device treats them as reads */
+	mips_error (*fetch)(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut);
+
+	/* Devices which cannot keep observers the normal way (they forward
+	   them to another memory, or refuse them) provide these, otherwise
+	   they are NULL and the generic layer keeps its own list */
+	mips_error (*add_write_observer)(mips_mem_h mem, mips_mem_write_observer fn, void *context);
+	mips_error (*remove_write_observer)(mips_mem_h mem, mips_mem_write_observer fn, void *context);
+
+	/* Releases the device, including the memory holding the provider */
+	void (*free)(mips_mem_h mem);
+
+	/* Snapshots, or NULL if the device cannot take them. A device which
+	   puts data back on restore must tell the observers about it with
+	   mips_mem_provider_notify */
+	mips_error (*snapshot_take)(mips_mem_h mem, mips_mem_snapshot_h *snapshot);
+	mips_error (*snapshot_restore)(mips_mem_h mem, mips_mem_snapshot_h snapshot);
+	void (*snapshot_free)(mips_mem_h mem, mips_mem_snapshot_h snapshot);
+
+	/* Dirty page tracking, or NULL if the device does not keep it */
+	mips_error (*mark_clean)(mips_mem_h mem);
+	mips_error (*reset_dirty)(mips_mem_h mem, mips_mem_dirty_reset how);
+	mips_error (*get_dirty)(mips_mem_h mem, uint32_t *pageSize, uint32_t *addresses, unsigned capacity, unsigned *count);
+
+	/* Direct read access to the bytes behind a range, or NULL if the
+	   device has no such bytes or needs to see every access */
+	mips_error (*get_host_range)(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t **ptr);
+};
+
+struct mips_mem_provider
+{
+	const struct mips_mem_ops *ops;
+	struct mips_mem_observer *observers;
+};
+
+/* Each device's snapshots start with this, so that a snapshot handed
+   to the wrong memory can be refused */
+struct mips_mem_snapshot
+{
+	mips_mem_h owner;	/* NULL once a restore has thrown it away */
+};
+
+/* Sets up the part of a device which the generic layer owns */
+void mips_mem_provider_init(struct mips_mem_provider *mem, const struct mips_mem_ops *ops);
+
+/* The generic layer's own list of observers, for devices which provide
+   add_write_observer only to decide whether to accept them */
+mips_error mips_mem_provider_add_observer(struct mips_mem_provider *mem, mips_mem_write_observer fn, void *context);
+mips_error mips_mem_provider_remove_observer(struct mips_mem_provider *mem, mips_mem_write_observer fn, void *context);
+
+/* Tells the write observers that memory changed */
+void mips_mem_provider_notify(struct mips_mem_provider *mem, uint32_t address, uint32_t length);
+
+#endif
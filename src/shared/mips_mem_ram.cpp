@@ -1,43 +1,165 @@
-/* This file is an implementation of the functions
+/* This file is an implementation of the RAM device
    defined in mips_mem.h. It is designed to be
    linked against something which needs an implementation
    of a RAM device following that memory mapping
-   interface.
+   interface, together with mips_mem.cpp which provides
+   the device independent functions.
+
+   Snapshots are kept as undo logs. Each one holds the pages which were
+   first written after it was taken, as they were before that write,
+   and only the newest snapshot collects pages. Restoring copies back
+   the logs from the newest down to the one asked for.
+
+   Separately, a bitmap records which pages have been written since the
+   memory was last clean, so that resetting it between runs only has to
+   touch those pages.
+
+   The data is normally allocated with calloc. RAMs made from an image
+   or backed by a file map it with mmap instead, which only the POSIX
+   build supports.
 */
-#include "mips_mem.h"
+#include "mips_mem_provider.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RAM_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define RAM_PAGE_BITS 12
+#define RAM_PAGE_SIZE (1u<<RAM_PAGE_BITS)
+
+struct ram_saved_page
+{
+	uint32_t index;
+	struct ram_saved_page *next;
+	uint8_t data[RAM_PAGE_SIZE];
+};
+
+struct mips_mem_ram_snapshot
+{
+	struct mips_mem_snapshot base;	// Must be first
+	uint32_t epoch;
+	struct ram_saved_page *pages;
+	struct mips_mem_ram_snapshot *older;
+	struct mips_mem_ram_snapshot *newer;
+};
 
-struct mips_mem_provider
+struct mips_mem_ram
 {
+	struct mips_mem_provider base;	// Must be first
 	uint32_t length;
 	uint32_t blockSize;
 	uint8_t *data;
+	size_t mapped;			// Bytes mapped with mmap, or 0 if data came from calloc
+
+	uint32_t pageCount;
+	uint32_t *savedEpoch;	// Per page, so the newest snapshot saves each page once
+	uint32_t epoch;			// Last epoch handed out
+	struct mips_mem_ram_snapshot *newest;
+
+	uint32_t *dirty;		// One bit per page
+	uint32_t *zeroed;		// Pages since zeroed by a reset, which no longer match clean
+	uint8_t *clean;			// Contents when last marked clean, or NULL
 };
 
-extern "C" mips_mem_h mips_mem_create_ram(
-	uint32_t cbMem,	//!< Total number of bytes of ram
-	uint32_t blockSize	//!< Granularity in bytes
-){
-	uint8_t *data=(uint8_t*)malloc(cbMem);
-	if(data==0)
-		return 0;
-	
-	struct mips_mem_provider *mem=(struct mips_mem_provider*)malloc(sizeof(struct mips_mem_provider));
-	if(mem==0){
-		free(data);
-		return 0;
+static void ram_mark_dirty(struct mips_mem_ram *ram, uint32_t address, uint32_t length)
+{
+	uint32_t first=address>>RAM_PAGE_BITS;
+	uint32_t last=(address+length-1)>>RAM_PAGE_BITS;
+
+	for(uint32_t index=first; index<=last; index++){
+		ram->dirty[index>>5] |= 1u<<(index&31);
 	}
-	
-	mem->length=cbMem;
-	mem->blockSize=blockSize;
-	mem->data=data;
-	
-	return mem;
 }
 
-static mips_error mips_mem_read_write(
+/* Returns the first dirty page at or after index, or pageCount. With
+   zeroedToo, pages which differ from the clean image are included */
+static uint32_t ram_next_dirty(const struct mips_mem_ram *ram, uint32_t index, int zeroedToo)
+{
+	while(index<ram->pageCount){
+		uint32_t word=ram->dirty[index>>5] | (zeroedToo ? ram->zeroed[index>>5] : 0);
+		uint32_t bits=word >> (index&31);
+		if(bits){
+			while(!(bits&1)){
+				bits>>=1;
+				index++;
+			}
+			return index;
+		}
+		index=(index|31)+1;
+	}
+	return ram->pageCount;
+}
+
+static uint32_t ram_page_length(const struct mips_mem_ram *ram, uint32_t index)
+{
+	uint32_t start=index<<RAM_PAGE_BITS;
+	return (ram->length-start < RAM_PAGE_SIZE) ? ram->length-start : RAM_PAGE_SIZE;
+}
+
+/* Epochs are never reused by a live snapshot, so a page is in the newest
+   log exactly when its savedEpoch matches. If the counter wraps, every
+   mark is dropped, and the caller re-marks whichever log it needs */
+static uint32_t ram_next_epoch(struct mips_mem_ram *ram)
+{
+	if(++ram->epoch==0){
+		memset(ram->savedEpoch, 0, ram->pageCount*sizeof(uint32_t));
+		ram->epoch=1;
+	}
+	return ram->epoch;
+}
+
+static void ram_mark(struct mips_mem_ram *ram, const struct mips_mem_ram_snapshot *snap)
+{
+	for(const struct ram_saved_page *page=snap->pages; page; page=page->next){
+		ram->savedEpoch[page->index]=snap->epoch;
+	}
+}
+
+static void ram_free_pages(struct ram_saved_page *page)
+{
+	while(page){
+		struct ram_saved_page *next=page->next;
+		free(page);
+		page=next;
+	}
+}
+
+/* Copies pages into the newest log before a write changes them. Returns
+   zero if there was no memory to do so */
+static int ram_save_pages(struct mips_mem_ram *ram, uint32_t address, uint32_t length)
+{
+	struct mips_mem_ram_snapshot *snap=ram->newest;
+	uint32_t first=address>>RAM_PAGE_BITS;
+	uint32_t last=(address+length-1)>>RAM_PAGE_BITS;
+
+	for(uint32_t index=first; index<=last; index++){
+		if(ram->savedEpoch[index]==snap->epoch){
+			continue;
+		}
+
+		struct ram_saved_page *page=(struct ram_saved_page*)malloc(sizeof(struct ram_saved_page));
+		if(page==0){
+			return 0;
+		}
+
+		page->index=index;
+		memcpy(page->data, ram->data+(index<<RAM_PAGE_BITS), ram_page_length(ram, index));
+		page->next=snap->pages;
+		snap->pages=page;
+		ram->savedEpoch[index]=snap->epoch;
+	}
+	return 1;
+}
+
+static mips_error mips_mem_ram_read_write(
 	bool write,
     mips_mem_h mem,
     uint32_t address,
@@ -45,39 +167,51 @@ static mips_error mips_mem_read_write(
     uint8_t *dataOut
 )
 {	
-	if(mem==0)
-		return mips_ErrorInvalidHandle;
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
 	
-	if(0 != (address%mem->blockSize) ){
+	if(0 != (address%ram->blockSize) ){
 		return mips_ExceptionInvalidAlignment;
 	}
-	if(0 != ((address+length)%mem->blockSize)){
+	if(0 != ((address+length)%ram->blockSize)){
 		return mips_ExceptionInvalidAlignment;
 	}
-	if((address+length) > mem->length){	// A subtle bug here, maybe?
+	// Written so that address+length cannot wrap around
+	if(address > ram->length || length > ram->length-address){
 		return mips_ExceptionInvalidAddress;
 	}
 	
 	if(write){
-		for(unsigned i=0; i<length; i++){
-			mem->data[address+i]=dataOut[i];
+		if(ram->newest && length && !ram_save_pages(ram, address, length)){
+			return mips_InternalError;
+		}
+		if(length){
+			ram_mark_dirty(ram, address, length);
+		}
+		// Nearly every transaction is one word, which a fixed size copy
+		// turns into a single load and store
+		if(length==4){
+			memcpy(ram->data+address, dataOut, 4);
+		}else{
+			memcpy(ram->data+address, dataOut, length);
 		}
 	}else{
-		for(unsigned i=0; i<length; i++){
-			dataOut[i]=mem->data[address+i];
+		if(length==4){
+			memcpy(dataOut, ram->data+address, 4);
+		}else{
+			memcpy(dataOut, ram->data+address, length);
 		}
 	}
 	return mips_Success;
 }
 
-mips_error mips_mem_read(
-    mips_mem_h mem,		//!< Handle to target memory
-    uint32_t address,	//!< Byte address to start transaction at
-    uint32_t length,	//!< Number of bytes to transfer
-    uint8_t *dataOut	//!< Receives the target bytes
+static mips_error mips_mem_ram_read(
+    mips_mem_h mem,
+    uint32_t address,
+    uint32_t length,
+    uint8_t *dataOut
 )
 {	
-	return mips_mem_read_write(
+	return mips_mem_ram_read_write(
 		false,	// we want to read
 		mem,
 		address,
@@ -86,14 +220,14 @@ mips_error mips_mem_read(
 	);
 }
 
-mips_error mips_mem_write(
-	mips_mem_h mem,	//! Handle to target memory
-	uint32_t address,		//! Byte address to start transaction at
-	uint32_t length,			//! Number of bytes to transfer
-	const uint8_t *dataIn	//! Receives the target bytes
+static mips_error mips_mem_ram_write(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	const uint8_t *dataIn
 )
 {
-	return mips_mem_read_write(
+	return mips_mem_ram_read_write(
 		true,	// we want to write
 		mem,
 		address,
@@ -102,11 +236,362 @@ mips_error mips_mem_write(
 	);
 }
 
-void mips_mem_free(mips_mem_h mem)
+static mips_error mips_mem_ram_get_host_range(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t **ptr)
+{
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
+
+	if(address>ram->length || length>ram->length-address){
+		return mips_ExceptionInvalidAddress;
+	}
+
+	// The data is never moved, and restores copy into it in place
+	*ptr=ram->data+address;
+	return mips_Success;
+}
+
+static void ram_release_data(uint8_t *data, size_t mapped)
+{
+#ifdef RAM_HAVE_MMAP
+	if(mapped){
+		munmap(data, mapped);
+		return;
+	}
+#endif
+	free(data);
+}
+
+static void mips_mem_ram_free(mips_mem_h mem)
+{
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
+	
+	free(ram->clean);
+	free(ram->zeroed);
+	free(ram->dirty);
+	free(ram->savedEpoch);
+	ram_release_data(ram->data, ram->mapped);
+	ram->data=0;
+	free(ram);
+}
+
+static mips_error mips_mem_ram_snapshot_take(mips_mem_h mem, mips_mem_snapshot_h *snapshot)
+{
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
+
+	struct mips_mem_ram_snapshot *snap=(struct mips_mem_ram_snapshot*)malloc(sizeof(struct mips_mem_ram_snapshot));
+	if(snap==0)
+		return mips_InternalError;
+
+	snap->base.owner=mem;
+	snap->epoch=ram_next_epoch(ram);
+	snap->pages=0;
+	snap->older=ram->newest;
+	snap->newer=0;
+
+	if(ram->newest)
+		ram->newest->newer=snap;
+	ram->newest=snap;
+
+	*snapshot=&snap->base;
+	return mips_Success;
+}
+
+static mips_error mips_mem_ram_snapshot_restore(mips_mem_h mem, mips_mem_snapshot_h snapshot)
+{
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
+	struct mips_mem_ram_snapshot *target=(struct mips_mem_ram_snapshot*)snapshot;
+
+	if(target->base.owner!=mem)
+		return mips_ErrorInvalidArgument;
+
+	// Newest first, so a page saved by several logs ends up as the
+	// oldest copy at or after the target
+	for(;;){
+		struct mips_mem_ram_snapshot *snap=ram->newest;
+
+		for(struct ram_saved_page *page=snap->pages; page; page=page->next){
+			uint32_t length=ram_page_length(ram, page->index);
+			memcpy(ram->data+(page->index<<RAM_PAGE_BITS), page->data, length);
+			ram_mark_dirty(ram, page->index<<RAM_PAGE_BITS, length);
+			mips_mem_provider_notify(mem, page->index<<RAM_PAGE_BITS, length);
+		}
+		ram_free_pages(snap->pages);
+		snap->pages=0;
+
+		if(snap==target)
+			break;
+
+		ram->newest=snap->older;
+		snap->base.owner=0;
+		snap->older=0;
+		snap->newer=0;
+	}
+
+	target->newer=0;
+	target->epoch=ram_next_epoch(ram);
+	return mips_Success;
+}
+
+static void mips_mem_ram_snapshot_free(mips_mem_h mem, mips_mem_snapshot_h snapshot)
+{
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
+	struct mips_mem_ram_snapshot *snap=(struct mips_mem_ram_snapshot*)snapshot;
+
+	if(snap->base.owner==mem){
+		struct mips_mem_ram_snapshot *older=snap->older;
+
+		if(snap->newer)
+			snap->newer->older=older;
+		else
+			ram->newest=older;
+		if(older)
+			older->newer=snap->newer;
+
+		// Restoring the older snapshot still needs the pages this one
+		// saved, unless it saved the same page itself
+		if(older){
+			older->epoch=ram_next_epoch(ram);
+			ram_mark(ram, older);
+
+			struct ram_saved_page *page=snap->pages;
+			snap->pages=0;
+			while(page){
+				struct ram_saved_page *next=page->next;
+				if(ram->savedEpoch[page->index]==older->epoch){
+					free(page);
+				}else{
+					page->next=older->pages;
+					older->pages=page;
+					ram->savedEpoch[page->index]=older->epoch;
+				}
+				page=next;
+			}
+
+			if(ram->newest!=older)
+				ram_mark(ram, ram->newest);
+		}
+	}
+
+	ram_free_pages(snap->pages);
+	free(snap);
+}
+
+static mips_error mips_mem_ram_mark_clean(mips_mem_h mem)
 {
-	if(mem){
-		free(mem->data);
-		mem->data=0;
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
+	uint32_t words=(ram->pageCount+31)>>5;
+
+	if(ram->clean==0){
+		ram->clean=(uint8_t*)malloc(ram->length ? ram->length : 1);
+		if(ram->clean==0)
+			return mips_InternalError;
+		memcpy(ram->clean, ram->data, ram->length);
+	}else{
+		for(uint32_t index=ram_next_dirty(ram, 0, 1); index<ram->pageCount; index=ram_next_dirty(ram, index+1, 1)){
+			uint32_t start=index<<RAM_PAGE_BITS;
+			memcpy(ram->clean+start, ram->data+start, ram_page_length(ram, index));
+		}
+	}
+
+	memset(ram->dirty, 0, words*sizeof(uint32_t));
+	memset(ram->zeroed, 0, words*sizeof(uint32_t));
+	return mips_Success;
+}
+
+static mips_error mips_mem_ram_reset_dirty(mips_mem_h mem, mips_mem_dirty_reset how)
+{
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
+	int restore=how==mips_DirtyRestore;
+
+	if(restore && ram->clean==0)
+		return mips_ErrorInvalidArgument;
+
+	// Restoring also puts back pages an earlier reset zeroed
+	for(uint32_t index=ram_next_dirty(ram, 0, restore); index<ram->pageCount; index=ram_next_dirty(ram, index+1, restore)){
+		uint32_t start=index<<RAM_PAGE_BITS;
+		uint32_t length=ram_page_length(ram, index);
+		uint32_t bit=1u<<(index&31);
+
+		// A snapshot may still need the page as it is now
+		if(ram->newest && !ram_save_pages(ram, start, length))
+			return mips_InternalError;
+
+		if(restore){
+			memcpy(ram->data+start, ram->clean+start, length);
+			ram->zeroed[index>>5] &= ~bit;
+		}else{
+			memset(ram->data+start, 0, length);
+			if(ram->clean)
+				ram->zeroed[index>>5] |= bit;
+		}
+		ram->dirty[index>>5] &= ~bit;
+		mips_mem_provider_notify(mem, start, length);
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_ram_get_dirty(mips_mem_h mem, uint32_t *pageSize, uint32_t *addresses, unsigned capacity, unsigned *count)
+{
+	struct mips_mem_ram *ram=(struct mips_mem_ram*)mem;
+	unsigned found=0;
+
+	for(uint32_t index=ram_next_dirty(ram, 0, 0); index<ram->pageCount; index=ram_next_dirty(ram, index+1, 0)){
+		if(found<capacity){
+			addresses[found]=index<<RAM_PAGE_BITS;
+		}
+		found++;
+	}
+
+	*pageSize=RAM_PAGE_SIZE;
+	*count=found;
+	return mips_Success;
+}
+
+static const struct mips_mem_ops sg_ramOps={
+	mips_mem_ram_read,
+	mips_mem_ram_write,
+	0,	// fetches are just reads
+	0,	// observers are kept by the generic layer
+	0,
+	mips_mem_ram_free,
+	mips_mem_ram_snapshot_take,
+	mips_mem_ram_snapshot_restore,
+	mips_mem_ram_snapshot_free,
+	mips_mem_ram_mark_clean,
+	mips_mem_ram_reset_dirty,
+	mips_mem_ram_get_dirty,
+	mips_mem_ram_get_host_range
+};
+
+/* Wraps a RAM around data of cbMem bytes, which it takes ownership of
+   even if this fails */
+static mips_mem_h ram_create(uint8_t *data, size_t mapped, uint32_t cbMem, uint32_t blockSize)
+{
+	uint32_t pageCount=(uint32_t)(((uint64_t)cbMem+RAM_PAGE_SIZE-1)>>RAM_PAGE_BITS);
+	uint32_t *savedEpoch=(uint32_t*)calloc(pageCount ? pageCount : 1, sizeof(uint32_t));
+	uint32_t words=(pageCount+31)/32 ? (pageCount+31)/32 : 1;
+	uint32_t *dirty=(uint32_t*)calloc(words, sizeof(uint32_t));
+	uint32_t *zeroed=(uint32_t*)calloc(words, sizeof(uint32_t));
+	struct mips_mem_ram *mem=(struct mips_mem_ram*)malloc(sizeof(struct mips_mem_ram));
+	if(savedEpoch==0 || dirty==0 || zeroed==0 || mem==0){
 		free(mem);
+		free(zeroed);
+		free(dirty);
+		free(savedEpoch);
+		ram_release_data(data, mapped);
+		return 0;
 	}
+	
+	mips_mem_provider_init(&mem->base, &sg_ramOps);
+	mem->length=cbMem;
+	mem->blockSize=blockSize;
+	mem->data=data;
+	mem->mapped=mapped;
+	mem->pageCount=pageCount;
+	mem->savedEpoch=savedEpoch;
+	mem->epoch=0;
+	mem->newest=0;
+	mem->dirty=dirty;
+	mem->zeroed=zeroed;
+	mem->clean=0;
+	
+	return &mem->base;
+}
+
+extern "C" mips_mem_h mips_mem_create_ram(
+	uint32_t cbMem,	//!< Total number of bytes of ram
+	uint32_t blockSize	//!< Granularity in bytes
+){
+	// Zeroed, so that mips_DirtyZero gives back a newly created RAM
+	uint8_t *data=(uint8_t*)calloc(cbMem ? cbMem : 1, 1);
+	if(data==0)
+		return 0;
+	
+	return ram_create(data, 0, cbMem, blockSize);
+}
+
+extern "C" mips_mem_h mips_mem_create_ram_image(
+	const char *path,
+	uint32_t cbMem,
+	uint32_t blockSize
+){
+	if(path==0 || cbMem==0)
+		return 0;
+
+#ifdef RAM_HAVE_MMAP
+	int fd=open(path, O_RDONLY);
+	if(fd<0)
+		return 0;
+
+	struct stat info;
+	if(fstat(fd, &info) || (uint64_t)info.st_size>cbMem){
+		close(fd);
+		return 0;
+	}
+
+	// Zeros for the whole RAM, with the image mapped over the start of
+	// it. Both are private, so pages are only copied once written, and
+	// the file never changes. The rest of the image's last page reads
+	// as zeros.
+	void *region=mmap(0, cbMem, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(region==MAP_FAILED){
+		close(fd);
+		return 0;
+	}
+	if(info.st_size && mmap(region, (size_t)info.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0)==MAP_FAILED){
+		munmap(region, cbMem);
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	return ram_create((uint8_t*)region, cbMem, cbMem, blockSize);
+#else
+	FILE *src=fopen(path, "rb");
+	if(src==0)
+		return 0;
+
+	uint8_t *data=(uint8_t*)calloc(cbMem, 1);
+	size_t got=data ? fread(data, 1, cbMem, src) : 0;
+	int tooBig=data && got==cbMem && fgetc(src)!=EOF;
+	int failed=data==0 || ferror(src) || tooBig;
+	fclose(src);
+	if(failed){
+		free(data);
+		return 0;
+	}
+
+	return ram_create(data, 0, cbMem, blockSize);
+#endif
+}
+
+extern "C" mips_mem_h mips_mem_create_ram_file(
+	const char *path,
+	uint32_t cbMem,
+	uint32_t blockSize
+){
+	if(path==0 || cbMem==0)
+		return 0;
+
+#ifdef RAM_HAVE_MMAP
+	int fd=open(path, O_RDWR|O_CREAT, 0666);
+	if(fd<0)
+		return 0;
+
+	// A new or short file is extended with zeros
+	struct stat info;
+	if(fstat(fd, &info) || ((uint64_t)info.st_size<cbMem && ftruncate(fd, cbMem))){
+		close(fd);
+		return 0;
+	}
+
+	void *region=mmap(0, cbMem, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(region==MAP_FAILED)
+		return 0;
+
+	return ram_create((uint8_t*)region, cbMem, cbMem, blockSize);
+#else
+	(void)blockSize;
+	return 0;
+#endif
 }
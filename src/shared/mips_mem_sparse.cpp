@@ -0,0 +1,218 @@
+/* A RAM covering the whole 32-bit address space, as described in
+   mips_mem.h, which only allocates the pages that are written.
+
+   Pages are found through a two-level table: the top ten bits of an
+   address pick a leaf table, and the next ten bits pick a page in it.
+   Both levels are allocated (zeroed) when something is first written
+   there, and a missing page reads as zeros, so the memory used follows
+   the pages the program actually touches. Pages are never released
+   until the memory is freed, so host pointers to them stay valid.
+*/
+#include "mips_mem_provider.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SPARSE_PAGE_BITS 12
+#define SPARSE_PAGE_SIZE (1u<<SPARSE_PAGE_BITS)
+#define SPARSE_LEAF_BITS 10
+#define SPARSE_LEAF_SIZE (1u<<SPARSE_LEAF_BITS)
+#define SPARSE_TOP_SIZE (1u<<(32-SPARSE_PAGE_BITS-SPARSE_LEAF_BITS))
+
+struct sparse_leaf
+{
+	uint8_t *pages[SPARSE_LEAF_SIZE];
+};
+
+struct mips_mem_sparse
+{
+	struct mips_mem_provider base;	// Must be first
+	uint32_t blockSize;
+	uint32_t resident;		// Pages allocated
+	struct sparse_leaf *top[SPARSE_TOP_SIZE];
+};
+
+/* Returns the page holding address, or NULL if it has never been written */
+static uint8_t *sparse_find(const struct mips_mem_sparse *sparse, uint32_t address)
+{
+	const struct sparse_leaf *leaf=sparse->top[address>>(SPARSE_PAGE_BITS+SPARSE_LEAF_BITS)];
+	if(leaf==0)
+		return 0;
+	return leaf->pages[(address>>SPARSE_PAGE_BITS) & (SPARSE_LEAF_SIZE-1)];
+}
+
+/* As sparse_find, but allocates the page if needed. Returns NULL if
+   there was no memory to do so */
+static uint8_t *sparse_alloc(struct mips_mem_sparse *sparse, uint32_t address)
+{
+	struct sparse_leaf **leaf=&sparse->top[address>>(SPARSE_PAGE_BITS+SPARSE_LEAF_BITS)];
+	if(*leaf==0){
+		*leaf=(struct sparse_leaf*)calloc(1, sizeof(struct sparse_leaf));
+		if(*leaf==0)
+			return 0;
+	}
+
+	uint8_t **page=&(*leaf)->pages[(address>>SPARSE_PAGE_BITS) & (SPARSE_LEAF_SIZE-1)];
+	if(*page==0){
+		*page=(uint8_t*)calloc(1, SPARSE_PAGE_SIZE);
+		if(*page==0)
+			return 0;
+		sparse->resident++;
+	}
+	return *page;
+}
+
+static mips_error sparse_check(const struct mips_mem_sparse *sparse, uint32_t address, uint32_t length)
+{
+	if(0 != (address%sparse->blockSize) || 0 != (length%sparse->blockSize)){
+		return mips_ExceptionInvalidAlignment;
+	}
+	// Everything exists, but a transaction cannot wrap past the top
+	if((uint64_t)address+length > ((uint64_t)1<<32)){
+		return mips_ExceptionInvalidAddress;
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_sparse_read(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	uint8_t *dataOut
+)
+{
+	struct mips_mem_sparse *sparse=(struct mips_mem_sparse*)mem;
+
+	mips_error err=sparse_check(sparse, address, length);
+	if(err)
+		return err;
+
+	// One page at a time, as neighbouring pages are not next to each other
+	while(length){
+		uint32_t offset=address & (SPARSE_PAGE_SIZE-1);
+		uint32_t chunk=(length < SPARSE_PAGE_SIZE-offset) ? length : SPARSE_PAGE_SIZE-offset;
+
+		const uint8_t *page=sparse_find(sparse, address);
+		if(page){
+			memcpy(dataOut, page+offset, chunk);
+		}else{
+			memset(dataOut, 0, chunk);
+		}
+
+		address+=chunk;
+		length-=chunk;
+		dataOut+=chunk;
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_sparse_write(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	const uint8_t *dataIn
+)
+{
+	struct mips_mem_sparse *sparse=(struct mips_mem_sparse*)mem;
+
+	mips_error err=sparse_check(sparse, address, length);
+	if(err)
+		return err;
+
+	while(length){
+		uint32_t offset=address & (SPARSE_PAGE_SIZE-1);
+		uint32_t chunk=(length < SPARSE_PAGE_SIZE-offset) ? length : SPARSE_PAGE_SIZE-offset;
+
+		uint8_t *page=sparse_alloc(sparse, address);
+		if(page==0)
+			return mips_InternalError;
+		memcpy(page+offset, dataIn, chunk);
+
+		address+=chunk;
+		length-=chunk;
+		dataIn+=chunk;
+	}
+	return mips_Success;
+}
+
+/* Pages are not next to each other, so only ranges within one page can
+   be given out. Pages which have not been written are not allocated just
+   to be looked at, and a pointer to shared zeros would not see later
+   writes, so they give out nothing until then */
+static mips_error mips_mem_sparse_get_host_range(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t **ptr)
+{
+	struct mips_mem_sparse *sparse=(struct mips_mem_sparse*)mem;
+	uint32_t offset=address & (SPARSE_PAGE_SIZE-1);
+
+	if(length > SPARSE_PAGE_SIZE-offset)
+		return mips_ErrorNotImplemented;
+
+	uint8_t *page=sparse_find(sparse, address);
+	if(page==0)
+		return mips_ErrorNotImplemented;
+
+	*ptr=page+offset;
+	return mips_Success;
+}
+
+static void mips_mem_sparse_free(mips_mem_h mem)
+{
+	struct mips_mem_sparse *sparse=(struct mips_mem_sparse*)mem;
+
+	for(uint32_t i=0; i<SPARSE_TOP_SIZE; i++){
+		struct sparse_leaf *leaf=sparse->top[i];
+		if(leaf==0)
+			continue;
+		for(uint32_t j=0; j<SPARSE_LEAF_SIZE; j++){
+			free(leaf->pages[j]);
+		}
+		free(leaf);
+	}
+	free(sparse);
+}
+
+static const struct mips_mem_ops sg_sparseOps={
+	mips_mem_sparse_read,
+	mips_mem_sparse_write,
+	0,	// fetches are just reads
+	0,	// observers are kept by the generic layer
+	0,
+	mips_mem_sparse_free,
+	0,	// no snapshots
+	0,
+	0,
+	0,	// no dirty page tracking
+	0,
+	0,
+	mips_mem_sparse_get_host_range
+};
+
+extern "C" mips_mem_h mips_mem_create_sparse_ram(
+	uint32_t blockSize
+){
+	if(blockSize==0)
+		return 0;
+
+	struct mips_mem_sparse *sparse=(struct mips_mem_sparse*)calloc(1, sizeof(struct mips_mem_sparse));
+	if(sparse==0)
+		return 0;
+
+	mips_mem_provider_init(&sparse->base, &sg_sparseOps);
+	sparse->blockSize=blockSize;
+	sparse->resident=0;
+
+	return &sparse->base;
+}
+
+extern "C" mips_error mips_mem_get_sparse_resident(
+	mips_mem_h mem,
+	uint64_t *bytes
+){
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(mem->ops!=&sg_sparseOps || !bytes)
+		return mips_ErrorInvalidArgument;
+
+	*bytes=(uint64_t)((struct mips_mem_sparse*)mem)->resident*SPARSE_PAGE_SIZE;
+	return mips_Success;
+}
@@ -9,12 +9,10 @@
 #include <map>
 #include <string>
 #include <vector>
-#include <set>
+#include <new>
 #include <algorithm>
 #include <string> 
 
-static bool sg_started=false;
-
 struct test_info_t
 {
     int testId;
@@ -23,7 +21,17 @@ struct test_info_t
     std::string message;
 };
 
-static std::vector<test_info_t> sg_tests;
+struct mips_test_ctx_impl
+{
+    std::vector<test_info_t> tests;
+};
+
+/* The suite used by the original global functions. Everything else
+   lives in contexts, so that threads with their own context never
+   share anything writable. */
+static bool sg_started=false;
+static mips_test_ctx_impl sg_suite;
+static std::vector<test_info_t> &sg_tests=sg_suite.tests;
 
 struct instr_info_t
 {
@@ -90,7 +98,50 @@ static const instr_info_t sg_instructionsArray[]=
 };
 static const unsigned sg_instructionsCount = sizeof(sg_instructionsArray)/sizeof(sg_instructionsArray[0]);
 
-static std::set<std::string> sg_knownInstructions;
+/* Searches the table directly rather than building a set, so that
+   there is no shared state to set up before threads can use it. */
+static bool is_known_instruction(const std::string &name)
+{
+    for(unsigned i=0; i<sg_instructionsCount; i++){
+        if(name==sg_instructionsArray[i].instruction){
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool test_in_progress(const mips_test_ctx_impl *ctx)
+{
+    return ctx->tests.size()>0 && ctx->tests.back().status==-1;
+}
+
+static int ctx_begin_test(mips_test_ctx_impl *ctx, const char *instruction)
+{
+    int testId=ctx->tests.size();
+    
+    test_info_t info;
+    info.testId=testId;
+    
+    info.instruction=instruction; // We want the string in upper case (shouting!)
+    std::transform(info.instruction.begin(), info.instruction.end(), info.instruction.begin(), ::toupper);
+    
+    if(!is_known_instruction(info.instruction)){
+        fprintf(stderr, "Warning:mips_test_begin_test - Unknown instruction '%s', might want to check the spelling.\n", instruction);
+    }
+    
+    info.status=-1;
+    ctx->tests.push_back(info);
+    
+    return testId;
+}
+
+static void ctx_end_test(mips_test_ctx_impl *ctx, int passed, const char *msg)
+{
+    ctx->tests.back().status=passed ? 1 : 0;
+    if(msg){
+        ctx->tests.back().message=msg;
+    }
+}
 
 
 extern "C" void mips_test_begin_suite()
@@ -100,11 +151,6 @@ extern "C" void mips_test_begin_suite()
         exit(1);
     }
     
-    // Build up a list of known instruction names
-    for(unsigned i=0; i<sg_instructionsCount; i++){
-        sg_knownInstructions.insert(std::string(sg_instructionsArray[i].instruction));
-    }
-    
     sg_started=true;
 }
   
@@ -115,29 +161,12 @@ extern "C" int mips_test_begin_test(const char *instruction)
         exit(1);
     }
     
-    if(sg_tests.size()>0){
-        if(sg_tests.back().status == -1){
-            fprintf(stderr, "Error:mips_test_begin_test - Attempt to start new test of '%s', but previous test with id %u has not been completed.\n", instruction, sg_tests.back().testId);
-            exit(1);
-        }
-    }
-    
-    int testId=sg_tests.size();
-    
-    test_info_t info;
-    info.testId=testId;
-    
-    info.instruction=instruction; // We want the string in upper case (shouting!)
-    std::transform(info.instruction.begin(), info.instruction.end(), info.instruction.begin(), ::toupper);
-    
-    if(sg_knownInstructions.find(info.instruction)==sg_knownInstructions.end()){
-        fprintf(stderr, "Warning:mips_test_begin_test - Unknown instruction '%s', might want to check the spelling.\n", instruction);
+    if(test_in_progress(&sg_suite)){
+        fprintf(stderr, "Error:mips_test_begin_test - Attempt to start new test of '%s', but previous test with id %u has not been completed.\n", instruction, sg_tests.back().testId);
+        exit(1);
     }
     
-    info.status=-1;
-    sg_tests.push_back(info);
-    
-    return testId;
+    return ctx_begin_test(&sg_suite, instruction);
 }
 
 extern "C" void mips_test_end_test(int testId, int passed, const char *msg)
@@ -160,46 +189,32 @@ extern "C" void mips_test_end_test(int testId, int passed, const char *msg)
         exit(1);  
     }
     
-    sg_tests.back().status=passed ? 1 : 0;
-    if(msg){
-        sg_tests.back().message=msg;
-    }
+    ctx_end_test(&sg_suite, passed, msg);
 }
 
 
-extern "C" void mips_test_end_suite()
+static void print_summary(const std::vector<test_info_t> &tests, FILE *dst, unsigned &passedTests)
 {
-    if(!sg_started){
-        fprintf(stderr, "Error:mips_test_finish_suite - Test suite has not been started with mips_test_begin_suite.\n");
-        exit(1);
-    }
-    if(sg_tests.size()==0){
-        fprintf(stderr, "Error:mips_test_finish_suite - No tests have been executed.\n");
-        exit(1);
-    }
-    if(sg_tests.back().status==-1){
-        fprintf(stderr, "Error:mips_test_finish_suite - The final test has not been completed yet.\n");
-        exit(1);
-    }
-    
     // Now we will go through an collect some statistics about what happened
     
     // Build a map from instruction name to a pair of (tests,passed)
     typedef std::map<std::string, std::pair<int,int> > stats_t;
     stats_t statistics;
     
-    for(unsigned i=0; i<sg_tests.size(); i++){
-        test_info_t info=sg_tests[i];
+    passedTests=0;
+    for(unsigned i=0; i<tests.size(); i++){
+        const test_info_t &info=tests[i];
         
         statistics[info.instruction].first++;   // count all tests
         if(info.status==1){
             statistics[info.instruction].second++;  // count the ones that passed
+            passedTests++;
         }
     }
     
-    fprintf(stderr, "\n");
-    fprintf(stderr, "| Instruction |  tests | passed | success |\n");
-    fprintf(stderr, "+-------------+--------+--------+---------+\n");
+    fprintf(dst, "\n");
+    fprintf(dst, "| Instruction |  tests | passed | success |\n");
+    fprintf(dst, "+-------------+--------+--------+---------+\n");
     
     // Work out what happened for each instruction
     int totalTested=0;
@@ -222,19 +237,111 @@ extern "C" void mips_test_end_suite()
             totalFullyWorking++;
         }
             
-        fprintf(stderr, "|%12s |   %4u |   %4u |  %5.1f%% |\n", name.c_str(), total, passed, 100.0*passed/(double)total);
+        fprintf(dst, "|%12s |   %4u |   %4u |  %5.1f%% |\n", name.c_str(), total, passed, 100.0*passed/(double)total);
         
-        if(sg_knownInstructions.find(name)==sg_knownInstructions.end()){
-            fprintf(stderr, "+ Warning: previous instruction not known +\n");
+        if(!is_known_instruction(name)){
+            fprintf(dst, "+ Warning: previous instruction not known +\n");
         }
         
         ++it;
     }
    
-    fprintf(stderr, "+-------------+--------+--------+---------+\n"); 
-    fprintf(stderr, "\n");
-    fprintf(stderr, "Total instructions tested: %3u\n", totalTested);
-    fprintf(stderr, "Fully working :            %3u (%5.1f%%)\n", totalFullyWorking, 100.0*totalFullyWorking/(double)totalTested);
-    fprintf(stderr, "Partially working :        %3u (%5.1f%%)\n", totalPartiallyWorking, 100.0*totalPartiallyWorking/(double)totalTested);
-    fprintf(stderr, "Not working at all :       %3u (%5.1f%%)\n", totalNotWorking, 100.0*totalNotWorking/(double)totalTested);
+    fprintf(dst, "+-------------+--------+--------+---------+\n"); 
+    fprintf(dst, "\n");
+    fprintf(dst, "Total instructions tested: %3u\n", totalTested);
+    fprintf(dst, "Fully working :            %3u (%5.1f%%)\n", totalFullyWorking, 100.0*totalFullyWorking/(double)totalTested);
+    fprintf(dst, "Partially working :        %3u (%5.1f%%)\n", totalPartiallyWorking, 100.0*totalPartiallyWorking/(double)totalTested);
+    fprintf(dst, "Not working at all :       %3u (%5.1f%%)\n", totalNotWorking, 100.0*totalNotWorking/(double)totalTested);
+}
+
+extern "C" void mips_test_end_suite()
+{
+    if(!sg_started){
+        fprintf(stderr, "Error:mips_test_finish_suite - Test suite has not been started with mips_test_begin_suite.\n");
+        exit(1);
+    }
+    if(sg_tests.size()==0){
+        fprintf(stderr, "Error:mips_test_finish_suite - No tests have been executed.\n");
+        exit(1);
+    }
+    if(sg_tests.back().status==-1){
+        fprintf(stderr, "Error:mips_test_finish_suite - The final test has not been completed yet.\n");
+        exit(1);
+    }
+    
+    unsigned passedTests;
+    print_summary(sg_tests, stderr, passedTests);
+}
+
+
+extern "C" mips_test_ctx_h mips_test_ctx_create()
+{
+    return new (std::nothrow) mips_test_ctx_impl;
+}
+
+extern "C" int mips_test_ctx_begin_test(mips_test_ctx_h ctx, const char *instruction)
+{
+    if(!ctx || !instruction || test_in_progress(ctx)){
+        return -1;
+    }
+    
+    return ctx_begin_test(ctx, instruction);
+}
+
+extern "C" mips_error mips_test_ctx_end_test(mips_test_ctx_h ctx, int testId, int passed, const char *msg)
+{
+    if(!ctx){
+        return mips_ErrorInvalidHandle;
+    }
+    if(!test_in_progress(ctx) || ctx->tests.back().testId!=testId){
+        return mips_ErrorInvalidArgument;
+    }
+    
+    ctx_end_test(ctx, passed, msg);
+    return mips_Success;
+}
+
+extern "C" mips_error mips_test_ctx_merge(mips_test_ctx_h dst, mips_test_ctx_h src)
+{
+    if(!dst || !src){
+        return mips_ErrorInvalidHandle;
+    }
+    if(dst==src || test_in_progress(dst) || test_in_progress(src)){
+        return mips_ErrorInvalidArgument;
+    }
+    
+    int base=dst->tests.size();
+    dst->tests.insert(dst->tests.end(), src->tests.begin(), src->tests.end());
+    for(unsigned i=base; i<dst->tests.size(); i++){
+        dst->tests[i].testId=i;
+    }
+    
+    return mips_Success;
+}
+
+extern "C" mips_error mips_test_ctx_report(mips_test_ctx_h ctx, FILE *dst, unsigned *passed, unsigned *total)
+{
+    if(!ctx){
+        return mips_ErrorInvalidHandle;
+    }
+    if(!dst || ctx->tests.size()==0 || test_in_progress(ctx)){
+        return mips_ErrorInvalidArgument;
+    }
+    
+    unsigned passedTests;
+    print_summary(ctx->tests, dst, passedTests);
+    
+    if(passed){
+        *passed=passedTests;
+    }
+    if(total){
+        *total=ctx->tests.size();
+    }
+    
+    return ferror(dst) ? mips_ErrorFileWriteError : mips_Success;
+}
+
+extern "C" void mips_test_ctx_free(mips_test_ctx_h ctx)
+{
+    delete ctx;
 }
@@ -0,0 +1,592 @@
+/* This file implements the trace reader and writer
+   defined in mips_trace.h. The CPU produces raw records,
+   and this turns them into (and back from) the compressed
+   form, so that traces of long runs stay manageable.
+*/
+#include "mips_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Marks the start of each frame ("TRFM" as bytes)
+#define FRAME_MAGIC 0x4D465254u
+
+// magic, record count and payload size, then the 64-bit first index
+#define FRAME_HEADER_BYTES 20
+
+// Slots remembering the instruction last seen at each pc
+#define CACHE_SLOTS 1024
+
+// Longest possible encoding of a single record
+#define MAX_RECORD_BYTES 64
+
+enum trace_tag{
+    TAG_PC_SEQ=0x01,    // pc is the previous pc plus 4
+    TAG_CACHED=0x02,    // instr, dest and flags match the cache slot for pc
+    TAG_ERROR=0x04,     // an error code follows
+    TAG_EXTRA=0x08,     // raw value and address follow
+    TAG_REPEAT=0x10     // instr, dest and flags match the previous record
+};
+
+struct trace_cache_entry
+{
+    uint32_t pc;
+    uint32_t instr;
+    uint8_t dest;
+    uint8_t flags;
+    uint8_t valid;
+};
+
+// Everything the encoder and decoder need to agree on. It is reset
+// at the start of each frame.
+struct trace_codec
+{
+    uint32_t prevPc;
+    struct trace_cache_entry prev;  // Previous record, whatever its pc
+    uint32_t shadow[34];    // Last value written to each GPR, then HI and LO
+    uint32_t lastAddress;
+    uint32_t lastStore;
+    struct trace_cache_entry cache[CACHE_SLOTS];
+};
+
+static void codec_reset(struct trace_codec *codec)
+{
+    memset(codec, 0, sizeof(*codec));
+    codec->prevPc=0xFFFFFFFCu;  // So that a frame starting at 0 is sequential
+}
+
+static uint32_t zigzag(uint32_t delta)
+{
+    return (delta<<1) ^ (uint32_t)((int32_t)delta>>31);
+}
+
+static uint32_t unzigzag(uint32_t z)
+{
+    return (z>>1) ^ (0u-(z&1));
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    for(unsigned i=0; i<4; i++){
+        p[i]=(uint8_t)(v>>(8*i));
+    }
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static void put_varint(uint8_t *buf, uint32_t &pos, uint32_t v)
+{
+    while(v>=0x80){
+        buf[pos++]=(uint8_t)(v|0x80);
+        v>>=7;
+    }
+    buf[pos++]=(uint8_t)v;
+}
+
+static bool get_varint(const uint8_t *buf, uint32_t size, uint32_t &pos, uint32_t &v)
+{
+    v=0;
+    for(unsigned shift=0; shift<35; shift+=7){
+        if(pos>=size)
+            return false;
+        uint8_t b=buf[pos++];
+        v|=(uint32_t)(b&0x7F)<<shift;
+        if(!(b&0x80))
+            return true;
+    }
+    return false;
+}
+
+// Which of value and address the delta fields can reproduce for a record
+static bool value_covered(uint8_t dest, uint8_t flags)
+{
+    return (dest>0 && dest<=mips_TraceDestHiLo)
+        || ((flags & mips_TraceMemWrite) && dest==MIPS_TRACE_NO_DEST);
+}
+
+static bool address_covered(uint8_t dest, uint8_t flags)
+{
+    return dest==mips_TraceDestHiLo || (flags & (mips_TraceMemRead|mips_TraceMemWrite));
+}
+
+static void encode_record(struct trace_codec *codec, const mips_trace_record *rec, uint8_t *buf, uint32_t &pos)
+{
+    uint32_t tagPos=pos++;
+    uint8_t tag=0;
+
+    struct trace_cache_entry &entry=codec->cache[(rec->pc>>2)&(CACHE_SLOTS-1)];
+
+    if(rec->pc==codec->prevPc+4){
+        tag|=TAG_PC_SEQ;
+    }else{
+        put_varint(buf, pos, zigzag(rec->pc-(codec->prevPc+4)));
+    }
+    codec->prevPc=rec->pc;
+
+    if(entry.valid && entry.pc==rec->pc && entry.instr==rec->instr
+        && entry.dest==rec->dest && entry.flags==rec->flags){
+        tag|=TAG_CACHED;
+    }else{
+        // Runs of the same instruction (such as nops) are common in code
+        // which is only executed once
+        struct trace_cache_entry &prev=codec->prev;
+
+        if(prev.valid && prev.instr==rec->instr && prev.dest==rec->dest && prev.flags==rec->flags){
+            tag|=TAG_REPEAT;
+        }else{
+            put_u32(buf+pos, rec->instr);
+            pos+=4;
+            buf[pos++]=rec->dest;
+            buf[pos++]=rec->flags;
+        }
+
+        entry.valid=1;
+        entry.pc=rec->pc;
+        entry.instr=rec->instr;
+        entry.dest=rec->dest;
+        entry.flags=rec->flags;
+    }
+    codec->prev=entry;
+
+    if(rec->error){
+        tag|=TAG_ERROR;
+        put_varint(buf, pos, rec->error);
+    }
+
+    if(rec->dest>0 && rec->dest<mips_TraceDestHiLo){
+        put_varint(buf, pos, zigzag(rec->value-codec->shadow[rec->dest]));
+        codec->shadow[rec->dest]=rec->value;
+    }else if(rec->dest==mips_TraceDestHiLo){
+        put_varint(buf, pos, zigzag(rec->value-codec->shadow[mips_TraceDestLo]));
+        put_varint(buf, pos, zigzag(rec->address-codec->shadow[mips_TraceDestHi]));
+        codec->shadow[mips_TraceDestLo]=rec->value;
+        codec->shadow[mips_TraceDestHi]=rec->address;
+    }
+
+    if(rec->flags & (mips_TraceMemRead|mips_TraceMemWrite)){
+        put_varint(buf, pos, zigzag(rec->address-codec->lastAddress));
+        codec->lastAddress=rec->address;
+    }
+
+    if((rec->flags & mips_TraceMemWrite) && rec->dest==MIPS_TRACE_NO_DEST){
+        put_varint(buf, pos, zigzag(rec->value-codec->lastStore));
+        codec->lastStore=rec->value;
+    }
+
+    // Anything the fields above cannot reproduce is stored as it is
+    if((!value_covered(rec->dest, rec->flags) && rec->value)
+        || (!address_covered(rec->dest, rec->flags) && rec->address)){
+        tag|=TAG_EXTRA;
+        put_varint(buf, pos, rec->value);
+        put_varint(buf, pos, rec->address);
+    }
+
+    buf[tagPos]=tag;
+}
+
+static bool decode_record(struct trace_codec *codec, const uint8_t *buf, uint32_t size, uint32_t &pos, mips_trace_record *rec)
+{
+    uint32_t v;
+
+    if(pos>=size)
+        return false;
+    uint8_t tag=buf[pos++];
+
+    if(tag & TAG_PC_SEQ){
+        rec->pc=codec->prevPc+4;
+    }else{
+        if(!get_varint(buf, size, pos, v))
+            return false;
+        rec->pc=codec->prevPc+4+unzigzag(v);
+    }
+    codec->prevPc=rec->pc;
+
+    struct trace_cache_entry &entry=codec->cache[(rec->pc>>2)&(CACHE_SLOTS-1)];
+
+    if(tag & TAG_CACHED){
+        if(!entry.valid || entry.pc!=rec->pc)
+            return false;
+    }else if(tag & TAG_REPEAT){
+        if(!codec->prev.valid)
+            return false;
+        entry=codec->prev;
+        entry.pc=rec->pc;
+    }else{
+        if(pos+6>size)
+            return false;
+        entry.valid=1;
+        entry.pc=rec->pc;
+        entry.instr=get_u32(buf+pos);
+        entry.dest=buf[pos+4];
+        entry.flags=buf[pos+5];
+        pos+=6;
+    }
+    codec->prev=entry;
+    rec->instr=entry.instr;
+    rec->dest=entry.dest;
+    rec->flags=entry.flags;
+    rec->value=0;
+    rec->address=0;
+    rec->error=0;
+
+    if(tag & TAG_ERROR){
+        if(!get_varint(buf, size, pos, v))
+            return false;
+        rec->error=(uint16_t)v;
+    }
+
+    if(rec->dest>0 && rec->dest<mips_TraceDestHiLo){
+        if(!get_varint(buf, size, pos, v))
+            return false;
+        rec->value=codec->shadow[rec->dest]+unzigzag(v);
+        codec->shadow[rec->dest]=rec->value;
+    }else if(rec->dest==mips_TraceDestHiLo){
+        if(!get_varint(buf, size, pos, v))
+            return false;
+        rec->value=codec->shadow[mips_TraceDestLo]+unzigzag(v);
+        if(!get_varint(buf, size, pos, v))
+            return false;
+        rec->address=codec->shadow[mips_TraceDestHi]+unzigzag(v);
+        codec->shadow[mips_TraceDestLo]=rec->value;
+        codec->shadow[mips_TraceDestHi]=rec->address;
+    }
+
+    if(rec->flags & (mips_TraceMemRead|mips_TraceMemWrite)){
+        if(!get_varint(buf, size, pos, v))
+            return false;
+        rec->address=codec->lastAddress+unzigzag(v);
+        codec->lastAddress=rec->address;
+    }
+
+    if((rec->flags & mips_TraceMemWrite) && rec->dest==MIPS_TRACE_NO_DEST){
+        if(!get_varint(buf, size, pos, v))
+            return false;
+        rec->value=codec->lastStore+unzigzag(v);
+        codec->lastStore=rec->value;
+    }
+
+    if(tag & TAG_EXTRA){
+        if(!get_varint(buf, size, pos, rec->value))
+            return false;
+        if(!get_varint(buf, size, pos, rec->address))
+            return false;
+    }
+
+    return true;
+}
+
+struct mips_trace_writer_impl
+{
+    FILE *dst;
+    uint64_t index;     // Records in frames already written
+    uint32_t count;     // Records in the current frame
+    uint32_t used;      // Bytes of payload in the current frame
+    uint8_t *payload;
+    struct trace_codec codec;
+};
+
+extern "C" mips_trace_writer_h mips_trace_writer_create(FILE *dst)
+{
+    if(dst==0)
+        return 0;
+
+    uint8_t header[8];
+    put_u32(header, MIPS_TRACE_MAGIC_COMPRESSED);
+    header[4]=(uint8_t)MIPS_TRACE_VERSION_COMPRESSED;
+    header[5]=0;
+    header[6]=0;    // No fixed record size
+    header[7]=0;
+    if(1!=fwrite(header, sizeof(header), 1, dst))
+        return 0;
+
+    struct mips_trace_writer_impl *writer=(struct mips_trace_writer_impl*)malloc(sizeof(struct mips_trace_writer_impl));
+    if(writer==0)
+        return 0;
+
+    writer->payload=(uint8_t*)malloc(MIPS_TRACE_FRAME_RECORDS*MAX_RECORD_BYTES);
+    if(writer->payload==0){
+        free(writer);
+        return 0;
+    }
+
+    writer->dst=dst;
+    writer->index=0;
+    writer->count=0;
+    writer->used=0;
+    codec_reset(&writer->codec);
+
+    return writer;
+}
+
+static mips_error mips_trace_writer_flush(mips_trace_writer_h writer)
+{
+    if(writer->count==0)
+        return mips_Success;
+
+    uint8_t header[FRAME_HEADER_BYTES];
+    put_u32(header, FRAME_MAGIC);
+    put_u32(header+4, writer->count);
+    put_u32(header+8, writer->used);
+    put_u32(header+12, (uint32_t)writer->index);
+    put_u32(header+16, (uint32_t)(writer->index>>32));
+
+    if(1!=fwrite(header, sizeof(header), 1, writer->dst))
+        return mips_ErrorFileWriteError;
+    if(1!=fwrite(writer->payload, writer->used, 1, writer->dst))
+        return mips_ErrorFileWriteError;
+
+    writer->index+=writer->count;
+    writer->count=0;
+    writer->used=0;
+    codec_reset(&writer->codec);
+
+    return mips_Success;
+}
+
+extern "C" mips_error mips_trace_writer_append(mips_trace_writer_h writer, const mips_trace_record *rec)
+{
+    if(writer==0)
+        return mips_ErrorInvalidHandle;
+    if(rec==0)
+        return mips_ErrorInvalidArgument;
+
+    encode_record(&writer->codec, rec, writer->payload, writer->used);
+    writer->count++;
+
+    if(writer->count==MIPS_TRACE_FRAME_RECORDS)
+        return mips_trace_writer_flush(writer);
+
+    return mips_Success;
+}
+
+extern "C" mips_error mips_trace_writer_close(mips_trace_writer_h writer)
+{
+    if(writer==0)
+        return mips_ErrorInvalidHandle;
+
+    mips_error err=mips_trace_writer_flush(writer);
+    if(!err && fflush(writer->dst))
+        err=mips_ErrorFileWriteError;
+
+    free(writer->payload);
+    free(writer);
+
+    return err;
+}
+
+struct mips_trace_reader_impl
+{
+    FILE *src;
+    bool compressed;
+    long dataStart;     // File offset of the first record or frame
+    uint64_t index;     // Index of the next record to be returned
+
+    // Current frame of a compressed trace
+    bool haveFrame;
+    uint32_t frameCount;
+    uint32_t frameDone;
+    uint32_t size;
+    uint32_t pos;
+    uint32_t capacity;
+    uint8_t *payload;
+    struct trace_codec codec;
+};
+
+extern "C" mips_trace_reader_h mips_trace_reader_open(FILE *src)
+{
+    if(src==0)
+        return 0;
+
+    uint8_t header[8];
+    if(1!=fread(header, sizeof(header), 1, src))
+        return 0;
+
+    bool compressed;
+
+    mips_trace_file_header raw;
+    memcpy(&raw, header, sizeof(raw));
+
+    if(get_u32(header)==MIPS_TRACE_MAGIC_COMPRESSED && header[4]==MIPS_TRACE_VERSION_COMPRESSED){
+        compressed=true;
+    }else if(raw.magic==MIPS_TRACE_MAGIC && raw.version==MIPS_TRACE_VERSION
+        && raw.recordSize==sizeof(mips_trace_record)){
+        compressed=false;
+    }else{
+        return 0;
+    }
+
+    struct mips_trace_reader_impl *reader=(struct mips_trace_reader_impl*)malloc(sizeof(struct mips_trace_reader_impl));
+    if(reader==0)
+        return 0;
+
+    reader->src=src;
+    reader->compressed=compressed;
+    reader->dataStart=ftell(src);
+    reader->index=0;
+    reader->haveFrame=false;
+    reader->frameCount=0;
+    reader->frameDone=0;
+    reader->size=0;
+    reader->pos=0;
+    reader->capacity=0;
+    reader->payload=0;
+
+    return reader;
+}
+
+// Reads the header of the next frame. Returns false at a clean end of file.
+static bool read_frame_header(mips_trace_reader_h reader, uint32_t &count, uint32_t &size, uint64_t &first, mips_error &err)
+{
+    uint8_t header[FRAME_HEADER_BYTES];
+
+    err=mips_Success;
+
+    size_t got=fread(header, 1, sizeof(header), reader->src);
+    if(got==0)
+        return false;
+
+    if(got!=sizeof(header) || get_u32(header)!=FRAME_MAGIC){
+        err=mips_ErrorFileReadError;
+        return false;
+    }
+
+    count=get_u32(header+4);
+    size=get_u32(header+8);
+    first=get_u32(header+12) | ((uint64_t)get_u32(header+16)<<32);
+
+    return true;
+}
+
+// Loads the payload of a frame whose header has just been read
+static mips_error load_frame(mips_trace_reader_h reader, uint32_t count, uint32_t size)
+{
+    if(size>reader->capacity){
+        uint8_t *payload=(uint8_t*)realloc(reader->payload, size);
+        if(payload==0)
+            return mips_ErrorFileReadError;
+        reader->payload=payload;
+        reader->capacity=size;
+    }
+
+    if(size && 1!=fread(reader->payload, size, 1, reader->src))
+        return mips_ErrorFileReadError;
+
+    reader->haveFrame=true;
+    reader->frameCount=count;
+    reader->frameDone=0;
+    reader->size=size;
+    reader->pos=0;
+    codec_reset(&reader->codec);
+
+    return mips_Success;
+}
+
+extern "C" mips_error mips_trace_reader_read(mips_trace_reader_h reader, mips_trace_record *recs, unsigned maxCount, unsigned *count)
+{
+    if(reader==0)
+        return mips_ErrorInvalidHandle;
+    if(count==0 || (recs==0 && maxCount))
+        return mips_ErrorInvalidArgument;
+
+    *count=0;
+
+    if(!reader->compressed){
+        *count=fread(recs, sizeof(mips_trace_record), maxCount, reader->src);
+        reader->index+=*count;
+        return mips_Success;
+    }
+
+    while(*count<maxCount){
+        if(!reader->haveFrame || reader->frameDone==reader->frameCount){
+            uint32_t frameCount, size;
+            uint64_t first;
+            mips_error err;
+
+            reader->haveFrame=false;
+
+            if(!read_frame_header(reader, frameCount, size, first, err))
+                return err;
+
+            err=load_frame(reader, frameCount, size);
+            if(err)
+                return err;
+            continue;
+        }
+
+        if(!decode_record(&reader->codec, reader->payload, reader->size, reader->pos, &recs[*count]))
+            return mips_ErrorFileReadError;
+
+        reader->frameDone++;
+        reader->index++;
+        (*count)++;
+    }
+
+    return mips_Success;
+}
+
+extern "C" mips_error mips_trace_reader_seek(mips_trace_reader_h reader, uint64_t index)
+{
+    if(reader==0)
+        return mips_ErrorInvalidHandle;
+
+    if(!reader->compressed){
+        if(fseek(reader->src, reader->dataStart+(long)(index*sizeof(mips_trace_record)), SEEK_SET))
+            return mips_ErrorFileReadError;
+        reader->index=index;
+        return mips_Success;
+    }
+
+    if(fseek(reader->src, reader->dataStart, SEEK_SET))
+        return mips_ErrorFileReadError;
+
+    reader->haveFrame=false;
+    reader->index=0;
+
+    // Skip whole frames until the one holding index
+    while(1){
+        uint32_t frameCount, size;
+        uint64_t first;
+        mips_error err;
+
+        if(!read_frame_header(reader, frameCount, size, first, err))
+            return err;
+
+        reader->index=first;
+
+        if(index<first+frameCount){
+            err=load_frame(reader, frameCount, size);
+            if(err)
+                return err;
+
+            mips_trace_record rec;
+            while(reader->index<index){
+                if(!decode_record(&reader->codec, reader->payload, reader->size, reader->pos, &rec))
+                    return mips_ErrorFileReadError;
+                reader->frameDone++;
+                reader->index++;
+            }
+            return mips_Success;
+        }
+
+        if(fseek(reader->src, size, SEEK_CUR))
+            return mips_ErrorFileReadError;
+        reader->index=first+frameCount;
+    }
+}
+
+extern "C" uint64_t mips_trace_reader_tell(mips_trace_reader_h reader)
+{
+    return reader ? reader->index : 0;
+}
+
+extern "C" void mips_trace_reader_close(mips_trace_reader_h reader)
+{
+    if(reader){
+        free(reader->payload);
+        free(reader);
+    }
+}
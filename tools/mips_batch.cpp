@@ -0,0 +1,335 @@
+/* Runs many independent simulations of one binary image, spread over
+   all the cores of the host.
+
+    mips_batch [options] image.bin [jobs]
+        -t threads      Worker threads (default: one per core)
+        -s steps        Step budget for jobs which do not give one (default 1000000)
+        -m bytes        Size of each job's RAM (default 0x20000)
+        -e engine       mips_cpu_engine to use (default 0, the interpreter)
+        -o reg          Register printed as the result (default 2)
+        -r reg first last
+                        Instead of reading a jobs file, run one job for
+                        each value of reg from first to last
+
+   Each line of the jobs file is one job, as a name followed by settings:
+
+        fib12 $4=12
+        big   $4=30 steps=50000000 pc=0x40
+
+   "$n=value" sets a register, "pc=" the entry point (default 0) and
+   "steps=" the step budget. Lines starting with '#' are ignored.
+
+   Like run_fibonacci, every job starts with the image loaded at address
+   0, $29 pointing at 0x1000 and $31 holding a sentinel return address,
+   and ends when it returns to the sentinel. One line per job is printed
+   in the order of the jobs file, then a summary goes to stderr.
+
+   Jobs are handed out with work stealing: each worker takes jobs from
+   the front of its own queue, and once that is empty takes them from the
+   back of the others, so long jobs do not leave threads idle. A worker
+   keeps one CPU and RAM for all its jobs, and goes back to a snapshot
+   of them between jobs, which only copies the pages the last job wrote.
+*/
+#include "mips.h"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+static const uint32_t SENTINEL_PC=0x10000000;
+static const uint32_t STACK_POINTER=0x1000;
+
+struct batch_job
+{
+    std::string name;
+    uint32_t entry;
+    uint32_t maxSteps;
+    std::vector<std::pair<unsigned,uint32_t> > regs;
+
+    // Filled in by whichever worker runs it
+    mips_error err;
+    uint32_t steps;
+    uint32_t pc;
+    uint32_t result;
+};
+
+struct batch_queue
+{
+    std::mutex lock;
+    std::deque<size_t> jobs;
+};
+
+struct batch
+{
+    const char *imageName;
+    uint32_t ramSize;
+    mips_cpu_engine engine;
+    unsigned resultReg;
+
+    std::vector<batch_job> jobs;
+    std::vector<batch_queue> queues;
+};
+
+// Own queue first, oldest job first; then the newest job of anyone else
+static bool take_job(batch &b, unsigned self, size_t &job)
+{
+    for(unsigned i=0; i<b.queues.size(); i++){
+        batch_queue &q=b.queues[(self+i) % b.queues.size()];
+        std::lock_guard<std::mutex> guard(q.lock);
+
+        if(!q.jobs.empty()){
+            if(i==0){
+                job=q.jobs.front();
+                q.jobs.pop_front();
+            }else{
+                job=q.jobs.back();
+                q.jobs.pop_back();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_worker(batch *b, unsigned self)
+{
+    // Each worker maps the image privately, so loading costs nothing
+    // until pages are used
+    mips_mem_h mem=mips_mem_create_ram_image(b->imageName, b->ramSize, 4);
+    if(!mem){
+        fprintf(stderr, "Cannot load image '%s' into a RAM of 0x%x bytes.\n", b->imageName, b->ramSize);
+        exit(1);
+    }
+
+    mips_cpu_h cpu=mips_cpu_create_with_engine(mem, b->engine);
+    if(!cpu){
+        fprintf(stderr, "Unknown engine %d.\n", (int)b->engine);
+        exit(1);
+    }
+
+    mips_snapshot_h pristine;
+    if(mips_snapshot_take(cpu, &pristine)){
+        fprintf(stderr, "Cannot take a snapshot for worker %u.\n", self);
+        exit(1);
+    }
+
+    size_t index;
+    while(take_job(*b, self, index)){
+        batch_job &job=b->jobs[index];
+
+        mips_snapshot_restore(pristine);
+        mips_cpu_set_pc(cpu, job.entry);
+        mips_cpu_set_register(cpu, 31, SENTINEL_PC);
+        mips_cpu_set_register(cpu, 29, STACK_POINTER);
+        for(unsigned i=0; i<job.regs.size(); i++){
+            mips_cpu_set_register(cpu, job.regs[i].first, job.regs[i].second);
+        }
+
+        job.steps=0;
+        job.err=mips_cpu_run(cpu, job.maxSteps, SENTINEL_PC, &job.steps);
+        mips_cpu_get_pc(cpu, &job.pc);
+        mips_cpu_get_register(cpu, b->resultReg, &job.result);
+    }
+
+    mips_snapshot_free(pristine);
+    mips_cpu_free(cpu);
+    mips_mem_free(mem);
+}
+
+static bool parse_reg(const char *text, unsigned &reg)
+{
+    if(*text=='$'){
+        text++;
+    }
+    char *end;
+    unsigned long r=strtoul(text, &end, 0);
+    if(end==text || *end || r>31){
+        return false;
+    }
+    reg=(unsigned)r;
+    return true;
+}
+
+static bool parse_job(const char *line, uint32_t defaultSteps, batch_job &job)
+{
+    char name[256];
+    int used=0;
+    if(sscanf(line, " %255s%n", name, &used)!=1 || name[0]=='#'){
+        return false;
+    }
+
+    job.name=name;
+    job.entry=0;
+    job.maxSteps=defaultSteps;
+    job.regs.clear();
+
+    char setting[256];
+    const char *rest=line+used;
+    while(sscanf(rest, " %255s%n", setting, &used)==1){
+        rest+=used;
+
+        char *eq=strchr(setting, '=');
+        if(!eq){
+            fprintf(stderr, "Job '%s': expected name=value, got '%s'.\n", name, setting);
+            exit(1);
+        }
+        *eq=0;
+        uint32_t value=(uint32_t)strtoul(eq+1, 0, 0);
+
+        unsigned reg;
+        if(!strcmp(setting, "pc")){
+            job.entry=value;
+        }else if(!strcmp(setting, "steps")){
+            job.maxSteps=value;
+        }else if(setting[0]=='$' && parse_reg(setting, reg)){
+            job.regs.push_back(std::make_pair(reg, value));
+        }else{
+            fprintf(stderr, "Job '%s': unknown setting '%s'.\n", name, setting);
+            exit(1);
+        }
+    }
+    return true;
+}
+
+static void usage(const char *self)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-s steps] [-m bytes] [-e engine] [-o reg] image.bin jobs\n", self);
+    fprintf(stderr, "       %s [options] -r reg first last image.bin\n", self);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    batch b;
+    b.ramSize=0x20000;
+    b.engine=mips_EngineInterpreter;
+    b.resultReg=2;
+
+    unsigned threads=std::thread::hardware_concurrency();
+    uint32_t defaultSteps=1000000;
+
+    bool range=false;
+    unsigned rangeReg=0;
+    uint32_t rangeFirst=0, rangeLast=0;
+
+    int arg=1;
+    while(arg<argc && argv[arg][0]=='-'){
+        const char *opt=argv[arg];
+        if(!strcmp(opt, "-r") && arg+3<argc){
+            range=true;
+            if(!parse_reg(argv[arg+1], rangeReg)){
+                usage(argv[0]);
+            }
+            rangeFirst=(uint32_t)strtoul(argv[arg+2], 0, 0);
+            rangeLast=(uint32_t)strtoul(argv[arg+3], 0, 0);
+            arg+=4;
+            continue;
+        }
+        if(arg+1>=argc){
+            usage(argv[0]);
+        }
+        unsigned long value=strtoul(argv[arg+1], 0, 0);
+        if(!strcmp(opt, "-t")){
+            threads=(unsigned)value;
+        }else if(!strcmp(opt, "-s")){
+            defaultSteps=(uint32_t)value;
+        }else if(!strcmp(opt, "-m")){
+            b.ramSize=(uint32_t)value;
+        }else if(!strcmp(opt, "-e")){
+            b.engine=(mips_cpu_engine)value;
+        }else if(!strcmp(opt, "-o")){
+            if(!parse_reg(argv[arg+1], b.resultReg)){
+                usage(argv[0]);
+            }
+        }else{
+            usage(argv[0]);
+        }
+        arg+=2;
+    }
+
+    if(arg+(range ? 1 : 2)!=argc){
+        usage(argv[0]);
+    }
+    if(threads==0){
+        threads=1;
+    }
+
+    b.imageName=argv[arg];
+
+    if(range){
+        for(uint64_t v=rangeFirst; v<=rangeLast; v++){
+            batch_job job;
+            char name[32];
+            sprintf(name, "$%u=%llu", rangeReg, (unsigned long long)v);
+            job.name=name;
+            job.entry=0;
+            job.maxSteps=defaultSteps;
+            job.regs.push_back(std::make_pair(rangeReg, (uint32_t)v));
+            b.jobs.push_back(job);
+        }
+    }else{
+        FILE *list=fopen(argv[arg+1], "rt");
+        if(!list){
+            fprintf(stderr, "Cannot open jobs file '%s'.\n", argv[arg+1]);
+            exit(1);
+        }
+        char line[4096];
+        batch_job job;
+        while(fgets(line, sizeof(line), list)){
+            if(parse_job(line, defaultSteps, job)){
+                b.jobs.push_back(job);
+            }
+        }
+        fclose(list);
+    }
+
+    if(threads>b.jobs.size()){
+        threads=b.jobs.size() ? (unsigned)b.jobs.size() : 1;
+    }
+
+    // Neighbouring jobs often take similar times, so each worker starts
+    // with a contiguous slice and stealing evens out the rest
+    b.queues=std::vector<batch_queue>(threads);
+    for(size_t i=0; i<b.jobs.size(); i++){
+        b.queues[i*threads/b.jobs.size()].jobs.push_back(i);
+    }
+
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for(unsigned i=0; i<threads; i++){
+        workers.push_back(std::thread(run_worker, &b, i));
+    }
+    for(unsigned i=0; i<threads; i++){
+        workers[i].join();
+    }
+
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    uint64_t totalSteps=0;
+    unsigned failed=0;
+    for(size_t i=0; i<b.jobs.size(); i++){
+        const batch_job &job=b.jobs[i];
+        totalSteps+=job.steps;
+
+        if(job.err){
+            failed++;
+            printf("%s error 0x%x at %08x after %u steps\n", job.name.c_str(), job.err, job.pc, job.steps);
+        }else if(job.pc!=SENTINEL_PC){
+            failed++;
+            printf("%s budget exhausted at %08x after %u steps\n", job.name.c_str(), job.pc, job.steps);
+        }else{
+            printf("%s $%u=%u after %u steps\n", job.name.c_str(), b.resultReg, job.result, job.steps);
+        }
+    }
+
+    fprintf(stderr, "%u jobs (%u failed) on %u threads, %llu steps in %.3fs (%.1f MIPS)\n",
+        (unsigned)b.jobs.size(), failed, threads, (unsigned long long)totalSteps, seconds,
+        seconds>0 ? totalSteps/seconds/1e6 : 0.0);
+
+    return failed ? 1 : 0;
+}
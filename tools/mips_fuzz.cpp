@@ -0,0 +1,1082 @@
+/* Differential fuzzer for the CPU. Random MIPS-I instruction sequences
+   and register states are run both on the simulator and on a small
+   reference model in this file, which shares no code with the CPU, and
+   the architectural state of the two is compared as they go.
+
+    mips_fuzz [options]
+        -n cases        Number of cases to run (default 1000000)
+        -S seed         Case i of a given seed is always the same (default: the time)
+        -F first        Index of the first case (default 0), to rerun a logged case
+        -t threads      Worker threads (default: one per core)
+        -e engine       mips_cpu_engine to test (default 0, the interpreter)
+        -c steps        Steps between comparisons (default 1). Larger values
+                        let the block and JIT engines run whole blocks, at
+                        the cost of less precise reports.
+        -L length       Instructions per case (default 16, at most 256)
+        -i list         Only generate these instructions, as in "addu,lw,beq"
+        -f failures     Stop after this many failures (default 10)
+        -o file         Where failures are logged (default stdout)
+
+   Every case starts at pc 0 with its own registers and data, and runs
+   for twice its length. Registers $12-$15 start as pointers into a data
+   area at 0x1000 and $16-$17 as code addresses, so that loads, stores
+   and register jumps usually do something interesting. Each worker
+   keeps one CPU and RAM, and restores a snapshot of them between cases.
+
+   Failures are minimized before they are logged: instructions are
+   replaced by NOPs, and registers and data words cleared, as long as
+   the case still fails at the same instruction. The log lists what is
+   left, and when it is small enough adds a line in the format of
+   src/ocg14/test_vectors.txt holding the reference results.
+
+   HI and LO cannot be read through the API, so they are only compared
+   through MFHI and MFLO. Loads write their register straight away (as on
+   MIPS II), since MIPS I leaves using a value in the load delay slot
+   undefined. A case stops early before a division by zero, or of
+   0x80000000 by -1, as the architecture does not define their results.
+*/
+#include "mips.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdarg.h>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// The same RAM as the test vectors, so that logged vectors behave the same way
+static const uint32_t RAM_SIZE=0x10000;
+static const uint32_t DATA_BASE=0x1000;
+static const unsigned DATA_WORDS=64;
+static const unsigned MAX_LENGTH=256;
+
+// Limits of a line in the test vector format
+static const unsigned VECTOR_CODE=4;
+static const unsigned VECTOR_MEM=4;
+
+enum fuzz_format{
+    fmt_R3,         // rd, rs, rt
+    fmt_Shift,      // rd, rt, shift
+    fmt_ShiftV,     // rd, rt, rs
+    fmt_MulDiv,     // rs, rt
+    fmt_MoveFrom,   // rd
+    fmt_MoveTo,     // rs
+    fmt_Imm,        // rt, rs, immediate
+    fmt_Lui,        // rt, immediate
+    fmt_Mem,        // rt, offset(rs)
+    fmt_Branch2,    // rs, rt, offset
+    fmt_Branch1,    // rs, offset
+    fmt_Jump,       // target
+    fmt_JR,         // rs
+    fmt_JALR        // rd, rs
+};
+
+struct fuzz_op{
+    const char *name;
+    fuzz_format format;
+    uint32_t opcode;
+    uint32_t code;      // funct for SPECIAL, rt for REGIMM
+    unsigned align;     // Alignment needed by loads and stores
+};
+
+static const fuzz_op sg_ops[]={
+    {"ADD", fmt_R3, 0, 0x20, 0}, {"ADDU", fmt_R3, 0, 0x21, 0},
+    {"SUB", fmt_R3, 0, 0x22, 0}, {"SUBU", fmt_R3, 0, 0x23, 0},
+    {"AND", fmt_R3, 0, 0x24, 0}, {"OR", fmt_R3, 0, 0x25, 0},
+    {"XOR", fmt_R3, 0, 0x26, 0}, {"SLT", fmt_R3, 0, 0x2a, 0},
+    {"SLTU", fmt_R3, 0, 0x2b, 0},
+    {"SLL", fmt_Shift, 0, 0x00, 0}, {"SRL", fmt_Shift, 0, 0x02, 0},
+    {"SRA", fmt_Shift, 0, 0x03, 0}, {"SLLV", fmt_ShiftV, 0, 0x04, 0},
+    {"SRLV", fmt_ShiftV, 0, 0x06, 0}, {"SRAV", fmt_ShiftV, 0, 0x07, 0},
+    {"JR", fmt_JR, 0, 0x08, 0}, {"JALR", fmt_JALR, 0, 0x09, 0},
+    {"MFHI", fmt_MoveFrom, 0, 0x10, 0}, {"MTHI", fmt_MoveTo, 0, 0x11, 0},
+    {"MFLO", fmt_MoveFrom, 0, 0x12, 0}, {"MTLO", fmt_MoveTo, 0, 0x13, 0},
+    {"MULT", fmt_MulDiv, 0, 0x18, 0}, {"MULTU", fmt_MulDiv, 0, 0x19, 0},
+    {"DIV", fmt_MulDiv, 0, 0x1a, 0}, {"DIVU", fmt_MulDiv, 0, 0x1b, 0},
+    {"BLTZ", fmt_Branch1, 1, 0x00, 0}, {"BGEZ", fmt_Branch1, 1, 0x01, 0},
+    {"BLTZAL", fmt_Branch1, 1, 0x10, 0}, {"BGEZAL", fmt_Branch1, 1, 0x11, 0},
+    {"J", fmt_Jump, 2, 0, 0}, {"JAL", fmt_Jump, 3, 0, 0},
+    {"BEQ", fmt_Branch2, 4, 0, 0}, {"BNE", fmt_Branch2, 5, 0, 0},
+    {"BLEZ", fmt_Branch1, 6, 0, 0}, {"BGTZ", fmt_Branch1, 7, 0, 0},
+    {"ADDI", fmt_Imm, 8, 0, 0}, {"ADDIU", fmt_Imm, 9, 0, 0},
+    {"SLTI", fmt_Imm, 10, 0, 0}, {"SLTIU", fmt_Imm, 11, 0, 0},
+    {"ANDI", fmt_Imm, 12, 0, 0}, {"ORI", fmt_Imm, 13, 0, 0},
+    {"XORI", fmt_Imm, 14, 0, 0}, {"LUI", fmt_Lui, 15, 0, 0},
+    {"LB", fmt_Mem, 0x20, 0, 1}, {"LH", fmt_Mem, 0x21, 0, 2},
+    {"LWL", fmt_Mem, 0x22, 0, 1}, {"LW", fmt_Mem, 0x23, 0, 4},
+    {"LBU", fmt_Mem, 0x24, 0, 1}, {"LHU", fmt_Mem, 0x25, 0, 2},
+    {"LWR", fmt_Mem, 0x26, 0, 1}, {"SB", fmt_Mem, 0x28, 0, 1},
+    {"SH", fmt_Mem, 0x29, 0, 2}, {"SW", fmt_Mem, 0x2b, 0, 4}
+};
+static const unsigned sg_opCount=sizeof(sg_ops)/sizeof(sg_ops[0]);
+
+static bool is_control(const fuzz_op &op)
+{
+    return op.format==fmt_Branch1 || op.format==fmt_Branch2 || op.format==fmt_Jump
+        || op.format==fmt_JR || op.format==fmt_JALR;
+}
+
+// Finds which of sg_ops an instruction word is, or returns 0
+static const fuzz_op *find_op(uint32_t instr)
+{
+    uint32_t opcode=instr>>26;
+    for(unsigned i=0; i<sg_opCount; i++){
+        const fuzz_op &op=sg_ops[i];
+        if(op.opcode!=opcode){
+            continue;
+        }
+        if((opcode==0 && op.code!=(instr&0x3f)) || (opcode==1 && op.code!=((instr>>16)&0x1f))){
+            continue;
+        }
+        return &op;
+    }
+    return 0;
+}
+
+static void format_instr(uint32_t instr, char *text, size_t size)
+{
+    const fuzz_op *op=find_op(instr);
+    if(!op){
+        snprintf(text, size, "<INVALID>");
+        return;
+    }
+
+    unsigned rs=(instr>>21)&31, rt=(instr>>16)&31, rd=(instr>>11)&31, shift=(instr>>6)&31;
+    int simm=(int16_t)(instr&0xffff);
+
+    switch(op->format){
+    case fmt_R3:        snprintf(text, size, "%s $%u, $%u, $%u", op->name, rd, rs, rt); break;
+    case fmt_Shift:     snprintf(text, size, "%s $%u, $%u, %u", op->name, rd, rt, shift); break;
+    case fmt_ShiftV:    snprintf(text, size, "%s $%u, $%u, $%u", op->name, rd, rt, rs); break;
+    case fmt_MulDiv:    snprintf(text, size, "%s $%u, $%u", op->name, rs, rt); break;
+    case fmt_MoveFrom:  snprintf(text, size, "%s $%u", op->name, rd); break;
+    case fmt_MoveTo:    snprintf(text, size, "%s $%u", op->name, rs); break;
+    case fmt_Imm:       snprintf(text, size, "%s $%u, $%u, %d", op->name, rt, rs, simm); break;
+    case fmt_Lui:       snprintf(text, size, "%s $%u, 0x%x", op->name, rt, instr&0xffff); break;
+    case fmt_Mem:       snprintf(text, size, "%s $%u, %d($%u)", op->name, rt, simm, rs); break;
+    case fmt_Branch2:   snprintf(text, size, "%s $%u, $%u, %d", op->name, rs, rt, simm); break;
+    case fmt_Branch1:   snprintf(text, size, "%s $%u, %d", op->name, rs, simm); break;
+    case fmt_Jump:      snprintf(text, size, "%s 0x%x", op->name, (instr&0x3ffffff)<<2); break;
+    case fmt_JR:        snprintf(text, size, "%s $%u", op->name, rs); break;
+    case fmt_JALR:      snprintf(text, size, "%s $%u, $%u", op->name, rd, rs); break;
+    }
+}
+
+
+/* The reference model. Everything is done the obvious way, with the
+   whole RAM held as bytes in memory order. */
+struct ref_machine{
+    uint32_t pc, npc;
+    uint32_t regs[32];
+    uint32_t hi, lo;
+    uint8_t mem[RAM_SIZE];
+
+    // Word addresses stored to since the case started
+    std::vector<uint32_t> stored;
+};
+
+static uint32_t ref_read32(const ref_machine &m, uint32_t address)
+{
+    const uint8_t *p=m.mem+address;
+    return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+}
+
+// Checks a data access, which must lie in RAM and be aligned to its size
+static mips_error ref_check(uint32_t address, unsigned size)
+{
+    if(address & (size-1)){
+        return mips_ExceptionInvalidAlignment;
+    }
+    if(address > RAM_SIZE-size){
+        return mips_ExceptionInvalidAddress;
+    }
+    return mips_Success;
+}
+
+static void ref_store(ref_machine &m, uint32_t address, unsigned size, uint32_t value)
+{
+    for(unsigned i=0; i<size; i++){
+        m.mem[address+i]=(uint8_t)(value >> (8*(size-1-i)));
+    }
+    m.stored.push_back(address & ~3u);
+}
+
+static bool ref_undefined(uint32_t instr, const uint32_t *regs)
+{
+    uint32_t funct=instr&0x3f;
+    if((instr>>26)!=0 || (funct!=0x1a && funct!=0x1b)){
+        return false;
+    }
+    uint32_t s=regs[(instr>>21)&31], t=regs[(instr>>16)&31];
+    return t==0 || (funct==0x1a && s==0x80000000 && t==0xffffffff);
+}
+
+/* Executes one instruction. Nothing changes if it fails, and undefined
+   is set without executing anything if its result would be undefined. */
+static mips_error ref_step(ref_machine &m, bool &undefined)
+{
+    undefined=false;
+
+    mips_error err=ref_check(m.pc, 4);
+    if(err){
+        return err;
+    }
+
+    uint32_t instr=ref_read32(m, m.pc);
+    uint32_t rs=(instr>>21)&31, rt=(instr>>16)&31, rd=(instr>>11)&31, shift=(instr>>6)&31;
+    uint32_t s=m.regs[rs], t=m.regs[rt];
+    uint32_t imm=instr&0xffff;
+    uint32_t simm=(uint32_t)(int32_t)(int16_t)imm;
+    uint32_t branch=m.pc+4+(simm<<2);
+
+    if(ref_undefined(instr, m.regs)){
+        undefined=true;
+        return mips_Success;
+    }
+
+    uint32_t next=m.npc+4;
+    unsigned dest=0;
+    uint32_t value=0;
+
+    switch(instr>>26){
+    case 0:
+        dest=rd;
+        switch(instr&0x3f){
+        case 0x00: value=t<<shift; break;
+        case 0x02: value=t>>shift; break;
+        case 0x03: value=(uint32_t)((int32_t)t>>shift); break;
+        case 0x04: value=t<<(s&31); break;
+        case 0x06: value=t>>(s&31); break;
+        case 0x07: value=(uint32_t)((int32_t)t>>(s&31)); break;
+        case 0x08: dest=0; next=s; break;
+        case 0x09: value=m.pc+8; next=s; break;
+        case 0x10: value=m.hi; break;
+        case 0x11: dest=0; m.hi=s; break;
+        case 0x12: value=m.lo; break;
+        case 0x13: dest=0; m.lo=s; break;
+        case 0x18:{
+            int64_t p=(int64_t)(int32_t)s*(int32_t)t;
+            m.hi=(uint32_t)((uint64_t)p>>32);
+            m.lo=(uint32_t)p;
+            dest=0;
+            break;
+        }
+        case 0x19:{
+            uint64_t p=(uint64_t)s*t;
+            m.hi=(uint32_t)(p>>32);
+            m.lo=(uint32_t)p;
+            dest=0;
+            break;
+        }
+        case 0x1a:
+            m.lo=(uint32_t)((int32_t)s/(int32_t)t);
+            m.hi=(uint32_t)((int32_t)s%(int32_t)t);
+            dest=0;
+            break;
+        case 0x1b:
+            m.lo=s/t;
+            m.hi=s%t;
+            dest=0;
+            break;
+        case 0x20:
+            value=s+t;
+            if((s^value) & (t^value) & 0x80000000){
+                return mips_ExceptionArithmeticOverflow;
+            }
+            break;
+        case 0x21: value=s+t; break;
+        case 0x22:
+            value=s-t;
+            if((s^t) & (s^value) & 0x80000000){
+                return mips_ExceptionArithmeticOverflow;
+            }
+            break;
+        case 0x23: value=s-t; break;
+        case 0x24: value=s&t; break;
+        case 0x25: value=s|t; break;
+        case 0x26: value=s^t; break;
+        case 0x2a: value=(int32_t)s<(int32_t)t; break;
+        case 0x2b: value=s<t; break;
+        default:
+            return mips_ExceptionInvalidInstruction;
+        }
+        break;
+    case 1:{
+        bool taken=(rt&1) ? (int32_t)s>=0 : (int32_t)s<0;
+        if(rt!=0x00 && rt!=0x01 && rt!=0x10 && rt!=0x11){
+            return mips_ExceptionInvalidInstruction;
+        }
+        // The link happens whether or not the branch is taken
+        if(rt&0x10){
+            dest=31;
+            value=m.pc+8;
+        }
+        if(taken){
+            next=branch;
+        }
+        break;
+    }
+    case 2:
+    case 3:
+        next=((m.pc+4) & 0xf0000000) | ((instr & 0x3ffffff)<<2);
+        if(instr>>26==3){
+            dest=31;
+            value=m.pc+8;
+        }
+        break;
+    case 4: if(s==t) next=branch; break;
+    case 5: if(s!=t) next=branch; break;
+    case 6: if((int32_t)s<=0) next=branch; break;
+    case 7: if((int32_t)s>0) next=branch; break;
+    case 8:
+        value=s+simm;
+        if((s^value) & (simm^value) & 0x80000000){
+            return mips_ExceptionArithmeticOverflow;
+        }
+        dest=rt;
+        break;
+    case 9: dest=rt; value=s+simm; break;
+    case 10: dest=rt; value=(int32_t)s<(int32_t)simm; break;
+    case 11: dest=rt; value=s<simm; break;
+    case 12: dest=rt; value=s&imm; break;
+    case 13: dest=rt; value=s|imm; break;
+    case 14: dest=rt; value=s^imm; break;
+    case 15: dest=rt; value=imm<<16; break;
+    case 0x20: case 0x24:
+        if((err=ref_check(s+simm, 1))) return err;
+        value=m.mem[s+simm];
+        if(instr>>26==0x20) value=(uint32_t)(int32_t)(int8_t)value;
+        dest=rt;
+        break;
+    case 0x21: case 0x25:
+        if((err=ref_check(s+simm, 2))) return err;
+        value=((uint32_t)m.mem[s+simm]<<8) | m.mem[s+simm+1];
+        if(instr>>26==0x21) value=(uint32_t)(int32_t)(int16_t)value;
+        dest=rt;
+        break;
+    case 0x23:
+        if((err=ref_check(s+simm, 4))) return err;
+        value=ref_read32(m, s+simm);
+        dest=rt;
+        break;
+    case 0x22: case 0x26:{
+        // Big-endian LWL fills rt from the top, LWR from the bottom
+        uint32_t address=s+simm;
+        if((err=ref_check(address & ~3u, 4))) return err;
+        uint32_t word=ref_read32(m, address & ~3u);
+        unsigned bits=8*(address&3);
+        if(instr>>26==0x22){
+            value=(word<<bits) | (bits ? t & (0xffffffffu>>(32-bits)) : 0);
+        }else{
+            bits=24-bits;
+            value=(word>>bits) | (bits ? t & ~(0xffffffffu>>bits) : 0);
+        }
+        dest=rt;
+        break;
+    }
+    case 0x28:
+        if((err=ref_check(s+simm, 1))) return err;
+        ref_store(m, s+simm, 1, t);
+        break;
+    case 0x29:
+        if((err=ref_check(s+simm, 2))) return err;
+        ref_store(m, s+simm, 2, t);
+        break;
+    case 0x2b:
+        if((err=ref_check(s+simm, 4))) return err;
+        ref_store(m, s+simm, 4, t);
+        break;
+    default:
+        return mips_ExceptionInvalidInstruction;
+    }
+
+    if(dest){
+        m.regs[dest]=value;
+    }
+    m.pc=m.npc;
+    m.npc=next;
+
+    return mips_Success;
+}
+
+
+struct fuzz_case{
+    uint64_t index;
+    unsigned length;
+    uint32_t steps;
+    uint32_t code[MAX_LENGTH];
+    uint32_t regs[32];
+    uint32_t data[DATA_WORDS];
+};
+
+struct fuzz_failure{
+    uint32_t steps;     // Steps the reference had run, including any which failed
+    uint32_t instr;     // Last instruction the reference ran
+    int reg;            // Register which differed, or -1
+    bool memory;        // Set if the word at address differed
+    uint32_t address;
+    char what[128];
+};
+
+struct fuzz_config{
+    uint64_t seed;
+    uint64_t first;
+    uint64_t count;
+    unsigned length;
+    unsigned chunk;
+    unsigned maxFailures;
+    mips_cpu_engine engine;
+    std::vector<const fuzz_op*> ops;
+    FILE *log;
+};
+
+static uint64_t rng_next(uint64_t &s)
+{
+    // splitmix64
+    uint64_t z=(s+=0x9E3779B97F4A7C15ull);
+    z=(z^(z>>30))*0xBF58476D1CE4E5B9ull;
+    z=(z^(z>>27))*0x94D049BB133111EBull;
+    return z^(z>>31);
+}
+
+static uint32_t rng_value(uint64_t &s)
+{
+    uint64_t r=rng_next(s);
+    switch(r%8){
+    case 0: return 0;
+    case 1: return 1;
+    case 2: return 0xffffffff;
+    case 3: return 0x7fffffff;
+    case 4: return 0x80000000;
+    case 5: return (uint32_t)((int32_t)((r>>8)%64)-32);
+    default: return (uint32_t)(r>>32);
+    }
+}
+
+static uint32_t rng_imm(uint64_t &s)
+{
+    uint64_t r=rng_next(s);
+    switch(r%8){
+    case 0: return 0;
+    case 1: return 1;
+    case 2: return 0x7fff;
+    case 3: return 0x8000;
+    case 4: return 0xffff;
+    default: return (uint32_t)(r>>48);
+    }
+}
+
+static uint32_t encode(const fuzz_op &op, uint64_t &s, unsigned pos, unsigned length)
+{
+    uint32_t rs=rng_next(s)%32, rt=rng_next(s)%32, rd=rng_next(s)%32;
+    uint32_t word=(op.opcode<<26);
+    int32_t offset;
+
+    switch(op.format){
+    case fmt_R3:
+    case fmt_ShiftV:
+        return word | (rs<<21) | (rt<<16) | (rd<<11) | op.code;
+    case fmt_MulDiv:
+        return word | (rs<<21) | (rt<<16) | op.code;
+    case fmt_MoveFrom:
+        return word | (rd<<11) | op.code;
+    case fmt_MoveTo:
+        return word | (rs<<21) | op.code;
+    case fmt_Shift:
+        return word | (rt<<16) | (rd<<11) | ((rng_next(s)%32)<<6) | op.code;
+    case fmt_Imm:
+        return word | (rs<<21) | (rt<<16) | rng_imm(s);
+    case fmt_Lui:
+        return word | (rt<<16) | rng_imm(s);
+    case fmt_Mem:
+        // Mostly through the data pointers, and mostly aligned
+        if(rng_next(s)%4){
+            rs=12+rng_next(s)%4;
+        }
+        offset=(int32_t)(rng_next(s)%48)-8;
+        if(rng_next(s)%10){
+            offset&=~(int32_t)(op.align-1);
+        }
+        return word | (rs<<21) | (rt<<16) | ((uint32_t)offset & 0xffff);
+    case fmt_Branch2:
+    case fmt_Branch1:
+        offset=(int32_t)(rng_next(s)%(length+1))-(int32_t)(pos+1);
+        if(op.format==fmt_Branch1){
+            rt=op.code;
+        }
+        return word | (rs<<21) | (rt<<16) | ((uint32_t)offset & 0xffff);
+    case fmt_Jump:
+        return word | (uint32_t)(rng_next(s)%(length+1));
+    case fmt_JR:
+    case fmt_JALR:
+        if(rng_next(s)%4){
+            rs=16+rng_next(s)%2;
+        }
+        if(op.format==fmt_JR){
+            rd=0;
+        }else if(rng_next(s)%2 || rd==0 || rd==rs){
+            // JALR with rd equal to rs is undefined
+            rd=(rs==31) ? 30 : 31;
+        }
+        return word | (rs<<21) | (rd<<11) | op.code;
+    }
+    return 0;
+}
+
+static void generate_case(const fuzz_config &cfg, uint64_t index, fuzz_case &c)
+{
+    uint64_t s=cfg.seed ^ (index*0xD1B54A32D192ED03ull);
+
+    c.index=index;
+    c.length=cfg.length;
+    c.steps=2*cfg.length;
+
+    c.regs[0]=0;
+    for(unsigned r=1; r<32; r++){
+        c.regs[r]=rng_value(s);
+    }
+    for(unsigned r=12; r<=15; r++){
+        c.regs[r]=DATA_BASE+4*(rng_next(s)%DATA_WORDS);
+    }
+    c.regs[16]=4*(rng_next(s)%cfg.length);
+    c.regs[17]=4*(rng_next(s)%cfg.length);
+
+    for(unsigned i=0; i<DATA_WORDS; i++){
+        c.data[i]=rng_value(s);
+    }
+
+    // A jump or branch in a delay slot is undefined, so never generate one
+    bool inDelaySlot=false;
+    for(unsigned i=0; i<c.length; i++){
+        const fuzz_op *op=cfg.ops[rng_next(s)%cfg.ops.size()];
+        for(unsigned tries=0; inDelaySlot && is_control(*op) && tries<8; tries++){
+            op=cfg.ops[rng_next(s)%cfg.ops.size()];
+        }
+        if(inDelaySlot && is_control(*op)){
+            c.code[i]=0;
+            inDelaySlot=false;
+        }else{
+            c.code[i]=encode(*op, s, i, c.length);
+            inDelaySlot=is_control(*op);
+        }
+    }
+}
+
+
+struct fuzz_worker{
+    mips_mem_h mem;
+    mips_cpu_h cpu;
+    mips_snapshot_h blank;
+    ref_machine *ref;
+    unsigned lastLength;
+};
+
+static void put_words(uint8_t *bytes, const uint32_t *words, unsigned count)
+{
+    for(unsigned i=0; i<count; i++){
+        bytes[4*i]=(uint8_t)(words[i]>>24);
+        bytes[4*i+1]=(uint8_t)(words[i]>>16);
+        bytes[4*i+2]=(uint8_t)(words[i]>>8);
+        bytes[4*i+3]=(uint8_t)words[i];
+    }
+}
+
+// Puts the reference back to the start of the case, clearing only what the last case wrote
+static void ref_load(fuzz_worker &w, const fuzz_case &c)
+{
+    ref_machine &m=*w.ref;
+
+    for(unsigned i=0; i<m.stored.size(); i++){
+        memset(m.mem+m.stored[i], 0, 4);
+    }
+    m.stored.clear();
+
+    memset(m.mem, 0, 4*w.lastLength);
+    put_words(m.mem, c.code, c.length);
+    put_words(m.mem+DATA_BASE, c.data, DATA_WORDS);
+    w.lastLength=c.length;
+
+    m.pc=0;
+    m.npc=4;
+    m.hi=0;
+    m.lo=0;
+    memcpy(m.regs, c.regs, sizeof(m.regs));
+}
+
+static bool fail(fuzz_failure *f, int reg, const char *fmt, ...)
+{
+    if(f){
+        va_list args;
+        va_start(args, fmt);
+        f->reg=reg;
+        f->memory=false;
+        vsnprintf(f->what, sizeof(f->what), fmt, args);
+        va_end(args);
+    }
+    return true;
+}
+
+static bool compare_word(fuzz_worker &w, uint32_t address, fuzz_failure *f)
+{
+    uint8_t got[4];
+    if(mips_mem_read(w.mem, address, 4, got)){
+        return fail(f, -1, "[0x%x] could not be read", address);
+    }
+    uint32_t value=((uint32_t)got[0]<<24) | ((uint32_t)got[1]<<16) | ((uint32_t)got[2]<<8) | got[3];
+    uint32_t expected=ref_read32(*w.ref, address);
+    if(value!=expected){
+        fail(f, -1, "[0x%x] is 0x%08x, reference 0x%08x", address, value, expected);
+        if(f){
+            f->memory=true;
+            f->address=address;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool compare_region(fuzz_worker &w, uint32_t address, unsigned words, fuzz_failure *f)
+{
+    uint8_t got[4*MAX_LENGTH];
+    if(mips_mem_read(w.mem, address, 4*words, got)){
+        return fail(f, -1, "[0x%x] could not be read", address);
+    }
+    if(!memcmp(got, w.ref->mem+address, 4*words)){
+        return false;
+    }
+    for(unsigned i=0; i<words; i++){
+        if(compare_word(w, address+4*i, f)){
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Runs a case on both models, returning true and filling in f (if
+   given) when they disagree. */
+static bool run_case(fuzz_worker &w, const fuzz_case &c, unsigned chunk, fuzz_failure *f)
+{
+    ref_machine &m=*w.ref;
+
+    // Stop before anything the architecture leaves undefined
+    ref_load(w, c);
+    uint32_t budget=0;
+    bool undefined=false;
+    while(budget<c.steps && !ref_step(m, undefined) && !undefined){
+        budget++;
+    }
+    if(budget<c.steps && !undefined){
+        budget++;   // Include the instruction which fails
+    }
+
+    ref_load(w, c);
+
+    uint8_t bytes[4*MAX_LENGTH];
+    mips_snapshot_restore(w.blank);
+    put_words(bytes, c.code, c.length);
+    mips_mem_write(w.mem, 0, 4*c.length, bytes);
+    put_words(bytes, c.data, DATA_WORDS);
+    mips_mem_write(w.mem, DATA_BASE, 4*DATA_WORDS, bytes);
+    for(unsigned r=1; r<32; r++){
+        mips_cpu_set_register(w.cpu, r, c.regs[r]);
+    }
+
+    uint32_t done=0;
+    while(done<budget){
+        uint32_t n=std::min<uint32_t>(chunk, budget-done);
+        size_t firstStore=m.stored.size();
+
+        uint32_t simSteps=0;
+        mips_error simErr=mips_cpu_run_until(w.cpu, n, 0, 0, &simSteps);
+
+        uint32_t refSteps=0, lastPc=m.pc;
+        mips_error refErr=mips_Success;
+        while(refSteps<n){
+            lastPc=m.pc;
+            if((refErr=ref_step(m, undefined))){
+                break;
+            }
+            refSteps++;
+        }
+
+        if(f){
+            f->steps=done+refSteps+(refErr ? 1 : 0);
+            f->instr=ref_read32(m, lastPc & (RAM_SIZE-4));
+        }
+
+        if(simErr!=refErr){
+            return fail(f, -1, "error 0x%x, reference 0x%x", simErr, refErr);
+        }
+        if(simSteps!=refSteps){
+            return fail(f, -1, "%u steps, reference %u", simSteps, refSteps);
+        }
+
+        uint32_t pc;
+        if(!refErr && (mips_cpu_get_pc(w.cpu, &pc) || pc!=m.pc)){
+            return fail(f, -1, "pc is 0x%08x, reference 0x%08x", pc, m.pc);
+        }
+
+        for(unsigned r=1; r<32; r++){
+            uint32_t value=0;
+            if(mips_cpu_get_register(w.cpu, r, &value) || value!=m.regs[r]){
+                return fail(f, r, "$%u is 0x%08x, reference 0x%08x", r, value, m.regs[r]);
+            }
+        }
+
+        for(size_t i=firstStore; i<m.stored.size(); i++){
+            if(compare_word(w, m.stored[i], f)){
+                return true;
+            }
+        }
+
+        if(refErr){
+            break;
+        }
+        done+=n;
+    }
+
+    // Stores by the CPU to places the reference did not store to
+    return compare_region(w, 0, c.length, f) || compare_region(w, DATA_BASE, DATA_WORDS, f);
+}
+
+static bool still_fails(fuzz_worker &w, const fuzz_case &c, unsigned chunk, const fuzz_failure &original, fuzz_failure &f)
+{
+    return run_case(w, c, chunk, &f) && f.instr==original.instr;
+}
+
+// Removes whatever is not needed for the case to fail at the same instruction
+static void minimize(fuzz_worker &w, fuzz_case &c, unsigned chunk, fuzz_failure &f)
+{
+    fuzz_failure trial;
+    const fuzz_failure original=f;
+
+    c.steps=std::min(c.steps, f.steps);
+
+    for(unsigned i=0; i<c.length; i++){
+        uint32_t saved=c.code[i];
+        if(!saved){
+            continue;
+        }
+        c.code[i]=0;
+        if(still_fails(w, c, chunk, original, trial)){
+            f=trial;
+        }else{
+            c.code[i]=saved;
+        }
+    }
+
+    // Then try taking the NOPs out altogether, which moves what follows
+    for(unsigned i=0; i<c.length && c.length>1; ){
+        if(c.code[i]){
+            i++;
+            continue;
+        }
+        fuzz_case shorter=c;
+        memmove(shorter.code+i, shorter.code+i+1, 4*(shorter.length-i-1));
+        shorter.length--;
+        if(still_fails(w, shorter, chunk, original, trial)){
+            c=shorter;
+            f=trial;
+        }else{
+            i++;
+        }
+    }
+
+    for(unsigned r=1; r<32; r++){
+        uint32_t saved=c.regs[r];
+        if(!saved){
+            continue;
+        }
+        c.regs[r]=0;
+        if(still_fails(w, c, chunk, original, trial)){
+            f=trial;
+        }else{
+            c.regs[r]=saved;
+        }
+    }
+
+    for(unsigned i=0; i<DATA_WORDS; i++){
+        uint32_t saved=c.data[i];
+        if(!saved){
+            continue;
+        }
+        c.data[i]=0;
+        if(still_fails(w, c, chunk, original, trial)){
+            f=trial;
+        }else{
+            c.data[i]=saved;
+        }
+    }
+
+    c.steps=std::min(c.steps, f.steps);
+}
+
+/* Prints a minimized case, and when it fits, a test vector giving
+   what the reference did with it. */
+static void log_failure(fuzz_worker &w, const fuzz_config &cfg, const fuzz_case &c, const fuzz_failure &f)
+{
+    FILE *dst=cfg.log;
+    char text[64];
+
+    format_instr(f.instr, text, sizeof(text));
+    fprintf(dst, "# Case %llu of seed 0x%llx: %s at %s, after %u steps\n",
+        (unsigned long long)c.index, (unsigned long long)cfg.seed, f.what, text, f.steps);
+
+    for(unsigned i=0; i<c.length; i++){
+        format_instr(c.code[i], text, sizeof(text));
+        fprintf(dst, "#   %08x: %08x  %s\n", 4*i, c.code[i], text);
+    }
+
+    unsigned dataUsed=0;
+    for(unsigned i=0; i<DATA_WORDS; i++){
+        dataUsed+=c.data[i]!=0;
+    }
+
+    // Work out what the reference ends up with
+    ref_machine &m=*w.ref;
+    bool undefined;
+    mips_error err=mips_Success;
+    ref_load(w, c);
+    for(uint32_t i=0; i<c.steps && !err; i++){
+        err=ref_step(m, undefined);
+    }
+
+    std::vector<uint32_t> changed;
+    for(uint32_t a=0; a<RAM_SIZE; a+=4){
+        bool wasData=a>=DATA_BASE && a<DATA_BASE+4*DATA_WORDS;
+        uint32_t before=wasData ? c.data[(a-DATA_BASE)/4] : (a<4*c.length ? c.code[a/4] : 0);
+        if(ref_read32(m, a)!=before || (f.memory && f.address==a)){
+            changed.push_back(a);
+        }
+    }
+
+    if(c.length>VECTOR_CODE || dataUsed>VECTOR_MEM || changed.size()>VECTOR_MEM){
+        fprintf(dst, "# (too large to give as a test vector)\n\n");
+        fflush(dst);
+        return;
+    }
+
+    const fuzz_op *op=find_op(f.instr);
+    fprintf(dst, "%s ", op ? op->name : "<INTERNAL>");
+    for(unsigned i=0; i<c.length; i++){
+        fprintf(dst, "%s%08x", i ? "," : "", c.code[i]);
+    }
+    if(c.steps!=c.length){
+        fprintf(dst, " steps=%u", c.steps);
+    }
+    for(unsigned r=1; r<32; r++){
+        if(c.regs[r]){
+            fprintf(dst, " $%u=0x%x", r, c.regs[r]);
+        }
+    }
+    for(unsigned i=0; i<DATA_WORDS; i++){
+        if(c.data[i]){
+            fprintf(dst, " [0x%x]=0x%x", DATA_BASE+4*i, c.data[i]);
+        }
+    }
+
+    fprintf(dst, " =>");
+    if(err){
+        fprintf(dst, " error=0x%x", err);
+    }else{
+        fprintf(dst, " pc=0x%x", m.pc);
+    }
+    for(unsigned r=1; r<32; r++){
+        if(m.regs[r]!=c.regs[r] || (int)r==f.reg){
+            fprintf(dst, " $%u=0x%x", r, m.regs[r]);
+        }
+    }
+    for(unsigned i=0; i<changed.size(); i++){
+        fprintf(dst, " [0x%x]=0x%x", changed[i], ref_read32(m, changed[i]));
+    }
+    fprintf(dst, "\n\n");
+    fflush(dst);
+}
+
+
+struct fuzz_shared{
+    const fuzz_config *cfg;
+    std::atomic<uint64_t> next;
+    std::atomic<uint64_t> casesRun;
+    std::atomic<unsigned> failures;
+    std::mutex logLock;
+};
+
+static void run_worker(fuzz_shared *shared)
+{
+    const fuzz_config &cfg=*shared->cfg;
+    const uint64_t BLOCK=256;
+
+    fuzz_worker w;
+    w.mem=mips_mem_create_ram(RAM_SIZE, 4);
+    w.cpu=w.mem ? mips_cpu_create_with_engine(w.mem, cfg.engine) : 0;
+    if(!w.cpu || mips_snapshot_take(w.cpu, &w.blank)){
+        fprintf(stderr, "Cannot create a CPU with engine %d.\n", (int)cfg.engine);
+        exit(1);
+    }
+    w.ref=new ref_machine;
+    memset(w.ref->mem, 0, RAM_SIZE);
+    w.lastLength=0;
+
+    fuzz_case c;
+    fuzz_failure f;
+    uint64_t run=0;
+
+    while(shared->failures<cfg.maxFailures){
+        uint64_t first=shared->next.fetch_add(BLOCK);
+        if(first>=cfg.count){
+            break;
+        }
+        uint64_t last=std::min(first+BLOCK, cfg.count);
+
+        for(uint64_t i=first; i<last && shared->failures<cfg.maxFailures; i++){
+            generate_case(cfg, cfg.first+i, c);
+            run++;
+
+            if(run_case(w, c, cfg.chunk, &f)){
+                if(shared->failures++>=cfg.maxFailures){
+                    break;
+                }
+                minimize(w, c, cfg.chunk, f);
+
+                std::lock_guard<std::mutex> guard(shared->logLock);
+                log_failure(w, cfg, c, f);
+            }
+        }
+    }
+
+    shared->casesRun+=run;
+
+    delete w.ref;
+    mips_snapshot_free(w.blank);
+    mips_cpu_free(w.cpu);
+    mips_mem_free(w.mem);
+}
+
+static void usage(const char *self)
+{
+    fprintf(stderr, "Usage: %s [-n cases] [-S seed] [-F first] [-t threads] [-e engine] [-c steps]\n", self);
+    fprintf(stderr, "       [-L length] [-i instr,instr,...] [-f failures] [-o log]\n");
+    exit(1);
+}
+
+static void select_ops(fuzz_config &cfg, const char *list)
+{
+    std::string names(list);
+    size_t start=0;
+
+    cfg.ops.clear();
+    while(start<=names.size()){
+        size_t end=names.find(',', start);
+        if(end==std::string::npos){
+            end=names.size();
+        }
+        std::string name=names.substr(start, end-start);
+        std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+
+        unsigned i=0;
+        while(i<sg_opCount && name!=sg_ops[i].name){
+            i++;
+        }
+        if(i==sg_opCount){
+            fprintf(stderr, "Unknown instruction '%s'.\n", name.c_str());
+            exit(1);
+        }
+        cfg.ops.push_back(&sg_ops[i]);
+        start=end+1;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    fuzz_config cfg;
+    cfg.seed=(uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+    cfg.first=0;
+    cfg.count=1000000;
+    cfg.length=16;
+    cfg.chunk=1;
+    cfg.maxFailures=10;
+    cfg.engine=mips_EngineInterpreter;
+    cfg.log=stdout;
+    for(unsigned i=0; i<sg_opCount; i++){
+        cfg.ops.push_back(&sg_ops[i]);
+    }
+
+    unsigned threads=std::thread::hardware_concurrency();
+
+    for(int arg=1; arg<argc; arg+=2){
+        const char *opt=argv[arg];
+        if(opt[0]!='-' || arg+1>=argc){
+            usage(argv[0]);
+        }
+        const char *text=argv[arg+1];
+        unsigned long long value=strtoull(text, 0, 0);
+
+        if(!strcmp(opt, "-n")){
+            cfg.count=value;
+        }else if(!strcmp(opt, "-S")){
+            cfg.seed=value;
+        }else if(!strcmp(opt, "-F")){
+            cfg.first=value;
+        }else if(!strcmp(opt, "-t")){
+            threads=(unsigned)value;
+        }else if(!strcmp(opt, "-e")){
+            cfg.engine=(mips_cpu_engine)value;
+        }else if(!strcmp(opt, "-c")){
+            cfg.chunk=(unsigned)value;
+        }else if(!strcmp(opt, "-L")){
+            cfg.length=(unsigned)value;
+        }else if(!strcmp(opt, "-i")){
+            select_ops(cfg, text);
+        }else if(!strcmp(opt, "-f")){
+            cfg.maxFailures=(unsigned)value;
+        }else if(!strcmp(opt, "-o")){
+            cfg.log=fopen(text, "wt");
+            if(!cfg.log){
+                fprintf(stderr, "Cannot open log '%s'.\n", text);
+                exit(1);
+            }
+        }else{
+            usage(argv[0]);
+        }
+    }
+
+    if(cfg.length<1 || cfg.length>MAX_LENGTH || cfg.chunk<1){
+        usage(argv[0]);
+    }
+    if(threads==0){
+        threads=1;
+    }
+
+    fuzz_shared shared;
+    shared.cfg=&cfg;
+    shared.next=0;
+    shared.casesRun=0;
+    shared.failures=0;
+
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for(unsigned i=0; i<threads; i++){
+        workers.push_back(std::thread(run_worker, &shared));
+    }
+    for(unsigned i=0; i<threads; i++){
+        workers[i].join();
+    }
+
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    unsigned failures=std::min<unsigned>(shared.failures, cfg.maxFailures);
+
+    fprintf(stderr, "Seed 0x%llx: %llu cases, %u failed, on %u threads in %.2fs (%.0f cases/s)\n",
+        (unsigned long long)cfg.seed, (unsigned long long)shared.casesRun, failures, threads, seconds,
+        seconds>0 ? shared.casesRun/seconds : 0.0);
+
+    if(cfg.log!=stdout){
+        fclose(cfg.log);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+/* Annotates a disassembly listing with a profile written by
+   mips_cpu_write_profile, hottest instructions first.
+
+    mips_profile profile listing.diss [count]
+        Prints each instruction which executed, with how many times it
+        ran, its share of all executions and how many memory exceptions
+        it raised, followed by its line from the listing. Only the first
+        count lines are printed if count is given.
+
+   The listing is the output of objdump -d, as in the .diss files under fragments.
+*/
+#include "mips.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <string.h>
+#include <vector>
+
+struct profile_entry
+{
+    uint32_t pc;
+    unsigned long long executed;
+    unsigned long long faults;
+};
+
+static bool hotter(const profile_entry &a, const profile_entry &b)
+{
+    if(a.executed!=b.executed){
+        return a.executed > b.executed;
+    }
+    if(a.faults!=b.faults){
+        return a.faults > b.faults;
+    }
+    return a.pc < b.pc;
+}
+
+static FILE *open_file(const char *name)
+{
+    FILE *src=fopen(name, "rt");
+    if(!src){
+        fprintf(stderr, "Cannot open '%s'.\n", name);
+        exit(1);
+    }
+    return src;
+}
+
+static void read_profile(const char *name, std::vector<profile_entry> &entries)
+{
+    FILE *src=open_file(name);
+
+    char line[256];
+    while(fgets(line, sizeof(line), src)){
+        if(line[0]=='#'){
+            continue;
+        }
+
+        profile_entry e;
+        unsigned pc;
+        if(3!=sscanf(line, "%x %llu %llu", &pc, &e.executed, &e.faults)){
+            fprintf(stderr, "'%s' is not a profile written by mips_cpu_write_profile.\n", name);
+            exit(1);
+        }
+        e.pc=pc;
+        entries.push_back(e);
+    }
+
+    fclose(src);
+}
+
+// Instruction lines in objdump output look like "  34:\t2e030002 \tsltiu\tv1,s0,2"
+static void read_listing(const char *name, std::map<uint32_t,std::string> &listing)
+{
+    FILE *src=open_file(name);
+
+    char line[256];
+    while(fgets(line, sizeof(line), src)){
+        unsigned pc;
+        int used=0;
+        if(1==sscanf(line, " %x:%n", &pc, &used) && used>0 && line[used]=='\t'){
+            std::string text(line+used+1);
+            while(!text.empty() && (text[text.size()-1]=='\n' || text[text.size()-1]=='\r')){
+                text.erase(text.size()-1);
+            }
+            std::replace(text.begin(), text.end(), '\t', ' ');
+            listing[pc]=text;
+        }
+    }
+
+    fclose(src);
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc<3 || argc>4){
+        fprintf(stderr, "Usage: %s profile listing.diss [count]\n", argv[0]);
+        exit(1);
+    }
+
+    std::vector<profile_entry> entries;
+    std::map<uint32_t,std::string> listing;
+
+    read_profile(argv[1], entries);
+    read_listing(argv[2], listing);
+
+    unsigned long long total=0, faults=0;
+    for(unsigned i=0; i<entries.size(); i++){
+        total+=entries[i].executed;
+        faults+=entries[i].faults;
+    }
+
+    std::sort(entries.begin(), entries.end(), hotter);
+
+    unsigned count=entries.size();
+    if(argc>3){
+        count=std::min(count, (unsigned)strtoul(argv[3], 0, 0));
+    }
+
+    printf("%12s %7s %8s  %s\n", "executed", "share", "faults", "instruction");
+
+    unsigned missing=0;
+    for(unsigned i=0; i<entries.size(); i++){
+        const profile_entry &e=entries[i];
+
+        std::map<uint32_t,std::string>::const_iterator it=listing.find(e.pc);
+        if(it==listing.end()){
+            missing++;
+        }
+
+        if(i<count){
+            double share=total ? 100.0*e.executed/total : 0.0;
+            printf("%12llu %6.2f%% %8llu  %8x: %s\n", e.executed, share, e.faults, e.pc,
+                it!=listing.end() ? it->second.c_str() : "(not in listing)");
+        }
+    }
+
+    printf("\nTotal: %llu executed, %llu memory exceptions, %u of %u addresses not in the listing\n",
+        total, faults, missing, (unsigned)entries.size());
+
+    return 0;
+}
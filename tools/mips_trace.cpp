@@ -0,0 +1,272 @@
+/* Works with execution traces written by the CPU with mips_TraceBinary
+   or mips_TraceCompressed. Either kind of trace can be given anywhere.
+
+    mips_trace print trace [first [count]]
+        Prints records as text, in the same form as the text trace,
+        followed by what each one wrote to registers or memory.
+
+    mips_trace diff traceA traceB
+        Reports the first record where the two traces differ.
+
+    mips_trace replay trace [index]
+        Applies register writes from the start of the trace up to (but
+        not including) record index, or the whole trace, then prints
+        the register file as it was at that point.
+
+    mips_trace compress in out
+        Converts any trace to the compressed form.
+*/
+#include "mips.h"
+#include "mips_cpu_decoder.h"
+#include "mips_cpu_disasm.h"
+
+#include <string.h>
+
+static void print_record(FILE *dst, const mips_trace_record &rec)
+{
+    // A failed fetch has no instruction to show
+    if(!(rec.error && rec.instr==0)){
+        decoded_instr d;
+        decode_instr(rec.instr, d);
+        
+        char text[64];
+        disasm_instr(d, text, sizeof(text));
+        fprintf(dst, "%08x: %s", rec.pc, text);
+        
+        if(rec.error==mips_Success){
+            if(rec.dest<32){
+                fprintf(dst, "\t$%u = 0x%08x", rec.dest, rec.value);
+            }else if(rec.dest==mips_TraceDestHi){
+                fprintf(dst, "\thi = 0x%08x", rec.value);
+            }else if(rec.dest==mips_TraceDestLo){
+                fprintf(dst, "\tlo = 0x%08x", rec.value);
+            }else if(rec.dest==mips_TraceDestHiLo){
+                fprintf(dst, "\thi = 0x%08x, lo = 0x%08x", rec.address, rec.value);
+            }
+            
+            if(rec.flags & mips_TraceMemRead){
+                fprintf(dst, "\t[0x%08x]", rec.address);
+            }else if(rec.flags & mips_TraceMemWrite){
+                fprintf(dst, "\t[0x%08x] = 0x%08x", rec.address, rec.value);
+            }
+        }
+        fprintf(dst, "\n");
+    }
+    
+    if(rec.error){
+        fprintf(dst, "%08x: error 0x%x\n", rec.pc, rec.error);
+    }
+}
+
+static mips_trace_reader_h open_trace(const char *name, FILE *&src)
+{
+    src=fopen(name, "rb");
+    if(!src){
+        fprintf(stderr, "Cannot open trace file '%s'.\n", name);
+        exit(1);
+    }
+    
+    mips_trace_reader_h reader=mips_trace_reader_open(src);
+    if(!reader){
+        fprintf(stderr, "'%s' is not a trace, or was written by a host with a different byte order.\n", name);
+        exit(1);
+    }
+    return reader;
+}
+
+static void close_trace(mips_trace_reader_h reader, FILE *src)
+{
+    mips_trace_reader_close(reader);
+    fclose(src);
+}
+
+// Reads a single record, returning false at the end of the trace
+static bool next_record(mips_trace_reader_h reader, mips_trace_record &rec)
+{
+    unsigned count=0;
+    if(mips_trace_reader_read(reader, &rec, 1, &count)){
+        fprintf(stderr, "Trace is truncated or corrupt at record %llu.\n",
+            (unsigned long long)mips_trace_reader_tell(reader));
+        exit(1);
+    }
+    return count==1;
+}
+
+static int do_print(int argc, char *argv[])
+{
+    if(argc<1)
+        return -1;
+    
+    FILE *src;
+    mips_trace_reader_h reader=open_trace(argv[0], src);
+    
+    uint64_t first=argc>1 ? strtoull(argv[1], 0, 0) : 0;
+    uint64_t count=argc>2 ? strtoull(argv[2], 0, 0) : ~0ull;
+    
+    if(first && mips_trace_reader_seek(reader, first)){
+        fprintf(stderr, "Cannot seek to record %llu.\n", (unsigned long long)first);
+        exit(1);
+    }
+    
+    mips_trace_record rec;
+    for(uint64_t i=0; i<count && next_record(reader, rec); i++){
+        print_record(stdout, rec);
+    }
+    
+    close_trace(reader, src);
+    return 0;
+}
+
+static int do_diff(int argc, char *argv[])
+{
+    if(argc<2)
+        return -1;
+    
+    FILE *srcA, *srcB;
+    mips_trace_reader_h a=open_trace(argv[0], srcA);
+    mips_trace_reader_h b=open_trace(argv[1], srcB);
+    
+    mips_trace_record recA, recB;
+    uint64_t index=0;
+    int res=0;
+    
+    while(1){
+        bool gotA=next_record(a, recA);
+        bool gotB=next_record(b, recB);
+        
+        if(!gotA && !gotB){
+            fprintf(stdout, "Traces are identical (%llu records).\n", (unsigned long long)index);
+            break;
+        }
+        
+        if(gotA!=gotB){
+            fprintf(stdout, "%s ends at record %llu.\n", gotA ? argv[1] : argv[0], (unsigned long long)index);
+            res=1;
+            break;
+        }
+        
+        if(memcmp(&recA, &recB, sizeof(mips_trace_record))){
+            fprintf(stdout, "First difference at record %llu:\n", (unsigned long long)index);
+            fprintf(stdout, "< ");
+            print_record(stdout, recA);
+            fprintf(stdout, "> ");
+            print_record(stdout, recB);
+            res=1;
+            break;
+        }
+        
+        index++;
+    }
+    
+    close_trace(a, srcA);
+    close_trace(b, srcB);
+    return res;
+}
+
+static int do_replay(int argc, char *argv[])
+{
+    if(argc<1)
+        return -1;
+    
+    FILE *src;
+    mips_trace_reader_h reader=open_trace(argv[0], src);
+    
+    uint64_t stop=argc>1 ? strtoull(argv[1], 0, 0) : ~0ull;
+    
+    uint32_t regs[32]={0};
+    uint32_t hi=0, lo=0, pc=0;
+    uint64_t index=0;
+    
+    mips_trace_record rec;
+    while(index<stop && next_record(reader, rec)){
+        pc=rec.pc;
+        if(rec.error==mips_Success){
+            pc=rec.pc+4;    // Branch targets are only known from the next record
+            if(rec.dest>0 && rec.dest<32){
+                regs[rec.dest]=rec.value;
+            }else if(rec.dest==mips_TraceDestHi){
+                hi=rec.value;
+            }else if(rec.dest==mips_TraceDestLo){
+                lo=rec.value;
+            }else if(rec.dest==mips_TraceDestHiLo){
+                hi=rec.address;
+                lo=rec.value;
+            }
+        }
+        index++;
+    }
+    
+    // The pc is best taken from the record which would run next
+    if(next_record(reader, rec)){
+        pc=rec.pc;
+    }
+    
+    fprintf(stdout, "After %llu records: pc = 0x%08x, hi = 0x%08x, lo = 0x%08x\n",
+        (unsigned long long)index, pc, hi, lo);
+    for(unsigned i=0; i<32; i++){
+        fprintf(stdout, "$%-2u = 0x%08x%s", i, regs[i], (i%4==3) ? "\n" : "    ");
+    }
+    
+    close_trace(reader, src);
+    return 0;
+}
+
+static int do_compress(int argc, char *argv[])
+{
+    if(argc<2)
+        return -1;
+    
+    FILE *src;
+    mips_trace_reader_h reader=open_trace(argv[0], src);
+    
+    FILE *dst=fopen(argv[1], "wb");
+    if(!dst){
+        fprintf(stderr, "Cannot create '%s'.\n", argv[1]);
+        exit(1);
+    }
+    
+    mips_trace_writer_h writer=mips_trace_writer_create(dst);
+    
+    mips_trace_record rec;
+    while(writer && next_record(reader, rec)){
+        if(mips_trace_writer_append(writer, &rec)){
+            writer=0;
+        }
+    }
+    
+    if(!writer || mips_trace_writer_close(writer)){
+        fprintf(stderr, "Error while writing '%s'.\n", argv[1]);
+        exit(1);
+    }
+    
+    fclose(dst);
+    close_trace(reader, src);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int res=-1;
+    
+    if(argc>1){
+        if(!strcmp(argv[1], "print")){
+            res=do_print(argc-2, argv+2);
+        }else if(!strcmp(argv[1], "diff")){
+            res=do_diff(argc-2, argv+2);
+        }else if(!strcmp(argv[1], "replay")){
+            res=do_replay(argc-2, argv+2);
+        }else if(!strcmp(argv[1], "compress")){
+            res=do_compress(argc-2, argv+2);
+        }
+    }
+    
+    if(res<0){
+        fprintf(stderr, "Usage: %s print trace [first [count]]\n", argv[0]);
+        fprintf(stderr, "       %s diff traceA traceB\n", argv[0]);
+        fprintf(stderr, "       %s replay trace [index]\n", argv[0]);
+        fprintf(stderr, "       %s compress in out\n", argv[0]);
+        exit(1);
+    }
+    
+    return res;
+}